@@ -76,12 +76,72 @@ static void material_epsilon(material_type material,
 	 case MATERIAL_FUNCTION:
 	      CHECK(0, "invalid use of material-function");
 	      break;
+	 case NATIVE_MATERIAL_FUNCTION:
+	      CHECK(0, "invalid use of native-material-function");
+	      break;
 	 case MATERIAL_TYPE_SELF:
 	      CHECK(0, "invalid use of material-type");
 	      break;
      }
 }
 
+/* Return the dielectric tensor and its inverse at the point p (in the
+   lattice unit-vector basis) in material, which is inside the object
+   oi of the geometry-tree node tp (tp = NULL for none), as returned by
+   material_at.  Evaluates material functions and grids. */
+static void point_epsilon(symmetric_matrix *eps, symmetric_matrix *eps_inv,
+			  material_type material, vector3 p,
+			  geom_box_tree tp, int oi)
+{
+     boolean destroy_material = 0;
+
+     while (material.which_subclass == MATERIAL_FUNCTION) {
+	  material_type m;
+	  SCM mo;
+	  /* material_func is a Scheme function, taking a position
+	     vector and returning a material at that point: */
+	  mo = gh_call1(material.subclass.
+			material_function_data->material_func,
+			ctl_convert_vector3_to_scm(p));
+	  material_type_input(mo, &m);
+	  if (destroy_material)
+	       material_type_destroy(material);
+	  material = m;
+	  destroy_material = 1;
+     }
+
+     if (material.which_subclass == NATIVE_MATERIAL_FUNCTION) {
+	  material_type m = native_medium(material, p);
+	  if (destroy_material)
+	       material_type_destroy(material);
+	  material = m;
+	  destroy_material = 1;
+     }
+
+     /* For a material grid, we interpolate the point (in "object"
+	coordinates) into the grid.  More than that, however,
+	we check if the same point intersects the *same* material grid
+	from multiple objects -- if so, we take the product of
+	the interpolated grid values. */
+     if (material.which_subclass == MATERIAL_GRID) {
+	  material_type mat_eps;
+	  mat_eps = make_epsilon(
+	       matgrid_val(p, tp, oi, 
+			   material.subclass.material_grid_data)
+	       * (material.subclass.material_grid_data->epsilon_max -
+		  material.subclass.material_grid_data->epsilon_min) +
+	       material.subclass.material_grid_data->epsilon_min);
+	  if (destroy_material)
+	       material_type_destroy(material);
+	  material = mat_eps;
+	  destroy_material = 1;
+     }
+
+     material_epsilon(material, eps, eps_inv);
+     if (destroy_material)
+	  material_type_destroy(material);
+}
+
 /* Given a position r in the basis of the lattice vectors, return the
    corresponding dielectric tensor and its inverse.  Should be
    called from within init_params (or after init_params), so that the
@@ -98,89 +158,209 @@ static void epsilon_func(symmetric_matrix *eps, symmetric_matrix *eps_inv,
      int oi;
      material_type material;
      vector3 p;
-     boolean inobject;
 
-     /* p needs to be in the lattice *unit* vector basis, while r is
-	in the lattice vector basis.  Also, shift origin to the center
-        of the grid. */
-     p.x = no_size_x ? 0 : (r[0] - 0.5) * geometry_lattice.size.x;
-     p.y = no_size_y ? 0 : (r[1] - 0.5) * geometry_lattice.size.y;
-     p.z = no_size_z ? 0 : (r[2] - 0.5) * geometry_lattice.size.z;
+     material = material_at(r, &p, &tp, &oi);
 
-     /* call search routine from libctl/utils/libgeom/geom.c: 
-        (we have to use the lower-level geom_tree_search to
-         support material-grid types, which have funny semantics) */
-     tp = geom_tree_search(p = shift_to_unit_cell(p), geometry_tree, &oi);
-     if (tp) {
-	  inobject = 1;
-	  material = tp->objects[oi].o->material;
-     }
-     else {
-	  inobject = 0;
-	  material = default_material;
-     }
+     /* if we aren't in any geometric object and we have an epsilon
+	file, use that. */
+     if (!tp && d->epsilon_file_func)
+	  d->epsilon_file_func(eps, eps_inv, r, d->epsilon_file_func_data);
+     else
+	  point_epsilon(eps, eps_inv, material, p, tp, oi);
+}
 
-#ifdef DEBUG_GEOMETRY_TREE
-     {
-	  material_type m2 = material_of_point_inobject(p, &inobject);
-	  CHECK(m2.which_subclass == material.which_subclass &&
-		m2.subclass.medium_data ==
-		material.subclass.medium_data,
-		"material_of_point & material_of_point_in_tree don't agree!");
+/* Like epsilon_func, but for the n points r[3*i..3*i+2] at once; this
+   is passed to set_maxwell_dielectric2 as its batch function.  The
+   points are first all looked up in the geometry tree at once (by
+   materials_at), and then the points in the same material are
+   evaluated together: a constant material only once, and a native
+   material function in a single call.  Material functions and grids
+   are evaluated point by point (by point_epsilon, reusing the
+   lookup). */
+static void epsilon_batch_func(symmetric_matrix *eps,
+			       symmetric_matrix *eps_inv,
+			       int n, const real *r, void *edata)
+{
+     medium_func_data *d = (medium_func_data *) edata;
+     material_type mat[MEDIUM_BATCH];
+     vector3 p[MEDIUM_BATCH];
+     geom_box_tree tp[MEDIUM_BATCH];
+     int oi[MEDIUM_BATCH], todo[MEDIUM_BATCH], group[MEDIUM_BATCH];
+     double vals[MEDIUM_BATCH];
+     int i0, i, k, nb, ntodo, ngroup;
+
+     for (i0 = 0; i0 < n; i0 += MEDIUM_BATCH) {
+	  symmetric_matrix *beps = eps + i0, *beps_inv = eps_inv + i0;
+	  const real *br = r + 3*i0;
+
+	  nb = MIN2(MEDIUM_BATCH, n - i0);
+	  materials_at(nb, br, mat, p, tp, oi);
+	  ntodo = 0;
+	  for (i = 0; i < nb; ++i) {
+	       if (!tp[i] && d->epsilon_file_func)
+		    d->epsilon_file_func(beps + i, beps_inv + i, br + 3*i,
+					 d->epsilon_file_func_data);
+	       else if (mat[i].which_subclass == MATERIAL_FUNCTION ||
+			mat[i].which_subclass == MATERIAL_GRID)
+		    point_epsilon(beps + i, beps_inv + i, mat[i], p[i],
+				  tp[i], oi[i]);
+	       else
+		    todo[ntodo++] = i;
+	  }
+
+	  while (ntodo > 0) {
+	       material_type m = mat[todo[0]];
+
+	       /* move the points in material m from todo to group: */
+	       ngroup = 0;
+	       for (i = k = 0; i < ntodo; ++i)
+		    if (same_material(mat[todo[i]], m))
+			 group[ngroup++] = todo[i];
+		    else
+			 todo[k++] = todo[i];
+	       ntodo = k;
+
+	       if (m.which_subclass == NATIVE_MATERIAL_FUNCTION) {
+		    native_epsilon_values(m, ngroup, group, p, vals);
+		    for (i = 0; i < ngroup; ++i) {
+			 material_type mi;
+			 medium md;
+			 isotropic_medium(&mi, &md, vals[i]);
+			 material_epsilon(mi, beps + group[i],
+					  beps_inv + group[i]);
+		    }
+	       }
+	       else {
+		    material_epsilon(m, beps + group[0], beps_inv + group[0]);
+		    for (i = 1; i < ngroup; ++i) {
+			 beps[group[i]] = beps[group[0]];
+			 beps_inv[group[i]] = beps_inv[group[0]];
+		    }
+	       }
+	  }
      }
-#endif
+}
+
+/* Passed to set_maxwell_dielectric2 as its "uniform" function: epsilon
+   is constant over a box, given in the lattice-vector basis like the
+   r of epsilon_func, if no object's bounding box intersects it (and
+   if the default material is constant and there is no epsilon file). */
+static int uniform_epsilon_func(symmetric_matrix *eps,
+				const real rmin[3], const real rmax[3],
+				void *edata)
+{
+     medium_func_data *d = (medium_func_data *) edata;
+     symmetric_matrix eps_inv;
+     geom_box b;
+
+     if (d->epsilon_file_func
+	 || variable_material(default_material.which_subclass))
+	  return 0;
+
+     get_lattice_box(&b, rmin, rmax);
+     if (!geom_box_to_unit_cell(&b)
+	 || geom_box_tree_intersects(geometry_tree, &b))
+	  return 0;
+
+     material_epsilon(default_material, eps, &eps_inv);
+     return 1;
+}
+
+/* Average epsilon over a pixel (a box in the lattice unit-vector basis)
+   that overlaps several objects, analytically if possible (see
+   get_pixel_objects), returning 0 if not.  The fill fractions are
+   exact, but there is no single interface normal, so we use the
+   average of the objects' normals, weighted by their epsilon contrast
+   with the default material and by f(1-f) for a fill fraction f,
+   which is largest for the objects whose interfaces cut the pixel
+   near its middle. */
+static int mean_epsilon_multi(symmetric_matrix *meps,
+			      symmetric_matrix *meps_inv,
+			      real n[3], geom_box pixel, double tol,
+			      medium_func_data *d)
+{
+     pixel_object po[MAX_PIXEL_OBJECTS];
+     material_type mats[MAX_PIXEL_OBJECTS + 1];
+     symmetric_matrix eps[MAX_PIXEL_OBJECTS + 1], eps_inv;
+     double fill[MAX_PIXEL_OBJECTS + 1], wsum = 0, tr0, nc[3];
+     int npo, nmat, i, k;
+     vector3 p;
 
-     if (material.which_subclass == MATERIAL_TYPE_SELF) {
-	  material = default_material;
-	  tp = 0; inobject = 0;  /* treat as a "nothing" object */
+     if (d->epsilon_file_func
+	 || variable_material(default_material.which_subclass)
+	 || !geom_box_to_unit_cell(&pixel)
+	 || (npo = get_pixel_objects(&pixel, po, tol)) < 0)
+	  return 0;
+     p = vector3_scale(0.5, vector3_plus(pixel.low, pixel.high));
+
+     /* the distinct materials and their fill fractions, with the
+	default material first: */
+     mats[0] = default_material;
+     fill[0] = 1;
+     nmat = 1;
+     for (i = 0; i < npo; ++i) {
+	  material_type mat = po[i].o->material;
+	  if (mat.which_subclass == MATERIAL_TYPE_SELF)
+	       mat = default_material;
+	  else if (variable_material(mat.which_subclass))
+	       return 0;
+	  for (k = 0; k < nmat && !material_type_equal(&mats[k], &mat); ++k)
+	       ;
+	  if (k == nmat) {
+	       mats[nmat] = mat;
+	       fill[nmat++] = 0;
+	  }
+	  fill[k] += po[i].fill;
+	  fill[0] -= po[i].fill;
      }
+     fill[0] = fill[0] < 0 ? 0 : fill[0];
 
-     /* if we aren't in any geometric object and we have an epsilon
-	file, use that. */
-     if (!inobject && d->epsilon_file_func) {
-	  d->epsilon_file_func(eps, eps_inv, r, d->epsilon_file_func_data);
+     for (k = 0; k < nmat; ++k)
+	  material_epsilon(mats[k], eps + k, k ? &eps_inv : meps_inv);
+     if (nmat == 1) {
+	  *meps = eps[0];
+	  n[0] = n[1] = n[2] = 0;
+	  return 1;
      }
-     else {
-	  boolean destroy_material = 0;
-
-	  while (material.which_subclass == MATERIAL_FUNCTION) {
-	       material_type m;
-	       SCM mo;
-	       /* material_func is a Scheme function, taking a position
-		  vector and returning a material at that point: */
-	       mo = gh_call1(material.subclass.
-			     material_function_data->material_func,
-			     ctl_convert_vector3_to_scm(p));
-	       material_type_input(mo, &m);
-	       if (destroy_material)
-		    material_type_destroy(material);
-	       material = m;
-	       destroy_material = 1;
-	  }
 
-	  /* For a material grid, we interpolate the point (in "object"
-	     coordinates) into the grid.  More than that, however,
-	     we check if the same point intersects the *same* material grid
-	     from multiple objects -- if so, we take the product of
-	     the interpolated grid values. */
-	  if (material.which_subclass == MATERIAL_GRID) {
-	       material_type mat_eps;
-	       mat_eps = make_epsilon(
-		    matgrid_val(p, tp, oi, 
-				material.subclass.material_grid_data)
-		    * (material.subclass.material_grid_data->epsilon_max -
-		       material.subclass.material_grid_data->epsilon_min) +
-		    material.subclass.material_grid_data->epsilon_min);
-	       if (destroy_material)
-		    material_type_destroy(material);
-	       material = mat_eps;
-	       destroy_material = 1;
-	  }
-	       
-	  material_epsilon(material, eps, eps_inv);
-	  if (destroy_material)
-	       material_type_destroy(material);
+     tr0 = eps[0].m00 + eps[0].m11 + eps[0].m22;
+     n[0] = n[1] = n[2] = 0;
+     for (i = 0; i < npo; ++i) {
+	  vector3 normal;
+	  double w, nlen, f = po[i].fill;
+	  material_type mat = po[i].o->material;
+	  if (f >= 1 || mat.which_subclass == MATERIAL_TYPE_SELF)
+	       continue;
+	  for (k = 0; !material_type_equal(&mats[k], &mat); ++k)
+	       ;
+	  w = (eps[k].m00 + eps[k].m11 + eps[k].m22 - tr0) * f * (1 - f);
+	  normal = normal_to_fixed_object(vector3_minus(p, po[i].shiftby),
+					  *po[i].o);
+	  normal.x = no_size_x ? 0 : normal.x / geometry_lattice.size.x;
+	  normal.y = no_size_y ? 0 : normal.y / geometry_lattice.size.y;
+	  normal.z = no_size_z ? 0 : normal.z / geometry_lattice.size.z;
+	  /* normalize the Cartesian normal R^T normal: */
+	  nc[0] = R[0][0]*normal.x + R[1][0]*normal.y + R[2][0]*normal.z;
+	  nc[1] = R[0][1]*normal.x + R[1][1]*normal.y + R[2][1]*normal.z;
+	  nc[2] = R[0][2]*normal.x + R[1][2]*normal.y + R[2][2]*normal.z;
+	  nlen = sqrt(nc[0]*nc[0] + nc[1]*nc[1] + nc[2]*nc[2]);
+	  if (nlen == 0)
+	       continue;
+	  w /= nlen;
+	  n[0] += w * normal.x;
+	  n[1] += w * normal.y;
+	  n[2] += w * normal.z;
+	  wsum += fabs(w) * nlen;
      }
+
+     /* give up if the normals (nearly) cancel: */
+     nc[0] = R[0][0] * n[0] + R[1][0] * n[1] + R[2][0] * n[2];
+     nc[1] = R[0][1] * n[0] + R[1][1] * n[1] + R[2][1] * n[2];
+     nc[2] = R[0][2] * n[0] + R[1][2] * n[1] + R[2][2] * n[2];
+     if (sqrt(nc[0]*nc[0] + nc[1]*nc[1] + nc[2]*nc[2]) <= 1e-3 * wsum)
+	  return 0;
+
+     return kottke_average(meps, n, nmat, eps, fill);
 }
 
 static int mean_epsilon_func(symmetric_matrix *meps, 
@@ -226,6 +406,26 @@ static int mean_epsilon_func(symmetric_matrix *meps,
      return 1;
 #endif
 
+     pixel.low.x = p.x - d1;
+     pixel.high.x = p.x + d1;
+     pixel.low.y = p.y - d2;
+     pixel.high.y = p.y + d2;
+     pixel.low.z = p.z - d3;
+     pixel.high.z = p.z + d3;
+     tol = tol > 0.01 ? 0.01 : tol;
+
+     /* quick check for a pixel entirely in the default material: */
+     if (!d->epsilon_file_func
+	 && !variable_material(default_material.which_subclass)) {
+	  geom_box b = pixel;
+	  if (geom_box_to_unit_cell(&b)
+	      && !geom_box_tree_intersects(geometry_tree, &b)) {
+	       material_epsilon(default_material, meps, meps_inv);
+	       n[0] = n[1] = n[2] = 0;
+	       return 1;
+	  }
+     }
+
      for (i = 0; i < num_neighbors[dimensions - 1]; ++i) {
 	  const geometric_object *o;
 	  material_type mat;
@@ -260,7 +460,8 @@ static int mean_epsilon_func(symmetric_matrix *meps,
 		     (id1 == id || material_type_equal(&mat1,&mat))) &&
 		   !(id2 < id1 &&
 		     (id2 == id || material_type_equal(&mat2,&mat))))
-	       return 0; /* too many nearby objects for analysis */
+	       /* too many nearby objects for the two-material analysis: */
+	       return mean_epsilon_multi(meps, meps_inv, n, pixel, tol, d);
      }
 
      CHECK(id1 > -1, "bug in object_of_point_in_tree?");
@@ -297,123 +498,26 @@ static int mean_epsilon_func(symmetric_matrix *meps,
      n[1] = no_size_y ? 0 : normal.y / geometry_lattice.size.y;
      n[2] = no_size_z ? 0 : normal.z / geometry_lattice.size.z;
 
-     pixel.low.x = p.x - d1;
-     pixel.high.x = p.x + d1;
-     pixel.low.y = p.y - d2;
-     pixel.high.y = p.y + d2;
-     pixel.low.z = p.z - d3;
-     pixel.high.z = p.z + d3;
-
-     tol = tol > 0.01 ? 0.01 : tol;
      if (id1 > id2) {
 	  pixel.low = vector3_minus(pixel.low, shiftby1);
 	  pixel.high = vector3_minus(pixel.high, shiftby1);
-	  fill = box_overlap_with_object(pixel, *o1, tol, 100/tol);
+	  fill = cached_box_overlap(pixel, o1, tol);
      }
      else {
 	  pixel.low = vector3_minus(pixel.low, shiftby2);
 	  pixel.high = vector3_minus(pixel.high, shiftby2);
-	  fill = 1 - box_overlap_with_object(pixel, *o2, tol, 100/tol);
+	  fill = 1 - cached_box_overlap(pixel, o2, tol);
      }
 
      {
-	  symmetric_matrix eps2, epsinv2;
-	  symmetric_matrix eps1, delta;
-	  double Rot[3][3], norm, n0, n1, n2;
-	  material_epsilon(mat2, &eps2, &epsinv2);
-	  eps1 = *meps;
-
-	  /* make Cartesian orthonormal frame relative to interface */
-	  n0 = R[0][0] * n[0] + R[1][0] * n[1] + R[2][0] * n[2];
-	  n1 = R[0][1] * n[0] + R[1][1] * n[1] + R[2][1] * n[2];
-	  n2 = R[0][2] * n[0] + R[1][2] * n[1] + R[2][2] * n[2];
-	  norm = sqrt(n0*n0 + n1*n1 + n2*n2);
-	  if (norm == 0.0)
+	  symmetric_matrix eps[2], epsinv2;
+	  double fills[2];
+	  eps[0] = *meps;
+	  material_epsilon(mat2, &eps[1], &epsinv2);
+	  fills[0] = fill;
+	  fills[1] = 1 - fill;
+	  if (!kottke_average(meps, n, 2, eps, fills))
 	       return 0;
-	  norm = 1.0 / norm;
-	  Rot[0][0] = n0 = n0 * norm;
-	  Rot[1][0] = n1 = n1 * norm;
-	  Rot[2][0] = n2 = n2 * norm;
-	  if (fabs(n0) > 1e-2 || fabs(n1) > 1e-2) { /* (z x n) */
-	       Rot[0][2] = n1;
-	       Rot[1][2] = -n0;
-	       Rot[2][2] = 0;
-	  }
-	  else { /* n is ~ parallel to z direction, use (x x n) instead */
-	       Rot[0][2] = 0;
-	       Rot[1][2] = -n2;
-	       Rot[2][2] = n1;
-	  }
-	  { /* normalize second column */
-	       double s = Rot[0][2]*Rot[0][2]+Rot[1][2]*Rot[1][2]+Rot[2][2]*Rot[2][2];
-	       s = 1.0 / sqrt(s);
-	       Rot[0][2] *= s;
-	       Rot[1][2] *= s;
-	       Rot[2][2] *= s;
-	  }
-	  /* 1st column is 2nd column x 0th column */
-	  Rot[0][1] = Rot[1][2] * Rot[2][0] - Rot[2][2] * Rot[1][0];
-	  Rot[1][1] = Rot[2][2] * Rot[0][0] - Rot[0][2] * Rot[2][0];
-	  Rot[2][1] = Rot[0][2] * Rot[1][0] - Rot[1][2] * Rot[0][0];
-
-	  /* rotate epsilon tensors to surface parallel/perpendicular axes */
-	  maxwell_sym_matrix_rotate(&eps1, &eps1, Rot);
-	  maxwell_sym_matrix_rotate(&eps2, &eps2, Rot);
-
-#define AVG (fill * (EXPR(eps1)) + (1-fill) * (EXPR(eps2)))
-
-#define EXPR(eps) (-1 / eps.m00)
-	  delta.m00 = AVG;
-#undef EXPR
-#define EXPR(eps) (eps.m11 - ESCALAR_NORMSQR(eps.m01) / eps.m00)
-	  delta.m11 = AVG;
-#undef EXPR
-#define EXPR(eps) (eps.m22 - ESCALAR_NORMSQR(eps.m02) / eps.m00)
-	  delta.m22 = AVG;
-#undef EXPR
-
-#define EXPR(eps) (ESCALAR_RE(eps.m01) / eps.m00)
-	  ESCALAR_RE(delta.m01) = AVG;
-#undef EXPR
-#define EXPR(eps) (ESCALAR_RE(eps.m02) / eps.m00)
-	  ESCALAR_RE(delta.m02) = AVG;
-#undef EXPR
-#define EXPR(eps) (ESCALAR_RE(eps.m12) - ESCALAR_MULT_CONJ_RE(eps.m02, eps.m01) / eps.m00)
-	  ESCALAR_RE(delta.m12) = AVG;
-#undef EXPR
-
-#ifdef WITH_HERMITIAN_EPSILON
-#  define EXPR(eps) (ESCALAR_IM(eps.m01) / eps.m00)
-	  ESCALAR_IM(delta.m01) = AVG;
-#  undef EXPR
-#  define EXPR(eps) (ESCALAR_IM(eps.m02) / eps.m00)
-	  ESCALAR_IM(delta.m02) = AVG;
-#  undef EXPR
-#  define EXPR(eps) (ESCALAR_IM(eps.m12) - ESCALAR_MULT_CONJ_IM(eps.m02, eps.m01) / eps.m00)
-	  ESCALAR_IM(delta.m12) = AVG;
-#  undef EXPR
-#endif /* WITH_HERMITIAN_EPSILON */
-
-	  meps->m00 = -1/delta.m00;
-	  meps->m11 = delta.m11 - ESCALAR_NORMSQR(delta.m01) / delta.m00;
-	  meps->m22 = delta.m22 - ESCALAR_NORMSQR(delta.m02) / delta.m00;
-	  ASSIGN_ESCALAR(meps->m01, -ESCALAR_RE(delta.m01)/delta.m00,
-			-ESCALAR_IM(delta.m01)/delta.m00);
-	  ASSIGN_ESCALAR(meps->m02, -ESCALAR_RE(delta.m02)/delta.m00,
-			-ESCALAR_IM(delta.m02)/delta.m00);
-	  ASSIGN_ESCALAR(meps->m12, 
-			ESCALAR_RE(delta.m12) 
-			- ESCALAR_MULT_CONJ_RE(delta.m02, delta.m01)/delta.m00,
-			ESCALAR_IM(delta.m12) 
-			- ESCALAR_MULT_CONJ_IM(delta.m02, delta.m01)/delta.m00);
-
-#define SWAP(a,b) { double xxx = a; a = b; b = xxx; }	  
-	  /* invert rotation matrix = transpose */
-	  SWAP(Rot[0][1], Rot[1][0]);
-	  SWAP(Rot[0][2], Rot[2][0]);
-	  SWAP(Rot[2][1], Rot[1][2]);
-	  maxwell_sym_matrix_rotate(meps, meps, Rot); /* rotate back */
-#undef SWAP
 
 #  ifdef DEBUG
 	  CHECK(negative_epsilon_okp 
@@ -386,11 +386,13 @@ void compute_field_divergence(void)
      for (i = 0; i < mdata->other_dims; ++i)
           for (j = 0; j < mdata->last_dim; ++j) {
                int ij = i * mdata->last_dim_size + j;
-	       k_data cur_k = mdata->k_plus_G[ij];
+	       k_data cur_k;
+	       real kx, ky, kz;
+	       cur_k = mdata->k_plus_G[ij];
 	       /* k+G = |k+G| (m x n) */
-	       real kx = cur_k.kmag * (cur_k.my*cur_k.nz-cur_k.mz*cur_k.ny);
-	       real ky = cur_k.kmag * (cur_k.mz*cur_k.nx-cur_k.mx*cur_k.nz);
-	       real kz = cur_k.kmag * (cur_k.mx*cur_k.ny-cur_k.my*cur_k.nz);
+	       kx = cur_k.kmag * (cur_k.my*cur_k.nz-cur_k.mz*cur_k.ny);
+	       ky = cur_k.kmag * (cur_k.mz*cur_k.nx-cur_k.mx*cur_k.nz);
+	       kz = cur_k.kmag * (cur_k.mx*cur_k.ny-cur_k.my*cur_k.nz);
 	       ASSIGN_SCALAR(field2[ij],
 			     SCALAR_RE(field2[3*ij+0]) * kx +
 			     SCALAR_RE(field2[3*ij+1]) * ky +
@@ -677,6 +679,15 @@ cmatrix3x3 get_epsilon_inverse_tensor_point(vector3 p)
 #endif
 }
 
+/* Return the mean of the trace of eps_inv over the grid, divided by 3
+   (used by the preconditioners). */
+number get_epsilon_inverse_mean(void)
+{
+     CHECK(mdata, "init-params must be called before "
+	   "get-epsilon-inverse-mean");
+     return mdata->eps_inv_mean;
+}
+
 number get_energy_point(vector3 p)
 {
      CHECK(curfield && strchr("DHBR", curfield_type),
@@ -1350,8 +1361,96 @@ number compute_energy_in_object_list(geometric_object_list objects)
 
 /**************************************************************************/
 
-/* Compute the integral of f(energy/field, epsilon, r) over the cell. */
-cnumber compute_field_integral(function f)
+/* The integrand is evaluated in batches of up to INTEGRAND_BATCH points,
+   so that a native integrand function (see mpb.h) is called once per
+   batch rather than once per point.  A Scheme integrand is still called
+   once per point, in the same order. */
+
+#define INTEGRAND_BATCH 1024
+
+typedef struct {
+     function f; /* Scheme integrand, if nf is NULL */
+     native_integrand_func nf;
+     number_list params; /* parameters for nf */
+     int nvals; /* 1 (energy density) or 6 (complex field) */
+     int n; /* number of points in the batch */
+     double vals[6*INTEGRAND_BATCH], epsilon[INTEGRAND_BATCH];
+     double r[3*INTEGRAND_BATCH], integrand[2*INTEGRAND_BATCH];
+     cnumber integral;
+} integrand_batch;
+
+static void integrand_batch_flush(integrand_batch *b)
+{
+     int i;
+
+     if (b->nf) {
+	  b->nf(b->n, b->nvals, b->vals, b->epsilon, b->r, b->integrand,
+		b->params.items, b->params.num_items);
+	  for (i = 0; i < b->n; ++i) {
+	       b->integral.re += b->integrand[2*i];
+	       b->integral.im += b->integrand[2*i+1];
+	  }
+     }
+     else
+	  for (i = 0; i < b->n; ++i) {
+	       vector3 p;
+	       p.x = b->r[3*i]; p.y = b->r[3*i+1]; p.z = b->r[3*i+2];
+	       if (b->nvals == 1)
+		    b->integral.re +=
+			 ctl_convert_number_to_c(
+			      gh_call3(b->f,
+				       ctl_convert_number_to_scm(b->vals[i]),
+				       ctl_convert_number_to_scm(b->epsilon[i]),
+				       ctl_convert_vector3_to_scm(p)));
+	       else {
+		    cvector3 F;
+		    cnumber integrand;
+		    const double *v = b->vals + 6*i;
+		    F.x.re = v[0]; F.x.im = v[1];
+		    F.y.re = v[2]; F.y.im = v[3];
+		    F.z.re = v[4]; F.z.im = v[5];
+		    integrand =
+			 ctl_convert_cnumber_to_c(
+			      gh_call3(b->f,
+				       ctl_convert_cvector3_to_scm(F),
+				       ctl_convert_number_to_scm(b->epsilon[i]),
+				       ctl_convert_vector3_to_scm(p)));
+		    b->integral.re += integrand.re;
+		    b->integral.im += integrand.im;
+	       }
+	  }
+     b->n = 0;
+}
+
+/* Add a point to the batch, where vals holds the energy density or the
+   x/y/z field components, depending on b->nvals. */
+static void integrand_batch_add(integrand_batch *b, const double *vals,
+				real epsilon, vector3 p)
+{
+     int i;
+     for (i = 0; i < b->nvals; ++i)
+	  b->vals[b->nvals * b->n + i] = vals[i];
+     b->epsilon[b->n] = epsilon;
+     b->r[3*b->n] = p.x; b->r[3*b->n+1] = p.y; b->r[3*b->n+2] = p.z;
+     if (++b->n == INTEGRAND_BATCH)
+	  integrand_batch_flush(b);
+}
+
+static void integrand_batch_add_field(integrand_batch *b, cvector3 F,
+				      real epsilon, vector3 p)
+{
+     double vals[6];
+     vals[0] = F.x.re; vals[1] = F.x.im;
+     vals[2] = F.y.re; vals[3] = F.y.im;
+     vals[4] = F.z.re; vals[5] = F.z.im;
+     integrand_batch_add(b, vals, epsilon, p);
+}
+
+/* Compute the integral of f(energy/field, epsilon, r) over the cell,
+   where f is either the Scheme function f or (if non-NULL) the native
+   function nf with parameters params. */
+static cnumber field_integral(function f, native_integrand_func nf,
+			      number_list params)
 {
      int i, j, k, n1, n2, n3, n_other, n_last, rank, last_dim;
 #ifdef HAVE_MPI
@@ -1362,6 +1461,7 @@ cnumber compute_field_integral(function f)
      real *energy = (real *) curfield;
      cnumber integral = {0,0};
      vector3 kvector = {0,0,0};
+     integrand_batch *b;
 
      if (!curfield || !strchr("dhbeDHBRcv", curfield_type)) {
           mpi_one_fprintf(stderr, "The D or H energy/field must be loaded first.\n");
@@ -1385,6 +1485,14 @@ cnumber compute_field_integral(function f)
      c2 = n2 <= 1 ? 0 : geometry_lattice.size.y * 0.5;
      c3 = n3 <= 1 ? 0 : geometry_lattice.size.z * 0.5;
 
+     CHK_MALLOC(b, integrand_batch, 1);
+     b->f = f;
+     b->nf = nf;
+     b->params = params;
+     b->nvals = integrate_energy ? 1 : 6;
+     b->n = 0;
+     b->integral = integral;
+
      LOOP_XYZ(mdata) {
 	       real epsilon;
 	       vector3 p;
@@ -1393,18 +1501,13 @@ cnumber compute_field_integral(function f)
 
 	       p.x = i1 * s1 - c1; p.y = i2 * s2 - c2; p.z = i3 * s3 - c3;
 	       if (integrate_energy) {
-		    integral.re +=
-			 ctl_convert_number_to_c(
-			      gh_call3(f,
-				     ctl_convert_number_to_scm(energy[xyz_index]),
-				       ctl_convert_number_to_scm(epsilon),
-				       ctl_convert_vector3_to_scm(p)));
+		    double e = energy[xyz_index];
+		    integrand_batch_add(b, &e, epsilon, p);
 	       }
 	       else {
 		    cvector3 F;
 		    double phase_phi;
 		    scalar_complex phase;
-		    cnumber integrand;
 
 		    phase_phi = TWOPI *
 			 (kvector.x * (p.x/geometry_lattice.size.x) +
@@ -1417,14 +1520,7 @@ cnumber compute_field_integral(function f)
 		    CASSIGN_MULT_IM(F.y.im, curfield[3*xyz_index+1], phase);
 		    CASSIGN_MULT_RE(F.z.re, curfield[3*xyz_index+2], phase);
 		    CASSIGN_MULT_IM(F.z.im, curfield[3*xyz_index+2], phase);
-		    integrand =
-			 ctl_convert_cnumber_to_c(
-                              gh_call3(f,
-				       ctl_convert_cvector3_to_scm(F),
-				       ctl_convert_number_to_scm(epsilon),
-                                       ctl_convert_vector3_to_scm(p)));
-		    integral.re += integrand.re;
-		    integral.im += integrand.im;
+		    integrand_batch_add_field(b, F, epsilon, p);
 	       }
 
 #ifndef SCALAR_COMPLEX
@@ -1447,18 +1543,14 @@ cnumber compute_field_integral(function f)
 			 p.x = i1c * s1 - c1;
 			 p.y = i2c * s2 - c2;
 			 p.z = i3c * s3 - c3;
-			 if (integrate_energy)
-			      integral.re +=
-				   ctl_convert_number_to_c(
-					gh_call3(f,
-				      ctl_convert_number_to_scm(energy[xyz_index]),
-				      ctl_convert_number_to_scm(epsilon),
-				      ctl_convert_vector3_to_scm(p)));
+			 if (integrate_energy) {
+			      double e = energy[xyz_index];
+			      integrand_batch_add(b, &e, epsilon, p);
+			 }
 			 else {
 			      cvector3 F;
 			      double phase_phi;
 			      scalar_complex phase, Fx, Fy, Fz;
-			      cnumber integrand;
 
 			      Fx = curfield[3*xyz_index+0];
 			      Fy = curfield[3*xyz_index+1];
@@ -1481,19 +1573,15 @@ cnumber compute_field_integral(function f)
 			      CASSIGN_MULT_RE(F.z.re, Fz, phase);
 			      CASSIGN_MULT_IM(F.z.im, Fz, phase);
 
-			      integrand =
-				   ctl_convert_cnumber_to_c(
-					gh_call3(f,
-					    ctl_convert_cvector3_to_scm(F),
-				            ctl_convert_number_to_scm(epsilon),
-                                            ctl_convert_vector3_to_scm(p)));
-			      integral.re += integrand.re;
-			      integral.im += integrand.im;
+			      integrand_batch_add_field(b, F, epsilon, p);
 			 }
 		    }
 	       }
 #endif
 	}}}
+     integrand_batch_flush(b);
+     integral = b->integral;
+     free(b);
 
      integral.re *= Vol / H.N;
      integral.im *= Vol / H.N;
@@ -1505,6 +1593,22 @@ cnumber compute_field_integral(function f)
      }
 }
 
+cnumber compute_field_integral(function f)
+{
+     number_list no_params = {0, NULL};
+     return field_integral(f, NULL, no_params);
+}
+
+/* Like compute_field_integral, but with a native integrand function
+   func from the shared library library (see mpb.h). */
+cnumber compute_field_integral_native(string library, string func,
+				      number_list params)
+{
+     native_integrand_func nf =
+	  (native_integrand_func) get_native_function(library, func);
+     return field_integral(SCM_BOOL_F, nf, params);
+}
+
 number compute_energy_integral(function f)
 {
      if (!curfield || !strchr("DHBR", curfield_type)) {
@@ -1515,4 +1619,15 @@ number compute_energy_integral(function f)
      return cnumber_re(compute_field_integral(f));
 }
 
+number compute_energy_integral_native(string library, string func,
+				      number_list params)
+{
+     if (!curfield || !strchr("DHBR", curfield_type)) {
+          mpi_one_fprintf(stderr, "The D or H energy density must be loaded first.\n");
+          return 0.0;
+     }
+
+     return cnumber_re(compute_field_integral_native(library, func, params));
+}
+
 /**************************************************************************/
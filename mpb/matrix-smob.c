@@ -271,6 +271,7 @@ void set_eigenvectors(SCM mo, integer b_start)
 
      evectmatrix_copy_slice(H, *m, b_start - 1, 0, m->p);
      curfield_reset();
+     reset_kpoint_history();
      scm_remember_upto_here_1(mo);
 }
 
@@ -371,6 +372,7 @@ void load_eigenvectors(char *filename)
      printf("Loading eigenvectors from \"%s\"...\n", filename);
      evectmatrixio_readall_raw(filename, H);
      curfield_reset();
+     reset_kpoint_history();
 }
 
 /*************************************************************************/
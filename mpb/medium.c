@@ -41,6 +41,9 @@ typedef struct {
      void *mu_file_func_data;
 } medium_func_data;
 
+/* maximum number of points that epsilon_batch_func looks up at once */
+#define MEDIUM_BATCH 64
+
 static material_type make_medium(double epsilon, double mu)
 {
      material_type m;
@@ -61,12 +64,595 @@ static material_type make_mu(double mu)
     return make_medium(1.0, mu);
 }
 
+/* Return the (isotropic, mu = 1) medium of a native material at p. */
+static material_type native_medium(material_type m, vector3 p)
+{
+     double r[3], eps;
+     r[0] = p.x; r[1] = p.y; r[2] = p.z;
+     native_material_epsilon(m, 1, r, &eps);
+     return make_medium(eps, 1.0);
+}
+
+/* Set m to an isotropic medium (stored in md) with epsilon = mu = val,
+   for use with material_epsilon or material_mu. */
+static void isotropic_medium(material_type *m, medium *md, double val)
+{
+     m->which_subclass = MEDIUM;
+     m->subclass.medium_data = md;
+     md->epsilon = val;
+     md->mu = val;
+}
+
+/* The epsilon (or mu, which is 1) values of the native material m at
+   the n points p[which[i]], for epsilon_batch_func (or mu_batch_func). */
+static void native_epsilon_values(material_type m, int n, const int *which,
+				  const vector3 *p, double *vals)
+{
+     double r[3*MEDIUM_BATCH];
+     int i;
+     for (i = 0; i < n; ++i) {
+	  r[3*i] = p[which[i]].x;
+	  r[3*i+1] = p[which[i]].y;
+	  r[3*i+2] = p[which[i]].z;
+     }
+     native_material_epsilon(m, n, r, vals);
+}
+
+static void native_mu_values(material_type m, int n, const int *which,
+			     const vector3 *p, double *vals)
+{
+     int i;
+     (void) m; (void) which; (void) p;
+     for (i = 0; i < n; ++i)
+	  vals[i] = 1.0;
+}
+
+static int same_material(material_type m1, material_type m2)
+{
+     return (m1.which_subclass == m2.which_subclass &&
+	     m1.subclass.medium_data == m2.subclass.medium_data);
+}
+
+/* Return the material at r (given in the basis of the lattice vectors,
+   like the argument of epsilon_func), setting p to the corresponding
+   point in the lattice unit-vector basis (shifted into the unit cell),
+   and tp and oi to the tree node and index of the object containing it
+   (tp = NULL if there is none, in which case default_material is
+   returned). */
+static material_type material_at(const real r[3], vector3 *p,
+				 geom_box_tree *tp, int *oi)
+{
+     material_type material;
+
+     /* p needs to be in the lattice *unit* vector basis, while r is
+	in the lattice vector basis.  Also, shift origin to the center
+        of the grid. */
+     p->x = no_size_x ? 0 : (r[0] - 0.5) * geometry_lattice.size.x;
+     p->y = no_size_y ? 0 : (r[1] - 0.5) * geometry_lattice.size.y;
+     p->z = no_size_z ? 0 : (r[2] - 0.5) * geometry_lattice.size.z;
+
+     /* call search routine from libctl/utils/libgeom/geom.c: 
+        (we have to use the lower-level geom_tree_search to
+         support material-grid types, which have funny semantics) */
+     *tp = geom_tree_search(*p = shift_to_unit_cell(*p), geometry_tree, oi);
+     if (*tp)
+	  material = (*tp)->objects[*oi].o->material;
+     else
+	  material = default_material;
+
+#ifdef DEBUG_GEOMETRY_TREE
+     {
+	  boolean inobject;
+	  material_type m2 = material_of_point_inobject(*p, &inobject);
+	  CHECK(m2.which_subclass == material.which_subclass &&
+		m2.subclass.medium_data ==
+		material.subclass.medium_data,
+		"material_of_point & material_of_point_in_tree don't agree!");
+     }
+#endif
+
+     if (material.which_subclass == MATERIAL_TYPE_SELF) {
+	  material = default_material;
+	  *tp = 0;  /* treat as a "nothing" object */
+     }
+     return material;
+}
+
 static int variable_material(int which_subclass)
+{
+     return (which_subclass == MATERIAL_GRID ||
+	     which_subclass == MATERIAL_FUNCTION ||
+	     which_subclass == NATIVE_MATERIAL_FUNCTION);
+}
+
+static int threadunsafe_material(int which_subclass)
 {
      return (which_subclass == MATERIAL_GRID ||
 	     which_subclass == MATERIAL_FUNCTION);
 }
 
+/* Return whether the epsilon and mu functions may be called from
+   several threads at once, which is not the case for material grids
+   (which use a static array handle) or material functions (which
+   call Scheme).  Native material functions are required to be
+   thread-safe. */
+static int medium_threadsafe(void)
+{
+     int i;
+     if (threadunsafe_material(default_material.which_subclass))
+	  return 0;
+     for (i = 0; i < geometry.num_items; ++i)
+	  if (threadunsafe_material(geometry.items[i].material.which_subclass))
+	       return 0;
+     return 1;
+}
+
+static int geom_boxes_intersect(const geom_box *b1, const geom_box *b2)
+{
+     return (b1->low.x <= b2->high.x && b2->low.x <= b1->high.x &&
+	     b1->low.y <= b2->high.y && b2->low.y <= b1->high.y &&
+	     b1->low.z <= b2->high.z && b2->low.z <= b1->high.z);
+}
+
+/* Return whether the bounding box of any object in the tree t
+   intersects the box b. */
+static int geom_box_tree_intersects(geom_box_tree t, const geom_box *b)
+{
+     int i;
+     if (!t || !geom_boxes_intersect(&t->b, b))
+	  return 0;
+     for (i = 0; i < t->nobjects; ++i)
+	  if (geom_boxes_intersect(&t->objects[i].box, b))
+	       return 1;
+     return (geom_box_tree_intersects(t->t1, b) ||
+	     geom_box_tree_intersects(t->t2, b));
+}
+
+/* Shift the box b (in the lattice unit-vector basis) into the unit
+   cell, as shift_to_unit_cell does for each point looked up in
+   geometry_tree, and return whether it then lies entirely within the
+   unit cell (so that every point in it is shifted by the same amount).
+   The no-size dimensions are ignored. */
+static int geom_box_to_unit_cell(geom_box *b)
+{
+     vector3 c, shift, low, high;
+     c = vector3_scale(0.5, vector3_plus(b->low, b->high));
+     shift = vector3_minus(shift_to_unit_cell(c), c);
+     b->low = vector3_plus(b->low, shift);
+     b->high = vector3_plus(b->high, shift);
+     low = vector3_plus(geometry_center,
+			vector3_scale(-0.5, geometry_lattice.size));
+     high = vector3_plus(geometry_center,
+			 vector3_scale(0.5, geometry_lattice.size));
+     return ((no_size_x || (b->low.x >= low.x && b->high.x < high.x)) &&
+	     (no_size_y || (b->low.y >= low.y && b->high.y < high.y)) &&
+	     (no_size_z || (b->low.z >= low.z && b->high.z < high.z)));
+}
+
+/* Set b to the box rmin <= r <= rmax given in the lattice-vector basis
+   (like the r of epsilon_func), converted to the lattice *unit*-vector
+   basis of the geometric objects. */
+static void get_lattice_box(geom_box *b,
+			    const real rmin[3], const real rmax[3])
+{
+     b->low.x = no_size_x ? 0 : (rmin[0] - 0.5) * geometry_lattice.size.x;
+     b->low.y = no_size_y ? 0 : (rmin[1] - 0.5) * geometry_lattice.size.y;
+     b->low.z = no_size_z ? 0 : (rmin[2] - 0.5) * geometry_lattice.size.z;
+     b->high.x = no_size_x ? 0 : (rmax[0] - 0.5) * geometry_lattice.size.x;
+     b->high.y = no_size_y ? 0 : (rmax[1] - 0.5) * geometry_lattice.size.y;
+     b->high.z = no_size_z ? 0 : (rmax[2] - 0.5) * geometry_lattice.size.z;
+}
+
+/**************************************************************************/
+
+/* materials_at looks up a batch of points in geometry_tree with a
+   single walk of the tree: it collects the objects whose bounding
+   boxes intersect the bounding box of the whole batch (usually the
+   sampling mesh of one or a few neighboring grid points, so that these
+   are only the objects of one or two leaves), and then tests each
+   point against only those, in the same order as geom_tree_search.
+   For a point to be tested against an object, geom_tree_search
+   requires it to lie in the box of every node on the way down to the
+   object's node, so we keep the intersection of those boxes. */
+
+#define MAX_BATCH_OBJECTS 16
+
+typedef struct {
+     geom_box_tree t; /* the tree node, and the index of the object */
+     int oi;
+     geom_box nodes_box; /* intersection of the boxes of t and its parents */
+} batch_object;
+
+static int geom_box_contains(const geom_box *b, vector3 p)
+{
+     return (b->low.x <= p.x && p.x <= b->high.x &&
+	     b->low.y <= p.y && p.y <= b->high.y &&
+	     b->low.z <= p.z && p.z <= b->high.z);
+}
+
+/* Add the objects of the tree t (whose parents' boxes intersect in
+   nodes_box) whose bounding boxes intersect b to bo (which has nbo
+   objects), returning the new nbo, or -1 if there are more than
+   MAX_BATCH_OBJECTS. */
+static int add_batch_objects(geom_box_tree t, geom_box nodes_box,
+			     const geom_box *b, batch_object *bo, int nbo)
+{
+     int i;
+     if (!t || nbo < 0)
+	  return nbo;
+     nodes_box.low.x = MAX2(nodes_box.low.x, t->b.low.x);
+     nodes_box.low.y = MAX2(nodes_box.low.y, t->b.low.y);
+     nodes_box.low.z = MAX2(nodes_box.low.z, t->b.low.z);
+     nodes_box.high.x = MIN2(nodes_box.high.x, t->b.high.x);
+     nodes_box.high.y = MIN2(nodes_box.high.y, t->b.high.y);
+     nodes_box.high.z = MIN2(nodes_box.high.z, t->b.high.z);
+     if (!geom_boxes_intersect(&nodes_box, b))
+	  return nbo;
+     for (i = 0; i < t->nobjects; ++i)
+	  if (geom_boxes_intersect(&t->objects[i].box, b)) {
+	       if (nbo == MAX_BATCH_OBJECTS)
+		    return -1;
+	       bo[nbo].t = t;
+	       bo[nbo].oi = i;
+	       bo[nbo].nodes_box = nodes_box;
+	       ++nbo;
+	  }
+     nbo = add_batch_objects(t->t1, nodes_box, b, bo, nbo);
+     return add_batch_objects(t->t2, nodes_box, b, bo, nbo);
+}
+
+/* Like material_at, for the n points r[3*i..3*i+2], setting mat[i],
+   p[i], tp[i], and oi[i]. */
+static void materials_at(int n, const real *r, material_type *mat,
+			 vector3 *p, geom_box_tree *tp, int *oi)
+{
+     batch_object bo[MAX_BATCH_OBJECTS];
+     geom_box b;
+     int i, k, nbo;
+
+     if (n <= 0)
+	  return;
+
+     for (i = 0; i < n; ++i) {
+	  p[i].x = no_size_x ? 0 : (r[3*i] - 0.5) * geometry_lattice.size.x;
+	  p[i].y = no_size_y ? 0 : (r[3*i+1] - 0.5) * geometry_lattice.size.y;
+	  p[i].z = no_size_z ? 0 : (r[3*i+2] - 0.5) * geometry_lattice.size.z;
+	  p[i] = shift_to_unit_cell(p[i]);
+	  if (i == 0)
+	       b.low = b.high = p[0];
+	  else {
+	       b.low.x = MIN2(b.low.x, p[i].x);
+	       b.low.y = MIN2(b.low.y, p[i].y);
+	       b.low.z = MIN2(b.low.z, p[i].z);
+	       b.high.x = MAX2(b.high.x, p[i].x);
+	       b.high.y = MAX2(b.high.y, p[i].y);
+	       b.high.z = MAX2(b.high.z, p[i].z);
+	  }
+     }
+     if (!geometry_tree ||
+	 (nbo = add_batch_objects(geometry_tree, geometry_tree->b,
+				  &b, bo, 0)) < 0) {
+	  for (i = 0; i < n; ++i)
+	       mat[i] = material_at(r + 3*i, p + i, tp + i, oi + i);
+	  return;
+     }
+
+     for (i = 0; i < n; ++i) {
+	  tp[i] = NULL;
+	  mat[i] = default_material;
+	  for (k = 0; k < nbo; ++k) {
+	       const geom_box_object *gbo = bo[k].t->objects + bo[k].oi;
+	       if (geom_box_contains(&bo[k].nodes_box, p[i]) &&
+		   geom_box_contains(&gbo->box, p[i]) &&
+		   point_in_fixed_objectp(vector3_minus(p[i], gbo->shiftby),
+					  *gbo->o)) {
+		    tp[i] = bo[k].t;
+		    oi[i] = bo[k].oi;
+		    mat[i] = gbo->o->material;
+		    break;
+	       }
+	  }
+	  if (mat[i].which_subclass == MATERIAL_TYPE_SELF) {
+	       mat[i] = default_material;
+	       tp[i] = NULL;
+	  }
+     }
+}
+
+/**************************************************************************/
+
+/* mean_epsilon_func averages a pixel that overlaps several objects
+   analytically, from the fraction of the pixel inside each of them
+   (given by box_overlap_with_object), as long as the objects do not
+   overlap one another within the pixel (so that their precedence does
+   not matter).  Since box_overlap_with_object is expensive, and a
+   crystal usually contains many identical objects (and the same pixels
+   are averaged again for mu), we cache the fill fractions, keyed by
+   the shape of the object (everything but its center and material)
+   and the position of the pixel relative to its center.  The cache
+   only lives for one reset_epsilon, during which the pixel size and
+   the tolerance are fixed. */
+
+#define MAX_PIXEL_OBJECTS 8
+#define OVERLAP_CACHE_SIZE 65536 /* power of 2 */
+
+typedef struct {
+     const geometric_object *o;
+     vector3 shiftby;
+     geom_box box;
+     double fill;
+} pixel_object;
+
+typedef struct {
+     int shape; /* -1 for an empty entry */
+     double offset[3]; /* pixel center - object center, quantized */
+     double fill;
+} overlap_cache_entry;
+
+static overlap_cache_entry *overlap_cache = NULL;
+static int *object_shapes = NULL; /* shape index of each geometry item */
+
+#define MAX_SHAPES 64 /* max # distinct shapes we compare against */
+
+/* Return whether a and b have the same shape, ignoring their centers
+   and materials. */
+static int same_shape(const geometric_object *a, const geometric_object *b)
+{
+     geometric_object tmp;
+     if (a->which_subclass != b->which_subclass)
+	  return 0;
+     tmp = *a;
+     tmp.center = b->center;
+     tmp.material = b->material;
+     return geometric_object_equal(&tmp, b);
+}
+
+static void init_overlap_cache(void)
+{
+     int i, j, nshapes = 0, shapes[MAX_SHAPES];
+     CHK_MALLOC(overlap_cache, overlap_cache_entry, OVERLAP_CACHE_SIZE);
+     for (i = 0; i < OVERLAP_CACHE_SIZE; ++i)
+	  overlap_cache[i].shape = -1;
+     CHK_MALLOC(object_shapes, int, MAX2(1, geometry.num_items));
+     for (i = 0; i < geometry.num_items; ++i) {
+	  for (j = 0; j < nshapes; ++j)
+	       if (same_shape(geometry.items + i, geometry.items + shapes[j]))
+		    break;
+	  if (j < nshapes)
+	       object_shapes[i] = shapes[j];
+	  else {
+	       object_shapes[i] = i;
+	       if (nshapes < MAX_SHAPES)
+		    shapes[nshapes++] = i;
+	  }
+     }
+}
+
+static void destroy_overlap_cache(void)
+{
+     free(overlap_cache); overlap_cache = NULL;
+     free(object_shapes); object_shapes = NULL;
+}
+
+/* Like box_overlap_with_object(pixel, *o, tol, 100/tol), where o is
+   a geometry item, but using the cache. */
+static double cached_box_overlap(geom_box pixel, const geometric_object *o,
+				 double tol)
+{
+     int i, shape, hit;
+     double offset[3], w[3], fill;
+     unsigned h;
+     overlap_cache_entry *e;
+
+     if (!overlap_cache || o < geometry.items
+	 || o >= geometry.items + geometry.num_items)
+	  return box_overlap_with_object(pixel, *o, tol, 100/tol);
+     shape = object_shapes[o - geometry.items];
+
+     /* quantize the offset to 1e-8 of the pixel size, so that pixels
+	at the same position relative to identical objects (up to
+	roundoff) share an entry: */
+     offset[0] = 0.5 * (pixel.low.x + pixel.high.x) - o->center.x;
+     offset[1] = 0.5 * (pixel.low.y + pixel.high.y) - o->center.y;
+     offset[2] = 0.5 * (pixel.low.z + pixel.high.z) - o->center.z;
+     w[0] = pixel.high.x - pixel.low.x;
+     w[1] = pixel.high.y - pixel.low.y;
+     w[2] = pixel.high.z - pixel.low.z;
+     h = shape;
+     for (i = 0; i < 3; ++i) {
+	  offset[i] = w[i] > 0 ? floor(offset[i] / w[i] * 1e8 + 0.5) : 0;
+	  h = h * 2654435761U + (unsigned) (long) fmod(offset[i], 1e9);
+     }
+     e = overlap_cache + ((h ^ (h >> 16)) & (OVERLAP_CACHE_SIZE - 1));
+
+#pragma omp critical (overlap_cache)
+     {
+	  hit = (e->shape == shape && e->offset[0] == offset[0] &&
+		 e->offset[1] == offset[1] && e->offset[2] == offset[2]);
+	  fill = e->fill;
+     }
+     if (hit)
+	  return fill;
+
+     fill = box_overlap_with_object(pixel, *o, tol, 100/tol);
+#pragma omp critical (overlap_cache)
+     {
+	  e->shape = shape;
+	  e->offset[0] = offset[0];
+	  e->offset[1] = offset[1];
+	  e->offset[2] = offset[2];
+	  e->fill = fill;
+     }
+     return fill;
+}
+
+/* Add the objects in the tree t whose bounding boxes intersect the
+   pixel to po (which has npo objects), returning the new npo, or -1
+   if there are more than MAX_PIXEL_OBJECTS. */
+static int add_pixel_objects(geom_box_tree t, const geom_box *pixel,
+			     pixel_object *po, int npo)
+{
+     int i, j;
+     if (!t || npo < 0 || !geom_boxes_intersect(&t->b, pixel))
+	  return npo;
+     for (i = 0; i < t->nobjects; ++i) {
+	  const geom_box_object *gbo = t->objects + i;
+	  if (!geom_boxes_intersect(&gbo->box, pixel))
+	       continue;
+	  for (j = 0; j < npo; ++j) /* objects may be in several nodes */
+	       if (po[j].o == gbo->o && vector3_equal(po[j].shiftby,
+						      gbo->shiftby))
+		    break;
+	  if (j < npo)
+	       continue;
+	  if (npo == MAX_PIXEL_OBJECTS)
+	       return -1;
+	  po[npo].o = gbo->o;
+	  po[npo].shiftby = gbo->shiftby;
+	  po[npo].box = gbo->box;
+	  ++npo;
+     }
+     npo = add_pixel_objects(t->t1, pixel, po, npo);
+     return add_pixel_objects(t->t2, pixel, po, npo);
+}
+
+/* Return whether the intersection of b1, b2, and b3 has a nonzero
+   volume (ignoring the no-size dimensions). */
+static int boxes_overlap_volume(const geom_box *b1, const geom_box *b2,
+				const geom_box *b3)
+{
+     return ((no_size_x || MAX2(MAX2(b1->low.x, b2->low.x), b3->low.x)
+	      < MIN2(MIN2(b1->high.x, b2->high.x), b3->high.x)) &&
+	     (no_size_y || MAX2(MAX2(b1->low.y, b2->low.y), b3->low.y)
+	      < MIN2(MIN2(b1->high.y, b2->high.y), b3->high.y)) &&
+	     (no_size_z || MAX2(MAX2(b1->low.z, b2->low.z), b3->low.z)
+	      < MIN2(MIN2(b1->high.z, b2->high.z), b3->high.z)));
+}
+
+/* Find the objects overlapping the pixel (which must lie within the
+   unit cell), with their fill fractions, omitting the objects with
+   zero fill.  Returns the number of objects, or -1 if they cannot be
+   analyzed this way: too many objects, or objects (or rather their
+   bounding boxes) that overlap within the pixel. */
+static int get_pixel_objects(const geom_box *pixel, pixel_object *po,
+			     double tol)
+{
+     int i, j, npo = add_pixel_objects(geometry_tree, pixel, po, 0);
+     for (i = 0; i < npo; ++i)
+	  for (j = 0; j < i; ++j)
+	       if (boxes_overlap_volume(&po[i].box, &po[j].box, pixel))
+		    return -1;
+     for (i = j = 0; i < npo; ++i) {
+	  geom_box b;
+	  b.low = vector3_minus(pixel->low, po[i].shiftby);
+	  b.high = vector3_minus(pixel->high, po[i].shiftby);
+	  po[i].fill = cached_box_overlap(b, po[i].o, tol);
+	  if (po[i].fill > 0)
+	       po[j++] = po[i];
+     }
+     return j;
+}
+
+/* Set meps to the average of the nmat tensors eps[k] (which are
+   overwritten) with fill fractions fill[k], for an interface with
+   normal n (in the lattice basis), by the method of Kottke et al.:
+   in a frame whose first axis is n, the tensor components are
+   transformed so that the averages of the continuous field components
+   (E parallel and D perpendicular to the interface) are exact.
+   Returns 0 if n is zero. */
+static int kottke_average(symmetric_matrix *meps, const real n[3],
+			  int nmat, symmetric_matrix *eps, const double *fill)
+{
+     symmetric_matrix delta;
+     double Rot[3][3], norm, n0, n1, n2;
+     int k;
+
+     /* make Cartesian orthonormal frame relative to interface */
+     n0 = R[0][0] * n[0] + R[1][0] * n[1] + R[2][0] * n[2];
+     n1 = R[0][1] * n[0] + R[1][1] * n[1] + R[2][1] * n[2];
+     n2 = R[0][2] * n[0] + R[1][2] * n[1] + R[2][2] * n[2];
+     norm = sqrt(n0*n0 + n1*n1 + n2*n2);
+     if (norm == 0.0)
+	  return 0;
+     norm = 1.0 / norm;
+     Rot[0][0] = n0 = n0 * norm;
+     Rot[1][0] = n1 = n1 * norm;
+     Rot[2][0] = n2 = n2 * norm;
+     if (fabs(n0) > 1e-2 || fabs(n1) > 1e-2) { /* (z x n) */
+	  Rot[0][2] = n1;
+	  Rot[1][2] = -n0;
+	  Rot[2][2] = 0;
+     }
+     else { /* n is ~ parallel to z direction, use (x x n) instead */
+	  Rot[0][2] = 0;
+	  Rot[1][2] = -n2;
+	  Rot[2][2] = n1;
+     }
+     { /* normalize second column */
+	  double s = Rot[0][2]*Rot[0][2]+Rot[1][2]*Rot[1][2]+Rot[2][2]*Rot[2][2];
+	  s = 1.0 / sqrt(s);
+	  Rot[0][2] *= s;
+	  Rot[1][2] *= s;
+	  Rot[2][2] *= s;
+     }
+     /* 1st column is 2nd column x 0th column */
+     Rot[0][1] = Rot[1][2] * Rot[2][0] - Rot[2][2] * Rot[1][0];
+     Rot[1][1] = Rot[2][2] * Rot[0][0] - Rot[0][2] * Rot[2][0];
+     Rot[2][1] = Rot[0][2] * Rot[1][0] - Rot[1][2] * Rot[0][0];
+
+     delta.m00 = delta.m11 = delta.m22 = 0;
+     ASSIGN_ESCALAR(delta.m01, 0, 0);
+     ASSIGN_ESCALAR(delta.m02, 0, 0);
+     ASSIGN_ESCALAR(delta.m12, 0, 0);
+
+     for (k = 0; k < nmat; ++k) {
+	  symmetric_matrix *e = eps + k;
+	  double f = fill[k];
+
+	  /* rotate epsilon tensor to surface parallel/perpendicular axes */
+	  maxwell_sym_matrix_rotate(e, e, Rot);
+
+	  delta.m00 += f * (-1 / e->m00);
+	  delta.m11 += f * (e->m11 - ESCALAR_NORMSQR(e->m01) / e->m00);
+	  delta.m22 += f * (e->m22 - ESCALAR_NORMSQR(e->m02) / e->m00);
+	  ESCALAR_RE(delta.m01) += f * (ESCALAR_RE(e->m01) / e->m00);
+	  ESCALAR_RE(delta.m02) += f * (ESCALAR_RE(e->m02) / e->m00);
+	  ESCALAR_RE(delta.m12) += f * (ESCALAR_RE(e->m12)
+					- ESCALAR_MULT_CONJ_RE(e->m02, e->m01)
+					/ e->m00);
+#ifdef WITH_HERMITIAN_EPSILON
+	  ESCALAR_IM(delta.m01) += f * (ESCALAR_IM(e->m01) / e->m00);
+	  ESCALAR_IM(delta.m02) += f * (ESCALAR_IM(e->m02) / e->m00);
+	  ESCALAR_IM(delta.m12) += f * (ESCALAR_IM(e->m12)
+					- ESCALAR_MULT_CONJ_IM(e->m02, e->m01)
+					/ e->m00);
+#endif /* WITH_HERMITIAN_EPSILON */
+     }
+
+     meps->m00 = -1/delta.m00;
+     meps->m11 = delta.m11 - ESCALAR_NORMSQR(delta.m01) / delta.m00;
+     meps->m22 = delta.m22 - ESCALAR_NORMSQR(delta.m02) / delta.m00;
+     ASSIGN_ESCALAR(meps->m01, -ESCALAR_RE(delta.m01)/delta.m00,
+		    -ESCALAR_IM(delta.m01)/delta.m00);
+     ASSIGN_ESCALAR(meps->m02, -ESCALAR_RE(delta.m02)/delta.m00,
+		    -ESCALAR_IM(delta.m02)/delta.m00);
+     ASSIGN_ESCALAR(meps->m12, 
+		    ESCALAR_RE(delta.m12) 
+		    - ESCALAR_MULT_CONJ_RE(delta.m02, delta.m01)/delta.m00,
+		    ESCALAR_IM(delta.m12) 
+		    - ESCALAR_MULT_CONJ_IM(delta.m02, delta.m01)/delta.m00);
+
+#define SWAP(a,b) { double xxx = a; a = b; b = xxx; }	  
+     /* invert rotation matrix = transpose */
+     SWAP(Rot[0][1], Rot[1][0]);
+     SWAP(Rot[0][2], Rot[2][0]);
+     SWAP(Rot[2][1], Rot[1][2]);
+     maxwell_sym_matrix_rotate(meps, meps, Rot); /* rotate back */
+#undef SWAP
+
+     return 1;
+}
+
 /**************************************************************************/
 
 #define epsilon_CURFIELD_TYPE 'n'
@@ -114,10 +700,343 @@ static int has_mu(medium_func_data *d)
 
 /**************************************************************************/
 
+/* To recompute eps_inv only where the medium has changed (e.g. when a
+   parameter sweep or a material-grid optimization changes only one
+   object, or a few grid values), we keep a copy of the geometry, and
+   of the material-grid values, from the previous reset_epsilon.  The
+   "dirty" regions are then the bounding boxes (before and after) of
+   the objects that differ, and the parts of material-grid objects
+   whose grid values differ.  If anything else that determines eps_inv
+   has changed (the lattice, geometry-center, ensure-periodicity,
+   resolution, mesh-size, default material, ...), or if the medium
+   depends on a material function or an input file (whose changes we
+   cannot detect), everything is recomputed. */
+
+typedef struct {
+     geometric_object_list geometry;
+     double **matgrid_vals; /* values of each object's material grid */
+     material_type default_material;
+     double *default_matgrid_vals;
+     matrix3x3 Rm, basis;
+     vector3 size, center;
+     int nx, ny, nz, mesh_size, dimensions, has_mu, ensure_periodicity;
+} medium_state;
+
+static medium_state prev_medium;
+static int have_prev_medium = 0;
+
+static geom_box *dirty_boxes = NULL;
+static int num_dirty_boxes = 0, num_dirty_alloc = 0;
+
+/* the mdata whose eps_inv and mu_inv are those for prev_medium, or the
+   eps_inv and mu_inv arrays of a destroyed mdata (see keep_epsilon) */
+static maxwell_data *medium_mdata = NULL;
+static symmetric_matrix *kept_eps_inv = NULL, *kept_mu_inv = NULL;
+static int kept_nx, kept_ny, kept_nz, kept_fft_output_size;
+
+/* Return a copy of the grid values of m, or NULL if m is not a material
+   grid.  The grid is also protected from garbage collection, since we
+   keep a reference to it. */
+static double *get_matgrid_vals(const material_type *m)
+{
+     material_grid *g;
+     double *vals;
+     if (m->which_subclass != MATERIAL_GRID)
+	  return NULL;
+     g = m->subclass.material_grid_data;
+     scm_gc_protect_object(g->matgrid);
+     CHK_MALLOC(vals, double, material_grids_ntot(g, 1));
+     material_grids_get(vals, g, 1);
+     return vals;
+}
+
+static void destroy_matgrid_vals(const material_type *m, double *vals)
+{
+     if (vals) {
+	  scm_gc_unprotect_object(m->subclass.material_grid_data->matgrid);
+	  free(vals);
+     }
+}
+
+static void save_medium_state(medium_state *ms, int mu)
+{
+     int i;
+     ms->geometry.num_items = geometry.num_items;
+     CHK_MALLOC(ms->geometry.items, geometric_object, geometry.num_items);
+     CHK_MALLOC(ms->matgrid_vals, double *, geometry.num_items);
+     for (i = 0; i < geometry.num_items; ++i) {
+	  geometric_object_copy(geometry.items + i, ms->geometry.items + i);
+	  ms->matgrid_vals[i] = get_matgrid_vals(&geometry.items[i].material);
+     }
+     material_type_copy(&default_material, &ms->default_material);
+     ms->default_matgrid_vals = get_matgrid_vals(&default_material);
+     ms->Rm = Rm;
+     ms->basis = geometry_lattice.basis;
+     ms->size = geometry_lattice.size;
+     ms->center = geometry_center;
+     ms->ensure_periodicity = ensure_periodicity;
+     ms->nx = mdata->nx; ms->ny = mdata->ny; ms->nz = mdata->nz;
+     ms->mesh_size = mesh_size;
+     ms->dimensions = dimensions;
+     ms->has_mu = mu;
+}
+
+static void destroy_medium_state(medium_state *ms)
+{
+     int i;
+     for (i = 0; i < ms->geometry.num_items; ++i) {
+	  destroy_matgrid_vals(&ms->geometry.items[i].material,
+			       ms->matgrid_vals[i]);
+	  geometric_object_destroy(ms->geometry.items[i]);
+     }
+     free(ms->geometry.items);
+     free(ms->matgrid_vals);
+     destroy_matgrid_vals(&ms->default_material, ms->default_matgrid_vals);
+     material_type_destroy(ms->default_material);
+}
+
+static int grid_vals_equal(const double *vals1, const double *vals2, int n)
+{
+     int i;
+     for (i = 0; i < n; ++i)
+	  if (vals1[i] != vals2[i])
+	       return 0;
+     return 1;
+}
+
+/* Return whether the medium depends on anything besides ms, i.e. on a
+   material function or an input file. */
+static int medium_unknown(const medium_state *ms, medium_func_data *d)
+{
+     int i;
+     if (d->epsilon_file_func || d->mu_file_func ||
+	 ms->default_material.which_subclass == MATERIAL_FUNCTION)
+	  return 1;
+     for (i = 0; i < ms->geometry.num_items; ++i)
+	  if (ms->geometry.items[i].material.which_subclass
+	      == MATERIAL_FUNCTION)
+	       return 1;
+     return 0;
+}
+
+static void add_dirty_box(const geom_box *b)
+{
+     if (num_dirty_boxes == num_dirty_alloc) {
+	  num_dirty_alloc = num_dirty_alloc * 2 + 8;
+	  dirty_boxes = (geom_box *) realloc(dirty_boxes, sizeof(geom_box)
+					     * num_dirty_alloc);
+	  CHECK(dirty_boxes, "out of memory");
+     }
+     dirty_boxes[num_dirty_boxes++] = *b;
+}
+
+static void add_dirty_object(geometric_object o)
+{
+     geom_box b;
+     geom_get_bounding_box(o, &b);
+     add_dirty_box(&b);
+}
+
+/* Add the dirty box for the material-grid object o, whose grid values
+   have changed from vals0 to vals.  Since the grid is linearly
+   interpolated, each changed value affects its neighboring cells as
+   well.  For blocks, we can bound the region of the changed cells,
+   mapping the block's [0,1]^3 grid coordinates back to the lattice;
+   for other shapes, we just take the whole bounding box. */
+static void add_dirty_matgrid(const geometric_object *o,
+			      const double *vals0, const double *vals)
+{
+     material_grid *g = o->material.subclass.material_grid_data;
+     int n[3], lo[3], hi[3], i, j, ntot;
+     geom_box b, bb;
+
+     n[0] = g->size.x; n[1] = g->size.y; n[2] = g->size.z;
+     ntot = n[0] * n[1] * n[2];
+     lo[0] = n[0]; lo[1] = n[1]; lo[2] = n[2];
+     hi[0] = hi[1] = hi[2] = -1;
+     for (i = 0; i < ntot; ++i)
+	  if (vals0[i] != vals[i]) {
+	       int x = i / (n[1] * n[2]), y = (i / n[2]) % n[1], z = i % n[2];
+	       lo[0] = MIN2(lo[0], x); hi[0] = MAX2(hi[0], x);
+	       lo[1] = MIN2(lo[1], y); hi[1] = MAX2(hi[1], y);
+	       lo[2] = MIN2(lo[2], z); hi[2] = MAX2(hi[2], z);
+	  }
+     if (hi[0] < 0)
+	  return; /* unchanged */
+
+     geom_get_bounding_box(*o, &bb);
+     if (o->which_subclass != BLOCK) {
+	  add_dirty_box(&bb);
+	  return;
+     }
+
+     b.low = b.high = o->center;
+     for (i = 0; i < 3; ++i) {
+	  block *blk = o->subclass.block_data;
+	  vector3 e = i == 0 ? blk->e1 : (i == 1 ? blk->e2 : blk->e3);
+	  double s = i == 0 ? blk->size.x : (i == 1 ? blk->size.y
+					      : blk->size.z);
+	  double ulo = MAX2(0.0, (lo[i] - 1.0) / n[i]) - 0.5;
+	  double uhi = MIN2(1.0, (hi[i] + 2.0) / n[i]) - 0.5;
+	  for (j = 0; j < 3; ++j) {
+	       double c = j == 0 ? e.x : (j == 1 ? e.y : e.z);
+	       double v1 = c * s * ulo, v2 = c * s * uhi;
+	       double *low = j == 0 ? &b.low.x : (j == 1 ? &b.low.y
+						   : &b.low.z);
+	       double *high = j == 0 ? &b.high.x : (j == 1 ? &b.high.y
+						     : &b.high.z);
+	       *low += MIN2(v1, v2);
+	       *high += MAX2(v1, v2);
+	  }
+     }
+     /* clip to the bounding box: */
+     b.low.x = MAX2(b.low.x, bb.low.x);
+     b.low.y = MAX2(b.low.y, bb.low.y);
+     b.low.z = MAX2(b.low.z, bb.low.z);
+     b.high.x = MIN2(b.high.x, bb.high.x);
+     b.high.y = MIN2(b.high.y, bb.high.y);
+     b.high.z = MIN2(b.high.z, bb.high.z);
+     add_dirty_box(&b);
+}
+
+/* Compare the current medium with that of the previous call, setting
+   dirty_boxes to the regions where it has changed, and save it for the
+   next call.  Returns 0 if everything must be recomputed. */
+static int find_dirty_boxes(medium_func_data *d, int mu)
+{
+     medium_state ms;
+     int i, incremental;
+
+     save_medium_state(&ms, mu);
+     num_dirty_boxes = 0;
+
+     incremental = (have_prev_medium &&
+		    !medium_unknown(&ms, d) &&
+		    !medium_unknown(&prev_medium, d) &&
+		    ms.nx == prev_medium.nx && ms.ny == prev_medium.ny &&
+		    ms.nz == prev_medium.nz &&
+		    ms.mesh_size == prev_medium.mesh_size &&
+		    ms.dimensions == prev_medium.dimensions &&
+		    ms.has_mu == prev_medium.has_mu &&
+		    ms.ensure_periodicity == prev_medium.ensure_periodicity &&
+		    matrix3x3_equal(ms.Rm, prev_medium.Rm) &&
+		    matrix3x3_equal(ms.basis, prev_medium.basis) &&
+		    vector3_equal(ms.size, prev_medium.size) &&
+		    vector3_equal(ms.center, prev_medium.center) &&
+		    material_type_equal(&ms.default_material,
+					&prev_medium.default_material) &&
+		    (!ms.default_matgrid_vals ||
+		     grid_vals_equal(ms.default_matgrid_vals,
+				     prev_medium.default_matgrid_vals,
+				     material_grids_ntot(
+					  ms.default_material.subclass
+					  .material_grid_data, 1))));
+
+     for (i = 0; incremental && i < ms.geometry.num_items; ++i) {
+	  const geometric_object *o = ms.geometry.items + i;
+	  if (i >= prev_medium.geometry.num_items)
+	       add_dirty_object(*o);
+	  else if (!geometric_object_equal(o, prev_medium.geometry.items + i)) {
+	       add_dirty_object(*o);
+	       add_dirty_object(prev_medium.geometry.items[i]);
+	  }
+	  else if (ms.matgrid_vals[i])
+	       add_dirty_matgrid(o, prev_medium.matgrid_vals[i],
+				 ms.matgrid_vals[i]);
+     }
+     for (; incremental && i < prev_medium.geometry.num_items; ++i)
+	  add_dirty_object(prev_medium.geometry.items[i]);
+
+     if (have_prev_medium)
+	  destroy_medium_state(&prev_medium);
+     prev_medium = ms;
+     have_prev_medium = 1;
+     return incremental;
+}
+
+static int intervals_intersect(double low, double high,
+			       double dlow, double dhigh,
+			       double size, int no_size)
+{
+     if (no_size)
+	  return (low <= dhigh && dlow <= high);
+     /* is there an integer n with low <= dhigh + n*size
+	and dlow + n*size <= high? */
+     return (ceil((low - dhigh) / size) <= floor((high - dlow) / size));
+}
+
+/* Passed to set_maxwell_dielectric2 (and set_maxwell_mu2) as its
+   "changed" function: the medium may have changed in the box if it
+   intersects a periodic image of a dirty box. */
+static int changed_medium_func(const real rmin[3], const real rmax[3],
+			       void *edata)
+{
+     geom_box b;
+     int i;
+     (void) edata;
+     get_lattice_box(&b, rmin, rmax);
+     for (i = 0; i < num_dirty_boxes; ++i) {
+	  const geom_box *db = dirty_boxes + i;
+	  if (intervals_intersect(b.low.x, b.high.x, db->low.x, db->high.x,
+				  geometry_lattice.size.x, no_size_x) &&
+	      intervals_intersect(b.low.y, b.high.y, db->low.y, db->high.y,
+				  geometry_lattice.size.y, no_size_y) &&
+	      intervals_intersect(b.low.z, b.high.z, db->low.z, db->high.z,
+				  geometry_lattice.size.z, no_size_z))
+	       return 1;
+     }
+     return 0;
+}
+
+static void free_kept_eps_inv(void)
+{
+     free(kept_eps_inv); kept_eps_inv = NULL;
+     free(kept_mu_inv); kept_mu_inv = NULL;
+}
+
+/* Called before mdata is destroyed (by init_params), to keep its eps_inv
+   and mu_inv for the next reset_epsilon to update, if the new mdata
+   has the same grid. */
+void keep_epsilon(void)
+{
+     if (!mdata || mdata != medium_mdata)
+	  return;
+     free_kept_eps_inv();
+     kept_eps_inv = mdata->eps_inv; mdata->eps_inv = NULL;
+     kept_mu_inv = mdata->mu_inv; mdata->mu_inv = NULL;
+     kept_nx = mdata->nx; kept_ny = mdata->ny; kept_nz = mdata->nz;
+     kept_fft_output_size = mdata->fft_output_size;
+     medium_mdata = NULL;
+}
+
+/* Make mdata->eps_inv (and mu_inv, if mu) hold the result of the
+   previous reset_epsilon, if possible, returning whether it does. */
+static int restore_eps_inv(int mu)
+{
+     if (mdata == medium_mdata)
+	  return 1;
+     if (!kept_eps_inv || (mu && !kept_mu_inv) ||
+	 kept_nx != mdata->nx || kept_ny != mdata->ny ||
+	 kept_nz != mdata->nz ||
+	 kept_fft_output_size != mdata->fft_output_size)
+	  return 0;
+     free(mdata->eps_inv);
+     mdata->eps_inv = kept_eps_inv; kept_eps_inv = NULL;
+     if (mu) {
+	  free(mdata->mu_inv);
+	  mdata->mu_inv = kept_mu_inv; kept_mu_inv = NULL;
+     }
+     return 1;
+}
+
+/**************************************************************************/
+
 void reset_epsilon(void)
 {
      medium_func_data d;
      int mesh[3];
+     int threadsafe = medium_threadsafe(), mu, incremental;
+     maxwell_dielectric_changed_function changed;
 
      mesh[0] = mesh_size;
      mesh[1] = (dimensions > 1) ? mesh_size : 1;
@@ -127,14 +1046,30 @@ void reset_epsilon(void)
 			   &d.epsilon_file_func, &d.epsilon_file_func_data);
      get_epsilon_file_func(mu_input_file,
                            &d.mu_file_func, &d.mu_file_func_data);
-     mpi_one_printf("Initializing epsilon function...\n");
-     set_maxwell_dielectric(mdata, mesh, R, G, 
-			    epsilon_func, mean_epsilon_func, &d);
-     if (has_mu(&d)) {
+     mu = has_mu(&d);
+     incremental = find_dirty_boxes(&d, mu) && restore_eps_inv(mu);
+     free_kept_eps_inv();
+     changed = incremental ? changed_medium_func : NULL;
+     if (incremental)
+	  mpi_one_printf("Updating epsilon function in %d changed "
+			 "region%s...\n", num_dirty_boxes,
+			 num_dirty_boxes == 1 ? "" : "s");
+     else
+	  mpi_one_printf("Initializing epsilon function...\n");
+     load_native_materials();
+     init_overlap_cache();
+     set_maxwell_dielectric2(mdata, mesh, R, G, 
+			     epsilon_func, epsilon_batch_func,
+			     mean_epsilon_func,
+			     uniform_epsilon_func, changed, threadsafe, &d);
+     if (mu) {
          mpi_one_printf("Initializing mu function...\n");
-         set_maxwell_mu(mdata, mesh, R, G, 
-                        mu_func, mean_mu_func, &d);
+         set_maxwell_mu2(mdata, mesh, R, G, 
+                         mu_func, mu_batch_func, mean_mu_func,
+                         uniform_mu_func, changed, threadsafe, &d);
      }
+     destroy_overlap_cache();
+     medium_mdata = mdata;
      destroy_epsilon_file_func_data(d.epsilon_file_func_data);
      destroy_epsilon_file_func_data(d.mu_file_func_data);
 }
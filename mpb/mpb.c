@@ -109,6 +109,11 @@ void ctl_start_hook(int *argc, char ***argv)
 	  omp_set_num_threads(nthread);
 	  CHECK(FFTW(init_threads)(), "error initializing threaded FFTW");
 	  FFTW(plan_with_nthreads)(nthread);
+#  if defined(HAVE_MIXED_PRECISION_FFT) && defined(HAVE_LIBFFTW3F_OMP)
+	  /* single-precision FFTs for mixed-precision? */
+	  CHECK(fftwf_init_threads(), "error initializing threaded FFTW");
+	  fftwf_plan_with_nthreads(nthread);
+#  endif
      }
 #endif
 
@@ -129,8 +134,20 @@ void ctl_start_hook(int *argc, char ***argv)
 #endif
 }
 
+/* Save any newly-measured FFTW plans to the fft-wisdom-file, if any,
+   so that later runs on the same grid can skip the planning. */
+static void export_fft_wisdom(void)
+{
+     if (mdata && fft_wisdom_file && fft_wisdom_file[0]) {
+	  char *fname = maxwell_fft_wisdom_filename(mdata, fft_wisdom_file);
+	  maxwell_export_fft_wisdom(mdata, fname);
+	  free(fname);
+     }
+}
+
 void ctl_stop_hook(void)
 {
+     export_fft_wisdom();
 #ifdef HAVE_FFTW3_MPI
      FFTW(mpi_cleanup)();
 #endif
@@ -243,6 +260,24 @@ char curfield_type = '-';
 
 void curfield_reset(void) { curfield = NULL; curfield_type = '-'; }
 
+/* for extrapolate-kpoints?: the solution at the k point before
+   cur_kvector, and the number of k points (0, 1, or 2) for which H
+   and Hprev hold converged solutions (see extrapolate_kpoint_fields) */
+static evectmatrix Hprev;
+static vector3 prev_kvector;
+static int num_prev_kpoints = 0;
+
+/* for kp-interpolation-tolerance: the k.p data of the last k point
+   that we solved for (see kp_interpolate_kpoint) */
+static maxwell_kp_data *kpdata = NULL;
+
+void reset_kpoint_history(void)
+{
+     num_prev_kpoints = 0;
+     destroy_maxwell_kp_data(kpdata);
+     kpdata = NULL;
+}
+
 /* R[i]/G[i] are lattice/reciprocal-lattice vectors */
 real R[3][3], G[3][3];
 matrix3x3 Rm, Gm; /* same thing, but matrix3x3 */
@@ -292,6 +327,7 @@ void randomize_fields(void)
      if (!mdata)
 	  return;
      mpi_one_printf("Initializing fields to random numbers...\n");
+     reset_kpoint_history();
      for (i = 0; i < H.n * H.p; ++i) {
 	  ASSIGN_SCALAR(H.data[i], rand() * 1.0 / RAND_MAX,
 			rand() * 1.0 / RAND_MAX);
@@ -364,6 +400,209 @@ void set_parity(integer p)
 
 /**************************************************************************/
 
+/* Autotuning of the block size and of the number of bands per FFT
+   (max_fft_bands), enabled by the autotune-block-size? input variable.
+   Instead of modeling the machine (cache sizes, threads, MPI layout),
+   we just time the kernels whose cost depends on these parameters, the
+   Maxwell operator and the block dot products (XtY), on the actual
+   grid, and pick the block size that minimizes the predicted time per
+   converged band.  The result is remembered for subsequent init-params
+   calls with the same grid and number of bands, and is saved alongside
+   the FFTW wisdom if there is an fft-wisdom-file. */
+
+static int fft_bands = NUM_FFT_BANDS; /* max. number of bands per FFT */
+
+static int tuned_nx = 0, tuned_ny = 0, tuned_nz = 0, tuned_num_bands = 0;
+static int tuned_block_size, tuned_fft_bands;
+
+#define MAX_TUNE_CANDIDATES 16
+
+/* Return a newly malloc'ed filename for saving the tuning results,
+   with the same suffixes as the FFTW wisdom file (whose name is
+   based on the grid size, precision, and threads/processes). */
+static char *block_size_tuning_filename(void)
+{
+     char *wname = maxwell_fft_wisdom_filename(mdata, fft_wisdom_file);
+     char *fname;
+     int len = strlen(wname) - strlen(".wisdom");
+
+     CHK_MALLOC(fname, char, len + 64);
+     strncpy(fname, wname, len);
+     sprintf(fname + len, "-%db.blocksize", num_bands);
+     free(wname);
+     return fname;
+}
+
+/* Return the (max over processes) time in seconds for the best
+   of a few calls of the Maxwell operator on p bands, with at most
+   nfft bands per FFT.  X and Y must have at least p columns. */
+static double time_maxwell_operator(evectmatrix X, evectmatrix Y,
+				    int p, int nfft)
+{
+     double t, tbest = 0;
+     int i;
+
+     evectmatrix_resize(&X, p, 0);
+     evectmatrix_resize(&Y, p, 0);
+     maxwell_set_max_fft_bands(mdata, nfft);
+     maxwell_set_num_bands(mdata, p);
+     for (i = 0; i < 3; ++i) { /* first call is warm-up (FFT planning) */
+	  mpiglue_clock_t start = MPIGLUE_CLOCK;
+	  maxwell_operator(X, Y, (void *) mdata, 0, Y);
+	  t = MPIGLUE_CLOCK_DIFF(MPIGLUE_CLOCK, start);
+	  if (i == 1 || (i > 1 && t < tbest))
+	       tbest = t;
+     }
+     mpi_allreduce(&tbest, &t, 1, double, MPI_DOUBLE, MPI_MAX, mpb_comm);
+     return t;
+}
+
+/* Like time_maxwell_operator, but for evectmatrix_XtY on p bands. */
+static double time_XtY(evectmatrix X, evectmatrix Y, int p)
+{
+     sqmatrix U, S;
+     double t, tbest = 0;
+     int i;
+
+     evectmatrix_resize(&X, p, 0);
+     evectmatrix_resize(&Y, p, 0);
+     U = create_sqmatrix(p);
+     S = create_sqmatrix(p);
+     for (i = 0; i < 3; ++i) {
+	  mpiglue_clock_t start = MPIGLUE_CLOCK;
+	  evectmatrix_XtY(U, X, Y, S);
+	  t = MPIGLUE_CLOCK_DIFF(MPIGLUE_CLOCK, start);
+	  if (i == 1 || (i > 1 && t < tbest))
+	       tbest = t;
+     }
+     destroy_sqmatrix(S);
+     destroy_sqmatrix(U);
+     mpi_allreduce(&tbest, &t, 1, double, MPI_DOUBLE, MPI_MAX, mpb_comm);
+     return t;
+}
+
+/* Choose *block_size and *nfft for num_bands bands by timing; must be
+   called after the dielectric function is initialized. */
+static void autotune_block_size(int *block_size, int *nfft)
+{
+     evectmatrix X, Y;
+     int cand[MAX_TUNE_CANDIDATES], ncand = 0, nblocks, i, j, f;
+     double t, tbest = 0, cost, cost_best = 0;
+     real k[3] = {0, 0, 0};
+
+     mpi_one_printf("Autotuning block size...\n");
+     X = create_evectmatrix(mdata->N, 2, num_bands,
+			    mdata->local_N, mdata->N_start, mdata->alloc_N);
+     Y = create_evectmatrix(mdata->N, 2, num_bands,
+			    mdata->local_N, mdata->N_start, mdata->alloc_N);
+     for (i = 0; i < X.n * X.p; ++i) /* arbitrary, but don't touch rand() */
+	  ASSIGN_SCALAR(X.data[i], (i % 7) * 0.1, (i % 11) * 0.1);
+     if (k_points.num_items > 0)
+	  vector3_to_arr(k, k_points.items[0]);
+     update_maxwell_data_k(mdata, k, G[0], G[1], G[2]);
+
+     /* the number of bands per FFT hardly depends on the block size
+	(as long as it is at most the block size), so tune it first,
+	using the largest block: */
+     *nfft = 1;
+     for (f = 1; f <= num_bands && f <= 64; f *= 2) {
+	  t = time_maxwell_operator(X, Y, num_bands, f);
+	  if (f == 1 || t < tbest) {
+	       tbest = t;
+	       *nfft = f;
+	  }
+     }
+
+     /* candidate block sizes, chosen so that all the blocks are nearly
+	equal in size (as for negative eigensolver-block-size): */
+     for (nblocks = 1; nblocks <= num_bands && ncand < MAX_TUNE_CANDIDATES;
+	  nblocks = nblocks < 4 ? nblocks + 1 : (nblocks * 3) / 2) {
+	  int b = (num_bands + nblocks - 1) / nblocks;
+	  if (ncand == 0 || b != cand[ncand - 1])
+	       cand[ncand++] = b;
+     }
+
+     /* Each iteration (for the default eigensolver) costs about two
+	operator applications (A and the preconditioner) and six block
+	dot products, plus two dot products with each previous block for
+	the deflation; we assume that the number of iterations does
+	not depend much on the block size. */
+     *block_size = num_bands;
+     for (i = 0; i < ncand; ++i) {
+	  int b = cand[i];
+	  double t_op = time_maxwell_operator(X, Y, b, MIN2(*nfft, b));
+	  double t_XtY = time_XtY(X, Y, b);
+	  nblocks = (num_bands + b - 1) / b;
+	  cost = 0;
+	  for (j = 0; j < nblocks; ++j)
+	       cost += 2 * t_op + (6 + 2 * j) * t_XtY;
+	  cost /= num_bands;
+	  mpi_one_printf("    block size %d: %g s/band/iteration\n", b, cost);
+	  if (i == 0 || cost < cost_best) {
+	       cost_best = cost;
+	       *block_size = b;
+	  }
+     }
+
+     destroy_evectmatrix(Y);
+     destroy_evectmatrix(X);
+}
+
+/* Set *block_size and fft_bands from the saved or newly computed
+   tuning results, resizing mdata accordingly. */
+static void get_tuned_block_size(int *block_size)
+{
+     if (tuned_nx != mdata->nx || tuned_ny != mdata->ny ||
+	 tuned_nz != mdata->nz || tuned_num_bands != num_bands) {
+	  int ok = 0, bs[2] = {0, 0};
+	  char *fname = NULL;
+
+	  if (fft_wisdom_file && fft_wisdom_file[0]) {
+	       fname = block_size_tuning_filename();
+	       if (mpi_is_master()) {
+		    FILE *f = fopen(fname, "r");
+		    if (f) {
+			 ok = fscanf(f, "%d %d", bs, bs + 1) == 2
+			      && bs[0] > 0 && bs[0] <= num_bands && bs[1] > 0;
+			 fclose(f);
+		    }
+	       }
+	       MPI_Bcast(&ok, 1, MPI_INT, 0, mpb_comm);
+	       MPI_Bcast(bs, 2, MPI_INT, 0, mpb_comm);
+	  }
+	  if (ok)
+	       mpi_one_printf("Read block-size tuning from %s\n", fname);
+	  else {
+	       autotune_block_size(bs, bs + 1);
+	       if (fname && mpi_is_master()) {
+		    FILE *f = fopen(fname, "w");
+		    if (f) {
+			 fprintf(f, "%d %d\n", bs[0], bs[1]);
+			 fclose(f);
+		    }
+		    else
+			 mpi_one_fprintf(stderr, "WARNING: could not write "
+					 "block-size tuning file %s\n", fname);
+	       }
+	  }
+	  free(fname);
+
+	  tuned_nx = mdata->nx; tuned_ny = mdata->ny; tuned_nz = mdata->nz;
+	  tuned_num_bands = num_bands;
+	  tuned_block_size = bs[0];
+	  tuned_fft_bands = bs[1];
+     }
+
+     *block_size = tuned_block_size;
+     fft_bands = tuned_fft_bands;
+     maxwell_set_max_fft_bands(mdata, MIN2(*block_size, fft_bands));
+     maxwell_set_num_bands(mdata, *block_size);
+     mpi_one_printf("Autotuned: solving for %d bands at a time, "
+		    "with FFTs of up to %d bands.\n", *block_size, fft_bands);
+}
+
+/**************************************************************************/
+
 /* Guile-callable function: init-params, which initializes any data
    that we need for the eigenvalue calculation.  When this function
    is called, the input variables (the geometry, etcetera) have already
@@ -376,12 +615,23 @@ void set_parity(integer p)
    If reset_fields is false, then any fields from a previous run are
    retained if they are of the same dimensions.  Otherwise, new
    fields are allocated and initialized to random numbers. */
+
+/* number of workspace matrices to allocate for the eigensolver */
+static int eigensolver_nwork_alloc(int using_mu)
+{
+     if (eigensolver_lobpcgp) /* needs X, W, P and their images */
+	  return eigensolver_nwork > 6 + 3*using_mu ?
+	       eigensolver_nwork : 6 + 3*using_mu;
+     return eigensolver_nwork + using_mu;
+}
+
 void init_params(integer p, boolean reset_fields)
 {
      int i, local_N, N_start, alloc_N;
      int nx, ny, nz;
      int have_old_fields = 0;
      int block_size;
+     int autotune;
      
      /* Output a bunch of stuff so that the user can see what we're
 	doing and what we've read in. */
@@ -417,7 +667,22 @@ void init_params(integer p, boolean reset_fields)
      mpi_one_printf("Working in %d dimensions.\n", dimensions);
      mpi_one_printf("Grid size is %d x %d x %d.\n", nx, ny, nz);
 
-     if (eigensolver_block_size != 0 && eigensolver_block_size < num_bands) {
+     autotune = autotune_block_sizep && eigensolver_chebyshev_degree <= 0
+	  && num_bands > 1;
+     if (!autotune)
+	  fft_bands = NUM_FFT_BANDS;
+
+     if (eigensolver_chebyshev_degree > 0) {
+	  /* Chebyshev filtering solves for all the bands at once */
+	  block_size = num_bands;
+	  mpi_one_printf("Using Chebyshev-filtered subspace iteration "
+			 "(degree %d).\n", eigensolver_chebyshev_degree);
+     }
+     else if (autotune && nx == tuned_nx && ny == tuned_ny && nz == tuned_nz
+	      && num_bands == tuned_num_bands)
+	  block_size = tuned_block_size; /* tuned in a previous call */
+     else if (eigensolver_block_size != 0 &&
+	      eigensolver_block_size < num_bands) {
 	  block_size = eigensolver_block_size;
 	  if (block_size < 0) {
 	       /* Guess a block_size near -block_size, chosen so that
@@ -433,7 +698,7 @@ void init_params(integer p, boolean reset_fields)
      if (mdata) {  /* need to clean up from previous init_params call */
 	  if (nx == mdata->nx && ny == mdata->ny && nz == mdata->nz &&
 	      block_size == Hblock.alloc_p && num_bands == H.p &&
-	      eigensolver_nwork + (mdata->mu_inv!=NULL) == nwork_alloc)
+	      eigensolver_nwork_alloc(mdata->mu_inv!=NULL) == nwork_alloc)
 	       have_old_fields = 1; /* don't need to reallocate */
 	  else {
 	       destroy_evectmatrix(H);
@@ -445,6 +710,12 @@ void init_params(integer p, boolean reset_fields)
                    destroy_evectmatrix(muinvH);                   
 	  }
 	  destroy_maxwell_target_data(mtdata); mtdata = NULL;
+	  if (Hprev.data) {
+	       destroy_evectmatrix(Hprev);
+	       Hprev.data = NULL;
+	  }
+	  export_fft_wisdom();
+	  keep_epsilon(); /* for reset_epsilon to update, if possible */
 	  destroy_maxwell_data(mdata); mdata = NULL;
 	  curfield_reset();
      }
@@ -461,9 +732,17 @@ void init_params(integer p, boolean reset_fields)
 
      mpi_one_printf("Creating Maxwell data...\n");
      mdata = create_maxwell_data(nx, ny, nz, &local_N, &N_start, &alloc_N,
-                                 block_size, NUM_FFT_BANDS);
+                                 block_size, fft_bands);
      CHECK(mdata, "NULL mdata");
 
+     maxwell_set_fft_planner_effort(mdata, fft_planner_effort);
+     if (fft_wisdom_file && fft_wisdom_file[0]) {
+	  char *fname = maxwell_fft_wisdom_filename(mdata, fft_wisdom_file);
+	  if (maxwell_import_fft_wisdom(fname))
+	       mpi_one_printf("Imported FFTW wisdom from %s\n", fname);
+	  free(fname);
+     }
+
      if (target_freq != 0.0)
 	  mtdata = create_maxwell_target_data(mdata, target_freq);
      else
@@ -471,11 +750,40 @@ void init_params(integer p, boolean reset_fields)
 
      init_epsilon();
 
-     if (!have_old_fields) {
-	  mpi_one_printf("Allocating fields...\n");
-	  H = create_evectmatrix(nx * ny * nz, 2, num_bands,
-				 local_N, N_start, alloc_N);
-	  nwork_alloc = eigensolver_nwork + (mdata->mu_inv!=NULL);
+     if (autotune)
+	  get_tuned_block_size(&block_size);
+
+     if (mixed_precisionp) {
+	  /* check availability only, independent of the parity (for which
+	     maxwell_set_mixed_precision may also return 0): */
+	  int prev_parity = mdata->parity;
+	  mdata->parity = NO_PARITY;
+	  if (!maxwell_set_mixed_precision(mdata, 1))
+	       mpi_one_printf("Warning: mixed-precision? requires FFTW3 "
+			      "with single-precision libfftw3f (and "
+			      "libfftw3f_omp with OpenMP), and is not "
+			      "supported with MPI or mu; ignoring it.\n");
+	  maxwell_set_mixed_precision(mdata, 0);
+	  mdata->parity = prev_parity;
+     }
+
+     if (have_old_fields && block_size != Hblock.alloc_p) {
+	  /* autotuning changed the block size: keep the old H, but
+	     reallocate the other fields */
+	  for (i = 0; i < nwork_alloc; ++i)
+	       destroy_evectmatrix(W[i]);
+	  if (Hblock.data != H.data)
+	       destroy_evectmatrix(Hblock);
+	  if (muinvH.data != H.data)
+	       destroy_evectmatrix(muinvH);
+     }
+     if (!have_old_fields || block_size != Hblock.alloc_p) {
+	  if (!have_old_fields) {
+	       mpi_one_printf("Allocating fields...\n");
+	       H = create_evectmatrix(nx * ny * nz, 2, num_bands,
+				      local_N, N_start, alloc_N);
+	  }
+	  nwork_alloc = eigensolver_nwork_alloc(mdata->mu_inv!=NULL);
 	  for (i = 0; i < nwork_alloc; ++i)
 	       W[i] = create_evectmatrix(nx * ny * nz, 2, block_size,
 					 local_N, N_start, alloc_N);
@@ -499,6 +807,7 @@ void init_params(integer p, boolean reset_fields)
 			 k_points.items[i].y, k_points.items[i].z);
 
      set_parity(p);
+     reset_kpoint_history(); /* old fields are for a different epsilon */
      if (!have_old_fields || reset_fields)
 	  randomize_fields();
 
@@ -534,6 +843,7 @@ typedef struct {
 			itself be normalized (Yt B Y = 1) */
      evectmatrix BY;  /* B * Y */
      int p;  /* the number of columns of Y to orthogonalize against */
+     int BY_p;  /* the number of columns of BY that are up-to-date */
      scalar *S;  /* a matrix for storing the dot products; should have
 		    at least p * X.p elements (see below for X) */
      scalar *S2; /* a scratch matrix the same size as S */
@@ -565,8 +875,208 @@ static void deflation_constraint(evectmatrix X, void *data)
 		   1.0, X.data, X.p);
 }
 
+/* Make sure that the first p columns of d->BY = mu^-1 * Y are computed.
+   The lower bands don't change from one block to the next, so we only
+   need to apply the operator to the columns added since the last call. */
+static void deflation_update_BY(deflation_data *d, int p)
+{
+     int ib;
+
+     evectmatrix_resize(&d->BY, p, 1);
+     for (ib = d->BY_p; ib < p; ib += mdata->num_fft_bands)
+	  maxwell_compute_H_from_B(mdata, d->Y, d->BY,
+				   (scalar_complex *) mdata->fft_data,
+				   ib, ib, MIN2(mdata->num_fft_bands, p - ib));
+     d->BY_p = p;
+}
+
 /**************************************************************************/
 
+/* if this is the first k point, print out a header line for
+   for the frequency grep data: */
+static void print_freqs_header(void)
+{
+     int i;
+     if (!kpoint_index && mpi_is_master()) {
+	  printf("%sfreqs:, k index, k1, k2, k3, kmag/2pi",
+		 parity_string(mdata));
+	  for (i = 0; i < num_bands; ++i)
+	       printf(", %s%sband %d",
+		      parity_string(mdata),
+		      mdata->parity == NO_PARITY ? "" : " ",
+		      i + 1);
+	  printf("\n");
+     }
+}
+
+/* For extrapolate-kpoints?: before solving at kvector, given the
+   solutions H at cur_kvector and Hprev at prev_kvector, extrapolate H
+   linearly along the k path.  Hprev is first aligned with H by
+   projecting H onto its span, P = Hprev (Hprev'Hprev)^-1 Hprev'H,
+   which takes care of arbitrary phases and of band crossings (or any
+   other mixing within the subspace), and then H <- H + t (H - P),
+   where t is the ratio of the k-point spacings.  This is only done if
+   the three k points are collinear and in order (i.e. along a segment
+   of the k path, as from interpolate); otherwise, we just start from
+   the previous solution as usual.  Either way, Hprev is left holding
+   the old H. */
+static void extrapolate_kpoint_fields(vector3 kvector)
+{
+     vector3 d0, d1;
+     real t = 0;
+
+     if (!extrapolate_kpointsp)
+	  num_prev_kpoints = 0;
+     if (num_prev_kpoints == 0)
+	  return;
+
+     if (!Hprev.data)
+	  Hprev = create_evectmatrix(H.N, H.c, H.alloc_p,
+				     H.localN, H.Nstart, H.allocN);
+     CHECK(Hprev.p == H.p, "bug: Hprev has the wrong size");
+
+     d0 = vector3_minus(cur_kvector, prev_kvector);
+     d1 = vector3_minus(kvector, cur_kvector);
+     if (num_prev_kpoints == 2
+	 && vector3_norm(prev_kvector) > 1e-10
+	 && vector3_norm(cur_kvector) > 1e-10
+	 && vector3_norm(kvector) > 1e-10
+	 && vector3_norm(d0) > 0 && vector3_norm(d1) > 0
+	 && vector3_dot(d0, d1) > 0.999 * vector3_norm(d0) * vector3_norm(d1))
+	  t = vector3_norm(d1) / vector3_norm(d0);
+
+     if (t > 0 && t <= 2) {
+	  sqmatrix S, C, Sw;
+	  scalar *P;
+	  int p = H.p, r0, nr, i, nchunk = 1024;
+
+	  mpi_one_printf("Extrapolating fields from the last two k points.\n");
+	  S = create_sqmatrix(p);
+	  C = create_sqmatrix(p);
+	  Sw = create_sqmatrix(p);
+	  evectmatrix_XtX(S, Hprev, Sw);
+	  if (!sqmatrix_invert(S, 1, Sw)) {
+	       mpi_one_printf("Warning: singular fields at previous k point; "
+			      "not extrapolating.\n");
+	       destroy_sqmatrix(Sw); destroy_sqmatrix(C); destroy_sqmatrix(S);
+	       evectmatrix_copy(Hprev, H);
+	       prev_kvector = cur_kvector;
+	       return;
+	  }
+	  evectmatrix_XtY(Sw, Hprev, H, C);
+	  sqmatrix_AeBC(C, S, 0, Sw, 0);
+
+	  /* process the rows in chunks, so that P = Hprev C only needs
+	     a small scratch array: */
+	  CHK_MALLOC(P, scalar, nchunk * p);
+	  for (r0 = 0; r0 < H.n; r0 += nchunk) {
+	       nr = MIN2(nchunk, H.n - r0);
+	       blasglue_gemm('N', 'N', nr, p, p,
+			     1.0, Hprev.data + r0 * p, p, C.data, p,
+			     0.0, P, p);
+	       for (i = 0; i < nr * p; ++i) {
+		    scalar h = H.data[r0 * p + i];
+		    Hprev.data[r0 * p + i] = h;
+		    ASSIGN_SCALAR(H.data[r0 * p + i],
+				  (1 + t) * SCALAR_RE(h) - t * SCALAR_RE(P[i]),
+				  (1 + t) * SCALAR_IM(h) - t * SCALAR_IM(P[i]));
+	       }
+	  }
+	  free(P);
+	  destroy_sqmatrix(Sw);
+	  destroy_sqmatrix(C);
+	  destroy_sqmatrix(S);
+     }
+     else
+	  evectmatrix_copy(Hprev, H);
+     prev_kvector = cur_kvector;
+}
+
+/* Set the output variables for the bands at kvector, with eigenvalues
+   eigvals, that took iters iterations (summed over the bands) to find,
+   and print the frequencies. */
+static void set_kpoint_freqs(vector3 kvector, real *eigvals, int iters)
+{
+     int i;
+
+     if (num_write_output_vars > 0) {
+	  /* clean up from prev. call */
+         destroy_output_vars();
+     }
+
+     CHK_MALLOC(parity, char, strlen(parity_string(mdata)) + 1);
+     parity = strcpy(parity, parity_string(mdata));
+
+     iterations = iters; /* iterations output variable */
+
+     /* create freqs array for storing frequencies in a Guile list */
+     freqs.num_items = num_bands;
+     CHK_MALLOC(freqs.items, number, freqs.num_items);
+     
+     set_kpoint_index(kpoint_index + 1);
+
+     mpi_one_printf("%sfreqs:, %d, %g, %g, %g, %g",
+		    parity,
+		    kpoint_index, (double)kvector.x, (double)kvector.y,
+		    (double)kvector.z,
+		    vector3_norm(matrix3x3_vector3_mult(Gm, kvector)));
+     for (i = 0; i < num_bands; ++i) {
+	  freqs.items[i] =
+	       negative_epsilon_okp ? eigvals[i] : sqrt(eigvals[i]);
+	  mpi_one_printf(", %g", freqs.items[i]);
+     }
+     mpi_one_printf("\n");
+
+     eigensolver_flops = evectmatrix_flops;
+}
+
+/* If kp-interpolation-tolerance is positive, try to find the bands at
+   kvector by k.p interpolation from the last k point that we solved
+   for (see maxwell_kp.c), instead of with the eigensolver.  Returns 1
+   on success, after setting the output variables as in solve_kpoint,
+   and 0 if interpolation isn't possible or its estimated error is
+   larger than the tolerance; in the latter case, H is left holding
+   the interpolated bands, which are a good starting point for the
+   eigensolver. */
+static int kp_interpolate_kpoint(vector3 kvector)
+{
+     real k[3], err, *eigvals;
+     int prev_parity;
+
+     if (kp_interpolation_tolerance <= 0 || !kpdata || mtdata
+	 || vector3_norm(kvector) < 1e-10 || H.p + 1 != kpdata->H.p)
+	  return 0;
+
+     /* H will no longer be the solution at cur_kvector: */
+     num_prev_kpoints = 0;
+
+     prev_parity = mdata->parity;
+     cur_kvector = kvector;
+     vector3_to_arr(k, kvector);
+     update_maxwell_data_k(mdata, k, G[0], G[1], G[2]);
+     CHECK(mdata->parity == prev_parity,
+	   "k vector is incompatible with specified parity");
+
+     CHK_MALLOC(eigvals, real, num_bands);
+     err = maxwell_kp_interpolate(kpdata, mdata, H, eigvals);
+     if (err > kp_interpolation_tolerance) {
+	  mpi_one_printf("Estimated k.p interpolation error %g is too "
+			 "large; solving.\n", err);
+	  free(eigvals);
+	  return 0;
+     }
+     mpi_one_printf("Interpolated bands by k.p with estimated error %g.\n",
+		    err);
+     set_kpoint_freqs(kvector, eigvals, 0);
+     free(eigvals);
+     return 1;
+}
+
+/* relative tolerance that is reached in single precision before
+   switching to full precision, for the mixed-precision? input variable
+   (see maxwell_set_mixed_precision): */
+#define MIXED_PRECISION_TOLERANCE 1e-5
+
 /* Solve for the bands at a given k point.
    Must only be called after init_params! */
 void solve_kpoint(vector3 kvector)
@@ -577,6 +1087,8 @@ void solve_kpoint(vector3 kvector)
      int flags;
      deflation_data deflation;
      int prev_parity;
+     evectpreconditioner K;
+     void *Kdata;
 
      /* if we get too close to singular k==0 point, just set k=0
 	to exploit our special handling of this k */
@@ -599,18 +1111,12 @@ void solve_kpoint(vector3 kvector)
 	  return;
      }
 
-     /* if this is the first k point, print out a header line for
-	for the frequency grep data: */
-     if (!kpoint_index && mpi_is_master()) {
-	  printf("%sfreqs:, k index, k1, k2, k3, kmag/2pi",
-		 parity_string(mdata));
-	  for (i = 0; i < num_bands; ++i)
-	       printf(", %s%sband %d",
-		      parity_string(mdata),
-		      mdata->parity == NO_PARITY ? "" : " ",
-		      i + 1);
-	  printf("\n");
-     }
+     print_freqs_header();
+
+     if (kp_interpolate_kpoint(kvector))
+	  return;
+
+     extrapolate_kpoint_fields(kvector);
 
      prev_parity = mdata->parity;
      cur_kvector = kvector;
@@ -625,6 +1131,12 @@ void solve_kpoint(vector3 kvector)
      if (verbose)
 	  flags |= EIGS_VERBOSE;
 
+     /* preconditioner for the untargeted Maxwell operator: */
+     K = simple_preconditionerp ? maxwell_preconditioner
+	  : (local_eps_preconditionerp ? maxwell_preconditioner3
+	     : maxwell_preconditioner2);
+     Kdata = (void *) mdata;
+
      /* constant (zero frequency) bands at k=0 are handled specially,
         so remove them from the solutions for the eigensolver: */
      if (mdata->zero_k && !mtdata) {
@@ -643,13 +1155,16 @@ void solve_kpoint(vector3 kvector)
           deflation.Y = H;
           deflation.BY = muinvH.data != H.data ? muinvH : H;
 	  deflation.p = 0;
+	  deflation.BY_p = 0;
+	  if (deflation.BY.data != H.data)
+	       evectmatrix_resize(&deflation.BY, 0, 0);
 	  CHK_MALLOC(deflation.S, scalar, H.p * Hblock.p);
 	  CHK_MALLOC(deflation.S2, scalar, H.p * Hblock.p);
      }
 
      for (ib = ib0; ib < num_bands; ib += Hblock.alloc_p) {
 	  evectconstraint_chain *constraints;
-	  int num_iters;
+	  int num_iters, block_iters, mixed;
 
 	  /* don't solve for too many bands if the block size doesn't divide
 	     the number of bands: */
@@ -681,76 +1196,127 @@ void solve_kpoint(vector3 kvector)
 			      H.data[in * H.p + ip + (ib-ib0)];
 	       deflation.p = ib-ib0;
 	       if (deflation.p > 0) {
-                    if (deflation.BY.data != H.data) {
-                        evectmatrix_resize(&deflation.BY, deflation.p, 0);
-                        maxwell_muinv_operator(H, deflation.BY, (void *) mdata,
-                                               1, deflation.BY);
-                    }
+                    if (deflation.BY.data != H.data)
+			 deflation_update_BY(&deflation, deflation.p);
 		    constraints = evect_add_constraint(constraints,
 						       deflation_constraint,
 						       &deflation);
                }
 	  }
 
-	  if (mtdata) {  /* solving for bands near a target frequency */
-               CHECK(mdata->mu_inv==NULL, "targeted solver doesn't handle mu");
-               if (eigensolver_davidsonp)
-		    eigensolver_davidson(
-			 Hblock, eigvals + ib,
-			 maxwell_target_operator, (void *) mtdata,
-			 simple_preconditionerp ? 
-			 maxwell_target_preconditioner :
-			 maxwell_target_preconditioner2,
-			 (void *) mtdata,
-			 evectconstraint_chain_func,
-			 (void *) constraints,
-			 W, nwork_alloc, tolerance, &num_iters, flags, 0.0);
-	       else
-		    eigensolver(Hblock, eigvals + ib,
-				maxwell_target_operator, (void *) mtdata,
-                                NULL, NULL,
-				simple_preconditionerp ? 
-				maxwell_target_preconditioner :
-				maxwell_target_preconditioner2,
-				(void *) mtdata,
-				evectconstraint_chain_func,
-				(void *) constraints,
-				W, nwork_alloc, tolerance, &num_iters, flags);
-
-	       /* now, diagonalize the real Maxwell operator in the
-		  solution subspace to get the true eigenvalues and
-		  eigenvectors: */
-	       CHECK(nwork_alloc >= 2, "not enough workspace");
-	       eigensolver_get_eigenvals(Hblock, eigvals + ib,
-					 maxwell_operator,mdata, W[0],W[1]);
-	  }
-	  else {
-               if (eigensolver_davidsonp) {
-                    CHECK(mdata->mu_inv==NULL, "Davidson doesn't handle mu");
-		    eigensolver_davidson(
-			 Hblock, eigvals + ib,
-			 maxwell_operator, (void *) mdata,
-			 simple_preconditionerp ?
-			 maxwell_preconditioner :
-			 maxwell_preconditioner2,
-			 (void *) mdata,
-			 evectconstraint_chain_func,
-			 (void *) constraints,
-			 W, nwork_alloc, tolerance, &num_iters, flags, 0.0);
-               }
-	       else
-		    eigensolver(Hblock, eigvals + ib,
-				maxwell_operator, (void *) mdata,
-                                mdata->mu_inv ? maxwell_muinv_operator : NULL,
-                                (void *) mdata,
-				simple_preconditionerp ?
-				maxwell_preconditioner :
-				maxwell_preconditioner2,
-				(void *) mdata,
-				evectconstraint_chain_func,
-				(void *) constraints,
-				W, nwork_alloc, tolerance, &num_iters, flags);
+	  /* in mixed-precision mode, first converge as far as single
+	     precision allows, then finish in full precision: */
+	  mixed = mixed_precisionp && !mtdata
+	       && maxwell_set_mixed_precision(mdata, 1);
+	  block_iters = 0;
+	  for (;;) {
+	       real tol = mixed ? MAX2(tolerance, MIXED_PRECISION_TOLERANCE)
+		    : tolerance;
+
+	       if (mtdata) {  /* solving for bands near a target frequency */
+		    CHECK(mdata->mu_inv==NULL,
+			  "targeted solver doesn't handle mu");
+		    if (eigensolver_jacobi_davidsonp)
+			 /* works with M itself, not (M - w^2)^2, and
+			    allocates its own (larger) search space */
+			 eigensolver_jacobi_davidson(
+			      Hblock, eigvals + ib,
+			      maxwell_operator, (void *) mdata,
+			      maxwell_shifted_preconditioner, (void *) mtdata,
+			      evectconstraint_chain_func,
+			      (void *) constraints,
+			      W, nwork_alloc, tol, &num_iters, flags,
+			      mtdata->target_frequency * mtdata->target_frequency);
+		    else if (eigensolver_davidsonp)
+			 eigensolver_davidson(
+			      Hblock, eigvals + ib,
+			      maxwell_target_operator, (void *) mtdata,
+			      simple_preconditionerp ? 
+			      maxwell_target_preconditioner :
+			      maxwell_target_preconditioner2,
+			      (void *) mtdata,
+			      evectconstraint_chain_func,
+			      (void *) constraints,
+			      W, nwork_alloc, tol, &num_iters, flags, 0.0);
+		    else if (eigensolver_lobpcgp)
+			 eigensolver_lobpcg(Hblock, eigvals + ib,
+				     maxwell_target_operator, (void *) mtdata,
+				     NULL, NULL,
+				     simple_preconditionerp ?
+				     maxwell_target_preconditioner :
+				     maxwell_target_preconditioner2,
+				     (void *) mtdata,
+				     evectconstraint_chain_func,
+				     (void *) constraints,
+				     W, nwork_alloc, tol, &num_iters, flags);
+		    else
+			 eigensolver(Hblock, eigvals + ib,
+				     maxwell_target_operator, (void *) mtdata,
+				     NULL, NULL,
+				     simple_preconditionerp ? 
+				     maxwell_target_preconditioner :
+				     maxwell_target_preconditioner2,
+				     (void *) mtdata,
+				     evectconstraint_chain_func,
+				     (void *) constraints,
+				     W, nwork_alloc, tol, &num_iters, flags);
+
+		    /* now, diagonalize the real Maxwell operator in the
+		       solution subspace to get the true eigenvalues and
+		       eigenvectors: */
+		    CHECK(nwork_alloc >= 2, "not enough workspace");
+		    eigensolver_get_eigenvals(Hblock, eigvals + ib,
+					      maxwell_operator,mdata, W[0],W[1]);
+	       }
+	       else {
+		    if (eigensolver_chebyshev_degree > 0) {
+			 CHECK(mdata->mu_inv==NULL,
+			       "Chebyshev filtering doesn't handle mu");
+			 eigensolver_chebyshev(
+			      Hblock, eigvals + ib,
+			      maxwell_operator, (void *) mdata,
+			      evectconstraint_chain_func,
+			      (void *) constraints,
+			      W, nwork_alloc, tol, &num_iters, flags,
+			      eigensolver_chebyshev_degree);
+		    }
+		    else if (eigensolver_davidsonp) {
+			 CHECK(mdata->mu_inv==NULL, "Davidson doesn't handle mu");
+			 eigensolver_davidson(
+			      Hblock, eigvals + ib,
+			      maxwell_operator, (void *) mdata,
+			      K, Kdata,
+			      evectconstraint_chain_func,
+			      (void *) constraints,
+			      W, nwork_alloc, tol, &num_iters, flags, 0.0);
+		    }
+		    else if (eigensolver_lobpcgp)
+			 eigensolver_lobpcg(Hblock, eigvals + ib,
+				     maxwell_operator, (void *) mdata,
+				     mdata->mu_inv ? maxwell_muinv_operator : NULL,
+				     (void *) mdata,
+				     K, Kdata,
+				     evectconstraint_chain_func,
+				     (void *) constraints,
+				     W, nwork_alloc, tol, &num_iters, flags);
+		    else
+			 eigensolver(Hblock, eigvals + ib,
+				     maxwell_operator, (void *) mdata,
+				     mdata->mu_inv ? maxwell_muinv_operator : NULL,
+				     (void *) mdata,
+				     K, Kdata,
+				     evectconstraint_chain_func,
+				     (void *) constraints,
+				     W, nwork_alloc, tol, &num_iters, flags);
+	       }
+
+	       block_iters += num_iters;
+	       if (!mixed)
+		    break;
+	       maxwell_set_mixed_precision(mdata, 0);
+	       mixed = 0;
 	  }
+	  num_iters = block_iters;
 	  
 	  if (Hblock.data != H.data) {  /* save solutions of current block */
 	       int in, ip;
@@ -795,36 +1361,159 @@ void solve_kpoint(vector3 kvector)
 	  free(deflation.S);
      }
 
-     if (num_write_output_vars > 0) {
-	  /* clean up from prev. call */
-         destroy_output_vars();
-     }
+     num_prev_kpoints = MIN2(num_prev_kpoints + 1, 2);
 
-     CHK_MALLOC(parity, char, strlen(parity_string(mdata)) + 1);
-     parity = strcpy(parity, parity_string(mdata));
+     /* use this k point as the anchor for k.p interpolation: */
+     destroy_maxwell_kp_data(kpdata);
+     kpdata = NULL;
+     if (kp_interpolation_tolerance > 0 && !mtdata && !mdata->zero_k
+	 && mdata->mu_inv == NULL)
+	  kpdata = create_maxwell_kp_data(mdata, H);
 
-     iterations = total_iters; /* iterations output variable */
+     set_kpoint_freqs(kvector, eigvals, total_iters);
 
-     /* create freqs array for storing frequencies in a Guile list */
-     freqs.num_items = num_bands;
-     CHK_MALLOC(freqs.items, number, freqs.num_items);
-     
-     set_kpoint_index(kpoint_index + 1);
+     free(eigvals);
+}
 
-     mpi_one_printf("%sfreqs:, %d, %g, %g, %g, %g",
-		    parity,
-		    kpoint_index, (double)k[0], (double)k[1], (double)k[2],
-		    vector3_norm(matrix3x3_vector3_mult(Gm, kvector)));
-     for (i = 0; i < num_bands; ++i) {
-	  freqs.items[i] =
-	       negative_epsilon_okp ? eigvals[i] : sqrt(eigvals[i]);
-	  mpi_one_printf(", %g", freqs.items[i]);
+/**************************************************************************/
+
+/* Warn about the eigensolver settings that solve_kpoints_batched
+   ignores: it always uses block LOBPCG with the simple preconditioner,
+   for all of the bands at once, in full precision. */
+static void warn_batched_ignored(void)
+{
+     if (Hblock.alloc_p < num_bands)
+	  mpi_one_fprintf(stderr, "WARNING: solve-kpoints-batched ignores "
+			  "the block size (%d) and solves for all %d "
+			  "bands at once\n", Hblock.alloc_p, num_bands);
+     if (mixed_precisionp)
+	  mpi_one_fprintf(stderr, "WARNING: solve-kpoints-batched ignores "
+			  "mixed-precision?\n");
+     if (eigensolver_chebyshev_degree > 0 || eigensolver_davidsonp
+	 || eigensolver_jacobi_davidsonp)
+	  mpi_one_fprintf(stderr, "WARNING: solve-kpoints-batched ignores "
+			  "the choice of eigensolver and uses LOBPCG\n");
+     if (local_eps_preconditionerp)
+	  mpi_one_fprintf(stderr, "WARNING: solve-kpoints-batched ignores "
+			  "the choice of preconditioner and uses the "
+			  "simple one\n");
+}
+
+/* Solve for the bands at all of the given k points at once, using a
+   batched Maxwell operator (see maxwell_set_k_batch) that Fourier
+   transforms the bands of all the k points together.  For small grids
+   with few bands, this is much more efficient than solving the k
+   points one by one with solve_kpoint, whose FFTs are then too small
+   to be efficient.  The fields of the previous solve_kpoint are
+   used as the starting point for every k point.  Afterwards, H,
+   mdata, and the output variables are those of the last k point, as
+   if it had been solved by solve_kpoint.  Returns the frequencies,
+   num_bands for each k point in turn.  k = 0, mu, and
+   target-freq are not supported (run-parity solves those cases with
+   solve_kpoint instead), and the settings listed in
+   warn_batched_ignored are ignored.  Must only be called after
+   init_params! */
+number_list solve_kpoints_batched(vector3_list kpoints)
+{
+     number_list retval = { 0, 0 };
+     int nk = kpoints.num_items, ik, i, num_iters, flags, prev_parity;
+     int max_fft_bands;
+     real *ks, *eigvals;
+     evectmatrix Y, Wb[6];
+     evectconstraint_chain *constraints;
+
+     curfield_reset();
+
+     if (nk == 0 || num_bands == 0)
+	  return retval;
+
+     if (!mdata) {
+	  mpi_one_fprintf(stderr, "init-params must be called before "
+			  "solve-kpoints-batched!\n");
+	  return retval;
      }
-     mpi_one_printf("\n");
+     CHECK(!mtdata, "solve-kpoints-batched doesn't handle target-freq");
+     CHECK(mdata->mu_inv == NULL, "solve-kpoints-batched doesn't handle mu");
+
+     warn_batched_ignored();
+     mpi_one_printf("solve_kpoints_batched (%d k points):\n", nk);
+     print_freqs_header();
+
+     CHK_MALLOC(ks, real, 3 * nk);
+     for (ik = 0; ik < nk; ++ik) {
+	  CHECK(vector3_norm(kpoints.items[ik]) >= 1e-10,
+		"k = 0 must be solved with solve-kpoint");
+	  vector3_to_arr(ks + 3*ik, kpoints.items[ik]);
+     }
+     prev_parity = mdata->parity;
+     maxwell_set_k_batch(mdata, nk, ks, G[0], G[1], G[2]);
+     CHECK(mdata->parity == prev_parity,
+	   "k vector is incompatible with specified parity");
 
-     eigensolver_flops = evectmatrix_flops;
+     /* transform the bands of all the k points together, with the
+	same number of bands per k point as for a single k point: */
+     max_fft_bands = mdata->max_fft_bands;
+     maxwell_set_max_fft_bands(mdata, nk * MIN2(num_bands, fft_bands));
+
+     Y = create_evectmatrix(H.N, 2, nk * num_bands,
+			    H.localN, H.Nstart, H.allocN);
+     for (i = 0; i < 6; ++i)
+	  Wb[i] = create_evectmatrix(H.N, 2, nk * num_bands,
+				     H.localN, H.Nstart, H.allocN);
+     for (ik = 0; ik < nk; ++ik)
+	  evectmatrix_copy_slice(Y, H, ik * num_bands, 0, num_bands);
+     CHK_MALLOC(eigvals, real, nk * num_bands);
+
+     flags = eigensolver_flags; /* ctl file input variable */
+     if (verbose)
+	  flags |= EIGS_VERBOSE;
+
+     constraints = NULL;
+     constraints = evect_add_constraint(constraints,
+					maxwell_parity_constraint,
+					(void *) mdata);
+
+     eigensolver_lobpcg_batch(Y, eigvals,
+			      maxwell_batch_operator, (void *) mdata,
+			      maxwell_batch_preconditioner, (void *) mdata,
+			      evectconstraint_chain_func,
+			      (void *) constraints,
+			      Wb, 6, tolerance, &num_iters, flags, nk);
+
+     evect_destroy_constraints(constraints);
+     for (i = 0; i < 6; ++i)
+	  destroy_evectmatrix(Wb[i]);
+     maxwell_set_max_fft_bands(mdata, max_fft_bands);
+     maxwell_set_k_batch(mdata, 0, NULL, G[0], G[1], G[2]);
+
+     /* leave H and mdata at the last k point, so that it is as if we
+	had just called solve_kpoint there: */
+     evectmatrix_copy_slice(H, Y, 0, (nk - 1) * num_bands, num_bands);
+     destroy_evectmatrix(Y);
+     cur_kvector = kpoints.items[nk - 1];
+     update_maxwell_data_k(mdata, ks + 3*(nk - 1), G[0], G[1], G[2]);
+     num_prev_kpoints = 1;
+     destroy_maxwell_kp_data(kpdata);
+     kpdata = NULL;
+     if (kp_interpolation_tolerance > 0 && !mdata->zero_k)
+	  kpdata = create_maxwell_kp_data(mdata, H);
+
+     mpi_one_printf("Finished solving %d k points after %d iterations.\n",
+		    nk, num_iters);
+
+     retval.num_items = nk * num_bands;
+     CHK_MALLOC(retval.items, number, retval.num_items);
+     for (ik = 0; ik < nk; ++ik) {
+	  /* (iterations per k point, as in solve_kpoint) */
+	  set_kpoint_freqs(kpoints.items[ik], eigvals + ik * num_bands,
+			   num_iters * num_bands);
+	  for (i = 0; i < num_bands; ++i)
+	       retval.items[ik * num_bands + i] = freqs.items[i];
+     }
 
      free(eigvals);
+     free(ks);
+     return retval;
 }
 
 /**************************************************************************/
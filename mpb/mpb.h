@@ -61,6 +61,7 @@ extern int curfield_band;
 extern char curfield_type;
 
 extern void curfield_reset(void);
+extern void reset_kpoint_history(void);
 
 /* R[i]/G[i] are lattice/reciprocal-lattice vectors */
 extern real R[3][3], G[3][3];
@@ -90,6 +91,7 @@ extern void cvector32cscalar3(scalar_complex *cs, cvector3 v);
 extern int no_size_x, no_size_y, no_size_z;
 extern geom_box_tree geometry_tree;
 extern void reset_epsilon(void);
+extern void keep_epsilon(void);
 extern void init_epsilon(void);
 
 /**************************************************************************/
@@ -107,6 +109,32 @@ void material_grids_addgradient(double *v,
 				double scalegrad, int band,
 				const material_grid *grids, int ngrids);
 
+/**************************************************************************/
+/* native.c */
+
+/* A native material function computes the dielectric constants
+   epsilon[i] at n points r[3*i..3*i+2] (given in the same coordinates
+   as the argument of a material-func), given the nparams numbers of
+   native-parameters.  It may be called from several threads at once. */
+typedef void (*native_material_func)(int n, const double *r,
+				     double *epsilon,
+				     const double *params, int nparams);
+
+/* A native integrand function computes the complex integrands
+   integrand[2*i] + i*integrand[2*i+1] at n points, given nf = 1 value
+   (the energy density) or nf = 6 values (the real and imaginary parts
+   of the x, y, and z field components) vals[nf*i..] at each point, and
+   also the dielectric constants epsilon[i] and positions r[3*i..]. */
+typedef void (*native_integrand_func)(int n, int nf, const double *vals,
+				      const double *epsilon, const double *r,
+				      double *integrand,
+				      const double *params, int nparams);
+
+extern void *get_native_function(const char *library, const char *func);
+extern void load_native_materials(void);
+extern void native_material_epsilon(material_type m, int n, const double *r,
+				    double *epsilon);
+
 /**************************************************************************/
 
 extern const char *parity_string(maxwell_data *d);
@@ -0,0 +1,146 @@
+/* Copyright (C) 1999-2014 Massachusetts Institute of Technology.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/**************************************************************************/
+
+/* This file loads "native" material and integrand functions, written
+   in C (or anything with a C calling convention) and compiled into a
+   shared library, as an alternative to Scheme functions that have to
+   be called through Guile once per point.  The native functions take
+   whole batches of points at once; see native_material_func and
+   native_integrand_func in mpb.h for their calling conventions. */
+
+/**************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "config.h"
+#include <check.h>
+#include <mpi_utils.h>
+
+#include <ctl-io.h>
+
+#if defined(HAVE_DLFCN_H) && defined(HAVE_DLOPEN)
+#  include <dlfcn.h>
+#  define HAVE_NATIVE_FUNCTIONS 1
+#endif
+
+#include "mpb.h"
+
+/* Functions that have already been looked up.  Each library is
+   dlopen'ed once and never closed, so the function pointers remain
+   valid for the whole run. */
+typedef struct {
+     char *library, *function;
+     void *func;
+} native_function;
+
+static native_function *native_functions = NULL;
+static int num_native_functions = 0, num_native_alloc = 0;
+
+/* Return the function named func in the shared library library (which
+   is searched for in the usual places, e.g. LD_LIBRARY_PATH, unless it
+   contains a "/").  Dies if the library or function can't be found.
+
+   Looking up a new function modifies a global table, so this is not
+   thread-safe; the callers look up every function serially (e.g.
+   load_native_materials, below) before any parallel evaluation, after
+   which the lookups only read the table. */
+void *get_native_function(const char *library, const char *func)
+{
+     int i;
+
+     for (i = 0; i < num_native_functions; ++i)
+	  if (!strcmp(native_functions[i].library, library) &&
+	      !strcmp(native_functions[i].function, func))
+	       return native_functions[i].func;
+
+#ifdef HAVE_NATIVE_FUNCTIONS
+     {
+	  void *handle, *f;
+
+	  handle = dlopen(library, RTLD_NOW | RTLD_LOCAL);
+	  if (!handle)
+	       mpi_die("error loading native library %s: %s\n",
+		       library, dlerror());
+	  dlerror(); /* clear any old error */
+	  f = dlsym(handle, func);
+	  if (!f)
+	       mpi_die("error finding %s in native library %s: %s\n",
+		       func, library, dlerror());
+
+	  if (num_native_functions == num_native_alloc) {
+	       num_native_alloc = num_native_alloc * 2 + 4;
+	       native_functions = (native_function *)
+		    realloc(native_functions,
+			    sizeof(native_function) * num_native_alloc);
+	       CHECK(native_functions, "out of memory!");
+	  }
+	  CHK_MALLOC(native_functions[num_native_functions].library,
+		     char, strlen(library) + 1);
+	  strcpy(native_functions[num_native_functions].library, library);
+	  CHK_MALLOC(native_functions[num_native_functions].function,
+		     char, strlen(func) + 1);
+	  strcpy(native_functions[num_native_functions].function, func);
+	  native_functions[num_native_functions].func = f;
+	  return native_functions[num_native_functions++].func;
+     }
+#else
+     mpi_die("cannot load %s from %s: MPB was compiled without dlopen\n",
+	     func, library);
+     return NULL;
+#endif
+}
+
+static void load_native_material(material_type m)
+{
+     if (m.which_subclass == NATIVE_MATERIAL_FUNCTION)
+	  get_native_function(m.subclass.native_material_function_data
+			      ->native_library,
+			      m.subclass.native_material_function_data
+			      ->native_function);
+}
+
+/* Look up the functions of all the native materials in the geometry
+   (and the default material), so that the epsilon function can later
+   be called from several threads at once. */
+void load_native_materials(void)
+{
+     int i;
+     load_native_material(default_material);
+     for (i = 0; i < geometry.num_items; ++i)
+	  load_native_material(geometry.items[i].material);
+}
+
+/* Evaluate the native material function of m at n points r (3n numbers,
+   in the same coordinates that a material-func gets), returning the
+   dielectric constants in epsilon. */
+void native_material_epsilon(material_type m, int n, const double *r,
+			     double *epsilon)
+{
+     native_material_function *nm = m.subclass.native_material_function_data;
+     native_material_func f;
+
+     CHECK(m.which_subclass == NATIVE_MATERIAL_FUNCTION,
+	   "native_material_epsilon called for a non-native material");
+     f = (native_material_func) get_native_function(nm->native_library,
+						    nm->native_function);
+     f(n, r, epsilon,
+       nm->native_parameters.items, nm->native_parameters.num_items);
+}
@@ -0,0 +1,61 @@
+/* Copyright (C) 1999-2014 Massachusetts Institute of Technology.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/* A native material function and integrand for "make check", which
+   runs examples/check-native.ctl to compare them against the same
+   functions written in Scheme.  This is built as a stand-alone module,
+   like a user's library would be, so it doesn't include any MPB
+   headers; the prototypes are those of native_material_func and
+   native_integrand_func in mpb.h. */
+
+#include <math.h>
+
+#define TWOPI 6.2831853071795864769252867665590057683943388
+
+/* epsilon = params[0] + params[1] cos(2 pi x) cos(2 pi y) */
+void native_test_epsilon(int n, const double *r, double *epsilon,
+			 const double *params, int nparams)
+{
+     int i;
+     for (i = 0; i < n; ++i)
+	  epsilon[i] = params[0] + params[1] * cos(TWOPI * r[3*i])
+	       * cos(TWOPI * r[3*i+1]);
+     (void) nparams;
+}
+
+/* The integrand u * epsilon * (params[0] + x) for an energy density u,
+   or F_x conj(F_y) * (params[0] + x) for a field F. */
+void native_test_integrand(int n, int nf, const double *vals,
+			   const double *epsilon, const double *r,
+			   double *integrand,
+			   const double *params, int nparams)
+{
+     int i;
+     for (i = 0; i < n; ++i) {
+	  double w = params[0] + r[3*i];
+	  if (nf == 1) {
+	       integrand[2*i] = vals[i] * epsilon[i] * w;
+	       integrand[2*i+1] = 0;
+	  }
+	  else {
+	       const double *F = vals + 6*i;
+	       integrand[2*i] = (F[0] * F[2] + F[1] * F[3]) * w;
+	       integrand[2*i+1] = (F[1] * F[2] - F[0] * F[3]) * w;
+	  }
+     }
+     (void) nparams;
+}
@@ -97,8 +97,20 @@ extern void F(herk,HERK) (char *, char *, int *, int *,
 extern void F(syrk,SYRK) (char *, char *, int *, int *,
 			  real *, scalar *, int *,
 			  real *, scalar *, int *);
+extern void F(trmm,TRMM) (char *, char *, char *, char *, int *, int *,
+			  scalar *, scalar *, int *, scalar *, int *);
 extern void F(potrf,POTRF) (char *, int *, scalar *, int *, int *);
 extern void F(potri,POTRI) (char *, int *, scalar *, int *, int *);
+extern void F(trtri,TRTRI) (char *, char *, int *, scalar *, int *, int *);
+extern void F(gelqf,GELQF) (int *, int *, scalar *, int *, scalar *,
+			    scalar *, int *, int *);
+#ifdef SCALAR_COMPLEX
+extern void F(unglq,UNGLQ) (int *, int *, int *, scalar *, int *, scalar *,
+			    scalar *, int *, int *);
+#else
+extern void F(orglq,ORGLQ) (int *, int *, int *, scalar *, int *, scalar *,
+			    scalar *, int *, int *);
+#endif
 extern void F(hetrf,HETRF) (char *, int *, scalar *, int *,
 			    int *, scalar *, int *, int *);
 extern void F(hetri,HETRI) (char *, int *, scalar *, int *,
@@ -241,6 +253,27 @@ void blasglue_herk(char uplo, char trans, int n, int k,
 #endif
 }
 
+/* B <- a B op(A) (side 'R') or a op(A) B (side 'L'), where A is
+   triangular (upper or lower, according to uplo) and op(A) is A, its
+   transpose ('T'), or its adjoint ('C'), according to transa. */
+void blasglue_trmm(char side, char uplo, char transa, int m, int n,
+		   real a, scalar *A, int fdA, scalar *B, int fdB)
+{
+     scalar alpha;
+     char diag = 'N';
+
+     if (m*n == 0)
+	  return;
+
+     ASSIGN_REAL(alpha, a);
+
+     side = side == 'L' ? 'R' : 'L';
+     uplo = uplo == 'U' ? 'L' : 'U';
+
+     F(trmm,TRMM) (&side, &uplo, &transa, &diag, &n, &m,
+		   &alpha, A, &fdA, B, &fdB);
+}
+
 /*************************************************************************/
 
 #ifndef NO_LAPACK
@@ -269,6 +302,49 @@ int lapackglue_potri(char uplo, int n, scalar *A, int fdA)
      return (info == 0);
 }
 
+int lapackglue_trtri(char uplo, int n, scalar *A, int fdA)
+{
+     int info;
+     char diag = 'N';
+
+     uplo = uplo == 'U' ? 'L' : 'U';
+
+     F(trtri,TRTRI) (&uplo, &diag, &n, A, &fdA, &info);
+
+     CHECK(info >= 0, "invalid argument in trtri");
+     return (info == 0);
+}
+
+/* QR factorization of the m x n matrix A: R is returned in the upper
+   triangle of A, and Q is represented by the Householder reflectors
+   in the rest of A and in tau (see lapackglue_orgqr).  Since A is
+   row-major, this is the LQ factorization of the Fortran array. */
+void lapackglue_geqrf(int m, int n, scalar *A, int fdA,
+		      scalar *tau, scalar *work, int lwork)
+{
+     int info;
+
+     F(gelqf,GELQF) (&n, &m, A, &fdA, tau, work, &lwork, &info);
+
+     CHECK(info >= 0, "invalid argument in gelqf");
+}
+
+/* A <- the first n columns of Q, given the first k reflectors of Q
+   from lapackglue_geqrf (m >= n >= k). */
+void lapackglue_orgqr(int m, int n, int k, scalar *A, int fdA,
+		      scalar *tau, scalar *work, int lwork)
+{
+     int info;
+
+#ifdef SCALAR_COMPLEX
+     F(unglq,UNGLQ) (&n, &m, &k, A, &fdA, tau, work, &lwork, &info);
+#else
+     F(orglq,ORGLQ) (&n, &m, &k, A, &fdA, tau, work, &lwork, &info);
+#endif
+
+     CHECK(info >= 0, "invalid argument in orglq");
+}
+
 int lapackglue_hetrf(char uplo, int n, scalar *A, int fdA,
 		      int *ipiv, scalar *work, int lwork)
 {
@@ -32,8 +32,15 @@ void blasglue_gemm(char transa, char transb, int m, int n, int k,
 extern void blasglue_herk(char uplo, char trans, int n, int k,
 			  real a, scalar *A, int fdA,
 			  real b, scalar *C, int fdC);
+extern void blasglue_trmm(char side, char uplo, char transa, int m, int n,
+			  real a, scalar *A, int fdA, scalar *B, int fdB);
 extern int lapackglue_potrf(char uplo, int n, scalar *A, int fdA);
 extern int lapackglue_potri(char uplo, int n, scalar *A, int fdA);
+extern int lapackglue_trtri(char uplo, int n, scalar *A, int fdA);
+extern void lapackglue_geqrf(int m, int n, scalar *A, int fdA,
+			     scalar *tau, scalar *work, int lwork);
+extern void lapackglue_orgqr(int m, int n, int k, scalar *A, int fdA,
+			     scalar *tau, scalar *work, int lwork);
 extern int lapackglue_hetrf(char uplo, int n, scalar *A, int fdA,
 			     int *ipiv, scalar *work, int lwork);
 extern int lapackglue_hetri(char uplo, int n, scalar *A, int fdA,
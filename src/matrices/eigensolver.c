@@ -75,6 +75,16 @@ extern void eigensolver_get_eigenvals_aux(evectmatrix Y, real *eigenvals,
 /* Threshold for trace(1/YtBY) = trace(U) before we reorthogonalize: */
 #define EIGS_TRACE_U_THRESHOLD 1e8
 
+/* With EIGS_RECURRENCE_AY, the maximum number of iterations between
+   explicit evaluations of A*Y, and the relative error (in units of the
+   tolerance) of the recurred A*Y above which we refresh it more often: */
+#define AY_REFRESH_ITERS 16
+#define AY_DRIFT_THRESHOLD 0.1
+
+/* With EIGS_LOCKING, a band is locked once |residual|^2 is less than
+   EIGS_LOCK_THRESHOLD * tolerance * eigenvalue^2: */
+#define EIGS_LOCK_THRESHOLD 1.0
+
 /**************************************************************************/
 
 /* estimated times/iteration for different iteration schemes, based
@@ -179,6 +189,39 @@ static linmin_real trace_func(linmin_real theta, linmin_real *trace_deriv, void
 
 /**************************************************************************/
 
+/* With EIGS_LOCKING, the converged (locked) bands are stored in Y
+   after the active bands, and the active bands are kept orthogonal
+   to them by the following constraint, which is chained with the
+   user's constraint (if any).  (As in the deflation constraint in
+   mpb.c, we call the BLAS directly since the locked and active
+   blocks have different numbers of columns.) */
+
+typedef struct {
+     evectconstraint constraint;
+     void *constraint_data;
+     evectmatrix Y; /* the locked bands (orthonormal) */
+     scalar *S, *S2; /* scratch arrays, at least Y.p * X.p elements */
+} lock_data;
+
+static void lock_constraint(evectmatrix X, void *data)
+{
+     lock_data *d = (lock_data *) data;
+
+     if (d->constraint)
+	  d->constraint(X, d->constraint_data);
+
+     /* compute S = Xt Y and then X = X - Y St = (1 - Y Yt) X */
+     blasglue_gemm('C', 'N', X.p, d->Y.p, X.n,
+		   1.0, X.data, X.p, d->Y.data, d->Y.p, 0.0, d->S2, d->Y.p);
+     mpi_allreduce(d->S2, d->S, d->Y.p * X.p * SCALAR_NUMVALS,
+		   real, SCALAR_MPI_TYPE, MPI_SUM, mpb_comm);
+     blasglue_gemm('N', 'C', X.n, X.p, d->Y.p,
+		   -1.0, d->Y.data, d->Y.p, d->S, d->Y.p,
+		   1.0, X.data, X.p);
+}
+
+/**************************************************************************/
+
 #define EIG_HISTORY_SIZE 5
 
 /* find generalized eigenvectors Y of (A,B) by minimizing Rayleigh quotient
@@ -192,6 +235,11 @@ static linmin_real trace_func(linmin_real theta, linmin_real *trace_deriv, void
    Constraints that commute with A and B (and L) are specified via the
    "constraint" argument, which gives the projection operator for
    the constraint(s).
+
+   With EIGS_LOCKING (and B = L = NULL), the residual of each band is
+   checked on every iteration, and bands that have converged are
+   locked: removed from the active block (which shrinks accordingly)
+   and kept fixed, with the remaining bands orthogonal to them.
 */
 
 void eigensolver_lagrange(evectmatrix Y, real *eigenvals,
@@ -205,19 +253,27 @@ void eigensolver_lagrange(evectmatrix Y, real *eigenvals,
 			  int flags)
 {
      real convergence_history[EIG_HISTORY_SIZE];
-     evectmatrix G, D, X, BY, prev_G, BD;
+     evectmatrix G, D, X, BY, prev_G, BD, AY;
      real g_lag = 0, d_lag = 0, prev_g_lag = 0;
      short usingConjugateGradient = 0, use_polak_ribiere = 0,
-	   use_linmin = 1;
+	   use_linmin = 1, use_ay_recurrence = 0, ay_valid = 0;
+     int ay_age = 0, ay_refresh_iters = AY_REFRESH_ITERS;
      real E, prev_E = 0.0;
      real d_scale = 1.0;
      real traceGtX, prev_traceGtX = 0.0;
      real theta, prev_theta = 0.5;
      int i, iteration = 0, num_emergency_restarts = 0;
+     int p = Y.p, nlocked = 0;
+     short use_locking = 0;
+     real E_locked = 0.0; /* sum of the eigenvalues of the locked bands */
+     real *lock_eigs = NULL, *rnorm2 = NULL;
+     lock_data ld;
      mpiglue_clock_t prev_feedback_time;
-     real time_AZ, time_KZ=0, time_ZtZ, time_ZtW, time_ZS, time_linmin=0;
+     real time_AZ=0, time_KZ=0, time_ZtZ, time_ZtW, time_ZS, time_linmin=0;
      real linmin_improvement = 0;
+     scalar trace_s[2]; /* traces from batched reductions */
      sqmatrix YtAYU, DtAD, symYtAD, YtBY, U, DtBD, symYtBD, S1, S2, S3;
+     evectreduce R; /* for combining the reductions of each step */
      trace_func_data tfd;
 
      prev_feedback_time = MPIGLUE_CLOCK;
@@ -237,6 +293,36 @@ void eigensolver_lagrange(evectmatrix Y, real *eigenvals,
      else
          BY = Y;
 
+     /* With EIGS_RECURRENCE_AY, the last workspace holds A*Y, which is
+	updated from A*D after each exact line minimization rather than
+	being recomputed, saving one application of A per iteration.
+	(We only do this if there is still room for conjugate gradient.) */
+     if (flags & EIGS_RECURRENCE_AY) {
+	  if (nWork >= 4 + (B != NULL)) {
+	       use_ay_recurrence = 1;
+	       AY = Work[--nWork];
+	  }
+	  else
+	       mpi_one_fprintf(stderr, "WARNING: A*Y recurrence needs "
+			       "nwork >= %d; disabled.\n", 4 + (B != NULL));
+     }
+     if (!use_ay_recurrence)
+	  AY = X;
+
+     if (flags & EIGS_LOCKING) {
+	  if (B || L)
+	       mpi_one_fprintf(stderr, "WARNING: locking of converged bands "
+			       "needs B = L = NULL; disabled.\n");
+	  else {
+	       use_locking = 1;
+	       CHK_MALLOC(lock_eigs, real, p);
+	       CHK_MALLOC(rnorm2, real, p);
+	       ld.constraint = constraint;
+	       ld.constraint_data = constraint_data;
+	       ld.S = ld.S2 = NULL;
+	  }
+     }
+
      usingConjugateGradient = nWork >= 3 + (B != NULL);
      if (usingConjugateGradient) {
           D = Work[2 + (B != NULL)];
@@ -276,25 +362,29 @@ void eigensolver_lagrange(evectmatrix Y, real *eigenvals,
      S2 = create_sqmatrix(Y.p);
      S3 = create_sqmatrix(Y.p);
 
+     R = create_evectreduce();
+
      tfd.YtAY = S1; tfd.DtAD = DtAD; tfd.symYtAD = symYtAD;
      tfd.YtBY = YtBY; tfd.DtBD = DtBD; tfd.symYtBD = symYtBD;
      tfd.S1 = YtAYU; tfd.S2 = S2; tfd.S3 = S3;
 
  restartY:
 
+     ay_valid = 0;
+
      if (flags & EIGS_ORTHONORMALIZE_FIRST_STEP) {
           if (B) {
               B(Y, BY, Bdata, 1, G); /* B*Y; G is scratch */
               evectmatrix_XtY(U, Y, BY, S2);
+              sqmatrix_assert_hermitian(U);
+              CHECK(sqmatrix_invert(U, 1, S2), "non-independent initial Y");
+              sqmatrix_sqrt(S1, U, S2); /* S1 = 1/sqrt(Yt*Y) */
+              evectmatrix_XeYS(G, Y, S1, 1); /* G = orthonormalize Y */
+              evectmatrix_copy(Y, G);
           }
-          else {
-              evectmatrix_XtX(U, Y, S2);
-          }
-	  sqmatrix_assert_hermitian(U);
-	  CHECK(sqmatrix_invert(U, 1, S2), "non-independent initial Y");
-	  sqmatrix_sqrt(S1, U, S2); /* S1 = 1/sqrt(Yt*Y) */
-	  evectmatrix_XeYS(G, Y, S1, 1); /* G = orthonormalize Y */
-	  evectmatrix_copy(Y, G);
+          else
+              CHECK(eigensolver_orthonormalize(Y, G, S1, U, S2, flags),
+                    "non-independent initial Y");
      }
 
      for (i = 0; i < Y.p; ++i)
@@ -324,6 +414,7 @@ void eigensolver_lagrange(evectmatrix Y, real *eigenvals,
 	  y_norm = sqrt(SCALAR_RE(sqmatrix_trace(YtBY)) / Y.p);
 	  blasglue_rscal(Y.p * Y.n, 1/y_norm, Y.data, 1);
 	  if (B) blasglue_rscal(Y.p * Y.n, 1/y_norm, BY.data, 1);
+	  if (ay_valid) blasglue_rscal(Y.p * Y.n, 1/y_norm, AY.data, 1);
 	  blasglue_rscal(Y.p * Y.p, 1/(y_norm*y_norm), YtBY.data, 1);
 
 	  sqmatrix_copy(U, YtBY);
@@ -353,9 +444,19 @@ void eigensolver_lagrange(evectmatrix Y, real *eigenvals,
 	       mpi_assert_equal(traceU);
 	       if (traceU > EIGS_TRACE_U_THRESHOLD * U.p) {
 		    mpi_one_printf("    re-orthonormalizing Y\n");
-		    sqmatrix_sqrt(S1, U, S2); /* S1 = 1/sqrt(Yt*Y) */
-		    evectmatrix_XeYS(G, Y, S1, 1); /* G = orthonormalize Y */
-		    evectmatrix_copy(Y, G);
+		    if (!B && (flags & (EIGS_CHOLQR | EIGS_TSQR)))
+			 CHECK(eigensolver_orthonormalize(Y, G, S1, U, S2,
+							  flags),
+			       "non-independent Y in re-orthogonalization");
+		    else {
+			 sqmatrix_sqrt(S1, U, S2); /* S1 = 1/sqrt(Yt*Y) */
+			 evectmatrix_XeYS(G, Y, S1, 1); /* G = orthonormalize Y */
+			 evectmatrix_copy(Y, G);
+		    }
+		    if (ay_valid) { /* AY = A Y S1 */
+			 evectmatrix_XeYS(G, AY, S1, 0);
+			 evectmatrix_copy(AY, G);
+		    }
 		    prev_traceGtX = 0.0;
                     if (B) {
                         B(Y, BY, Bdata, 1, G); /* B*Y; G is scratch */
@@ -366,6 +467,8 @@ void eigensolver_lagrange(evectmatrix Y, real *eigenvals,
 		    y_norm = sqrt(SCALAR_RE(sqmatrix_trace(YtBY)) / Y.p);
 		    blasglue_rscal(Y.p * Y.n, 1/y_norm, Y.data, 1);
 		    if (B) blasglue_rscal(Y.p * Y.n, 1/y_norm, BY.data, 1);
+		    if (ay_valid)
+			 blasglue_rscal(Y.p * Y.n, 1/y_norm, AY.data, 1);
 		    blasglue_rscal(Y.p * Y.p, 1/(y_norm*y_norm), YtBY.data, 1);
 		    sqmatrix_copy(U, YtBY);
 		    CHECK(sqmatrix_invert(U, 1, S2),
@@ -373,38 +476,84 @@ void eigensolver_lagrange(evectmatrix Y, real *eigenvals,
 	       }
 	  }
 
-	  TIME_OP(time_AZ, A(Y, X, Adata, 1, G)); /* X = AY; G is scratch */
+     computeAY:
+	  if (!use_ay_recurrence) {
+	       TIME_OP(time_AZ, A(Y, X, Adata, 1, G)); /* X = AY; G is scratch */
+	  }
+	  else if (!ay_valid || ay_age >= ay_refresh_iters) {
+	       TIME_OP(time_AZ, A(Y, X, Adata, 1, G)); /* X = AY; G is scratch */
+	       if (ay_valid) {
+		    /* compare with the recurred AY, to see how much error
+		       has accumulated, and adjust the refresh interval: */
+		    real drift;
+		    evectmatrix_aXpbY(1.0, AY, -1.0, X);
+		    drift = sqrt(SCALAR_RE(evectmatrix_traceXtY(AY, AY)) /
+				 SCALAR_RE(evectmatrix_traceXtY(X, X)));
+		    mpi_assert_equal(drift);
+		    if (drift > AY_DRIFT_THRESHOLD * tolerance) {
+			 ay_refresh_iters = MAX2(1, ay_refresh_iters / 2);
+			 if (flags & EIGS_VERBOSE)
+			      mpi_one_printf("    A*Y recurrence error %g, "
+					     "refreshing every %d iters\n",
+					     (double) drift, ay_refresh_iters);
+		    }
+		    else if (drift < 0.01 * AY_DRIFT_THRESHOLD * tolerance)
+			 ay_refresh_iters = MIN2(AY_REFRESH_ITERS,
+						 ay_refresh_iters * 2);
+	       }
+	       evectmatrix_copy(AY, X);
+	       ay_valid = 1;
+	       ay_age = 0;
+	  }
 
 #ifdef DEBUG
-	  evectmatrix_XtY(S1, Y, X, S2);
+	  evectmatrix_XtY(S1, Y, AY, S2);
 	  sqmatrix_assert_hermitian(S1);
 #endif
 
 	  /* G = AYU; note that U is Hermitian: */
-	  TIME_OP(time_ZS, evectmatrix_XeYS(G, X, U, 1));
+	  TIME_OP(time_ZS, evectmatrix_XeYS(G, AY, U, 1));
 
-	  TIME_OP(time_ZtW, evectmatrix_XtY(YtAYU, Y, G, S2));
+	  if (L) {
+	       L(Y, X, Ldata, 1, X); /* X = LY, no scratch */
+	       evectreduce_traceXtY(&R, &trace_s[0], Y, X);
+	  }
+
+	  TIME_OP(time_ZtW, evectreduce_XtY(&R, YtAYU, Y, G);
+		  evectreduce_sum(&R));
 	  E = SCALAR_RE(sqmatrix_trace(YtAYU));
 	  CHECK(!BADNUM(E), "crazy number detected in trace!!\n");
 	  mpi_assert_equal(E);
 
 	  if (L) {
-	       /* X = LY, no scratch */
-	       L(Y, X, Ldata, 1, X);
-	       g_lag = tfd.trace_YtLY = SCALAR_RE(evectmatrix_traceXtY(Y, X));
+	       g_lag = tfd.trace_YtLY = SCALAR_RE(trace_s[0]);
 	       E += *lag * g_lag;
 	  }
 
+	  /* (E is the trace of the active bands; the locked bands
+	     contribute E_locked to the total.) */
 	  convergence_history[iteration % EIG_HISTORY_SIZE] =
-	       200.0 * fabs(E - prev_E) / (fabs(E) + fabs(prev_E));
+	       200.0 * fabs(E - prev_E) / (fabs(E + E_locked) +
+					  fabs(prev_E + E_locked));
 	  
 	  if (iteration > 0 && mpi_is_master() &&
 	      ((flags & EIGS_VERBOSE) ||
 	       MPIGLUE_CLOCK_DIFF(MPIGLUE_CLOCK, prev_feedback_time)
 	       > FEEDBACK_TIME)) {
-               mpi_one_printf("    iteration %4d: "
-                      "trace = %0.16g (%g%% change)\n", iteration, (double)E,
-	           (double)convergence_history[iteration % EIG_HISTORY_SIZE]);
+	       if (use_locking)
+		    mpi_one_printf("    iteration %4d: "
+				   "trace = %0.16g (%g%% change), "
+				   "%d/%d bands locked\n", iteration,
+				   (double) (E + E_locked),
+				   (double) convergence_history[iteration %
+								EIG_HISTORY_SIZE],
+				   nlocked, p);
+	       else
+		    mpi_one_printf("    iteration %4d: "
+				   "trace = %0.16g (%g%% change)\n",
+				   iteration, (double) E,
+				   (double) convergence_history[iteration %
+								EIG_HISTORY_SIZE]);
 	       if (flags & EIGS_VERBOSE)
 		    debug_output_malloc_count();
 	       fflush(stdout); /* make sure output appears */
@@ -412,8 +561,16 @@ void eigensolver_lagrange(evectmatrix Y, real *eigenvals,
           }
 
 	  if (iteration > 0 &&
-              fabs(E - prev_E) < tolerance * 0.5 * (E + prev_E + 1e-7))
+              fabs(E - prev_E) < tolerance * 0.5 * (E + prev_E + 2 * E_locked
+						    + 1e-7)) {
+	       if (use_ay_recurrence && ay_age > 0) {
+		    /* make sure convergence isn't an artifact of the
+		       recurrence, by re-evaluating with an exact AY */
+		    ay_age = ay_refresh_iters;
+		    goto computeAY;
+	       }
                break; /* convergence!  hooray! */
+	  }
 	  
 	  /* Compute gradient of functional: G = (1 - BY U Yt) A Y U */
 	  sqmatrix_AeBC(S1, U, 0, YtAYU, 0);
@@ -423,6 +580,130 @@ void eigensolver_lagrange(evectmatrix Y, real *eigenvals,
 	       evectmatrix_aXpbY(1.0, G, *lag, X);
 	  }
 
+	  if (use_locking && iteration > 0) {
+	       int nconv = 0;
+
+	       /* Per-band residuals: if C holds the Ritz coefficients,
+		  with Ct YtBY C = 1 and Ct YtAY C = diag(lock_eigs), then
+		  the residuals of the Ritz vectors Y C are given by
+		  A Y C - B Y C diag(lock_eigs) = G YtBY C, so we only need
+		  Gt G and some p x p matrices. */
+	       sqmatrix_AeBC(S1, YtAYU, 0, YtBY, 1); /* S1 = Yt A Y */
+	       sqmatrix_copy(S2, YtBY);
+	       sqmatrix_gen_eigensolve(S1, S2, lock_eigs, S3);
+	       /* C = S1t, since the eigenvectors are the rows of S1: */
+	       sqmatrix_AeBC(S2, YtBY, 0, S1, 1); /* S2 = YtBY C */
+	       evectmatrix_XtX(S3, G, DtAD);
+	       sqmatrix_AeBC(symYtAD, S3, 0, S2, 0); /* GtG YtBY C */
+	       for (i = 0; i < Y.p; ++i) {
+		    int k;
+		    rnorm2[i] = 0;
+		    for (k = 0; k < Y.p; ++k) {
+			 scalar c = S2.data[k * Y.p + i];
+			 scalar r = symYtAD.data[k * Y.p + i];
+			 rnorm2[i] += SCALAR_RE(c) * SCALAR_RE(r)
+			      + SCALAR_IM(c) * SCALAR_IM(r);
+		    }
+	       }
+
+	       /* lock converged bands in order, starting with the lowest: */
+	       while (nconv < Y.p && rnorm2[nconv] <= EIGS_LOCK_THRESHOLD
+		      * tolerance * lock_eigs[nconv] * lock_eigs[nconv])
+		    ++nconv;
+	       mpi_assert_equal(nconv);
+
+	       if (nconv == Y.p) {
+		    if (use_ay_recurrence && ay_age > 0) {
+			 ay_age = ay_refresh_iters;
+			 goto computeAY;
+		    }
+		    break; /* all bands converged */
+	       }
+	       else if (nconv > 0) {
+		    int pa = Y.p - nconv, in, ip, nl = nlocked + nconv;
+		    scalar *Yl;
+
+		    if (flags & EIGS_VERBOSE)
+			 mpi_one_printf("    locking %d converged bands\n",
+					nconv);
+
+		    /* G = Y C, the (orthonormal) Ritz vectors, and X = the
+		       previously locked bands; then store the active
+		       bands in Y, followed by the locked ones: */
+		    evectmatrix_aXpbYS_sub(0.0, G, 1.0, Y, S1, 0, 1);
+		    for (in = 0; in < Y.n * nlocked; ++in)
+			 X.data[in] = Y.data[Y.n * Y.p + in];
+		    Yl = Y.data + Y.n * pa;
+		    for (in = 0; in < Y.n; ++in) {
+			 for (ip = 0; ip < pa; ++ip)
+			      Y.data[in * pa + ip] = G.data[in*Y.p + nconv+ip];
+			 for (ip = 0; ip < nlocked; ++ip)
+			      Yl[in * nl + ip] = X.data[in * nlocked + ip];
+			 for (ip = 0; ip < nconv; ++ip)
+			      Yl[in * nl + nlocked + ip] = G.data[in*Y.p + ip];
+		    }
+		    for (ip = 0; ip < nconv; ++ip) {
+			 E_locked += lock_eigs[ip];
+			 prev_E -= lock_eigs[ip];
+		    }
+		    nlocked = nl;
+
+		    /* shrink the workspaces to the active bands: */
+		    evectmatrix_resize(&Y, pa, 0);
+		    evectmatrix_resize(&G, pa, 0);
+		    evectmatrix_resize(&X, pa, 0);
+		    BY = Y;
+		    if (usingConjugateGradient)
+			 evectmatrix_resize(&D, pa, 0);
+		    else
+			 D = X;
+		    BD = D;
+		    if (use_polak_ribiere)
+			 evectmatrix_resize(&prev_G, pa, 0);
+		    else
+			 prev_G = G;
+		    if (use_ay_recurrence)
+			 evectmatrix_resize(&AY, pa, 0);
+		    else
+			 AY = X;
+		    sqmatrix_resize(&YtAYU, pa, 0);
+		    sqmatrix_resize(&DtAD, pa, 0);
+		    sqmatrix_resize(&symYtAD, pa, 0);
+		    sqmatrix_resize(&YtBY, pa, 0);
+		    sqmatrix_resize(&U, pa, 0);
+		    sqmatrix_resize(&DtBD, pa, 0);
+		    sqmatrix_resize(&symYtBD, pa, 0);
+		    sqmatrix_resize(&S1, pa, 0);
+		    sqmatrix_resize(&S2, pa, 0);
+		    sqmatrix_resize(&S3, pa, 0);
+		    tfd.YtAY = S1; tfd.DtAD = DtAD; tfd.symYtAD = symYtAD;
+		    tfd.YtBY = YtBY; tfd.DtBD = DtBD; tfd.symYtBD = symYtBD;
+		    tfd.S1 = YtAYU; tfd.S2 = S2; tfd.S3 = S3;
+
+		    /* keep the active bands orthogonal to the locked ones: */
+		    ld.Y = Y;
+		    ld.Y.data = Yl;
+		    ld.Y.p = ld.Y.alloc_p = nlocked;
+		    if (!ld.S) {
+			 CHK_MALLOC(ld.S, scalar, p * p);
+			 CHK_MALLOC(ld.S2, scalar, p * p);
+			 constraint = lock_constraint;
+			 constraint_data = &ld;
+		    }
+
+		    /* restart conjugate gradient with the active bands: */
+		    if (usingConjugateGradient)
+			 for (i = 0; i < D.n * D.p; ++i)
+			      ASSIGN_ZERO(D.data[i]);
+		    if (use_polak_ribiere)
+			 for (i = 0; i < prev_G.n * prev_G.p; ++i)
+			      ASSIGN_ZERO(prev_G.data[i]);
+		    prev_traceGtX = 0.0;
+		    ++iteration;
+		    goto restartY;
+	       }
+	  }
+
 	  /* set X = precondition(G): */
 	  if (K != NULL) {
 	       TIME_OP(time_KZ, K(G, X, Kdata, Y, NULL, YtBY));
@@ -450,20 +731,19 @@ void eigensolver_lagrange(evectmatrix Y, real *eigenvals,
 	     any computations that we need with G.  (Yes, we're
 	     playing tricksy games here, but isn't it fun?) */
 
-	  mpi_assert_equal(traceGtX = 
-			   SCALAR_RE(evectmatrix_traceXtY(G, X))
-			   + g_lag * g_lag);
+	  /* (for Polak-Ribiere, we compute tr (G - prev_G)t X as
+	     tr Gt X - tr prev_Gt X, so that both traces need only
+	     a single reduction) */
+	  evectreduce_traceXtY(&R, &trace_s[0], G, X);
+	  if (usingConjugateGradient && use_polak_ribiere)
+	       evectreduce_traceXtY(&R, &trace_s[1], prev_G, X);
+	  evectreduce_sum(&R);
+	  mpi_assert_equal(traceGtX = SCALAR_RE(trace_s[0]) + g_lag * g_lag);
 	  if (usingConjugateGradient) {
                if (use_polak_ribiere) {
-                    /* assign G = G - prev_G and copy prev_G = G in the
-                       same loop.  We can't use the BLAS routines because
-                       we would then need an extra n x p array. */
-                    for (i = 0; i < Y.n * Y.p; ++i) {
-                         scalar g = G.data[i];
-                         ACCUMULATE_DIFF(G.data[i], prev_G.data[i]);
-                         prev_G.data[i] = g;
-                    }
-                    gamma_numerator = SCALAR_RE(evectmatrix_traceXtY(G, X));
+                    gamma_numerator = SCALAR_RE(trace_s[0])
+			 - SCALAR_RE(trace_s[1]);
+                    evectmatrix_copy(prev_G, G);
 
 		    { real g = g_lag; g_lag -= prev_g_lag; prev_g_lag = g; }
 		    gamma_numerator += g_lag * prev_g_lag;
@@ -558,6 +838,8 @@ void eigensolver_lagrange(evectmatrix Y, real *eigenvals,
 	  if (!use_linmin) {
 	       real dE, E2, d2E, t, d_norm;
 
+	       ay_valid = 0; /* no A*D here, so AY can't be updated */
+
 	       /* Here, we do an approximate line minimization along D
 		  by evaluating dE (the derivative) at the current point,
 		  and the trace E2 at a second point, and then approximating
@@ -567,13 +849,15 @@ void eigensolver_lagrange(evectmatrix Y, real *eigenvals,
 	          matrix multiplications compared to the exact linmin. */
 
                if (B) B(D, BD, Bdata, 0, BD); /* B*Y; no scratch */
-               
-	       d_norm = sqrt(SCALAR_RE(evectmatrix_traceXtY(BD,D)) / Y.p);
-	       mpi_assert_equal(d_norm);
 
 	       /* dE = 2 * tr Gt D.  (Use prev_G instead of G so that
 		  it works even when we are using Polak-Ribiere.) */
-	       dE = 2.0 * SCALAR_RE(evectmatrix_traceXtY(prev_G, D)) / d_norm;
+	       evectreduce_traceXtY(&R, &trace_s[0], BD, D);
+	       evectreduce_traceXtY(&R, &trace_s[1], prev_G, D);
+	       evectreduce_sum(&R);
+	       d_norm = sqrt(SCALAR_RE(trace_s[0]) / Y.p);
+	       mpi_assert_equal(d_norm);
+	       dE = 2.0 * SCALAR_RE(trace_s[1]) / d_norm;
 
 	       /* shift Y by prev_theta along D, in the downhill direction: */
 	       t = dE < 0 ? -fabs(prev_theta) : fabs(prev_theta);
@@ -581,22 +865,24 @@ void eigensolver_lagrange(evectmatrix Y, real *eigenvals,
 
                if (B) {
                    B(Y, BY, Bdata, 1, G); /* B*Y; G is scratch */
-                   evectmatrix_XtY(U, Y, BY, S2);
+                   evectreduce_XtY(&R, U, Y, BY);
                }
                else
-                   evectmatrix_XtX(U, Y, S2);
-	       CHECK(sqmatrix_invert(U, 1, S2),
-		     "singular YtBY");  /* U = 1 / (Yt B Y) */
+                   evectreduce_XtX(&R, U, Y);
 	       A(Y, G, Adata, 1, X); /* G = AY; X is scratch */
-	       evectmatrix_XtY(S1, Y, G, S2);  /* S1 = Yt A Y */
-
-	       E2 = SCALAR_RE(sqmatrix_traceAtB(S1, U));
-
+	       evectreduce_XtY(&R, S1, Y, G);  /* S1 = Yt A Y */
 	       if (L) {
 		    *lag += (t / d_norm) * d_lag;
 		    L(Y, X, Ldata, 1, X);
-		    E2 += *lag * SCALAR_RE(evectmatrix_traceXtY(Y, X));
+		    evectreduce_traceXtY(&R, &trace_s[0], Y, X);
 	       }
+	       evectreduce_sum(&R);
+	       CHECK(sqmatrix_invert(U, 1, S2),
+		     "singular YtBY");  /* U = 1 / (Yt B Y) */
+
+	       E2 = SCALAR_RE(sqmatrix_traceAtB(S1, U));
+	       if (L)
+		    E2 += *lag * SCALAR_RE(trace_s[0]);
 	       
 	       mpi_assert_equal(E2);
 
@@ -640,26 +926,40 @@ void eigensolver_lagrange(evectmatrix Y, real *eigenvals,
 	       real dE, d2E;
 
                if (B) B(D, BD, Bdata, 0, G); /* B*Y; G is scratch */
-               
-	       d_scale = sqrt(SCALAR_RE(evectmatrix_traceXtY(BD, D)) / Y.p);
-	       mpi_assert_equal(d_scale);
-	       blasglue_rscal(Y.p * Y.n, 1/d_scale, D.data, 1);
-	       if (B) blasglue_rscal(Y.p * Y.n, 1/d_scale, BD.data, 1);
-
 	       A(D, G, Adata, 0, X); /* G = A D; X is scratch */
+	       if (L)
+		    L(D, X, Ldata, 0, X);
+
+	       /* Compute all of the projections of D at once (with a
+		  single reduction), and then normalize D to have
+		  tr Dt B D = p, rescaling the projections to match: */
                if (B)
-                   evectmatrix_XtY(DtBD, D, BD, S2);
+                   evectreduce_XtY(&R, DtBD, D, BD);
                else
-                   evectmatrix_XtX(DtBD, D, S2);
-	       evectmatrix_XtY(DtAD, D, G, S2);
+                   evectreduce_XtX(&R, DtBD, D);
+	       evectreduce_XtY(&R, DtAD, D, G);
+	       evectreduce_XtY(&R, S1, Y, BD);
+	       evectreduce_XtY(&R, S2, Y, G);
+	       if (L) {
+		    evectreduce_traceXtY(&R, &trace_s[0], D, X);
+		    evectreduce_traceXtY(&R, &trace_s[1], Y, X);
+	       }
+	       evectreduce_sum(&R);
+
+	       d_scale = sqrt(SCALAR_RE(sqmatrix_trace(DtBD)) / Y.p);
+	       mpi_assert_equal(d_scale);
+	       blasglue_rscal(Y.p * Y.n, 1/d_scale, D.data, 1);
+	       if (B) blasglue_rscal(Y.p * Y.n, 1/d_scale, BD.data, 1);
+	       blasglue_rscal(Y.p * Y.n, 1/d_scale, G.data, 1);
+	       blasglue_rscal(Y.p * Y.p, 1/(d_scale*d_scale), DtBD.data, 1);
+	       blasglue_rscal(Y.p * Y.p, 1/(d_scale*d_scale), DtAD.data, 1);
 	       sqmatrix_assert_hermitian(DtBD);
 	       sqmatrix_assert_hermitian(DtAD);
-	       
-	       evectmatrix_XtY(S1, Y, BD, S2);
-	       sqmatrix_symmetrize(symYtBD, S1);
 
-	       evectmatrix_XtY(S1, Y, G, S2);
-	       sqmatrix_symmetrize(symYtAD, S1);
+	       sqmatrix_symmetrize(symYtBD, S1);
+	       blasglue_rscal(Y.p * Y.p, 1/d_scale, symYtBD.data, 1);
+	       sqmatrix_symmetrize(symYtAD, S2);
+	       blasglue_rscal(Y.p * Y.p, 1/d_scale, symYtAD.data, 1);
 
 	       sqmatrix_AeBC(S1, U, 0, symYtBD, 1);
 	       dE = 2.0 * (SCALAR_RE(sqmatrix_traceAtB(U, symYtAD)) -
@@ -678,9 +978,9 @@ void eigensolver_lagrange(evectmatrix Y, real *eigenvals,
 		    tfd.d_lag = d_lag;
 		    tfd.lag = *lag;
 		    /* note: tfd.trace_YtLY was set above */
-		    L(D, X, Ldata, 0, X);
-		    tfd.trace_DtLD = SCALAR_RE(evectmatrix_traceXtY(D, X));
-		    tfd.trace_YtLD = SCALAR_RE(evectmatrix_traceXtY(Y, X));
+		    tfd.trace_DtLD = SCALAR_RE(trace_s[0])
+			 / (d_scale * d_scale);
+		    tfd.trace_YtLD = SCALAR_RE(trace_s[1]) / d_scale;
 		    dE += tfd.lag * 2.0 * tfd.trace_YtLD
 			 + tfd.d_lag * tfd.trace_YtLY;
 		    d2E += tfd.lag * 2.0 * tfd.trace_DtLD
@@ -734,13 +1034,22 @@ void eigensolver_lagrange(evectmatrix Y, real *eigenvals,
 	       /* Shift Y to new location minimizing the trace along D: */
 	       evectmatrix_aXpbY(cos(theta), Y, sin(theta), D);
 	       if (L) *lag = *lag * cos(theta) + d_lag * sin(theta);
+
+	       if (ay_valid) { /* G = A D from above */
+		    evectmatrix_aXpbY(cos(theta), AY, sin(theta), G);
+		    ++ay_age;
+	       }
 	  }
 
 	  /* In exact arithmetic, we don't need to do this, but in practice
 	     it is probably a good idea to keep errors from adding up and
-	     eventually violating the constraints. */
-	  if (constraint)
+	     eventually violating the constraints.  (The constraints
+	     commute with A, so we can apply them to AY as well.) */
+	  if (constraint) {
                constraint(Y, constraint_data);
+	       if (ay_valid)
+		    constraint(AY, constraint_data);
+	  }
 
 	  prev_traceGtX = traceGtX;
           prev_theta = theta;
@@ -749,7 +1058,7 @@ void eigensolver_lagrange(evectmatrix Y, real *eigenvals,
 	  /* Finally, we use the times for the various operations to
 	     help us pick an algorithm for the next iteration: */
 	  {
-	       real t_exact, t_approx;
+	       real t_exact, t_approx, t[4];
 	       t_exact = EXACT_LINMIN_TIME(time_AZ, time_KZ, time_ZtW,
 					   time_ZS, time_ZtZ, time_linmin);
 	       t_approx = APPROX_LINMIN_TIME(time_AZ, time_KZ, time_ZtW,
@@ -758,13 +1067,15 @@ void eigensolver_lagrange(evectmatrix Y, real *eigenvals,
 		    t_exact += time_ZtW + time_ZS;
 		    t_approx += time_ZtW + time_ZS;
 	       }
+	       if (use_ay_recurrence) /* A*Y is (mostly) free with linmin */
+		    t_exact -= time_AZ;
 
 	       /* Sum the times over the processors so that all the
 		  processors compare the same, average times. */
-	       mpi_allreduce_1(&t_exact,
-			       real, SCALAR_MPI_TYPE, MPI_SUM, mpb_comm);
-	       mpi_allreduce_1(&t_approx, 
-			       real, SCALAR_MPI_TYPE, MPI_SUM, mpb_comm);
+	       t[0] = t_exact; t[1] = t_approx;
+	       mpi_allreduce(t, t + 2, 2,
+			     real, SCALAR_MPI_TYPE, MPI_SUM, mpb_comm);
+	       t_exact = t[2]; t_approx = t[3];
 
 	       if (!(flags & EIGS_FORCE_EXACT_LINMIN) &&
 		   linmin_improvement > 0 &&
@@ -791,6 +1102,34 @@ void eigensolver_lagrange(evectmatrix Y, real *eigenvals,
            STRINGIZE(EIGENSOLVER_MAX_ITERATIONS)
            " iterations");
 
+     if (nlocked > 0) {
+	  /* put the active and locked bands back together into an
+	     n x p matrix Y, using G as scratch: */
+	  int pa = Y.p, in, ip;
+	  evectmatrix_resize(&G, p, 0);
+	  for (in = 0; in < Y.n * p; ++in)
+	       G.data[in] = Y.data[in];
+	  evectmatrix_resize(&Y, p, 0);
+	  for (in = 0; in < Y.n; ++in) {
+	       for (ip = 0; ip < nlocked; ++ip)
+		    Y.data[in * p + ip] = G.data[Y.n * pa + in * nlocked + ip];
+	       for (ip = 0; ip < pa; ++ip)
+		    Y.data[in * p + nlocked + ip] = G.data[in * pa + ip];
+	  }
+	  evectmatrix_resize(&X, p, 0);
+	  sqmatrix_resize(&U, p, 0);
+	  sqmatrix_resize(&S1, p, 0);
+	  sqmatrix_resize(&S2, p, 0);
+	  if (flags & EIGS_VERBOSE)
+	       mpi_one_printf("    %d/%d bands were locked\n", nlocked, p);
+     }
+     if (use_locking) {
+	  free(ld.S2);
+	  free(ld.S);
+	  free(rnorm2);
+	  free(lock_eigs);
+     }
+
      if (B) {
          B(Y, BY, Bdata, 1, G); /* B*Y; G is scratch */
          evectmatrix_XtY(U, Y, BY, S2);
@@ -803,6 +1142,7 @@ void eigensolver_lagrange(evectmatrix Y, real *eigenvals,
 
      *num_iterations = iteration;
      
+     destroy_evectreduce(R);
      destroy_sqmatrix(S3);
      destroy_sqmatrix(S2);
      destroy_sqmatrix(S1);
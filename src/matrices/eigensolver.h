@@ -68,10 +68,54 @@ extern void eigensolver_davidson(evectmatrix Y, real *eigenvals,
 				 int flags,
 				 real target);
 
+extern void eigensolver_lobpcg(evectmatrix Y, real *eigenvals,
+			       evectoperator A, void *Adata,
+			       evectoperator B, void *Bdata,
+			       evectpreconditioner K, void *Kdata,
+			       evectconstraint constraint,
+			       void *constraint_data,
+			       evectmatrix Work[], int nWork,
+			       real tolerance, int *num_iterations,
+			       int flags);
+extern void eigensolver_lobpcg_batch(evectmatrix Y, real *eigenvals,
+				     evectoperator A, void *Adata,
+				     evectpreconditioner K, void *Kdata,
+				     evectconstraint constraint,
+				     void *constraint_data,
+				     evectmatrix Work[], int nWork,
+				     real tolerance, int *num_iterations,
+				     int flags, int nblocks);
+
+extern void eigensolver_chebyshev(evectmatrix Y, real *eigenvals,
+				  evectoperator A, void *Adata,
+				  evectconstraint constraint,
+				  void *constraint_data,
+				  evectmatrix Work[], int nWork,
+				  real tolerance, int *num_iterations,
+				  int flags, int degree);
+
+extern void eigensolver_jacobi_davidson(evectmatrix Y, real *eigenvals,
+					evectoperator A, void *Adata,
+					evectpreconditioner K, void *Kdata,
+					evectconstraint constraint,
+					void *constraint_data,
+					evectmatrix Work[], int nWork,
+					real tolerance, int *num_iterations,
+					int flags,
+					real target);
+
+extern int eigensolver_orthonormalize(evectmatrix Y, evectmatrix Work,
+				      sqmatrix T, sqmatrix S1, sqmatrix S2,
+				      int flags);
+
 extern void eigensolver_get_eigenvals(evectmatrix Y, real *eigenvals,
 				      evectoperator A, void *Adata,
 				      evectmatrix Work1, evectmatrix Work2);
 
+extern evectmatrix eigensolver_subspace_matrix(evectmatrix Y, int p,
+					       evectmatrix Work[], int nWork,
+					       int i, int *allocated);
+
 /* eigensolver option flags, designed to be combined with a bitwise or ('|');
    each flag should set exactly one bit. */
 #define EIGS_VERBOSE (1<<0)
@@ -83,6 +127,15 @@ extern void eigensolver_get_eigenvals(evectmatrix Y, real *eigenvals,
 #define EIGS_REORTHOGONALIZE (1<<6)
 #define EIGS_DYNAMIC_RESET_CG (1<<7)
 #define EIGS_ORTHOGONAL_PRECONDITIONER (1<<8)
+/* update A*Y by recurrence from A*D instead of applying A to Y on every
+   iteration (exact line minimization only); needs one extra Work matrix */
+#define EIGS_RECURRENCE_AY (1<<9)
+/* lock converged bands, shrinking the active block (ordinary problems) */
+#define EIGS_LOCKING (1<<10)
+/* orthonormalize by CholeskyQR2 or by a tall-skinny QR (see
+   eigensolver_orthonormalize) instead of with 1/sqrt(Yt*Y) */
+#define EIGS_CHOLQR (1<<11)
+#define EIGS_TSQR (1<<12)
 
 /* default flags: what we think works best most of the time: */
 #define EIGS_DEFAULT_FLAGS (EIGS_RESET_CG | EIGS_REORTHOGONALIZE)
@@ -0,0 +1,313 @@
+/* Copyright (C) 1999-2014 Massachusetts Institute of Technology.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/* This file contains an alternative eigensolver for computing many
+   bands at once, Chebyshev-filtered subspace iteration:
+
+   Y. Zhou, Y. Saad, M. L. Tiago, and J. R. Chelikowsky, "Self-consistent
+   field calculations using Chebyshev-filtered subspace iteration,"
+   J. Comput. Phys. 219, pp. 172-184 (2006).
+
+   Each outer iteration applies a Chebyshev polynomial in A to the
+   whole block Y, which amplifies the wanted (lowest) part of the
+   spectrum relative to the rest, followed by a single Rayleigh-Ritz
+   step.  The filter needs no inner products at all, only applications
+   of A and axpy operations, so there is no per-band orthogonalization
+   or deflation; the only dense operations are in the Rayleigh-Ritz
+   step (BLAS3).  The upper end of the spectrum, needed to define the
+   filter, is estimated by a few steps of Lanczos on a random vector. */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+
+#include "config.h"
+#include <mpiglue.h>
+#include <mpi_utils.h>
+#include <check.h>
+#include <scalar.h>
+#include <matrices.h>
+#include <blasglue.h>
+
+#include "eigensolver.h"
+
+#define STRINGIZEx(x) #x /* a hack so that we can stringize macro values */
+#define STRINGIZE(x) STRINGIZEx(x)
+
+#if defined(SCALAR_LONG_DOUBLE_PREC)
+#  define fabs fabsl
+#  define sqrt sqrtl
+#endif
+
+/**************************************************************************/
+
+#define EIGENSOLVER_MAX_ITERATIONS 10000
+#define FEEDBACK_TIME 4.0 /* elapsed time before we print progress feedback */
+
+/* number of Lanczos steps used to estimate the top of the spectrum */
+#define LANCZOS_STEPS 12
+
+#define SWAP_EVECT(a,b) { evectmatrix xxx_swap = a; a = b; b = xxx_swap; }
+
+/**************************************************************************/
+
+/* Return an upper bound for the eigenvalues of A, via a few Lanczos
+   steps on a random vector: the largest Ritz value plus the norm of
+   the last residual.  v, w, and vprev are n x 1 scratch matrices. */
+static real lanczos_upper_bound(evectoperator A, void *Adata,
+				evectconstraint constraint,
+				void *constraint_data,
+				evectmatrix v, evectmatrix w, evectmatrix vprev)
+{
+     sqmatrix T, Twork;
+     real eigs[LANCZOS_STEPS], alpha, beta = 0, norm, bound;
+     int i, j;
+
+     for (i = 0; i < v.n; ++i)
+	  ASSIGN_SCALAR(v.data[i],
+			rand() * 1.0 / RAND_MAX - 0.5,
+			rand() * 1.0 / RAND_MAX - 0.5);
+     if (constraint)
+	  constraint(v, constraint_data);
+     norm = sqrt(SCALAR_RE(evectmatrix_traceXtY(v, v)));
+     CHECK(norm > 0, "zero vector in Lanczos bound estimate");
+     blasglue_rscal(v.n, 1/norm, v.data, 1);
+     for (i = 0; i < vprev.n; ++i)
+	  ASSIGN_ZERO(vprev.data[i]);
+
+     T = create_sqmatrix(LANCZOS_STEPS);
+     Twork = create_sqmatrix(LANCZOS_STEPS);
+     for (i = 0; i < LANCZOS_STEPS * LANCZOS_STEPS; ++i)
+	  ASSIGN_ZERO(T.data[i]);
+
+     for (j = 0; j < LANCZOS_STEPS; ++j) {
+	  A(v, w, Adata, 0, w); /* w = A v; no scratch */
+	  alpha = SCALAR_RE(evectmatrix_traceXtY(v, w));
+	  evectmatrix_aXpbY(1.0, w, -alpha, v);
+	  evectmatrix_aXpbY(1.0, w, -beta, vprev);
+	  beta = sqrt(SCALAR_RE(evectmatrix_traceXtY(w, w)));
+	  mpi_assert_equal(beta);
+	  ASSIGN_REAL(T.data[j * LANCZOS_STEPS + j], alpha);
+	  if (j + 1 < LANCZOS_STEPS) {
+	       ASSIGN_REAL(T.data[j * LANCZOS_STEPS + j + 1], beta);
+	       ASSIGN_REAL(T.data[(j+1) * LANCZOS_STEPS + j], beta);
+	  }
+	  if (beta == 0) /* invariant subspace: the bound is exact */
+	       break;
+	  evectmatrix_copy(vprev, v);
+	  evectmatrix_copy(v, w);
+	  blasglue_rscal(v.n, 1/beta, v.data, 1);
+     }
+
+     sqmatrix_resize(&T, j < LANCZOS_STEPS ? j + 1 : LANCZOS_STEPS, 1);
+     sqmatrix_eigensolve(T, eigs, Twork);
+     bound = eigs[T.p - 1] + beta;
+
+     destroy_sqmatrix(Twork);
+     destroy_sqmatrix(T);
+     return bound;
+}
+
+/**************************************************************************/
+
+/* Number of extra "guard" bands to iterate along with the p wanted
+   bands.  The filter damps everything above the largest Ritz value
+   of the subspace, so without guard bands the highest wanted band
+   would be damped as much as the unwanted ones, and would converge
+   very slowly; with them, the wanted bands are separated from the
+   damped interval by (roughly) the gap to band p + guard. */
+#define GUARD_BANDS(p) ((p) / 10 + 2)
+
+/* Solve for the Y.p lowest eigenvectors of A by Chebyshev-filtered
+   subspace iteration, using a filter polynomial of the given degree
+   in each outer iteration.  The iteration runs on a subspace of
+   Y.p + GUARD_BANDS(Y.p) vectors, and needs four matrices of that
+   size: Work[0..3] are used if they are big enough (nWork may be
+   smaller), and otherwise the matrices are allocated here.  The
+   iteration stops when every wanted band has a residual norm
+   |A y - lambda y|^2 <= tolerance * lambda^2, as in LOBPCG.
+   On output, Y is orthonormal and contains the eigenvectors. */
+void eigensolver_chebyshev(evectmatrix Y, real *eigenvals,
+			   evectoperator A, void *Adata,
+			   evectconstraint constraint, void *constraint_data,
+			   evectmatrix Work[], int nWork,
+			   real tolerance, int *num_iterations,
+			   int flags, int degree)
+{
+     evectmatrix X, X1, X2, X3, Xm[4];
+     sqmatrix U, S1, S2;
+     real *eigs, *rnorm2, *rscratch, upper;
+     int allocated[4];
+     int p = Y.p, q = Y.p + GUARD_BANDS(Y.p), i, nconv, iteration = 0;
+     mpiglue_clock_t prev_feedback_time;
+
+     prev_feedback_time = MPIGLUE_CLOCK;
+
+#ifdef DEBUG
+     flags |= EIGS_VERBOSE;
+#endif
+
+     CHECK(degree >= 1, "Chebyshev filter degree must be positive");
+
+     if (q > Y.N * Y.c) /* (can't have more bands than the problem size) */
+	  q = Y.N * Y.c;
+     CHECK(q >= p, "more bands than the size of the problem");
+     for (i = 0; i < 4; ++i)
+	  Xm[i] = eigensolver_subspace_matrix(Y, q, Work, nWork, i,
+					     &allocated[i]);
+     CHK_MALLOC(eigs, real, q);
+     CHK_MALLOC(rnorm2, real, q);
+     CHK_MALLOC(rscratch, real, q);
+
+     /* estimate the top of the spectrum, using (columns of) the
+	workspace as Lanczos vectors: */
+     {
+	  evectmatrix v = Xm[1], w = Xm[2], vprev = Xm[3];
+	  evectmatrix_resize(&v, 1, 0);
+	  evectmatrix_resize(&w, 1, 0);
+	  evectmatrix_resize(&vprev, 1, 0);
+	  upper = lanczos_upper_bound(A, Adata, constraint, constraint_data,
+				      v, w, vprev);
+	  mpi_assert_equal(upper);
+	  if (flags & EIGS_VERBOSE)
+	       mpi_one_printf("    Chebyshev filter: upper bound %g, "
+			      "%d guard bands\n", (double) upper, q - p);
+     }
+
+     U = create_sqmatrix(q);
+     S1 = create_sqmatrix(q);
+     S2 = create_sqmatrix(q);
+
+     /* The buffers get swapped around below; X always holds the current
+	subspace, and X1, X2, X3 are free.  The subspace starts with Y
+	and random guard vectors. */
+     X = Xm[0]; X1 = Xm[1]; X2 = Xm[2]; X3 = Xm[3];
+     evectmatrix_copy_slice(X, Y, 0, 0, p);
+     for (i = 0; i < X.n; ++i) {
+	  int k;
+	  for (k = p; k < q; ++k)
+	       ASSIGN_SCALAR(X.data[i*q + k],
+			     rand() * 1.0 / RAND_MAX - 0.5,
+			     rand() * 1.0 / RAND_MAX - 0.5);
+     }
+     if (constraint)
+	  constraint(X, constraint_data);
+
+     do {
+	  /* Rayleigh-Ritz: orthonormalize X, diagonalize Xt A X, and
+	     rotate X (and A X) to the Ritz vectors.  The filtered X is
+	     badly conditioned, so it is orthonormalized twice: otherwise
+	     X1 is orthonormal only to about cond(X) * epsilon, and the
+	     Ritz values are off by more than the residuals imply. */
+	  for (i = 0; i < 2; ++i) {
+	       evectmatrix_XtX(U, X, S2);
+	       CHECK(sqmatrix_invert(U, 1, S2), "non-independent subspace");
+	       sqmatrix_sqrt(S1, U, S2); /* S1 = 1/sqrt(Xt X) */
+	       evectmatrix_XeYS(X1, X, S1, 1);
+	       if (i == 0)
+		    SWAP_EVECT(X, X1);
+	  }
+	  A(X1, X2, Adata, 1, X3); /* X2 = A X1 */
+	  evectmatrix_XtY(U, X1, X2, S2);
+	  sqmatrix_assert_hermitian(U);
+	  sqmatrix_eigensolve(U, eigs, S2);
+	  /* eigenvectors are the rows of U: */
+	  evectmatrix_aXpbYS_sub(0.0, X, 1.0, X1, U, 0, 1);
+	  evectmatrix_aXpbYS_sub(0.0, X3, 1.0, X2, U, 0, 1); /* A X */
+
+	  /* X3 = residuals A X - X eigs of the wanted bands: */
+	  matrix_XpaY_diag_real(X3.data, -1.0, X.data, eigs, X3.n, q);
+	  evectmatrix_XtX_diag_real(X3, rnorm2, rscratch);
+	  for (nconv = i = 0; i < p; ++i)
+	       nconv += rnorm2[i] <= tolerance * eigs[i] * eigs[i];
+
+	  if (iteration > 0 && mpi_is_master() &&
+	      ((flags & EIGS_VERBOSE) ||
+	       MPIGLUE_CLOCK_DIFF(MPIGLUE_CLOCK, prev_feedback_time)
+	       > FEEDBACK_TIME)) {
+	       real E = 0;
+	       for (i = 0; i < p; ++i)
+		    E += eigs[i];
+               mpi_one_printf("    iteration %4d: "
+			      "trace = %0.16g, %d/%d bands converged\n",
+			      iteration, (double) E, nconv, p);
+               fflush(stdout); /* make sure output appears */
+               prev_feedback_time = MPIGLUE_CLOCK; /* reset feedback clock */
+          }
+
+	  if (nconv == p)
+               break; /* convergence!  hooray! */
+
+	  /* Apply the Chebyshev filter of the given degree, which damps
+	     the interval [eigs[q-1], upper] (above the guard bands)
+	     relative to the wanted eigenvalues below it, scaled to avoid
+	     overflow by using eigs[0] (the three-term recurrence of
+	     Zhou et al.). */
+	  {
+	       real a = eigs[q - 1], b = upper;
+	       real e = (b - a) * 0.5, c = (b + a) * 0.5;
+	       real sigma, sigma1, sigma2;
+	       int m;
+
+	       if (e <= 0) /* the subspace fills the whole spectrum */
+		    break;
+	       sigma = sigma1 = e / (eigs[0] - c);
+
+	       /* X1 = (A X - c X) sigma1 / e */
+	       A(X, X1, Adata, 0, X3);
+	       evectmatrix_aXpbY(sigma1 / e, X1, -c * sigma1 / e, X);
+	       for (m = 2; m <= degree; ++m) {
+		    sigma2 = 1.0 / (2.0 / sigma1 - sigma);
+		    /* X2 = 2 sigma2 / e (A X1 - c X1) - sigma sigma2 X */
+		    A(X1, X2, Adata, 0, X3);
+		    evectmatrix_aXpbY(2.0 * sigma2 / e, X2,
+				      -2.0 * sigma2 * c / e, X1);
+		    evectmatrix_aXpbY(1.0, X2, -sigma * sigma2, X);
+		    SWAP_EVECT(X, X1); /* X = X1, X1 = X2, X2 = old X */
+		    SWAP_EVECT(X1, X2);
+		    sigma = sigma2;
+	       }
+	       SWAP_EVECT(X, X1); /* X = filtered subspace */
+	  }
+
+	  /* In exact arithmetic, the filter commutes with the constraints,
+	     but we re-apply them to avoid accumulated errors. */
+	  if (constraint)
+	       constraint(X, constraint_data);
+     } while (++iteration < EIGENSOLVER_MAX_ITERATIONS);
+
+     CHECK(iteration < EIGENSOLVER_MAX_ITERATIONS,
+           "failure to converge after "
+           STRINGIZE(EIGENSOLVER_MAX_ITERATIONS)
+           " iterations");
+
+     evectmatrix_copy_slice(Y, X, 0, 0, p);
+     for (i = 0; i < p; ++i)
+	  eigenvals[i] = eigs[i];
+
+     destroy_sqmatrix(S2);
+     destroy_sqmatrix(S1);
+     destroy_sqmatrix(U);
+     free(rscratch);
+     free(rnorm2);
+     free(eigs);
+     for (i = 0; i < 4; ++i)
+	  if (allocated[i])
+	       destroy_evectmatrix(Xm[i]);
+
+     *num_iterations = iteration;
+}
@@ -99,10 +99,9 @@ void eigensolver_davidson(evectmatrix Y, real *eigenvals,
      if (constraint)
 	  constraint(Y, constraint_data);
 
-     evectmatrix_XtX(U, Y, S3);
-     CHECK(sqmatrix_invert(U, 1, S3), "singular YtY at start");
-     sqmatrix_sqrt(S2, U, S3); /* S2 = 1/sqrt(Yt*Y) */
-     evectmatrix_XeYS(V[0], Y, S2, 1); /* V[0] = orthonormalize Y */
+     evectmatrix_copy(V[0], Y);
+     CHECK(eigensolver_orthonormalize(V[0], AV[0], S2, U, S3, flags),
+	   "singular YtY at start"); /* V[0] = orthonormalize Y */
 
      do {
 	  real E;
@@ -210,10 +209,10 @@ void eigensolver_davidson(evectmatrix Y, real *eigenvals,
 	       }
 
 	       /* orthonormalize within itself: */
-	       evectmatrix_XtX(U, AV[ibasis2], S3);
-	       CHECK(sqmatrix_invert(U, 1, S3), "non-independent AV subspace");
-	       sqmatrix_sqrt(S2, U, S3);
-	       evectmatrix_XeYS(V[ibasis2], AV[ibasis2], S2, 1);
+	       evectmatrix_copy(V[ibasis2], AV[ibasis2]);
+	       CHECK(eigensolver_orthonormalize(V[ibasis2], AV[ibasis2],
+						S2, U, S3, flags),
+		     "non-independent AV subspace");
 
 	       ibasis = ibasis2;
 	  }
@@ -0,0 +1,550 @@
+/* Copyright (C) 1999-2014 Massachusetts Institute of Technology.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/* This file contains a targeted eigensolver, finding the eigenvalues
+   of A closest to a given target (in the interior of the spectrum),
+   by a block Jacobi-Davidson method with harmonic Ritz extraction:
+
+   G. L. G. Sleijpen and H. A. Van der Vorst, "A Jacobi-Davidson
+   iteration method for linear eigenvalue problems," SIAM J. Matrix
+   Anal. Appl. 17, pp. 401-425 (1996).
+
+   R. B. Morgan, "Computing interior eigenvalues of large matrices,"
+   Linear Algebra Appl. 154-156, pp. 289-309 (1991).
+
+   In contrast to minimizing with the squared operator (A - target)^2,
+   this doesn't square the condition number, and A is applied only
+   once per iteration plus once per inner iteration of the correction
+   equation.  We keep a search space V along with W = (A - target) V,
+   where W is orthonormal.  The harmonic Ritz vectors are then the
+   eigenvectors of the small Hermitian matrix Wt V = Vt (A - target) V
+   with the largest-magnitude eigenvalues 1/(theta - target).  The
+   correction equation is solved approximately by preconditioned
+   MINRES (which, unlike CG, is fine with the indefinite operator of
+   an interior eigenproblem), to a relative accuracy that tightens as
+   the outer iteration proceeds (Fokkema et al., SIAM J. Sci. Comput.
+   20, pp. 94-125, 1998).  When the search space is full, we do a
+   "thick" restart, keeping the harmonic Ritz vectors closest to the
+   target from about half of the space. */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+
+#include "config.h"
+#include <mpiglue.h>
+#include <mpi_utils.h>
+#include <check.h>
+#include <scalar.h>
+#include <matrices.h>
+#include <blasglue.h>
+
+#include "eigensolver.h"
+
+#define STRINGIZEx(x) #x /* a hack so that we can stringize macro values */
+#define STRINGIZE(x) STRINGIZEx(x)
+
+#if defined(SCALAR_LONG_DOUBLE_PREC)
+#  define fabs fabsl
+#  define sqrt sqrtl
+#endif
+
+/**************************************************************************/
+
+#define EIGENSOLVER_MAX_ITERATIONS 100000
+#define FEEDBACK_TIME 4.0 /* elapsed time before we print progress feedback */
+
+/* maximum number of MINRES iterations for the correction equation,
+   and the factor by which its relative tolerance shrinks with each
+   outer iteration */
+#define JD_MAX_INNER_ITERATIONS 20
+#define JD_INNER_TOLERANCE_FACTOR 0.7
+
+/* number of blocks in the search space (before a thick restart), and
+   of workspace matrices used for scratch besides the search space (by
+   the outer iteration and by MINRES) */
+#define JD_BASIS_BLOCKS 7
+#define JD_SCRATCH 6
+
+/* The iteration runs on Y.p + JD_GUARD_BANDS(Y.p) vectors, of which
+   the Y.p closest to the target are returned.  An interior eigensolver
+   can converge to eigenvectors that are not the closest ones, if the
+   closest ones never entered the search space; the guard vectors make
+   it much more likely that the wanted ones do. */
+#define JD_GUARD_BANDS(p) ((p) / 10 + 2)
+
+/**************************************************************************/
+
+/* Make W orthonormal by W = W S, S = 1/sqrt(Wt W), applying the same
+   transformation to V (so that W = (A - target) V still holds).
+   T is a scratch matrix, and U, S2, S3 are p x p scratch matrices. */
+static void orthonormalize_W(evectmatrix V, evectmatrix W, evectmatrix T,
+			     sqmatrix U, sqmatrix S2, sqmatrix S3)
+{
+     evectmatrix_XtX(U, W, S3);
+     CHECK(sqmatrix_invert(U, 1, S3), "non-independent Jacobi-Davidson "
+	   "search space");
+     sqmatrix_sqrt(S2, U, S3); /* S2 = 1/sqrt(Wt W) */
+     evectmatrix_XeYS(T, W, S2, 1);
+     evectmatrix_copy(W, T);
+     evectmatrix_XeYS(T, V, S2, 1);
+     evectmatrix_copy(V, T);
+}
+
+/* Add block ib of the search space, given V[ib] and W[ib] = (A - target)
+   V[ib]: make W[ib] orthonormal to W[0..ib-1] (twice, for numerical
+   stability) and to itself, with V[ib] updated to match, and add the
+   new column blocks Wt V[ib] to (the upper triangle of) G. */
+static void add_block(evectmatrix *V, evectmatrix *W, int ib, sqmatrix *G,
+		      evectmatrix T, sqmatrix U, sqmatrix S2, sqmatrix S3)
+{
+     int i, k, p = V[ib].p, q = p * (ib + 1);
+
+     for (k = 0; k < 2; ++k)
+	  for (i = 0; i < ib; ++i) {
+	       evectmatrix_XtY(U, W[i], W[ib], S3);
+	       evectmatrix_XpaYS(W[ib], -1.0, W[i], U, 0);
+	       evectmatrix_XpaYS(V[ib], -1.0, V[i], U, 0);
+	  }
+     orthonormalize_W(V[ib], W[ib], T, U, S2, S3);
+
+     sqmatrix_resize(G, q, 1);
+     for (i = 0; i <= ib; ++i)
+	  evectmatrixXtY_sub(*G, p * (q * i + ib), W[i], V[ib], S3);
+}
+
+/* Set X = (1 - Y Yt) X, where Y is orthonormal.  U and S are p x p
+   scratch matrices. */
+static void project_out(evectmatrix X, evectmatrix Y, sqmatrix U, sqmatrix S)
+{
+     evectmatrix_XtY(U, Y, X, S);
+     evectmatrix_XpaYS(X, -1.0, Y, U, 0);
+}
+
+/* Multiply column b of X by s[b]. */
+static void scale_columns(evectmatrix X, const real *s)
+{
+     int i, b;
+     for (i = 0; i < X.n; ++i)
+	  for (b = 0; b < X.p; ++b)
+	       ASSIGN_SCALAR(X.data[i * X.p + b],
+			     SCALAR_RE(X.data[i * X.p + b]) * s[b],
+			     SCALAR_IM(X.data[i * X.p + b]) * s[b]);
+}
+
+/* Set z = (1 - Y Yt) K r, for r orthogonal to Y (or z = r if K is
+   NULL), i.e. apply the projected preconditioner. */
+static void precondition_projected(evectmatrix r, evectmatrix z,
+				   evectmatrix Y,
+				   evectpreconditioner K, void *Kdata,
+				   evectconstraint constraint,
+				   void *constraint_data,
+				   sqmatrix U, sqmatrix S, sqmatrix I)
+{
+     if (K == NULL) {
+	  evectmatrix_copy(z, r);
+	  return;
+     }
+     K(r, z, Kdata, Y, NULL, I);
+     if (constraint)
+	  constraint(z, constraint_data);
+     project_out(z, Y, U, S);
+}
+
+/* Solve the correction equation P (A - theta) P x = b, where
+   P = 1 - Y Yt and b is orthogonal to Y, approximately by
+   preconditioned MINRES (C. C. Paige and M. A. Saunders, SIAM J.
+   Numer. Anal. 12, pp. 617-629, 1975) with the projected
+   preconditioner P K P, separately for each column (with its own
+   theta).  A column stops changing once its (preconditioned) residual
+   has been reduced by the factor eta.  b is destroyed, s[0..5] are
+   scratch matrices, and d is scratch of 12 * x.p reals.  Returns the
+   number of iterations, i.e. of applications of A to the block. */
+static int correction_minres(evectmatrix x, evectmatrix b, evectmatrix Y,
+			     real *theta, real eta,
+			     evectoperator A, void *Adata,
+			     evectpreconditioner K, void *Kdata,
+			     evectconstraint constraint,
+			     void *constraint_data,
+			     evectmatrix s[], sqmatrix U, sqmatrix S,
+			     sqmatrix I, real *d)
+{
+     evectmatrix r1 = b, r2 = s[0], y = s[1], v = s[2];
+     evectmatrix w = s[3], w1 = s[4], w2 = s[5], t;
+     int p = x.p, i, iter, nactive;
+     real *beta1 = d, *beta = d + p, *oldb = d + 2*p, *alfa = d + 3*p;
+     real *dbar = d + 4*p, *epsln = d + 5*p, *phibar = d + 6*p;
+     real *cs = d + 7*p, *sn = d + 8*p, *c1 = d + 9*p, *c2 = d + 10*p;
+     real *phi = d + 11*p;
+
+     for (i = 0; i < x.n * p; ++i) {
+	  ASSIGN_ZERO(x.data[i]);
+	  ASSIGN_ZERO(w.data[i]);
+	  ASSIGN_ZERO(w2.data[i]);
+     }
+     evectmatrix_copy(r2, r1);
+     precondition_projected(r2, y, Y, K, Kdata, constraint, constraint_data,
+			    U, S, I);
+     evectmatrix_XtY_diag_real(r1, y, beta1, c1);
+     for (i = 0; i < p; ++i) {
+	  beta1[i] = beta1[i] > 0 ? sqrt(beta1[i]) : 0;
+	  beta[i] = phibar[i] = beta1[i];
+	  oldb[i] = dbar[i] = epsln[i] = sn[i] = 0;
+	  cs[i] = -1;
+     }
+
+     for (iter = 0; iter < JD_MAX_INNER_ITERATIONS; ) {
+	  /* v = y / beta, and y = P (A - theta) v - (alfa/beta) r2
+	     - (beta/oldb) r1, the Lanczos recurrence: */
+	  for (i = 0; i < p; ++i)
+	       c1[i] = beta[i] > 0 ? 1.0 / beta[i] : 0;
+	  evectmatrix_copy(v, y);
+	  scale_columns(v, c1);
+	  A(v, y, Adata, 0, w1); /* (w1 is free until the end) */
+	  matrix_XpaY_diag_real(y.data, -1.0, v.data, theta, y.n, p);
+	  project_out(y, Y, U, S);
+	  if (++iter >= 2) {
+	       for (i = 0; i < p; ++i)
+		    c1[i] = oldb[i] > 0 ? -beta[i] / oldb[i] : 0;
+	       matrix_XpaY_diag_real(y.data, 1.0, r1.data, c1, y.n, p);
+	  }
+	  evectmatrix_XtY_diag_real(v, y, alfa, c1);
+	  for (i = 0; i < p; ++i)
+	       c1[i] = beta[i] > 0 ? -alfa[i] / beta[i] : 0;
+	  matrix_XpaY_diag_real(y.data, 1.0, r2.data, c1, y.n, p);
+
+	  /* r1 = r2, r2 = y, y = P K P r2: */
+	  t = r1; r1 = r2; r2 = y; y = t;
+	  precondition_projected(r2, y, Y, K, Kdata,
+				 constraint, constraint_data, U, S, I);
+	  for (i = 0; i < p; ++i)
+	       oldb[i] = beta[i];
+	  evectmatrix_XtY_diag_real(r2, y, beta, c1);
+
+	  /* QR update of the Lanczos tridiagonal matrix: */
+	  for (nactive = i = 0; i < p; ++i) {
+	       real oldeps = epsln[i], delta, gbar, gamma;
+	       beta[i] = beta[i] > 0 ? sqrt(beta[i]) : 0;
+	       delta = cs[i] * dbar[i] + sn[i] * alfa[i];
+	       gbar = sn[i] * dbar[i] - cs[i] * alfa[i];
+	       epsln[i] = sn[i] * beta[i];
+	       dbar[i] = -cs[i] * beta[i];
+	       gamma = sqrt(gbar * gbar + beta[i] * beta[i]);
+	       if (gamma == 0 || phibar[i] <= eta * beta1[i]) {
+		    /* converged (or broke down): leave x_i as is */
+		    c1[i] = c2[i] = phi[i] = alfa[i] = 0;
+		    continue;
+	       }
+	       ++nactive;
+	       cs[i] = gbar / gamma;
+	       sn[i] = beta[i] / gamma;
+	       phi[i] = cs[i] * phibar[i];
+	       phibar[i] = sn[i] * phibar[i];
+	       alfa[i] = 1.0 / gamma; /* (alfa is no longer needed) */
+	       c1[i] = -oldeps / gamma;
+	       c2[i] = -delta / gamma;
+	  }
+	  if (nactive == 0)
+	       break;
+
+	  /* w1 = w2, w2 = w, w = (v - oldeps w1 - delta w2) / gamma,
+	     and x += phi w: */
+	  t = w1; w1 = w2; w2 = w; w = t;
+	  evectmatrix_copy(w, v);
+	  scale_columns(w, alfa);
+	  matrix_XpaY_diag_real(w.data, 1.0, w1.data, c1, w.n, p);
+	  matrix_XpaY_diag_real(w.data, 1.0, w2.data, c2, w.n, p);
+	  matrix_XpaY_diag_real(x.data, 1.0, w.data, phi, x.n, p);
+     }
+     return iter;
+}
+
+/**************************************************************************/
+
+/* Find the Y.p eigenvectors of A whose eigenvalues are closest to
+   target; K should approximate the inverse of A - target (or at least
+   be positive-definite, e.g. approximate the inverse of |A - target|
+   or of A).  The search space holds JD_BASIS_BLOCKS blocks of
+   Y.p + JD_GUARD_BANDS(Y.p) vectors before restarting, which needs
+   2 * JD_BASIS_BLOCKS + JD_SCRATCH + 1 matrices of that size:
+   Work[0..] are used if they are big enough (nWork may be smaller),
+   and otherwise the matrices are allocated here.  On output, Y is orthonormal and
+   eigenvals holds the Rayleigh quotients (sorted in increasing
+   order).  Every returned band has a residual norm
+   |A y - lambda y|^2 <= tolerance * lambda^2. */
+void eigensolver_jacobi_davidson(evectmatrix Y, real *eigenvals,
+				 evectoperator A, void *Adata,
+				 evectpreconditioner K, void *Kdata,
+				 evectconstraint constraint,
+				 void *constraint_data,
+				 evectmatrix Work[], int nWork,
+				 real tolerance, int *num_iterations,
+				 int flags,
+				 real target)
+{
+     int nbasis = JD_BASIS_BLOCKS, nmat, p = Y.p, q, qb, i, j, k, i0;
+     evectmatrix *Wq, *V, *W, *Scratch, Yq, T, T2;
+     sqmatrix G, S, Ssel, U, S2, S3, I;
+     real *mu, *h, *lambda, *theta, *rnorm2, *scratch, *d, E, eta = 1.0;
+     int *sel, *allocated, iteration = 0, ibasis = 0, inner_iterations = 0;
+     mpiglue_clock_t prev_feedback_time;
+
+     prev_feedback_time = MPIGLUE_CLOCK;
+
+#ifdef DEBUG
+     flags |= EIGS_VERBOSE;
+#endif
+
+     q = p + JD_GUARD_BANDS(p);
+     if (q > Y.N * Y.c) /* (can't have more bands than the problem size) */
+	  q = Y.N * Y.c;
+     if (nbasis > Y.N * Y.c / q) /* (the basis must be independent) */
+	  nbasis = Y.N * Y.c / q;
+     CHECK(nbasis >= 2, "problem too small for Jacobi-Davidson");
+
+     /* the workspace, with room for q columns, and Yq (the q-column
+	version of Y) at the end: */
+     nmat = 2 * nbasis + JD_SCRATCH + 1;
+     CHK_MALLOC(Wq, evectmatrix, nmat);
+     CHK_MALLOC(allocated, int, nmat);
+     for (i = 0; i < nmat; ++i)
+	  Wq[i] = eigensolver_subspace_matrix(Y, q, Work, nWork, i,
+					      &allocated[i]);
+     V = Wq;
+     W = Wq + nbasis;
+     T = Wq[2 * nbasis];
+     T2 = Wq[2 * nbasis + 1];
+     Scratch = Wq + 2 * nbasis + 2; /* JD_SCRATCH - 2 more */
+     Yq = Wq[nmat - 1];
+
+     qb = q * nbasis;
+     G = create_sqmatrix(qb);
+     S = create_sqmatrix(qb);
+     Ssel = create_sqmatrix(qb);
+     U = create_sqmatrix(q);
+     S2 = create_sqmatrix(q);
+     S3 = create_sqmatrix(q);
+     I = create_sqmatrix(0);
+     CHK_MALLOC(mu, real, qb);
+     CHK_MALLOC(sel, int, qb);
+     CHK_MALLOC(h, real, q);
+     CHK_MALLOC(lambda, real, q);
+     CHK_MALLOC(theta, real, q);
+     CHK_MALLOC(rnorm2, real, q);
+     CHK_MALLOC(scratch, real, q);
+     CHK_MALLOC(d, real, 12 * q);
+
+     /* initial search space V[0] = Y plus random guard vectors, with
+	W[0] = (A - target) V[0]: */
+     evectmatrix_copy_slice(V[0], Y, 0, 0, p);
+     for (i = 0; i < V[0].n; ++i)
+	  for (k = p; k < q; ++k)
+	       ASSIGN_SCALAR(V[0].data[i*q + k],
+			     rand() * 1.0 / RAND_MAX - 0.5,
+			     rand() * 1.0 / RAND_MAX - 0.5);
+     if (constraint)
+	  constraint(V[0], constraint_data);
+     A(V[0], W[0], Adata, 0, T);
+     evectmatrix_aXpbY(1.0, W[0], -target, V[0]);
+     add_block(V, W, 0, &G, T, U, S2, S3);
+
+     do {
+	  int nsel, qcur = q * (ibasis + 1);
+
+	  /* harmonic Ritz values mu = 1/(theta - target): */
+	  sqmatrix_resize(&S, qcur, 0);
+	  sqmatrix_copy_upper2full(S, G);
+	  sqmatrix_eigensolve(S, mu, Ssel);
+
+	  /* select the largest |mu| (the eigenvalues of the search space
+	     closest to the target): q of them for Yq, and enough to
+	     keep if we have to restart below */
+	  nsel = ibasis + 1 == nbasis ? qcur : q;
+	  for (i = 0; i < qcur; ++i)
+	       sel[i] = i;
+	  for (i = 0; i < nsel; ++i)
+	       for (j = i + 1; j < qcur; ++j)
+		    if (fabs(mu[sel[j]]) > fabs(mu[sel[i]])) {
+			 k = sel[i]; sel[i] = sel[j]; sel[j] = k;
+		    }
+
+	  /* Ssel = the selected eigenvectors (rows of S): */
+	  sqmatrix_resize(&Ssel, qcur, 0);
+	  for (i = 0; i < nsel; ++i)
+	       for (j = 0; j < qcur; ++j)
+		    Ssel.data[i * qcur + j] = S.data[sel[i] * qcur + j];
+
+	  /* Yq = V Ssel, T = W Ssel = (A - target) Yq */
+	  for (i = 0; i <= ibasis; ++i) {
+	       evectmatrix_aXpbYS_sub(i ? 1.0 : 0.0, Yq, 1.0, V[i],
+				      Ssel, q * i, 1);
+	       evectmatrix_aXpbYS_sub(i ? 1.0 : 0.0, T, 1.0, W[i],
+				      Ssel, q * i, 1);
+	  }
+
+	  /* Rayleigh-Ritz within span Yq, which gives better eigenvalue
+	     estimates than the harmonic Ritz values: */
+	  evectmatrix_XtX(U, Yq, S3);
+	  CHECK(sqmatrix_invert(U, 1, S3), "non-independent harmonic Ritz "
+		"vectors");
+	  sqmatrix_sqrt(S2, U, S3); /* S2 = 1/sqrt(Yqt Yq) */
+	  evectmatrix_XeYS(T2, Yq, S2, 1);
+	  evectmatrix_copy(Yq, T2);
+	  evectmatrix_XeYS(T2, T, S2, 1);
+	  evectmatrix_copy(T, T2);
+	  evectmatrix_XtY(U, Yq, T, S3);
+	  sqmatrix_symmetrize(S2, U);
+	  sqmatrix_eigensolve(S2, h, S3);
+	  evectmatrix_XeYS(T2, Yq, S2, 1); /* rotate by rows of S2 */
+	  evectmatrix_copy(Yq, T2);
+	  evectmatrix_XeYS(T2, T, S2, 1);
+	  evectmatrix_copy(T, T2);
+	  for (i = 0; i < q; ++i)
+	       lambda[i] = target + h[i];
+
+	  /* the wanted bands, closest to the target, are the (sorted)
+	     bands i0..i0+p-1: */
+	  for (i0 = 0; i0 + p < q && fabs(h[i0 + p]) < fabs(h[i0]); ++i0)
+	       ;
+	  for (E = 0.0, i = 0; i < p; ++i)
+	       E += lambda[i0 + i];
+	  mpi_assert_equal(E);
+
+	  /* T = residual = (A - target) Yq - Yq h = (A - lambda) Yq.
+	     Interior eigenvalues need not converge monotonically, so
+	     instead of the change in the trace we require a small
+	     residual for every wanted band. */
+	  matrix_XpaY_diag_real(T.data, -1.0, Yq.data, h, T.n, q);
+	  evectmatrix_XtX_diag_real(T, rnorm2, scratch);
+	  for (k = 0, i = i0; i < i0 + p; ++i)
+	       k += rnorm2[i] <= tolerance * lambda[i] * lambda[i];
+
+	  if (iteration > 0 && mpi_is_master() &&
+	      ((flags & EIGS_VERBOSE) ||
+	       MPIGLUE_CLOCK_DIFF(MPIGLUE_CLOCK, prev_feedback_time)
+	       > FEEDBACK_TIME)) {
+               mpi_one_printf("    iteration %4d: "
+			      "trace = %0.16g, %d/%d bands converged, "
+			      "%d inner iterations\n",
+			      iteration, (double) E, k, p, inner_iterations);
+               fflush(stdout); /* make sure output appears */
+               prev_feedback_time = MPIGLUE_CLOCK; /* reset feedback clock */
+          }
+
+	  if (k == p)
+               break; /* convergence!  hooray! */
+
+	  /* if the space is full, do a thick restart with the nkeep
+	     blocks of harmonic Ritz vectors closest to the target,
+	     which are still orthonormal after W = W Ssel and give
+	     G = Wt V = diag(mu) (computing V Ssel and W Ssel in the
+	     scratch matrices): */
+	  if (ibasis + 1 == nbasis) {
+	       int nkeep = (nbasis + 1) / 2, ib;
+	       if (nkeep > JD_SCRATCH - 2)
+		    nkeep = JD_SCRATCH - 2;
+	       if (flags & EIGS_VERBOSE)
+		    mpi_one_printf("    restarting search space\n");
+	       for (k = 0; k < 2; ++k) {
+		    evectmatrix *X = k ? W : V;
+		    for (ib = 0; ib < nkeep; ++ib)
+			 for (i = 0; i <= ibasis; ++i)
+			      evectmatrix_aXpbYS_sub(i ? 1.0 : 0.0,
+						     ib ? Scratch[ib - 1] : T2,
+						     1.0, X[i], Ssel,
+						     qcur * q * ib + q * i, 1);
+		    for (ib = 0; ib < nkeep; ++ib)
+			 evectmatrix_copy(X[ib], ib ? Scratch[ib - 1] : T2);
+	       }
+	       ibasis = nkeep - 1;
+	       sqmatrix_resize(&G, q * nkeep, 0);
+	       for (i = 0; i < G.p * G.p; ++i)
+		    ASSIGN_ZERO(G.data[i]);
+	       for (i = 0; i < G.p; ++i)
+		    ASSIGN_REAL(G.data[i * G.p + i], mu[sel[i]]);
+	  }
+
+	  /* Solve the correction equation P (A - theta) P t = r
+	     approximately, where P = 1 - Yq Yqt, with a relative
+	     tolerance eta that shrinks with each outer iteration.  Far
+	     from convergence we use theta = target, which steers the
+	     search towards the target (rather than towards whatever the
+	     current vectors happen to be near); close to convergence,
+	     theta = lambda gives fast local convergence. */
+	  ++ibasis;
+	  for (i = 0; i < q; ++i)
+	       theta[i] = rnorm2[i] > sqrt(tolerance) * lambda[i] * lambda[i]
+		    ? target : lambda[i];
+	  eta *= JD_INNER_TOLERANCE_FACTOR;
+	  {
+	       evectmatrix s[6];
+	       s[0] = T2; s[1] = W[ibasis];
+	       for (i = 0; i < JD_SCRATCH - 2; ++i)
+		    s[2 + i] = Scratch[i];
+	       inner_iterations =
+		    correction_minres(V[ibasis], T, Yq, theta, eta,
+				      A, Adata, K, Kdata,
+				      constraint, constraint_data,
+				      s, U, S3, I, d);
+	  }
+
+	  /* normalize the columns of t, since the corrections for
+	     nearly converged bands may be tiny: */
+	  evectmatrix_XtX_diag_real(V[ibasis], scratch, d);
+	  for (i = 0; i < q; ++i)
+	       scratch[i] = scratch[i] > 0 ? 1.0 / sqrt(scratch[i]) : 1.0;
+	  scale_columns(V[ibasis], scratch);
+	  if (constraint)
+	       constraint(V[ibasis], constraint_data);
+
+	  A(V[ibasis], W[ibasis], Adata, 0, T);
+	  evectmatrix_aXpbY(1.0, W[ibasis], -target, V[ibasis]);
+	  add_block(V, W, ibasis, &G, T, U, S2, S3);
+     } while (++iteration < EIGENSOLVER_MAX_ITERATIONS);
+
+     CHECK(iteration < EIGENSOLVER_MAX_ITERATIONS,
+           "failure to converge after "
+           STRINGIZE(EIGENSOLVER_MAX_ITERATIONS)
+           " iterations");
+
+     evectmatrix_copy_slice(Y, Yq, 0, i0, p);
+     for (i = 0; i < p; ++i)
+	  eigenvals[i] = lambda[i0 + i];
+
+     free(d);
+     free(scratch);
+     free(rnorm2);
+     free(theta);
+     free(lambda);
+     free(h);
+     free(sel);
+     free(mu);
+     destroy_sqmatrix(I);
+     destroy_sqmatrix(S3);
+     destroy_sqmatrix(S2);
+     destroy_sqmatrix(U);
+     destroy_sqmatrix(Ssel);
+     destroy_sqmatrix(S);
+     destroy_sqmatrix(G);
+     for (i = 0; i < nmat; ++i)
+	  if (allocated[i])
+	       destroy_evectmatrix(Wq[i]);
+     free(allocated);
+     free(Wq);
+
+     *num_iterations = iteration;
+}
@@ -0,0 +1,879 @@
+/* Copyright (C) 1999-2014 Massachusetts Institute of Technology.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/* This file contains an alternative eigensolver, the Locally Optimal
+   Block Preconditioned Conjugate Gradient (LOBPCG) method:
+
+   A. V. Knyazev, "Toward the optimal preconditioned eigensolver:
+   Locally optimal block preconditioned conjugate gradient method,"
+   SIAM J. Sci. Comput. 23, no. 2, pp. 517-541 (2001).
+
+   Each iteration does a Rayleigh-Ritz step in the subspace spanned by
+   the current eigenvectors X, the preconditioned residuals W, and the
+   previous search directions P.  W and P are made B-orthonormal to
+   X (and to each other), so that the Rayleigh-Ritz step is an ordinary
+   Hermitian eigenproblem (following Hetmaniuk and Lehoucq, J. Comput.
+   Phys. 218, pp. 324-332, 2006).  Columns of X whose residuals have
+   converged are "soft locked": they stay in the Rayleigh-Ritz step,
+   but no new search directions are computed for them. */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+
+#include "config.h"
+#include <mpiglue.h>
+#include <mpi_utils.h>
+#include <check.h>
+#include <scalar.h>
+#include <matrices.h>
+#include <blasglue.h>
+
+#include "eigensolver.h"
+
+#define STRINGIZEx(x) #x /* a hack so that we can stringize macro values */
+#define STRINGIZE(x) STRINGIZEx(x)
+
+#if defined(SCALAR_LONG_DOUBLE_PREC)
+#  define fabs fabsl
+#endif
+
+/**************************************************************************/
+
+#define EIGENSOLVER_MAX_ITERATIONS 100000
+#define FEEDBACK_TIME 4.0 /* elapsed time before we print progress feedback */
+
+#define SWAP_EVECT(a,b) { evectmatrix xxx_swap = a; a = b; b = xxx_swap; }
+
+/* relative size of the eigenvalues of a Gram matrix below which we
+   consider the corresponding directions to be dependent (roundoff) */
+#if defined(SCALAR_SINGLE_PREC)
+#  define DROP_TOLERANCE 1e-5
+#else
+#  define DROP_TOLERANCE 1e-12
+#endif
+
+/**************************************************************************/
+
+/* Set the X.p x Y.p block of U, starting at U and with row stride ldu,
+   to adjoint(X) * Y.  S1 and S2 are scratch arrays of at least
+   X.p * Y.p scalars. */
+static void XtY_block(scalar *U, int ldu, evectmatrix X, evectmatrix Y,
+		      scalar *S1, scalar *S2)
+{
+     int i, j;
+
+     CHECK(X.n == Y.n, "matrices not conformant");
+     if (X.p == 0 || Y.p == 0)
+	  return;
+
+     blasglue_gemm('C', 'N', X.p, Y.p, X.n,
+		   1.0, X.data, X.p, Y.data, Y.p, 0.0, S1, Y.p);
+     evectmatrix_flops += X.N * X.c * X.p * (2*Y.p);
+
+     mpi_allreduce(S1, S2, X.p * Y.p * SCALAR_NUMVALS,
+		   real, SCALAR_MPI_TYPE, MPI_SUM, mpb_comm);
+     for (i = 0; i < X.p; ++i)
+	  for (j = 0; j < Y.p; ++j)
+	       U[i*ldu + j] = S2[i*Y.p + j];
+}
+
+/* Compute X = b*X + a*Y*C, where C is a Y.p x X.p matrix with
+   row stride ldc. */
+static void XpaYC(real b, evectmatrix X, real a, evectmatrix Y,
+		  scalar *C, int ldc)
+{
+     CHECK(X.n == Y.n, "matrices not conformant");
+     if (Y.p == 0) { /* (gemm would zero X) */
+	  if (b == 0.0) {
+	       int i;
+	       for (i = 0; i < X.n * X.p; ++i)
+		    ASSIGN_ZERO(X.data[i]);
+	  }
+	  else if (b != 1.0)
+	       blasglue_rscal(X.n * X.p, b, X.data, 1);
+	  return;
+     }
+     blasglue_gemm('N', 'N', X.n, X.p, Y.p,
+		   a, Y.data, Y.p, C, ldc, b, X.data, X.p);
+     evectmatrix_flops += X.N * X.c * X.p * (2*Y.p);
+}
+
+/* Keep only the columns cols[0..ncols-1] (in increasing order) of X,
+   in place. */
+static void compact_columns(evectmatrix *X, const int *cols, int ncols)
+{
+     int i, k;
+     for (i = 0; i < X->n; ++i)
+	  for (k = 0; k < ncols; ++k)
+	       X->data[i*ncols + k] = X->data[i*X->p + cols[k]];
+     X->p = ncols;
+}
+
+/* Given X (B-orthonormal, with BX = B X) and the p x p matrix C,
+   set X = X C and likewise for AX and BX, using T as scratch.
+   (The matrices are swapped with T rather than copied.) */
+#define ROTATE_XC(X, AX, BX, T, C, ldc, haveB) { \
+     evectmatrix_resize(&T, X.p, 0); \
+     XpaYC(0.0, T, 1.0, X, C, ldc); SWAP_EVECT(X, T); \
+     XpaYC(0.0, T, 1.0, AX, C, ldc); SWAP_EVECT(AX, T); \
+     if (haveB) { XpaYC(0.0, T, 1.0, BX, C, ldc); SWAP_EVECT(BX, T); } \
+}
+
+/* Make Z (with AZ = A Z, BZ = B Z) B-orthogonal to the B-orthonormal
+   block X, i.e. Z -= X (Xt B Z).  Any of AZ.data may be NULL if
+   AZ is not yet computed.  C is scratch of at least X.p * Z.p. */
+static void orthogonalize_against(evectmatrix Z, evectmatrix AZ,
+				  evectmatrix BZ, int haveB,
+				  evectmatrix X, evectmatrix AX,
+				  evectmatrix BX, scalar *C,
+				  scalar *S1, scalar *S2)
+{
+     if (X.p == 0 || Z.p == 0)
+	  return;
+     XtY_block(C, Z.p, X, BZ, S1, S2);
+     XpaYC(1.0, Z, -1.0, X, C, Z.p);
+     if (AZ.data)
+	  XpaYC(1.0, AZ, -1.0, AX, C, Z.p);
+     if (haveB)
+	  XpaYC(1.0, BZ, -1.0, BX, C, Z.p);
+}
+
+/* B-orthonormalize Z within itself, updating AZ and BZ (as above),
+   and return the new number of columns.  If the columns of Z are not
+   independent (to within roundoff), then either return 0 leaving Z
+   unchanged (if !drop), or replace Z by a B-orthonormal basis of the
+   directions in its span whose B-norm is not negligible.  U, S2, and
+   S3 are scratch matrices, C is scratch of Z->p * Z->p scalars, and
+   eigs is scratch of Z->p reals. */
+static int orthonormalize(evectmatrix *Z, evectmatrix *AZ, evectmatrix *BZ,
+			  int haveB, evectmatrix *T,
+			  sqmatrix U, sqmatrix S2, sqmatrix S3,
+			  scalar *C, real *eigs, int drop)
+{
+     int p = Z->p, i, j, k, nk;
+
+     if (p == 0)
+	  return 0;
+     sqmatrix_resize(&U, p, 0);
+     sqmatrix_resize(&S2, p, 0);
+     sqmatrix_resize(&S3, p, 0);
+     XtY_block(U.data, p, *Z, *BZ, S2.data, S3.data);
+     sqmatrix_symmetrize(S2, U);
+     sqmatrix_eigensolve(S2, eigs, S3); /* eigenvectors = rows of S2 */
+
+     for (nk = 0, k = p - 1; k >= 0; --k)
+	  if (eigs[k] > eigs[p-1] * DROP_TOLERANCE)
+	       ++nk;
+     if (nk == 0 || (nk < p && !drop))
+	  return 0;
+
+     /* Let v_k = (conjugated) eigenvector row k of S2, scaled by
+	eigs[k]^(-1/4).  If nothing is dropped, C = sum_k v_k v_k^H
+	= 1/sqrt(Zt B Z), which changes Z the least; otherwise, the
+	columns of C are the kept v_k, scaled by another eigs[k]^(-1/4). */
+     for (k = p - nk; k < p; ++k) {
+	  real s = pow(eigs[k], -0.25);
+	  for (i = 0; i < p; ++i)
+	       ASSIGN_SCALAR(S2.data[k*p + i],
+			     SCALAR_RE(S2.data[k*p + i]) * s,
+			     SCALAR_IM(S2.data[k*p + i]) * s);
+     }
+     if (nk == p)
+	  for (i = 0; i < p; ++i)
+	       for (j = 0; j < p; ++j) {
+		    ASSIGN_ZERO(C[i*p + j]);
+		    for (k = 0; k < p; ++k)
+			 ACCUMULATE_SUM_CONJ_MULT(C[i*p + j],
+						  S2.data[k*p + i],
+						  S2.data[k*p + j]);
+	       }
+     else
+	  for (i = 0; i < p; ++i)
+	       for (k = 0; k < nk; ++k) {
+		    real s = pow(eigs[p - nk + k], -0.25);
+		    ASSIGN_SCALAR(C[i*nk + k],
+				  SCALAR_RE(S2.data[(p - nk + k)*p + i]) * s,
+				  -SCALAR_IM(S2.data[(p - nk + k)*p + i]) * s);
+	       }
+
+     evectmatrix_resize(T, nk, 0);
+     XpaYC(0.0, *T, 1.0, *Z, C, nk); SWAP_EVECT(*Z, *T);
+     if (AZ->data) {
+	  evectmatrix_resize(T, nk, 0);
+	  XpaYC(0.0, *T, 1.0, *AZ, C, nk); SWAP_EVECT(*AZ, *T);
+     }
+     if (haveB) {
+	  evectmatrix_resize(T, nk, 0);
+	  XpaYC(0.0, *T, 1.0, *BZ, C, nk); SWAP_EVECT(*BZ, *T);
+     }
+     return nk;
+}
+
+/**************************************************************************/
+
+/* Solve for the Y.p lowest eigenvectors of the generalized problem
+   A Y = B Y lambda (or the ordinary problem if B == NULL) by LOBPCG.
+   Needs nWork >= 6 workspace matrices, or nWork >= 9 if B != NULL.
+   Y is returned B-orthonormal, with the eigenvalues in eigenvals. */
+void eigensolver_lobpcg(evectmatrix Y, real *eigenvals,
+			evectoperator A, void *Adata,
+			evectoperator B, void *Bdata,
+			evectpreconditioner K, void *Kdata,
+			evectconstraint constraint, void *constraint_data,
+			evectmatrix Work[], int nWork,
+			real tolerance, int *num_iterations,
+			int flags)
+{
+     evectmatrix X, AX, BX, W, AW, BW, P, AP, BP, T, noAZ;
+     sqmatrix G, S, Swork, U, S2, S3, I;
+     scalar *C, *C2;
+     real *eigenvals2, *rnorm2, *rscratch, E, prev_E = 0.0;
+     int *active, *pos, nact, nw, np = 0, p = Y.p, q, i, k;
+     int precondition, retry;
+     int iteration = 0, haveB = B != NULL;
+     mpiglue_clock_t prev_feedback_time;
+
+     prev_feedback_time = MPIGLUE_CLOCK;
+
+#ifdef DEBUG
+     flags |= EIGS_VERBOSE;
+#endif
+
+     CHECK(nWork >= 6 + 3 * haveB, "not enough workspace for LOBPCG");
+
+     X = Y;
+     AX = Work[0];
+     W = Work[1]; AW = Work[2];
+     P = Work[3]; AP = Work[4];
+     T = Work[5];
+     if (haveB) {
+	  BX = Work[6]; BW = Work[7]; BP = Work[8];
+     }
+     else {
+	  BX = X; BW = W; BP = P;
+     }
+     noAZ = X; noAZ.data = NULL;
+
+     G = create_sqmatrix(3 * p);
+     S = create_sqmatrix(3 * p);
+     Swork = create_sqmatrix(3 * p);
+     U = create_sqmatrix(p);
+     S2 = create_sqmatrix(p);
+     S3 = create_sqmatrix(p);
+     I = create_sqmatrix(0);
+     CHK_MALLOC(C, scalar, 3 * p * p);
+     CHK_MALLOC(C2, scalar, p * p);
+     CHK_MALLOC(eigenvals2, real, 3 * p);
+     CHK_MALLOC(rnorm2, real, p);
+     CHK_MALLOC(rscratch, real, p);
+     CHK_MALLOC(active, int, p);
+     CHK_MALLOC(pos, int, p);
+
+     /* Initially: B-orthonormalize Y and do Rayleigh-Ritz in its span. */
+
+     if (constraint)
+	  constraint(X, constraint_data);
+     if (haveB)
+	  B(X, BX, Bdata, 1, T);
+     CHECK(orthonormalize(&X, &noAZ, &BX, haveB, &T, U, S2, S3,
+			  C, rscratch, 0) == p,
+	   "non-independent initial Y");
+     if (!haveB) BX = X;
+     A(X, AX, Adata, 1, T);
+     XtY_block(U.data, p, X, AX, S2.data, S3.data);
+     sqmatrix_symmetrize(S2, U);
+     sqmatrix_eigensolve(S2, eigenvals, S3);
+     for (i = 0; i < p; ++i) /* C = adjoint of eigenvector rows of S2 */
+	  for (k = 0; k < p; ++k)
+	       ASSIGN_CONJ(C[i*p + k], S2.data[k*p + i]);
+     ROTATE_XC(X, AX, BX, T, C, p, haveB);
+     if (!haveB) BX = X;
+
+     for (i = 0; i < p; ++i)
+	  active[i] = i;
+     nact = p;
+
+     do {
+	  int nact_new;
+
+	  for (E = 0.0, i = 0; i < p; ++i)
+	       E += eigenvals[i];
+	  mpi_assert_equal(E);
+
+	  /* W = residual = AX - BX * eigenvals */
+	  evectmatrix_resize(&W, p, 0);
+	  evectmatrix_copy(W, AX);
+	  matrix_XpaY_diag_real(W.data, -1.0, BX.data, eigenvals, W.n, p);
+	  evectmatrix_XtX_diag_real(W, rnorm2, rscratch);
+
+	  /* soft locking: stop searching along columns whose residual
+	     has converged (and never unlock them) */
+	  for (nact_new = k = 0; k < nact; ++k) {
+	       i = active[k];
+	       if (rnorm2[i] > tolerance * eigenvals[i] * eigenvals[i]) {
+		    pos[nact_new] = k; /* position in old active list */
+		    active[nact_new++] = i;
+	       }
+	  }
+	  if (np > 0 && nact_new < nact) {
+	       compact_columns(&P, pos, nact_new);
+	       compact_columns(&AP, pos, nact_new);
+	       if (haveB) compact_columns(&BP, pos, nact_new);
+	       else BP = P;
+	       np = nact_new;
+	  }
+	  nact = nact_new;
+
+	  if (iteration > 0 && mpi_is_master() &&
+	      ((flags & EIGS_VERBOSE) ||
+	       MPIGLUE_CLOCK_DIFF(MPIGLUE_CLOCK, prev_feedback_time)
+	       > FEEDBACK_TIME)) {
+               mpi_one_printf("    iteration %4d: "
+			      "trace = %0.16g (%g%% change), %d locked\n",
+			      iteration, (double) E,
+			      (double) (200.0 * fabs(E - prev_E)
+					/ (fabs(E) + fabs(prev_E))),
+			      p - nact);
+               fflush(stdout); /* make sure output appears */
+               prev_feedback_time = MPIGLUE_CLOCK; /* reset feedback clock */
+          }
+
+	  if (nact == 0 ||
+	      (iteration > 0 &&
+	       fabs(E - prev_E) < tolerance * 0.5 * (fabs(E) +
+						     fabs(prev_E) + 1e-7)))
+               break; /* convergence!  hooray! */
+
+	  /* W = precondition(residuals of the active columns), dropping
+	     any dependent directions (which can happen, e.g., if some of
+	     the residuals are mostly roundoff).  If nothing is left to
+	     search along, try again with the unpreconditioned residuals,
+	     which are only in the span of X if they have converged. */
+	  for (retry = 0; ; retry = 1) {
+	       if (retry) {
+		    evectmatrix_resize(&W, p, 0);
+		    evectmatrix_copy(W, AX);
+		    matrix_XpaY_diag_real(W.data, -1.0, BX.data, eigenvals,
+					  W.n, p);
+	       }
+	       compact_columns(&W, active, nact);
+	       precondition = K != NULL && !retry;
+	       if (precondition) {
+		    evectmatrix_resize(&T, nact, 0);
+		    K(W, T, Kdata, X, NULL, I);
+		    SWAP_EVECT(W, T);
+	       }
+	       if (constraint)
+		    constraint(W, constraint_data);
+
+	       if (haveB) {
+		    evectmatrix_resize(&BW, nact, 0);
+		    B(W, BW, Bdata, 0, T);
+	       }
+	       else
+		    BW = W;
+	       orthogonalize_against(W, noAZ, BW, haveB, X, AX, BX,
+				     C, C2, S.data);
+	       nw = orthonormalize(&W, &noAZ, &BW, haveB, &T, U, S2, S3,
+				   C, rscratch, 1);
+	       if (nw < nact && (flags & EIGS_VERBOSE))
+		    mpi_one_printf("    dropped %d dependent residuals\n",
+				   nact - nw);
+	       if (nw > 0 || np > 0 || !precondition)
+		    break;
+	  }
+	  if (nw == 0 && np == 0)
+	       break; /* the residuals are all roundoff: converged */
+	  if (!haveB) BW = W;
+	  evectmatrix_resize(&AW, nw, 0);
+	  if (nw > 0)
+	       A(W, AW, Adata, 0, T);
+
+	  if (np > 0) {
+	       orthogonalize_against(P, AP, BP, haveB, X, AX, BX,
+				     C, C2, S.data);
+	       orthogonalize_against(P, AP, BP, haveB, W, AW, BW,
+				     C, C2, S.data);
+	       if (!orthonormalize(&P, &AP, &BP, haveB, &T, U, S2, S3,
+				   C, rscratch, 0)) {
+		    if (flags & EIGS_VERBOSE)
+			 mpi_one_printf("    resetting search directions\n");
+		    np = 0;
+	       }
+	  }
+	  if (np == 0) { /* (so that the P blocks below are empty) */
+	       evectmatrix_resize(&P, 0, 0);
+	       evectmatrix_resize(&AP, 0, 0);
+	       if (haveB) evectmatrix_resize(&BP, 0, 0);
+	  }
+	  if (!haveB) BP = P;
+
+	  /* Rayleigh-Ritz in span [X, W, P]; the basis is B-orthonormal,
+	     so we need only the (upper triangle of) the A Gram matrix: */
+	  q = p + nw + np;
+	  sqmatrix_resize(&G, q, 0);
+	  sqmatrix_resize(&S, q, 0);
+	  sqmatrix_resize(&Swork, q, 0);
+	  XtY_block(G.data, q, X, AX, C, C2);
+	  XtY_block(G.data + p, q, X, AW, C, C2);
+	  XtY_block(G.data + p + nw, q, X, AP, C, C2);
+	  XtY_block(G.data + p*q + p, q, W, AW, C, C2);
+	  XtY_block(G.data + p*q + p + nw, q, W, AP, C, C2);
+	  XtY_block(G.data + (p + nw)*q + p + nw, q, P, AP, C, C2);
+	  sqmatrix_copy_upper2full(S, G);
+	  sqmatrix_eigensolve(S, eigenvals2, Swork);
+
+	  /* C = coefficients (q x p) of the lowest p Ritz vectors;
+	     the eigenvectors are the (conjugated) rows of S. */
+	  for (i = 0; i < q; ++i)
+	       for (k = 0; k < p; ++k)
+		    ASSIGN_CONJ(C[i*p + k], S.data[k*q + i]);
+
+	  /* T = W Cw + P Cp, X = X Cx + T, and P = active columns of T,
+	     likewise for AX, AP, and BX, BP.  The old P buffer is free
+	     after T is computed, so we put the new X there. */
+#define UPDATE_XP(X, W, P, haveP) { \
+	       evectmatrix_resize(&T, p, 0); \
+	       XpaYC(0.0, T, 1.0, W, C + p*p, p); \
+	       if (haveP) XpaYC(1.0, T, 1.0, P, C + (p + nw)*p, p); \
+	       evectmatrix_resize(&P, p, 0); \
+	       evectmatrix_copy(P, T); \
+	       XpaYC(1.0, P, 1.0, X, C, p); \
+	       SWAP_EVECT(X, P); \
+	       compact_columns(&T, active, nact); \
+	       SWAP_EVECT(P, T); \
+	  }
+	  UPDATE_XP(X, W, P, np > 0);
+	  UPDATE_XP(AX, AW, AP, np > 0);
+	  if (haveB) {
+	       UPDATE_XP(BX, BW, BP, np > 0);
+	  }
+	  else {
+	       BX = X; BW = W; BP = P;
+	  }
+#undef UPDATE_XP
+	  np = nact;
+
+	  for (i = 0; i < p; ++i)
+	       eigenvals[i] = eigenvals2[i];
+
+	  prev_E = E;
+     } while (++iteration < EIGENSOLVER_MAX_ITERATIONS);
+
+     CHECK(iteration < EIGENSOLVER_MAX_ITERATIONS,
+           "failure to converge after "
+           STRINGIZE(EIGENSOLVER_MAX_ITERATIONS)
+           " iterations");
+
+     if (X.data != Y.data)
+	  evectmatrix_copy(Y, X);
+
+     free(pos);
+     free(active);
+     free(rscratch);
+     free(rnorm2);
+     free(eigenvals2);
+     free(C2);
+     free(C);
+     destroy_sqmatrix(I);
+     destroy_sqmatrix(S3);
+     destroy_sqmatrix(S2);
+     destroy_sqmatrix(U);
+     destroy_sqmatrix(Swork);
+     destroy_sqmatrix(S);
+     destroy_sqmatrix(G);
+
+     *num_iterations = iteration;
+}
+
+/**************************************************************************/
+
+/* The following is a variant of LOBPCG for a Y whose columns consist
+   of nblocks independent blocks of pb = Y.p / nblocks columns each,
+   for an operator that is block-diagonal in this sense (e.g. the
+   Maxwell operator at several k-points at once; see
+   maxwell_batch_operator).  The operator, preconditioner, and
+   constraint are applied to all of the blocks at once, but the
+   orthonormalization and Rayleigh-Ritz steps are done separately for
+   each block (with a single reduction of the Gram matrices of all of
+   the blocks).  For simplicity, there is no B operator, and there is
+   no soft locking of individual columns (which would break up the
+   column layout of the blocks); instead, a block whose residuals have
+   all converged is left unchanged from then on. */
+
+/* For each block b, set U + b*pb*pb (a pb x pb matrix) to
+   adjoint(X_b) * Y_b.  S is scratch of at least nb*pb*pb scalars. */
+static void blocks_XtY(scalar *U, evectmatrix X, evectmatrix Y, int nb,
+		       scalar *S)
+{
+     int pb = X.p / nb, b;
+
+     CHECK(X.n == Y.n && X.p == Y.p, "matrices not conformant");
+
+     for (b = 0; b < nb; ++b)
+	  blasglue_gemm('C', 'N', pb, pb, X.n,
+			1.0, X.data + b*pb, X.p, Y.data + b*pb, Y.p,
+			0.0, S + b*pb*pb, pb);
+     evectmatrix_flops += X.N * X.c * X.p * (2*pb);
+
+     mpi_allreduce(S, U, nb*pb*pb * SCALAR_NUMVALS,
+		   real, SCALAR_MPI_TYPE, MPI_SUM, mpb_comm);
+}
+
+/* For each block b, compute X_b = beta*X_b + a*Y_b*C_b, where
+   C_b = C + b*pb*pb.  (X and Y must be distinct.) */
+static void blocks_XpaYC(real beta, evectmatrix X, real a, evectmatrix Y,
+			 scalar *C, int nb)
+{
+     int pb = X.p / nb, b;
+
+     CHECK(X.n == Y.n && X.p == Y.p, "matrices not conformant");
+
+     for (b = 0; b < nb; ++b)
+	  blasglue_gemm('N', 'N', X.n, pb, pb,
+			a, Y.data + b*pb, Y.p, C + b*pb*pb, pb,
+			beta, X.data + b*pb, X.p);
+     evectmatrix_flops += X.N * X.c * X.p * (2*pb);
+}
+
+/* Make each block of Z (and AZ, if AZ.data != NULL) orthogonal to the
+   corresponding orthonormal block of X, using C and S as scratch. */
+static void blocks_orthogonalize_against(evectmatrix Z, evectmatrix AZ,
+					 evectmatrix X, evectmatrix AX,
+					 int nb, scalar *C, scalar *S)
+{
+     blocks_XtY(C, X, Z, nb, S);
+     blocks_XpaYC(1.0, Z, -1.0, X, C, nb);
+     if (AZ.data)
+	  blocks_XpaYC(1.0, AZ, -1.0, AX, C, nb);
+}
+
+/* Orthonormalize each block of Z within itself, updating AZ (if
+   AZ->data != NULL) likewise.  ok[b] is set to whether the columns
+   of block b were independent; if not, or if skip[b] (for skip !=
+   NULL), the block is left unchanged and ok[b] = 0.  T is a scratch
+   matrix the size of Z, C and S are scratch arrays of nb*pb*pb
+   scalars, and U, S2, and S3 are pb x pb scratch matrices. */
+static void blocks_orthonormalize(evectmatrix *Z, evectmatrix *AZ,
+				  evectmatrix *T, int nb,
+				  const int *skip, int *ok,
+				  scalar *C, scalar *S,
+				  sqmatrix U, sqmatrix S2, sqmatrix S3)
+{
+     int pb = Z->p / nb, b, i;
+
+     blocks_XtY(C, *Z, *Z, nb, S);
+     for (b = 0; b < nb; ++b) {
+	  scalar *Cb = C + b*pb*pb;
+	  for (i = 0; i < pb*pb; ++i)
+	       U.data[i] = Cb[i];
+	  sqmatrix_symmetrize(S2, U);
+	  sqmatrix_copy(U, S2);
+	  ok[b] = !(skip && skip[b]) && sqmatrix_invert(U, 1, S3);
+	  if (ok[b]) {
+	       sqmatrix_sqrt(S2, U, S3); /* S2 = 1/sqrt(Zt Z) */
+	       for (i = 0; i < pb*pb; ++i)
+		    Cb[i] = S2.data[i];
+	  }
+	  else {
+	       for (i = 0; i < pb*pb; ++i)
+		    ASSIGN_ZERO(Cb[i]);
+	       for (i = 0; i < pb; ++i)
+		    ASSIGN_REAL(Cb[i*pb + i], 1.0);
+	  }
+     }
+     blocks_XpaYC(0.0, *T, 1.0, *Z, C, nb); SWAP_EVECT(*Z, *T);
+     if (AZ->data) {
+	  blocks_XpaYC(0.0, *T, 1.0, *AZ, C, nb); SWAP_EVECT(*AZ, *T);
+     }
+}
+
+/* copy the pb x pb matrix M into G (with row stride q) at (i0, j0) */
+static void set_block(scalar *G, int q, int i0, int j0,
+		      const scalar *M, int pb)
+{
+     int i, j;
+     for (i = 0; i < pb; ++i)
+	  for (j = 0; j < pb; ++j)
+	       G[(i0 + i)*q + j0 + j] = M[i*pb + j];
+}
+
+/* Solve for the lowest Y.p / nblocks eigenvectors of each of the
+   nblocks independent column blocks of Y (see above), i.e. the
+   ordinary eigenproblem A Y_b = Y_b lambda_b for each block, where
+   the eigenvalues of block b are returned in eigenvals + b*pb.
+   Needs nWork >= 6 workspace matrices (the same size as Y).  The
+   preconditioner K is passed NULL eigenvalues, and is otherwise
+   used as in eigensolver_lobpcg. */
+void eigensolver_lobpcg_batch(evectmatrix Y, real *eigenvals,
+			      evectoperator A, void *Adata,
+			      evectpreconditioner K, void *Kdata,
+			      evectconstraint constraint, void *constraint_data,
+			      evectmatrix Work[], int nWork,
+			      real tolerance, int *num_iterations,
+			      int flags, int nblocks)
+{
+     evectmatrix X, AX, W, AW, P, AP, T, noAZ;
+     sqmatrix G, S, Swork, U, S2, S3, I;
+     scalar *Gxx, *Gxw, *Gxp, *Gww, *Gwp, *Gpp, *Cx, *Cw, *Cp, *C, *C2;
+     real *eigenvals2, *rnorm2, *rscratch, *prev_Eb, E, prev_E = 0.0;
+     int *hasW, *hasP, *done, nb = nblocks, pb, p = Y.p, ndone;
+     int b, i, k, iteration = 0, haveP = 0;
+     mpiglue_clock_t prev_feedback_time;
+
+     prev_feedback_time = MPIGLUE_CLOCK;
+
+#ifdef DEBUG
+     flags |= EIGS_VERBOSE;
+#endif
+
+     CHECK(nWork >= 6, "not enough workspace for LOBPCG");
+     CHECK(nb > 0 && p % nb == 0, "invalid number of column blocks");
+     pb = p / nb;
+
+     X = Y;
+     AX = Work[0];
+     W = Work[1]; AW = Work[2];
+     P = Work[3]; AP = Work[4];
+     T = Work[5];
+     noAZ = X; noAZ.data = NULL;
+
+     G = create_sqmatrix(3 * pb);
+     S = create_sqmatrix(3 * pb);
+     Swork = create_sqmatrix(3 * pb);
+     U = create_sqmatrix(pb);
+     S2 = create_sqmatrix(pb);
+     S3 = create_sqmatrix(pb);
+     I = create_sqmatrix(0);
+     CHK_MALLOC(Gxx, scalar, 11 * nb*pb*pb);
+     Gxw = Gxx + nb*pb*pb; Gxp = Gxw + nb*pb*pb;
+     Gww = Gxp + nb*pb*pb; Gwp = Gww + nb*pb*pb; Gpp = Gwp + nb*pb*pb;
+     Cx = Gpp + nb*pb*pb; Cw = Cx + nb*pb*pb; Cp = Cw + nb*pb*pb;
+     C = Cp + nb*pb*pb; C2 = C + nb*pb*pb;
+     CHK_MALLOC(eigenvals2, real, 3 * pb);
+     CHK_MALLOC(rnorm2, real, p);
+     CHK_MALLOC(rscratch, real, p);
+     CHK_MALLOC(hasW, int, nb);
+     CHK_MALLOC(hasP, int, nb);
+     CHK_MALLOC(done, int, nb);
+     CHK_MALLOC(prev_Eb, real, nb); /* previous traces of the blocks */
+
+     /* Initially: orthonormalize each block of Y and do Rayleigh-Ritz
+	in its span. */
+
+     if (constraint)
+	  constraint(X, constraint_data);
+     blocks_orthonormalize(&X, &noAZ, &T, nb, NULL, done,
+			   C, C2, U, S2, S3);
+     for (b = 0; b < nb; ++b)
+	  CHECK(done[b], "non-independent initial Y");
+     A(X, AX, Adata, 1, T);
+     blocks_XtY(Gxx, X, AX, nb, C2);
+     for (b = 0; b < nb; ++b) {
+	  sqmatrix_resize(&G, pb, 0);
+	  sqmatrix_resize(&S, pb, 0);
+	  sqmatrix_resize(&Swork, pb, 0);
+	  set_block(G.data, pb, 0, 0, Gxx + b*pb*pb, pb);
+	  sqmatrix_symmetrize(S, G);
+	  sqmatrix_eigensolve(S, eigenvals + b*pb, Swork);
+	  for (i = 0; i < pb; ++i) /* C = adjoint of eigenvector rows */
+	       for (k = 0; k < pb; ++k)
+		    ASSIGN_CONJ(Cx[b*pb*pb + i*pb + k], S.data[k*pb + i]);
+	  done[b] = 0;
+     }
+     blocks_XpaYC(0.0, T, 1.0, X, Cx, nb); SWAP_EVECT(X, T);
+     blocks_XpaYC(0.0, T, 1.0, AX, Cx, nb); SWAP_EVECT(AX, T);
+
+     do {
+	  for (E = 0.0, i = 0; i < p; ++i)
+	       E += eigenvals[i];
+	  mpi_assert_equal(E);
+
+	  /* W = residual = AX - X * eigenvals */
+	  evectmatrix_copy(W, AX);
+	  matrix_XpaY_diag_real(W.data, -1.0, X.data, eigenvals, W.n, p);
+	  evectmatrix_XtX_diag_real(W, rnorm2, rscratch);
+
+	  /* A block has converged when all of its residuals have, or
+	     when its own trace has stopped changing (as in the other
+	     eigensolvers); the total trace is no use for this, since
+	     the converged blocks dilute its change. */
+	  for (ndone = b = 0; b < nb; ++b) {
+	       real Eb = 0.0;
+	       for (i = b*pb; i < (b+1)*pb; ++i)
+		    Eb += eigenvals[i];
+	       if (!done[b]) {
+		    done[b] = 1;
+		    for (i = b*pb; i < (b+1)*pb; ++i)
+			 if (rnorm2[i] > tolerance * eigenvals[i]*eigenvals[i])
+			      done[b] = 0;
+		    if (iteration > 0 &&
+			fabs(Eb - prev_Eb[b]) < tolerance * 0.5 *
+			(fabs(Eb) + fabs(prev_Eb[b]) + 1e-7))
+			 done[b] = 1;
+	       }
+	       prev_Eb[b] = Eb;
+	       ndone += done[b];
+	  }
+
+	  if (iteration > 0 && mpi_is_master() &&
+	      ((flags & EIGS_VERBOSE) ||
+	       MPIGLUE_CLOCK_DIFF(MPIGLUE_CLOCK, prev_feedback_time)
+	       > FEEDBACK_TIME)) {
+               mpi_one_printf("    iteration %4d: "
+			      "trace = %0.16g (%g%% change), "
+			      "%d/%d blocks converged\n",
+			      iteration, (double) E,
+			      (double) (200.0 * fabs(E - prev_E)
+					/ (fabs(E) + fabs(prev_E))),
+			      ndone, nb);
+               fflush(stdout); /* make sure output appears */
+               prev_feedback_time = MPIGLUE_CLOCK; /* reset feedback clock */
+          }
+
+	  if (ndone == nb)
+               break; /* convergence!  hooray! */
+
+	  /* W = precondition(residuals), orthonormal to X: */
+	  if (K != NULL) {
+	       K(W, T, Kdata, X, NULL, I);
+	       SWAP_EVECT(W, T);
+	  }
+	  if (constraint)
+	       constraint(W, constraint_data);
+	  blocks_orthogonalize_against(W, noAZ, X, AX, nb, C, C2);
+	  blocks_orthonormalize(&W, &noAZ, &T, nb, done, hasW,
+				C, C2, U, S2, S3);
+	  A(W, AW, Adata, 0, T);
+
+	  if (haveP) {
+	       blocks_orthogonalize_against(P, AP, X, AX, nb, C, C2);
+	       blocks_orthogonalize_against(P, AP, W, AW, nb, C, C2);
+	       blocks_orthonormalize(&P, &AP, &T, nb, done, hasP,
+				     C, C2, U, S2, S3);
+	  }
+	  else
+	       for (b = 0; b < nb; ++b)
+		    hasP[b] = 0;
+
+	  /* Gram matrices of A in span [X, W, P], for all blocks: */
+	  blocks_XtY(Gxx, X, AX, nb, C2);
+	  blocks_XtY(Gxw, X, AW, nb, C2);
+	  blocks_XtY(Gww, W, AW, nb, C2);
+	  if (haveP) {
+	       blocks_XtY(Gxp, X, AP, nb, C2);
+	       blocks_XtY(Gwp, W, AP, nb, C2);
+	       blocks_XtY(Gpp, P, AP, nb, C2);
+	  }
+
+	  /* Rayleigh-Ritz in each unconverged block, using whichever
+	     of W_b and P_b are independent; Cx, Cw, and Cp get the
+	     coefficients of the new X in terms of X, W, and P. */
+	  for (i = 0; i < 3 * nb*pb*pb; ++i)
+	       ASSIGN_ZERO(Cx[i]);
+	  for (b = 0; b < nb; ++b) {
+	       int ow = pb, op, q;
+	       scalar *Cxb = Cx + b*pb*pb, *Cwb = Cw + b*pb*pb;
+	       scalar *Cpb = Cp + b*pb*pb;
+
+	       if (done[b]) { /* leave X_b as is */
+		    for (i = 0; i < pb; ++i)
+			 ASSIGN_REAL(Cxb[i*pb + i], 1.0);
+		    continue;
+	       }
+
+	       op = pb * (1 + hasW[b]);
+	       q = op + pb * hasP[b];
+	       sqmatrix_resize(&G, q, 0);
+	       sqmatrix_resize(&S, q, 0);
+	       sqmatrix_resize(&Swork, q, 0);
+	       set_block(G.data, q, 0, 0, Gxx + b*pb*pb, pb);
+	       if (hasW[b]) {
+		    set_block(G.data, q, 0, ow, Gxw + b*pb*pb, pb);
+		    set_block(G.data, q, ow, ow, Gww + b*pb*pb, pb);
+	       }
+	       if (hasP[b]) {
+		    set_block(G.data, q, 0, op, Gxp + b*pb*pb, pb);
+		    if (hasW[b])
+			 set_block(G.data, q, ow, op, Gwp + b*pb*pb, pb);
+		    set_block(G.data, q, op, op, Gpp + b*pb*pb, pb);
+	       }
+	       sqmatrix_copy_upper2full(S, G);
+	       sqmatrix_eigensolve(S, eigenvals2, Swork);
+
+	       /* the eigenvectors are the (conjugated) rows of S: */
+	       for (i = 0; i < q; ++i)
+		    for (k = 0; k < pb; ++k) {
+			 scalar c;
+			 ASSIGN_CONJ(c, S.data[k*q + i]);
+			 if (i < ow)
+			      Cxb[i*pb + k] = c;
+			 else if (i < op)
+			      Cwb[(i - ow)*pb + k] = c;
+			 else
+			      Cpb[(i - op)*pb + k] = c;
+		    }
+	       for (i = 0; i < pb; ++i)
+		    eigenvals[b*pb + i] = eigenvals2[i];
+	  }
+
+	  /* T = W Cw + P Cp, X = X Cx + T, and P = T, likewise for
+	     AX and AP.  The old P buffer is free after T is computed,
+	     so we put the new X there. */
+#define UPDATE_XP(X, W, P) { \
+	       blocks_XpaYC(0.0, T, 1.0, W, Cw, nb); \
+	       if (haveP) blocks_XpaYC(1.0, T, 1.0, P, Cp, nb); \
+	       evectmatrix_copy(P, T); \
+	       blocks_XpaYC(1.0, P, 1.0, X, Cx, nb); \
+	       SWAP_EVECT(X, P); \
+	       SWAP_EVECT(P, T); \
+	  }
+	  UPDATE_XP(X, W, P);
+	  UPDATE_XP(AX, AW, AP);
+#undef UPDATE_XP
+	  haveP = 1;
+
+	  prev_E = E;
+     } while (++iteration < EIGENSOLVER_MAX_ITERATIONS);
+
+     CHECK(iteration < EIGENSOLVER_MAX_ITERATIONS,
+           "failure to converge after "
+           STRINGIZE(EIGENSOLVER_MAX_ITERATIONS)
+           " iterations");
+
+     if (X.data != Y.data)
+	  evectmatrix_copy(Y, X);
+
+     free(prev_Eb);
+     free(done);
+     free(hasP);
+     free(hasW);
+     free(rscratch);
+     free(rnorm2);
+     free(eigenvals2);
+     free(Gxx);
+     destroy_sqmatrix(I);
+     destroy_sqmatrix(S3);
+     destroy_sqmatrix(S2);
+     destroy_sqmatrix(U);
+     destroy_sqmatrix(Swork);
+     destroy_sqmatrix(S);
+     destroy_sqmatrix(G);
+
+     *num_iterations = iteration;
+}
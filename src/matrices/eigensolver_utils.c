@@ -17,13 +17,17 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <math.h>
+#include <float.h>
 
 #include "config.h"
 #include <mpiglue.h>
+#include <mpi_utils.h>
 #include <check.h>
 #include <scalar.h>
 #include <matrices.h>
+#include <blasglue.h>
 
 #include "eigensolver.h"
 
@@ -68,6 +72,168 @@ void eigensolver_get_eigenvals(evectmatrix Y, real *eigenvals,
 
 /**************************************************************************/
 
+/* Orthonormalization of the columns of an evectmatrix.  The default
+   is Y <- Y / sqrt(Yt*Y), which needs a Hermitian eigendecomposition
+   and loses accuracy as Yt*Y becomes ill-conditioned (roughly squaring
+   its condition number).  The alternatives, selected by flags, are:
+
+   EIGS_CHOLQR: CholeskyQR2, i.e. Y <- Y / R with Yt*Y = Rt*R, done
+   twice (the second pass cleans up the loss of orthogonality of the
+   first).  If the first Cholesky factorization fails, we shift Yt*Y
+   slightly and do a third pass ("shifted CholeskyQR3", Fukaya et al.,
+   SIAM J. Sci. Comput. 42, A477, 2020).  One p x p reduction per pass.
+
+   EIGS_TSQR: a tall-skinny QR: each process does a Householder QR of
+   its rows of Y, then the p x p R factors of all the processes are
+   gathered with a single reduction and factorized again.  This is
+   unconditionally stable, at the cost of local Householder QRs. */
+
+#ifdef SCALAR_SINGLE_PREC
+#  define REAL_EPSILON FLT_EPSILON
+#else
+#  define REAL_EPSILON DBL_EPSILON
+#endif
+
+/* One CholeskyQR pass: Y <- Y / R, with R <- 1/R on output, where
+   Rt*R = Yt*Y + shift * trace(Yt*Y) * I.  S is a scratch matrix.
+   Returns 0, leaving Y unchanged, if the Cholesky factorization fails. */
+static int cholqr_pass(evectmatrix Y, sqmatrix R, sqmatrix S, real shift)
+{
+     evectmatrix_XtX(R, Y, S);
+     if (shift > 0) {
+	  int i;
+	  real trace = SCALAR_RE(sqmatrix_trace(R));
+	  for (i = 0; i < R.p; ++i)
+	       ASSIGN_SCALAR(R.data[i * R.p + i],
+			     SCALAR_RE(R.data[i * R.p + i]) + shift * trace,
+			     SCALAR_IM(R.data[i * R.p + i]));
+     }
+     if (!sqmatrix_cholesky(R) || !sqmatrix_invert_upper(R))
+	  return 0;
+     evectmatrix_XeXR(Y, R);
+     return 1;
+}
+
+static int orthonormalize_cholqr(evectmatrix Y, sqmatrix T,
+				 sqmatrix S1, sqmatrix S2)
+{
+     int pass, npasses = 2;
+
+     if (!cholqr_pass(Y, T, S1, 0.0)) {
+	  real shift = 11 * (Y.N * Y.c * Y.p + Y.p * (Y.p + 1)) * REAL_EPSILON;
+	  if (!cholqr_pass(Y, T, S1, shift))
+	       return 0;
+	  npasses = 3;
+     }
+     for (pass = 1; pass < npasses; ++pass) {
+	  if (!cholqr_pass(Y, S1, S2, 0.0))
+	       return 0;
+	  sqmatrix_AeBC(S2, T, 0, S1, 0);
+	  sqmatrix_copy(T, S2);
+     }
+     return 1;
+}
+
+static int orthonormalize_tsqr(evectmatrix Y, evectmatrix Work,
+			       sqmatrix T, sqmatrix Qb)
+{
+     int rank, nprocs, p = Y.p, k = Y.n < Y.p ? Y.n : Y.p, i, j, lwork;
+     scalar *tau, *work, *Rs, *Rsum;
+
+     MPI_Comm_rank(mpb_comm, &rank);
+     MPI_Comm_size(mpb_comm, &nprocs);
+
+     lwork = 64 * p;
+     CHK_MALLOC(tau, scalar, p);
+     CHK_MALLOC(work, scalar, lwork);
+     CHK_MALLOC(Rs, scalar, 2 * nprocs * p * p);
+     Rsum = Rs + nprocs * p * p;
+
+     /* local QR of our rows of Y; if we have fewer rows than columns,
+	the extra rows of R and columns of Q are zero. */
+     evectmatrix_copy(Work, Y);
+     lapackglue_geqrf(Y.n, p, Work.data, p, tau, work, lwork);
+     memset(Rs, 0, sizeof(scalar) * (nprocs * p * p));
+     for (i = 0; i < k; ++i)
+	  for (j = i; j < p; ++j)
+	       Rs[(rank * p + i) * p + j] = Work.data[i * p + j];
+     lapackglue_orgqr(Y.n, k, k, Work.data, p, tau, work, lwork);
+     for (i = 0; i < Y.n; ++i)
+	  for (j = k; j < p; ++j)
+	       ASSIGN_ZERO(Work.data[i * p + j]);
+
+     /* stack the R's of all the processes, and factorize the stack
+	(redundantly, on every process): */
+     mpi_allreduce(Rs, Rsum, nprocs * p * p * SCALAR_NUMVALS,
+		   real, SCALAR_MPI_TYPE, MPI_SUM, mpb_comm);
+     lapackglue_geqrf(nprocs * p, p, Rsum, p, tau, work, lwork);
+     for (i = 0; i < p; ++i)
+	  for (j = 0; j < p; ++j)
+	       if (j >= i)
+		    T.data[i * p + j] = Rsum[i * p + j];
+	       else
+		    ASSIGN_ZERO(T.data[i * p + j]);
+     lapackglue_orgqr(nprocs * p, p, p, Rsum, p, tau, work, lwork);
+
+     /* Y = (local Q) * (our block of rows of the stack's Q) */
+     blasglue_copy(p * p, Rsum + rank * p * p, 1, Qb.data, 1);
+     evectmatrix_XeYS(Y, Work, Qb, 0);
+
+     free(Rs);
+     free(work);
+     free(tau);
+
+     return sqmatrix_invert_upper(T);
+}
+
+/* Orthonormalize the columns of Y in place, using the method selected
+   by flags (see above).  Work is a scratch matrix the same size as Y,
+   and T, S1, and S2 are p x p matrices; on output, T is the matrix
+   such that the new Y is the old Y times T (e.g. for updating A*Y
+   without applying A again), and S1 and S2 are overwritten.  Returns
+   0 if the columns of Y are not linearly independent, in which case
+   Y is undefined. */
+int eigensolver_orthonormalize(evectmatrix Y, evectmatrix Work,
+			       sqmatrix T, sqmatrix S1, sqmatrix S2,
+			       int flags)
+{
+     CHECK(T.p == Y.p && S1.p == Y.p && S2.p == Y.p,
+	   "matrices not conformant");
+
+     if (flags & EIGS_TSQR)
+	  return orthonormalize_tsqr(Y, Work, T, S1);
+     else if (flags & EIGS_CHOLQR)
+	  return orthonormalize_cholqr(Y, T, S1, S2);
+
+     evectmatrix_XtX(S1, Y, S2);
+     if (!sqmatrix_invert(S1, 1, S2))
+	  return 0;
+     sqmatrix_sqrt(T, S1, S2); /* T = 1/sqrt(Yt*Y) */
+     evectmatrix_XeYS(Work, Y, T, 1);
+     evectmatrix_copy(Y, Work);
+     return 1;
+}
+
+/* Return a matrix like Y but with room for p columns, taken from
+   Work[i] if it is big enough and otherwise allocated (in which case
+   *allocated is set, and the caller must destroy it).  This is for
+   eigensolvers that internally iterate on more than Y.p vectors. */
+evectmatrix eigensolver_subspace_matrix(evectmatrix Y, int p,
+					evectmatrix Work[], int nWork, int i,
+					int *allocated)
+{
+     evectmatrix X;
+     *allocated = i >= nWork || Work[i].alloc_p < p;
+     if (*allocated)
+	  X = create_evectmatrix(Y.N, Y.c, p, Y.localN, Y.Nstart, Y.allocN);
+     else
+	  X = Work[i];
+     evectmatrix_resize(&X, p, 0);
+     return X;
+}
+
+/**************************************************************************/
+
 /* Subroutines for chaining constraints, to make it easy to pass
    multiple constraint functions to the eigensolver: */
 
@@ -136,6 +136,14 @@ void evectmatrix_XpaYS(evectmatrix X, real a, evectmatrix Y,
      evectmatrix_aXpbYS_sub(1.0, X, a, Y, S, 0, sdagger);
 }
 
+/* compute X = X * R in place, where R is upper triangular. */
+void evectmatrix_XeXR(evectmatrix X, sqmatrix R)
+{
+     CHECK(R.p == X.p, "arrays not conformant");
+     blasglue_trmm('R', 'U', 'N', X.n, X.p, 1.0, R.data, R.p, X.data, X.p);
+     evectmatrix_flops += X.N * X.c * X.p * (1 + X.p);
+}
+
 /* compute U = adjoint(X) * X, with S a scratch matrix. */
 void evectmatrix_XtX(sqmatrix U, evectmatrix X, sqmatrix S)
 {
@@ -276,3 +284,108 @@ scalar evectmatrix_traceXtY(evectmatrix X, evectmatrix Y)
 
      return trace;
 }
+
+/**************************************************************************/
+
+/* Batched reductions.  Each of the functions above does its own
+   reduction (allreduce) over the processes, and for the small p x p
+   results these are dominated by latency on large parallel runs.  To
+   combine several of them into a single reduction, the evectreduce_
+   functions below compute only the local contributions, queueing them
+   in an evectreduce buffer, and evectreduce_sum then sums them all at
+   once and stores each result in its destination.  (The destinations
+   must not be used or resized until evectreduce_sum is called.) */
+
+evectreduce create_evectreduce(void)
+{
+     evectreduce R;
+
+     R.n = R.nalloc = R.nitems = 0;
+     R.buf = R.sum = (scalar *) NULL;
+     return R;
+}
+
+void destroy_evectreduce(evectreduce R)
+{
+     free(R.buf);
+}
+
+/* queue a result of size scalars, to be stored in dest, and return
+   the buffer for its local contribution */
+static scalar *evectreduce_add(evectreduce *R, scalar *dest, int size)
+{
+     scalar *b;
+
+     CHECK(R->nitems < EVECTREDUCE_MAX_ITEMS, "too many queued reductions");
+     if (R->n + size > R->nalloc) {
+	  int nalloc = R->n + size > 2 * R->nalloc ?
+	       R->n + size : 2 * R->nalloc;
+	  CHK_MALLOC(b, scalar, 2 * nalloc);
+	  if (R->n > 0)
+	       memcpy(b, R->buf, sizeof(scalar) * R->n);
+	  free(R->buf);
+	  R->buf = b;
+	  R->sum = b + nalloc;
+	  R->nalloc = nalloc;
+     }
+     R->dest[R->nitems] = dest;
+     R->size[R->nitems++] = size;
+     b = R->buf + R->n;
+     R->n += size;
+     return b;
+}
+
+/* queue U = adjoint(X) * X */
+void evectreduce_XtX(evectreduce *R, sqmatrix U, evectmatrix X)
+{
+     scalar *S;
+     int i, j;
+
+     CHECK(X.p == U.p, "matrices not conformant");
+
+     S = evectreduce_add(R, U.data, U.p * U.p);
+     memset(S, 0, sizeof(scalar) * (U.p * U.p));
+     blasglue_herk('U', 'C', X.p, X.n, 1.0, X.data, X.p, 0.0, S, U.p);
+     evectmatrix_flops += X.N * X.c * X.p * (X.p - 1);
+     for (i = 0; i < U.p; ++i)
+	  for (j = i + 1; j < U.p; ++j)
+	       ASSIGN_CONJ(S[j * U.p + i], S[i * U.p + j]);
+}
+
+/* queue U = adjoint(X) * Y */
+void evectreduce_XtY(evectreduce *R, sqmatrix U,
+		     evectmatrix X, evectmatrix Y)
+{
+     CHECK(X.p == Y.p && X.n == Y.n && X.p == U.p,
+	   "matrices not conformant");
+
+     blasglue_gemm('C', 'N', X.p, X.p, X.n,
+		   1.0, X.data, X.p, Y.data, Y.p, 0.0,
+		   evectreduce_add(R, U.data, U.p * U.p), U.p);
+     evectmatrix_flops += X.N * X.c * X.p * (2*X.p);
+}
+
+/* queue *trace = trace(adjoint(X) * Y) */
+void evectreduce_traceXtY(evectreduce *R, scalar *trace,
+			  evectmatrix X, evectmatrix Y)
+{
+     CHECK(X.p == Y.p && X.n == Y.n, "matrices not conformant");
+
+     *evectreduce_add(R, trace, 1) =
+	  blasglue_dotc(X.n * X.p, X.data, 1, Y.data, 1);
+     evectmatrix_flops += X.N * X.c * X.p * (2*X.p) + X.p;
+}
+
+/* do the queued reductions with a single allreduce */
+void evectreduce_sum(evectreduce *R)
+{
+     int i, n;
+
+     if (R->n == 0)
+	  return;
+     mpi_allreduce(R->buf, R->sum, R->n * SCALAR_NUMVALS,
+		   real, SCALAR_MPI_TYPE, MPI_SUM, mpb_comm);
+     for (i = n = 0; i < R->nitems; n += R->size[i++])
+	  memcpy(R->dest[i], R->sum + n, sizeof(scalar) * R->size[i]);
+     R->n = R->nitems = 0;
+}
@@ -17,6 +17,7 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 
 #include "config.h"
 #include <check.h>
@@ -44,6 +45,7 @@ evectmatrix create_evectmatrix(int N, int c, int p,
      
      if (allocN > 0) {
 	  CHK_MALLOC(X.data, scalar, allocN * c * p);
+	  matrix_first_touch(X.data, sizeof(scalar) * allocN * c * p);
      }
      else
 	  X.data = NULL;
@@ -74,6 +76,25 @@ void destroy_sqmatrix(sqmatrix X)
      free(X.data);
 }
 
+/* Zero the size bytes of a newly allocated array, in parallel, with
+   (roughly) the same contiguous division among the threads as the
+   "static" schedule of the OpenMP loops over it.  On a NUMA machine, where a
+   page is placed in the memory of the node that first touches it,
+   each thread's part of the array is thus local to that thread. */
+void matrix_first_touch(void *data, size_t size)
+{
+     const size_t chunk = 4096; /* a typical page size */
+     int i, nchunks = (int) ((size + chunk - 1) / chunk);
+     char *cdata = (char *) data;
+
+#pragma omp parallel for schedule(static)
+     for (i = 0; i < nchunks; ++i) {
+	  size_t start = chunk * i;
+	  memset(cdata + start, 0,
+		 size - start < chunk ? size - start : chunk);
+     }
+}
+
 /***********************************************************************/
 
 /* a few general matrix operations for diagonal matrices; these
@@ -18,6 +18,8 @@
 #ifndef MATRICES_H
 #define MATRICES_H
 
+#include <stddef.h>
+
 #include "scalar.h"
 
 #ifdef __cplusplus
@@ -36,6 +38,16 @@ typedef struct {
      scalar *data;
 } sqmatrix;
 
+/* a buffer for batching several evectmatrix reductions (see evectmatrix.c) */
+#define EVECTREDUCE_MAX_ITEMS 16
+typedef struct {
+     int n, nalloc; /* number of scalars in buf, and allocated size */
+     scalar *buf, *sum;
+     int nitems; /* number of queued results, with destinations: */
+     scalar *dest[EVECTREDUCE_MAX_ITEMS];
+     int size[EVECTREDUCE_MAX_ITEMS];
+} evectreduce;
+
 /* try to keep track of flops, at least from evectmatrix multiplications */
 extern double evectmatrix_flops;
 
@@ -46,6 +58,7 @@ extern evectmatrix create_evectmatrix(int N, int c, int p,
 extern void destroy_evectmatrix(evectmatrix X);
 extern sqmatrix create_sqmatrix(int p);
 extern void destroy_sqmatrix(sqmatrix X);
+extern void matrix_first_touch(void *data, size_t size);
 
 /* diagonal matrix utils: */
 
@@ -78,6 +91,7 @@ extern void evectmatrix_XeYS(evectmatrix X, evectmatrix Y,
 			     sqmatrix S, short sherm);
 extern void evectmatrix_XpaYS(evectmatrix X, real a, evectmatrix Y,
 			      sqmatrix S, short sdagger);
+extern void evectmatrix_XeXR(evectmatrix X, sqmatrix R);
 extern void evectmatrix_XtX(sqmatrix U, evectmatrix X, sqmatrix S);
 extern void evectmatrix_XtY(sqmatrix U, evectmatrix X, evectmatrix Y,
 			    sqmatrix S);
@@ -96,6 +110,15 @@ extern void evectmatrix_XtX_diag_real(evectmatrix X, real *diag,
 				      real *scratch_diag);
 extern scalar evectmatrix_traceXtY(evectmatrix X, evectmatrix Y);
 
+extern evectreduce create_evectreduce(void);
+extern void destroy_evectreduce(evectreduce R);
+extern void evectreduce_XtX(evectreduce *R, sqmatrix U, evectmatrix X);
+extern void evectreduce_XtY(evectreduce *R, sqmatrix U,
+			    evectmatrix X, evectmatrix Y);
+extern void evectreduce_traceXtY(evectreduce *R, scalar *trace,
+				 evectmatrix X, evectmatrix Y);
+extern void evectreduce_sum(evectreduce *R);
+
 /* sqmatrix operations, defined in sqmatrix.c: */
 
 extern void sqmatrix_assert_hermitian(sqmatrix A);
@@ -113,6 +136,8 @@ extern void sqmatrix_ApaB(sqmatrix A, real a, sqmatrix B);
 extern void sqmatrix_aApbB(real a, sqmatrix A, real b, sqmatrix B);
 extern int sqmatrix_invert(sqmatrix U, short positive_definite,
 			    sqmatrix Work);
+extern int sqmatrix_cholesky(sqmatrix U);
+extern int sqmatrix_invert_upper(sqmatrix R);
 extern void sqmatrix_eigensolve(sqmatrix U, real *eigenvals, sqmatrix W);
 extern void sqmatrix_gen_eigensolve(sqmatrix U, sqmatrix B, real *eigenvals, sqmatrix W);
 extern void sqmatrix_eigenvalues(sqmatrix A, scalar_complex *eigenvals);
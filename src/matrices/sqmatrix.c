@@ -244,6 +244,28 @@ int sqmatrix_invert(sqmatrix U, short positive_definite,
      return 1;
 }
 
+/* U <- R, the upper-triangular Cholesky factor of U = adjoint(R) * R.
+   U must be Hermitian.  Returns 1 on success, 0 if U is not
+   (numerically) positive-definite. */
+int sqmatrix_cholesky(sqmatrix U)
+{
+     int i, j;
+
+     sqmatrix_assert_hermitian(U);
+     if (!lapackglue_potrf('U', U.p, U.data, U.p)) return 0;
+     for (i = 0; i < U.p; ++i)
+	  for (j = 0; j < i; ++j)
+	       ASSIGN_ZERO(U.data[i * U.p + j]);
+     return 1;
+}
+
+/* R <- 1/R, where R is upper triangular.  Returns 1 on success, 0
+   if R is singular. */
+int sqmatrix_invert_upper(sqmatrix R)
+{
+     return lapackglue_trtri('U', R.p, R.data, R.p);
+}
+
 /* U <- eigenvectors of Ux=lambda B x, while B is overwritten (by its
    Cholesky factors).  U and B must be Hermitian, and B must be
    positive-definite; if B==NULL then it is taken to be the
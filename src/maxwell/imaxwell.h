@@ -75,6 +75,13 @@
 #    define FFTW(x) fftw_ ## x
 #  endif
   typedef FFTW(plan) fftplan;
+   /* single-precision FFTs for maxwell_set_mixed_precision, if configure
+      found libfftw3f in addition to the ordinary FFTW3 library (and,
+      with OpenMP, libfftw3f_omp, since single-threaded FFTs would be
+      slower than the multi-threaded double-precision ones): */
+#  if defined(HAVE_MIXED_PRECISION_FFT) && !defined(HAVE_MPI) && !defined(WITH_HERMITIAN_EPSILON) && (!defined(USE_OPENMP) || defined(HAVE_LIBFFTW3F_OMP))
+#    define MAXWELL_MIXED_PRECISION 1
+#  endif
 #elif defined(HAVE_FFTW)
 #  ifdef HAVE_MPI
 #    ifdef SCALAR_COMPLEX
@@ -91,4 +98,7 @@
 #  endif
 #endif
 
+/* in maxwell_op.c: */
+extern int maxwell_2d_parity_components(maxwell_data *d);
+
 #endif /* IMAXWELL_H */
@@ -17,10 +17,17 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <math.h>
 
 #include "imaxwell.h"
 #include "check.h"
+#include <mpiglue.h>
+#include <mpi_utils.h>
+
+#ifdef USE_OPENMP
+#  include <omp.h>
+#endif
 
 /* This file is has too many #ifdef's...blech. */
 
@@ -62,6 +69,9 @@ maxwell_data *create_maxwell_data(int nx, int ny, int nz,
      d->current_k[0] = d->current_k[1] = d->current_k[2] = 0.0;
      d->parity = NO_PARITY;
 
+     d->fft_planner_effort = MAXWELL_FFT_ESTIMATE;
+     d->fft_wisdom_dirty = 0;
+
      d->last_dim_size = d->last_dim = n[rank - 1];
 
      /* ----------------------------------------------------- */
@@ -218,11 +228,17 @@ maxwell_data *create_maxwell_data(int nx, int ny, int nz,
 #endif
 
      CHK_MALLOC(d->eps_inv, symmetric_matrix, d->fft_output_size);
+     matrix_first_touch(d->eps_inv,
+			sizeof(symmetric_matrix) * d->fft_output_size);
      d->mu_inv = NULL;
+     d->mixed_precision = 0;
+     d->nfplans = 0;
+     d->fft_data_float = d->eps_inv_float = NULL;
 
      /* A scratch output array is required because the "ordinary" arrays
 	are not in a cartesian basis (or even a constant basis). */
      fft_data_size *= d->max_fft_bands;
+     d->fft_data_size = 3 * fft_data_size;
 #if defined(HAVE_FFTW3)
      d->fft_data = (scalar *) FFTW(malloc)(sizeof(scalar) * 3 * fft_data_size);
      CHECK(d->fft_data, "out of memory!");
@@ -231,9 +247,13 @@ maxwell_data *create_maxwell_data(int nx, int ny, int nz,
      CHK_MALLOC(d->fft_data, scalar, 3 * fft_data_size);
      d->fft_data2 = d->fft_data; /* works in-place */
 #endif
+     matrix_first_touch(d->fft_data, sizeof(scalar) * 3 * fft_data_size);
 
      CHK_MALLOC(d->k_plus_G, k_data, *local_N);
      CHK_MALLOC(d->k_plus_G_normsqr, real, *local_N);
+     d->num_k_batch = 0;
+     d->k_plus_G_batch = NULL;
+     d->k_plus_G_normsqr_batch = NULL;
 
      d->eps_inv_mean = 1.0;
      d->mu_inv_mean = 1.0;
@@ -246,35 +266,48 @@ maxwell_data *create_maxwell_data(int nx, int ny, int nz,
      return d;
 }
 
-void destroy_maxwell_data(maxwell_data *d)
+static void destroy_plans(maxwell_data *d)
 {
-     if (d) {
-	  int i;
+     int i;
 
-	  for (i = 0; i < d->nplans; ++i) {
+     for (i = 0; i < d->nplans; ++i) {
 #if defined(HAVE_FFTW3)
-	       FFTW(destroy_plan)((fftplan) (d->plans[i]));
-	       FFTW(destroy_plan)((fftplan) (d->iplans[i]));
+	  FFTW(destroy_plan)((fftplan) (d->plans[i]));
+	  FFTW(destroy_plan)((fftplan) (d->iplans[i]));
 #elif defined(HAVE_FFTW)
 #  ifdef HAVE_MPI
 #    ifdef SCALAR_COMPLEX
-	       fftwnd_mpi_destroy_plan((fftplan) (d->plans[i]));
-	       fftwnd_mpi_destroy_plan((fftplan) (d->iplans[i]));
+	  fftwnd_mpi_destroy_plan((fftplan) (d->plans[i]));
+	  fftwnd_mpi_destroy_plan((fftplan) (d->iplans[i]));
 #    else /* not SCALAR_COMPLEX */
-	       rfftwnd_mpi_destroy_plan((fftplan) (d->plans[i]));
-	       rfftwnd_mpi_destroy_plan((fftplan) (d->iplans[i]));
+	  rfftwnd_mpi_destroy_plan((fftplan) (d->plans[i]));
+	  rfftwnd_mpi_destroy_plan((fftplan) (d->iplans[i]));
 #    endif /* not SCALAR_COMPLEX */
 #  else /* not HAVE_MPI */
 #    ifdef SCALAR_COMPLEX
-	       fftwnd_destroy_plan((fftplan) (d->plans[i]));
-	       fftwnd_destroy_plan((fftplan) (d->iplans[i]));
+	  fftwnd_destroy_plan((fftplan) (d->plans[i]));
+	  fftwnd_destroy_plan((fftplan) (d->iplans[i]));
 #    else /* not SCALAR_COMPLEX */
-	       rfftwnd_destroy_plan((fftplan) (d->plans[i]));
-	       rfftwnd_destroy_plan((fftplan) (d->iplans[i]));
+	  rfftwnd_destroy_plan((fftplan) (d->plans[i]));
+	  rfftwnd_destroy_plan((fftplan) (d->iplans[i]));
 #    endif /* not SCALAR_COMPLEX */
 #  endif /* not HAVE_MPI */
 #endif /* HAVE FFTW */
-	  }
+     }
+     d->nplans = 0;
+#ifdef MAXWELL_MIXED_PRECISION
+     for (i = 0; i < d->nfplans; ++i) {
+	  fftwf_destroy_plan((fftwf_plan) (d->fplans[i]));
+	  fftwf_destroy_plan((fftwf_plan) (d->fiplans[i]));
+     }
+#endif
+     d->nfplans = 0;
+}
+
+void destroy_maxwell_data(maxwell_data *d)
+{
+     if (d) {
+	  destroy_plans(d);
 
 	  free(d->eps_inv);
           if (d->mu_inv) free(d->mu_inv);
@@ -285,8 +318,13 @@ void destroy_maxwell_data(maxwell_data *d)
 #else
 	  free(d->fft_data);
 #endif
+#ifdef MAXWELL_MIXED_PRECISION
+	  fftwf_free(d->fft_data_float);
+#endif
+	  free(d->eps_inv_float);
 	  free(d->k_plus_G);
 	  free(d->k_plus_G_normsqr);
+	  maxwell_set_k_batch(d, 0, NULL, NULL, NULL, NULL);
 
 	  free(d);
      }
@@ -414,6 +452,92 @@ void update_maxwell_data_k(maxwell_data *d, real k[3],
      }
 }
 
+/* Set up the k+G data for nk k points at once, for use with
+   maxwell_batch_operator and maxwell_batch_preconditioner: the
+   ik-th k point is (k[3*ik], k[3*ik+1], k[3*ik+2]) in the basis of
+   the reciprocal lattice vectors, as for update_maxwell_data_k.  The
+   current k point is unchanged, but (as in update_maxwell_data_k)
+   the parity is reset if it is incompatible with any of the k
+   points.  k = 0 is not allowed, since it requires special handling
+   of the constant bands.  nk == 0 deallocates the batch data. */
+void maxwell_set_k_batch(maxwell_data *d, int nk, const real *k,
+			 real G1[3], real G2[3], real G3[3])
+{
+     k_data *kpG_save = d->k_plus_G;
+     real *kpGn2_save = d->k_plus_G_normsqr;
+     real current_k[3];
+     int zero_k = d->zero_k, ik;
+
+     if (d->num_k_batch > 0) {
+	  free(d->k_plus_G_batch);
+	  free(d->k_plus_G_normsqr_batch);
+	  d->k_plus_G_batch = NULL;
+	  d->k_plus_G_normsqr_batch = NULL;
+	  d->num_k_batch = 0;
+     }
+     if (nk <= 0)
+	  return;
+
+     CHK_MALLOC(d->k_plus_G_batch, k_data, nk * d->local_N);
+     CHK_MALLOC(d->k_plus_G_normsqr_batch, real, nk * d->local_N);
+     d->num_k_batch = nk;
+
+     /* compute the tables with update_maxwell_data_k, pointed at
+	the batch arrays: */
+     current_k[0] = d->current_k[0];
+     current_k[1] = d->current_k[1];
+     current_k[2] = d->current_k[2];
+     for (ik = 0; ik < nk; ++ik) {
+	  real kk[3];
+	  kk[0] = k[3*ik]; kk[1] = k[3*ik+1]; kk[2] = k[3*ik+2];
+	  d->k_plus_G = d->k_plus_G_batch + ik * d->local_N;
+	  d->k_plus_G_normsqr = d->k_plus_G_normsqr_batch + ik * d->local_N;
+	  update_maxwell_data_k(d, kk, G1, G2, G3);
+	  CHECK(!d->zero_k, "k = 0 is not supported in a k batch");
+     }
+     d->k_plus_G = kpG_save;
+     d->k_plus_G_normsqr = kpGn2_save;
+     d->current_k[0] = current_k[0];
+     d->current_k[1] = current_k[1];
+     d->current_k[2] = current_k[2];
+     d->zero_k = zero_k;
+}
+
+/* Change the maximum number of bands that are Fourier-transformed at
+   once (initially set by create_maxwell_data), reallocating the FFT
+   scratch array.  This is mainly useful for maxwell_batch_operator,
+   which transforms the bands of all the k points in a batch together. */
+void maxwell_set_max_fft_bands(maxwell_data *d, int max_fft_bands)
+{
+     int band_size = d->fft_data_size / d->max_fft_bands;
+
+     CHECK(max_fft_bands > 0, "max_fft_bands must be positive");
+     if (max_fft_bands == d->max_fft_bands)
+	  return;
+
+#if defined(HAVE_FFTW3)
+     if (d->fft_data2 != d->fft_data)
+	  FFTW(free)(d->fft_data2);
+     FFTW(free)(d->fft_data);
+     d->fft_data = (scalar *) FFTW(malloc)(sizeof(scalar) * band_size
+					   * max_fft_bands);
+     CHECK(d->fft_data, "out of memory!");
+#else
+     free(d->fft_data);
+     CHK_MALLOC(d->fft_data, scalar, band_size * max_fft_bands);
+#endif
+     d->fft_data2 = d->fft_data; /* works in-place */
+     matrix_first_touch(d->fft_data,
+			sizeof(scalar) * band_size * max_fft_bands);
+     d->fft_data_size = band_size * max_fft_bands;
+#ifdef MAXWELL_MIXED_PRECISION
+     fftwf_free(d->fft_data_float); /* reallocated when needed */
+     d->fft_data_float = NULL;
+#endif
+     d->max_fft_bands = max_fft_bands;
+     maxwell_set_num_bands(d, d->num_bands);
+}
+
 void set_maxwell_data_parity(maxwell_data *d, int parity)
 {
      if ((parity & EVEN_Z_PARITY) && (parity & ODD_Z_PARITY))
@@ -427,6 +551,181 @@ void set_maxwell_data_parity(maxwell_data *d, int parity)
      d->parity = parity;
 }
 
+/* Set the FFTW planning effort (one of the MAXWELL_FFT_* constants)
+   for subsequent plans.  Any cached plans are discarded so that they
+   are re-created with the new effort.  (FFTW2 plans are always created
+   with FFTW_ESTIMATE, so this has no effect there.) */
+void maxwell_set_fft_planner_effort(maxwell_data *d, int effort)
+{
+     CHECK(effort >= MAXWELL_FFT_ESTIMATE && effort <= MAXWELL_FFT_PATIENT,
+	   "invalid FFT planner effort");
+#if defined(HAVE_FFTW3)
+     if (effort != d->fft_planner_effort)
+	  destroy_plans(d);
+#endif
+     d->fft_planner_effort = effort;
+}
+
+/* Turn the mixed-precision mode of maxwell_operator on or off, returning
+   whether it is on.  In this mode, the FFTs and the multiplication by
+   eps_inv are done in single precision (halving the memory traffic of
+   the most expensive part of the operator), while the curls and
+   everything outside maxwell_operator stay in the precision of
+   "real".  This limits the accuracy of the eigenvalues to about
+   1e-6 relative, so the caller should switch back to full precision
+   for the final iterations.  It is only available if MPB was compiled
+   with FFTW3 in double precision and the single-precision FFTW3
+   library was also found (and not with MPI); otherwise 0 is returned.
+   The single-precision copy of eps_inv is made here, so this must be
+   called again (with mixed = 1) whenever eps_inv changes.
+
+   0 is also returned if the operator would not use single precision
+   anyway for the current k point and parity, i.e. with a mu or in 2d
+   with a definite z parity (which has its own cheaper operator), so
+   that the caller doesn't waste a single-precision phase. */
+int maxwell_set_mixed_precision(maxwell_data *d, int mixed)
+{
+#ifdef MAXWELL_MIXED_PRECISION
+     if (mixed && (d->mu_inv || maxwell_2d_parity_components(d)))
+	  mixed = 0;
+     if (mixed) {
+	  int i;
+	  if (!d->eps_inv_float)
+	       CHK_MALLOC(d->eps_inv_float, float, 6 * d->fft_output_size);
+#pragma omp parallel for
+	  for (i = 0; i < d->fft_output_size; ++i) {
+	       float *e = d->eps_inv_float + 6 * i;
+	       e[0] = d->eps_inv[i].m00;
+	       e[1] = d->eps_inv[i].m11;
+	       e[2] = d->eps_inv[i].m22;
+	       e[3] = d->eps_inv[i].m01;
+	       e[4] = d->eps_inv[i].m02;
+	       e[5] = d->eps_inv[i].m12;
+	  }
+     }
+     d->mixed_precision = mixed != 0;
+#else
+     (void) mixed;
+     d->mixed_precision = 0;
+#endif
+     return d->mixed_precision;
+}
+
+/* Return a newly malloc'ed filename for an FFTW wisdom file, formed
+   from prefix and suffixed by the grid size, the floating-point
+   precision, and the number of threads (and processes), since wisdom
+   generated for one of these is useless for the others.  (FFTW keys
+   the wisdom itself by howmany/stride/dist, so many block sizes can
+   share the same file.) */
+char *maxwell_fft_wisdom_filename(const maxwell_data *d, const char *prefix)
+{
+     char *fname;
+     int nthreads = 1, nprocs;
+     const char *prec;
+
+#if defined(SCALAR_SINGLE_PREC)
+     prec = "float";
+#elif defined(SCALAR_LONG_DOUBLE_PREC)
+     prec = "ldouble";
+#else
+     prec = "double";
+#endif
+#ifdef USE_OPENMP
+     nthreads = omp_get_max_threads();
+#endif
+     MPI_Comm_size(mpb_comm, &nprocs);
+
+     CHK_MALLOC(fname, char, strlen(prefix) + 128);
+     sprintf(fname, "%s-%dx%dx%d-%s%s-%dt", prefix, d->nx, d->ny, d->nz,
+#ifdef SCALAR_COMPLEX
+	     "complex-",
+#else
+	     "real-",
+#endif
+	     prec, nthreads);
+     if (nprocs > 1)
+	  sprintf(fname + strlen(fname), "-%dp", nprocs);
+     strcat(fname, ".wisdom");
+     return fname;
+}
+
+#ifdef MAXWELL_MIXED_PRECISION
+/* Return a newly malloc'ed filename for the single-precision FFTW
+   wisdom of the mixed-precision mode, which FFTW keeps separately
+   from the double-precision wisdom: fname with "-float" inserted
+   before the ".wisdom" suffix. */
+static char *float_wisdom_filename(const char *fname)
+{
+     char *ffname;
+     size_t len = strlen(fname);
+
+     CHK_MALLOC(ffname, char, len + 16);
+     strcpy(ffname, fname);
+     if (len >= 7 && !strcmp(fname + len - 7, ".wisdom"))
+	  ffname[len - 7] = 0;
+     strcat(ffname, "-float.wisdom");
+     return ffname;
+}
+#endif
+
+/* Import FFTW wisdom from fname, if it exists, returning non-zero
+   on success.  Also imports the single-precision wisdom for the
+   mixed-precision mode, if any.  Must be called by all processes. */
+int maxwell_import_fft_wisdom(const char *fname)
+{
+     int ok = 0;
+#if defined(HAVE_FFTW3)
+     if (mpi_is_master())
+	  ok = FFTW(import_wisdom_from_filename)(fname);
+#  ifdef HAVE_MPI
+     MPI_Bcast(&ok, 1, MPI_INT, 0, mpb_comm);
+     if (ok)
+	  FFTW(mpi_broadcast_wisdom)(mpb_comm);
+#  endif
+#  ifdef MAXWELL_MIXED_PRECISION
+     {
+	  char *ffname = float_wisdom_filename(fname);
+	  fftwf_import_wisdom_from_filename(ffname);
+	  free(ffname);
+     }
+#  endif
+#else
+     (void) fname; /* FFTW2 wisdom is not supported */
+#endif
+     return ok;
+}
+
+/* Export the accumulated FFTW wisdom to fname, but only if new plans
+   were measured since the last export (and similarly for the
+   single-precision wisdom).  Must be called by all processes. */
+void maxwell_export_fft_wisdom(maxwell_data *d, const char *fname)
+{
+     if (!d->fft_wisdom_dirty)
+	  return;
+#if defined(HAVE_FFTW3)
+     if (d->fft_wisdom_dirty & FFT_WISDOM_DIRTY) {
+#  ifdef HAVE_MPI
+	  FFTW(mpi_gather_wisdom)(mpb_comm);
+#  endif
+	  if (mpi_is_master() && !FFTW(export_wisdom_to_filename)(fname))
+	       mpi_one_fprintf(stderr, "WARNING: could not write FFTW "
+			       "wisdom file %s\n", fname);
+     }
+#  ifdef MAXWELL_MIXED_PRECISION
+     if (d->fft_wisdom_dirty & FFT_WISDOM_DIRTY_FLOAT) {
+	  char *ffname = float_wisdom_filename(fname);
+	  if (!fftwf_export_wisdom_to_filename(ffname))
+	       mpi_one_fprintf(stderr, "WARNING: could not write FFTW "
+			       "wisdom file %s\n", ffname);
+	  free(ffname);
+     }
+#  endif
+#else
+     (void) fname;
+#endif
+     d->fft_wisdom_dirty = 0;
+}
+
 maxwell_target_data *create_maxwell_target_data(maxwell_data *md, 
 						real target_frequency)
 {
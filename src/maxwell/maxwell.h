@@ -83,6 +83,15 @@ typedef struct {
 
 #define MAX_NPLANS 32
 
+/* FFTW planner effort used by maxwell_compute_fft (FFTW3 only): */
+#define MAXWELL_FFT_ESTIMATE 0
+#define MAXWELL_FFT_MEASURE 1
+#define MAXWELL_FFT_PATIENT 2
+
+/* bits of fft_wisdom_dirty: */
+#define FFT_WISDOM_DIRTY 1
+#define FFT_WISDOM_DIRTY_FLOAT 2
+
 typedef struct {
      int nx, ny, nz;
      int local_nx, local_ny;
@@ -101,17 +110,41 @@ typedef struct {
 
      void *plans[MAX_NPLANS], *iplans[MAX_NPLANS];
      int nplans, plans_howmany[MAX_NPLANS], plans_stride[MAX_NPLANS], plans_dist[MAX_NPLANS];
+     int fft_planner_effort; /* one of the MAXWELL_FFT_* constants */
+     int fft_wisdom_dirty; /* FFT_WISDOM_DIRTY (| FFT_WISDOM_DIRTY_FLOAT)
+			      if new (single-precision) plans were
+			      measured */
 
      scalar *fft_data, *fft_data2;
+     int fft_data_size; /* # of scalars allocated for fft_data */
      
      int zero_k;  /* non-zero if k is zero (handled specially) */
      k_data *k_plus_G;
      real *k_plus_G_normsqr;
 
+     /* k+G data for several k-points at once, for maxwell_batch_operator
+	(see maxwell_set_k_batch); num_k_batch == 0 if not used.  The
+	k_plus_G and k_plus_G_normsqr of the ik-th k point start at
+	k_plus_G_batch + ik * local_N and k_plus_G_normsqr_batch + ik *
+	local_N, respectively. */
+     int num_k_batch;
+     k_data *k_plus_G_batch;
+     real *k_plus_G_normsqr_batch;
+
      symmetric_matrix *eps_inv;
      real eps_inv_mean;
+
      symmetric_matrix *mu_inv;
      real mu_inv_mean;
+
+     /* single-precision FFT plans and data for the mixed-precision
+	operator (see maxwell_set_mixed_precision); eps_inv_float holds
+	m00,m11,m22,m01,m02,m12 at each point. */
+     int mixed_precision;
+     void *fplans[MAX_NPLANS], *fiplans[MAX_NPLANS];
+     int nfplans, fplans_howmany[MAX_NPLANS];
+     float *fft_data_float;
+     float *eps_inv_float;
 } maxwell_data;
 
 extern maxwell_data *create_maxwell_data(int nx, int ny, int nz,
@@ -128,10 +161,27 @@ extern void update_maxwell_data_k(maxwell_data *d, real k[3],
 
 extern void set_maxwell_data_parity(maxwell_data *d, int parity);
 
+extern void maxwell_set_k_batch(maxwell_data *d, int nk, const real *k,
+				real G1[3], real G2[3], real G3[3]);
+extern void maxwell_set_max_fft_bands(maxwell_data *d, int max_fft_bands);
+
+extern void maxwell_set_fft_planner_effort(maxwell_data *d, int effort);
+extern int maxwell_set_mixed_precision(maxwell_data *d, int mixed);
+extern char *maxwell_fft_wisdom_filename(const maxwell_data *d,
+					 const char *prefix);
+extern int maxwell_import_fft_wisdom(const char *fname);
+extern void maxwell_export_fft_wisdom(maxwell_data *d, const char *fname);
+
 typedef void (*maxwell_dielectric_function) (symmetric_matrix *eps,
 					     symmetric_matrix *eps_inv,
 					     const real r[3],
 					     void *epsilon_data);
+/* Like maxwell_dielectric_function, but for the n points
+   r[3*i], r[3*i+1], r[3*i+2] at once, setting eps[i] and eps_inv[i]. */
+typedef void (*maxwell_dielectric_batch_function) (symmetric_matrix *eps,
+						   symmetric_matrix *eps_inv,
+						   int n, const real *r,
+						   void *epsilon_data);
 typedef int (*maxwell_dielectric_mean_function) (symmetric_matrix *meps,
 						 symmetric_matrix *meps_inv,
 						 real n[3],
@@ -139,6 +189,19 @@ typedef int (*maxwell_dielectric_mean_function) (symmetric_matrix *meps,
 						 real tol,
 						 const real r[3],
 						 void *epsilon_data);
+/* If epsilon is constant over the box rmin <= r <= rmax (in the basis
+   of the lattice vectors, like r above), set eps to that constant
+   and return 1; otherwise (or if unsure) return 0. */
+typedef int (*maxwell_dielectric_uniform_function) (symmetric_matrix *eps,
+						    const real rmin[3],
+						    const real rmax[3],
+						    void *epsilon_data);
+/* Return 0 if epsilon is certainly unchanged, since the previous call
+   to set_maxwell_dielectric2, over the box rmin <= r <= rmax (in the
+   same basis as above); otherwise (or if unsure) return 1. */
+typedef int (*maxwell_dielectric_changed_function) (const real rmin[3],
+						    const real rmax[3],
+						    void *epsilon_data);
 
 extern void set_maxwell_dielectric(maxwell_data *md,
 				   const int mesh_size[3],
@@ -153,7 +216,29 @@ extern void set_maxwell_mu(maxwell_data *md,
                            maxwell_dielectric_function mu,
                            maxwell_dielectric_mean_function mmu,
                            void *mu_data);
+extern void set_maxwell_dielectric2(maxwell_data *md,
+				    const int mesh_size[3],
+				    real R[3][3], real G[3][3],
+				    maxwell_dielectric_function epsilon,
+				    maxwell_dielectric_batch_function
+				    epsilon_batch,
+				    maxwell_dielectric_mean_function mepsilon,
+				    maxwell_dielectric_uniform_function uniform,
+				    maxwell_dielectric_changed_function changed,
+				    int threadsafe,
+				    void *epsilon_data);
+extern void set_maxwell_mu2(maxwell_data *md,
+			    const int mesh_size[3],
+			    real R[3][3], real G[3][3],
+			    maxwell_dielectric_function mu,
+			    maxwell_dielectric_batch_function mu_batch,
+			    maxwell_dielectric_mean_function mmu,
+			    maxwell_dielectric_uniform_function umu,
+			    maxwell_dielectric_changed_function changed,
+			    int threadsafe,
+			    void *mu_data);
     
+
 extern void maxwell_sym_matrix_eigs(real eigs[3], const symmetric_matrix *V);
 extern void maxwell_sym_matrix_invert(symmetric_matrix *Vinv,
                                       const symmetric_matrix *V);
@@ -194,6 +279,9 @@ void assign_symmatrix_vector(scalar_complex *newv,
 
 extern void maxwell_operator(evectmatrix Xin, evectmatrix Xout, void *data,
 			     int is_current_eigenvector, evectmatrix Work);
+extern void maxwell_batch_operator(evectmatrix Xin, evectmatrix Xout,
+				   void *data, int is_current_eigenvector,
+				   evectmatrix Work);
 extern void maxwell_muinv_operator(evectmatrix Xin, evectmatrix Xout, void *data,
                                    int is_current_eigenvector, evectmatrix Work);
 extern void maxwell_simple_precondition(evectmatrix X,
@@ -202,13 +290,45 @@ extern void maxwell_preconditioner(evectmatrix Xin, evectmatrix Xout,
 				   void *data,
 				   evectmatrix Y, real *eigenvals,
 				   sqmatrix YtY);
+extern void maxwell_batch_preconditioner(evectmatrix Xin, evectmatrix Xout,
+					 void *data,
+					 evectmatrix Y, real *eigenvals,
+					 sqmatrix YtY);
 extern void maxwell_preconditioner2(evectmatrix Xin, evectmatrix Xout,
 				    void *data,
 				    evectmatrix Y, real *eigenvals,
 				    sqmatrix YtY);
+extern void maxwell_preconditioner3(evectmatrix Xin, evectmatrix Xout,
+				    void *data,
+				    evectmatrix Y, real *eigenvals,
+				    sqmatrix YtY);
 
 extern void maxwell_ucross_op(evectmatrix Xin, evectmatrix Xout,
 			      maxwell_data *d, const real u[3]);
+extern void maxwell_ucross_vcross_op(evectmatrix Xin, evectmatrix Xout,
+				     maxwell_data *d, const real u[3],
+				     const real v[3]);
+
+/* data for maxwell_kp_interpolate, which computes the bands near an
+   anchor k point from the band-band matrices of the k.p operators
+   there (see maxwell_kp.c) */
+typedef struct {
+     real k[3]; /* the anchor k point (in cartesian basis) */
+     evectmatrix H; /* the bands at k, plus a guard band above them */
+     real *mn; /* m and n vectors of the local planewaves at k */
+     sqmatrix M0, M1[3], M2[6]; /* H' * (maxwell operator and its
+				   first/second derivatives in k) * H */
+     sqmatrix S0, S2[6]; /* H' * H and its second derivatives in k */
+     evectmatrix W, X; /* workspace */
+     sqmatrix M, S, Sw; /* scratch matrices */
+     real *diag; /* scratch array of 3 * H.p reals */
+} maxwell_kp_data;
+
+extern maxwell_kp_data *create_maxwell_kp_data(maxwell_data *d,
+					       evectmatrix H);
+extern void destroy_maxwell_kp_data(maxwell_kp_data *kp);
+extern real maxwell_kp_interpolate(maxwell_kp_data *kp, maxwell_data *d,
+				   evectmatrix H, real *eigenvals);
 
 extern void maxwell_parity_constraint(evectmatrix X, void *data);
 extern void maxwell_zparity_constraint(evectmatrix X, void *data);
@@ -244,6 +364,10 @@ extern void maxwell_target_preconditioner2(evectmatrix Xin, evectmatrix Xout,
 					   void *data,
 					   evectmatrix Y, real *eigenvals,
 					   sqmatrix YtY);
+extern void maxwell_shifted_preconditioner(evectmatrix Xin, evectmatrix Xout,
+					   void *data,
+					   evectmatrix Y, real *eigenvals,
+					   sqmatrix YtY);
 
 extern void spherical_quadrature_points(real *x, real *y, real *z,
 					real *weight, int num_sq_pts);
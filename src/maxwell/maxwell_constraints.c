@@ -84,11 +84,13 @@ void maxwell_zparity_constraint(evectmatrix X, void *data)
      else {  /* common case (2d system): even/odd == TE/TM */
 	  nxy = d->other_dims * d->last_dim;
 	  if (zparity == +1)
+#pragma omp parallel for private(b)
 	       for (i = 0; i < nxy; ++i) 
 		    for (b = 0; b < X.p; ++b) {
 			 ASSIGN_ZERO(X.data[(i * X.c + 1) * X.p + b]);
 		    }
 	  else if (zparity == -1)
+#pragma omp parallel for private(b)
 	       for (i = 0; i < nxy; ++i) 
 		    for (b = 0; b < X.p; ++b) {
 			 ASSIGN_ZERO(X.data[(i * X.c) * X.p + b]);
@@ -96,6 +98,7 @@ void maxwell_zparity_constraint(evectmatrix X, void *data)
 	  return;
      }
 
+#pragma omp parallel for private(j,b)
      for (i = 0; i < nxy; ++i) {
 	  for (j = 0; 2*j <= nz; ++j) {
 	       int ij = i * nz + j; 
@@ -214,6 +217,7 @@ void maxwell_yparity_constraint(evectmatrix X, void *data)
      ny = d->ny;
      nz = d->nz;
 
+#pragma omp parallel for private(j,k,b)
      for (i = 0; i < nx; ++i) {
 	  for (j = 0; 2*j <= ny; ++j) {
 	       int ij = i * ny + j; 
@@ -26,7 +26,6 @@
 #include <mpi_utils.h>
 
 #include "maxwell.h"
-#include "xyz_loop.h"
 
 /**************************************************************************/
 
@@ -380,348 +379,596 @@ static void get_mesh(int nx, int ny, int nz, const int mesh_size[3],
    the output of the FFT.  Thus, its dimensions depend upon whether we are
    doing a real or complex and serial or parallel FFT. */
 
-void set_maxwell_dielectric(maxwell_data *md,
-			    const int mesh_size[3],
-			    real R[3][3], real G[3][3],
-			    maxwell_dielectric_function epsilon,
-			    maxwell_dielectric_mean_function mepsilon,
-			    void *epsilon_data)
-{
+/* The data shared by the grid points in set_maxwell_eps_inv, below. */
+typedef struct {
+     const int *mesh_size;
+     real (*R)[3];
+     maxwell_dielectric_function epsilon;
+     maxwell_dielectric_batch_function epsilon_batch;
+     maxwell_dielectric_mean_function mepsilon;
+     void *epsilon_data;
      real s1, s2, s3, m1, m2, m3;  /* grid/mesh steps */
      real mesh_center[3];
-     real moment_mesh[MAX_MOMENT_MESH][3];
-     real moment_mesh_weights[MAX_MOMENT_MESH];
-     real eps_inv_total = 0.0;
-     int i, j, k;
      int mesh_prod;
      real mesh_prod_inv;
-     int size_moment_mesh = 0;
-     int n1, n2, n3;
-#ifdef HAVE_MPI
-     int local_n2, local_y_start, local_n3;
-#endif
-#ifndef SCALAR_COMPLEX
-     int n_other, n_last, rank;
-#endif
+     real moment_mesh[MAX_MOMENT_MESH][3];
+     real moment_mesh_weights[MAX_MOMENT_MESH];
+     int size_moment_mesh;
+} eps_mesh_data;
 
-     n1 = md->nx; n2 = md->ny; n3 = md->nz;
+/* The mesh points of a grid point are passed to the epsilon function
+   in batches of up to EPS_BATCH points. */
+#define EPS_BATCH 64
 
-     get_mesh(n1, n2, n3, mesh_size, R, G,
-	      mesh_center, &mesh_prod, moment_mesh, moment_mesh_weights,
-	      &size_moment_mesh);
-     mesh_prod_inv = 1.0 / mesh_prod;
-
-     s1 = 1.0 / n1;
-     s2 = 1.0 / n2;
-     s3 = 1.0 / n3;
-     m1 = s1 / MAX2(1, mesh_size[0]);
-     m2 = s2 / MAX2(1, mesh_size[1]);
-     m3 = s3 / MAX2(1, mesh_size[2]);
-
-     LOOP_XYZ(md) {
-	  int mi, mj, mk;
+/* Compute eps[i] and eps_inv[i] at the n points r[3*i..3*i+2], with
+   the batch function if there is one. */
+static void get_eps_points(const eps_mesh_data *em, int n, const real *r,
+			   symmetric_matrix *eps, symmetric_matrix *eps_inv)
+{
+     int i;
+     if (em->epsilon_batch)
+	  em->epsilon_batch(eps, eps_inv, n, r, em->epsilon_data);
+     else
+	  for (i = 0; i < n; ++i)
+	       em->epsilon(eps + i, eps_inv + i, r + 3*i, em->epsilon_data);
+}
+
+/* Add the epsilon tensors (and their inverses) at the n points r to
+   the sums eps_mean and eps_inv_mean. */
+static void add_eps_points(const eps_mesh_data *em, int n, const real *r,
+			   symmetric_matrix *eps_mean,
+			   symmetric_matrix *eps_inv_mean)
+{
+     symmetric_matrix eps[EPS_BATCH], eps_inv[EPS_BATCH];
+     int i;
+
+     if (n == 0)
+	  return;
+     get_eps_points(em, n, r, eps, eps_inv);
+     for (i = 0; i < n; ++i) {
+	  eps_mean->m00 += eps[i].m00;
+	  eps_mean->m11 += eps[i].m11;
+	  eps_mean->m22 += eps[i].m22;
+	  eps_inv_mean->m00 += eps_inv[i].m00;
+	  eps_inv_mean->m11 += eps_inv[i].m11;
+	  eps_inv_mean->m22 += eps_inv[i].m22;
 #ifdef WITH_HERMITIAN_EPSILON
-	  symmetric_matrix eps_mean, eps_inv_mean, eps_mean_inv;
+	  CACCUMULATE_SUM(eps_mean->m01, eps[i].m01);
+	  CACCUMULATE_SUM(eps_mean->m02, eps[i].m02);
+	  CACCUMULATE_SUM(eps_mean->m12, eps[i].m12);
+	  CACCUMULATE_SUM(eps_inv_mean->m01, eps_inv[i].m01);
+	  CACCUMULATE_SUM(eps_inv_mean->m02, eps_inv[i].m02);
+	  CACCUMULATE_SUM(eps_inv_mean->m12, eps_inv[i].m12);
 #else
-	  symmetric_matrix eps_mean, eps_inv_mean, eps_mean_inv;
+	  eps_mean->m01 += eps[i].m01;
+	  eps_mean->m02 += eps[i].m02;
+	  eps_mean->m12 += eps[i].m12;
+	  eps_inv_mean->m01 += eps_inv[i].m01;
+	  eps_inv_mean->m02 += eps_inv[i].m02;
+	  eps_inv_mean->m12 += eps_inv[i].m12;
 #endif
-	  real norm_len;
-	  real norm0, norm1, norm2;
-	  short means_different_p, diag_eps_p;
+     }
+}
 
-	  {
-	       real r[3], normal[3];
-	       r[0] = i1 * s1;
-	       r[1] = i2 * s2;
-	       r[2] = i3 * s3;
-	       if (mepsilon && mepsilon(&eps_mean, &eps_inv_mean, normal,
-					s1, s2, s3, mesh_prod_inv,
-					r, epsilon_data)) {
-
-		    maxwell_sym_matrix_invert(md->eps_inv + xyz_index,
-					      &eps_mean);
-		    goto got_eps_inv;
-
-		    norm0 = R[0][0] * normal[0] + R[1][0] * normal[1]
-			 + R[2][0] * normal[2];
-		    norm1 = R[0][1] * normal[0] + R[1][1] * normal[1]
-			 + R[2][1] * normal[2];
-		    norm2 = R[0][2] * normal[0] + R[1][2] * normal[1]
-			 + R[2][2] * normal[2];
-		    means_different_p = 1;
-		    diag_eps_p = DIAG_SYMMETRIC_MATRIX(eps_mean);
-		    maxwell_sym_matrix_invert(&eps_mean_inv, &eps_mean);
+/* Compute md->eps_inv[xyz_index] for the grid point (i1,i2,i3). */
+static void set_eps_inv_point(maxwell_data *md, const eps_mesh_data *em,
+			      int xyz_index, int i1, int i2, int i3)
+{
+     const int *mesh_size = em->mesh_size;
+     real (*R)[3] = em->R;
+     maxwell_dielectric_mean_function mepsilon = em->mepsilon;
+     void *epsilon_data = em->epsilon_data;
+     real s1 = em->s1, s2 = em->s2, s3 = em->s3;
+     real m1 = em->m1, m2 = em->m2, m3 = em->m3;
+     const real *mesh_center = em->mesh_center;
+     int mesh_prod = em->mesh_prod;
+     real mesh_prod_inv = em->mesh_prod_inv;
+     const real (*moment_mesh)[3] = em->moment_mesh;
+     const real *moment_mesh_weights = em->moment_mesh_weights;
+     int size_moment_mesh = em->size_moment_mesh;
+     int mi, mj, mk, n;
+     real rmesh[3*EPS_BATCH];
+#ifdef WITH_HERMITIAN_EPSILON
+     symmetric_matrix eps_mean, eps_inv_mean, eps_mean_inv;
+#else
+     symmetric_matrix eps_mean, eps_inv_mean, eps_mean_inv;
+#endif
+     real norm_len;
+     real norm0, norm1, norm2;
+     short means_different_p, diag_eps_p;
+
+     {
+	  real r[3], normal[3];
+	  r[0] = i1 * s1;
+	  r[1] = i2 * s2;
+	  r[2] = i3 * s3;
+	  if (mepsilon && mepsilon(&eps_mean, &eps_inv_mean, normal,
+				   s1, s2, s3, mesh_prod_inv,
+				   r, epsilon_data)) {
+
+	       maxwell_sym_matrix_invert(md->eps_inv + xyz_index,
+					 &eps_mean);
+	       return;
+
+	       norm0 = R[0][0] * normal[0] + R[1][0] * normal[1]
+		    + R[2][0] * normal[2];
+	       norm1 = R[0][1] * normal[0] + R[1][1] * normal[1]
+		    + R[2][1] * normal[2];
+	       norm2 = R[0][2] * normal[0] + R[1][2] * normal[1]
+		    + R[2][2] * normal[2];
+	       means_different_p = 1;
+	       diag_eps_p = DIAG_SYMMETRIC_MATRIX(eps_mean);
+	       maxwell_sym_matrix_invert(&eps_mean_inv, &eps_mean);
 
 #if !defined(SCALAR_COMPLEX) && 0 /* check inversion symmetry */
-		    {
-			 symmetric_matrix eps_mean2, eps_inv_mean2;
-			 real normal2[3], r2[3], nc[3];
-			 r2[0] = n1 == 0 ? r[0] : 1.0 - r[0];
-			 r2[1] = n2 == 0 ? r[1] : 1.0 - r[1];
-			 r2[2] = n3 == 0 ? r[2] : 1.0 - r[2];
-			 CHECK(mepsilon(&eps_mean2, &eps_inv_mean2, normal2,
-					s1, s2, s3, mesh_prod_inv,
-					r2, epsilon_data),
-			       "mepsilon symmetry is broken");
-			 CHECK(sym_matrix_eq(eps_mean,eps_mean2,1e-10) &&
-			       sym_matrix_eq(eps_inv_mean,eps_inv_mean2,1e-10),
-			       "inversion symmetry is broken");
-			 nc[0] = normal[1]*normal2[2] - normal[2]*normal2[1];
-			 nc[1] = normal[2]*normal2[0] - normal[0]*normal2[2];
-			 nc[2] = normal[0]*normal2[1] - normal[1]*normal2[0];
-			 CHECK(sqrt(nc[0]*nc[0]+nc[1]*nc[1]+nc[2]*nc[2])<1e-6,
-			       "normal-vector symmetry is broken");
-		    }
+	       {
+		    symmetric_matrix eps_mean2, eps_inv_mean2;
+		    real normal2[3], r2[3], nc[3];
+		    r2[0] = md->nx == 0 ? r[0] : 1.0 - r[0];
+		    r2[1] = md->ny == 0 ? r[1] : 1.0 - r[1];
+		    r2[2] = md->nz == 0 ? r[2] : 1.0 - r[2];
+		    CHECK(mepsilon(&eps_mean2, &eps_inv_mean2, normal2,
+				   s1, s2, s3, mesh_prod_inv,
+				   r2, epsilon_data),
+			  "mepsilon symmetry is broken");
+		    CHECK(sym_matrix_eq(eps_mean,eps_mean2,1e-10) &&
+			  sym_matrix_eq(eps_inv_mean,eps_inv_mean2,1e-10),
+			  "inversion symmetry is broken");
+		    nc[0] = normal[1]*normal2[2] - normal[2]*normal2[1];
+		    nc[1] = normal[2]*normal2[0] - normal[0]*normal2[2];
+		    nc[2] = normal[0]*normal2[1] - normal[1]*normal2[0];
+		    CHECK(sqrt(nc[0]*nc[0]+nc[1]*nc[1]+nc[2]*nc[2])<1e-6,
+			  "normal-vector symmetry is broken");
+	       }
 #endif
 
-		    goto got_mean;
-	       }
+	       goto got_mean;
 	  }
+     }
 
-	  eps_mean.m00 = eps_mean.m11 = eps_mean.m22 =
-	       eps_inv_mean.m00 = eps_inv_mean.m11 = eps_inv_mean.m22 = 0.0;
-	  ASSIGN_ESCALAR(eps_mean.m01, 0,0);
-	  ASSIGN_ESCALAR(eps_mean.m02, 0,0);
-	  ASSIGN_ESCALAR(eps_mean.m12, 0,0);
-	  ASSIGN_ESCALAR(eps_inv_mean.m01, 0,0);
-	  ASSIGN_ESCALAR(eps_inv_mean.m02, 0,0);
-	  ASSIGN_ESCALAR(eps_inv_mean.m12, 0,0);
-
-	  for (mi = 0; mi < mesh_size[0]; ++mi)
-	       for (mj = 0; mj < mesh_size[1]; ++mj)
-		    for (mk = 0; mk < mesh_size[2]; ++mk) {
-			 real r[3];
-			 symmetric_matrix eps, eps_inv;
-			 r[0] = i1 * s1 + (mi - mesh_center[0]) * m1;
-			 r[1] = i2 * s2 + (mj - mesh_center[1]) * m2;
-			 r[2] = i3 * s3 + (mk - mesh_center[2]) * m3;
-			 epsilon(&eps, &eps_inv, r, epsilon_data);
-			 eps_mean.m00 += eps.m00;
-			 eps_mean.m11 += eps.m11;
-			 eps_mean.m22 += eps.m22;
-			 eps_inv_mean.m00 += eps_inv.m00;
-			 eps_inv_mean.m11 += eps_inv.m11;
-			 eps_inv_mean.m22 += eps_inv.m22;
-#ifdef WITH_HERMITIAN_EPSILON
-			 CACCUMULATE_SUM(eps_mean.m01, eps.m01);
-			 CACCUMULATE_SUM(eps_mean.m02, eps.m02);
-			 CACCUMULATE_SUM(eps_mean.m12, eps.m12);
-			 CACCUMULATE_SUM(eps_inv_mean.m01, eps_inv.m01);
-			 CACCUMULATE_SUM(eps_inv_mean.m02, eps_inv.m02);
-			 CACCUMULATE_SUM(eps_inv_mean.m12, eps_inv.m12);
-#else
-			 eps_mean.m01 += eps.m01;
-			 eps_mean.m02 += eps.m02;
-			 eps_mean.m12 += eps.m12;
-			 eps_inv_mean.m01 += eps_inv.m01;
-			 eps_inv_mean.m02 += eps_inv.m02;
-			 eps_inv_mean.m12 += eps_inv.m12;
-#endif
+     eps_mean.m00 = eps_mean.m11 = eps_mean.m22 =
+	  eps_inv_mean.m00 = eps_inv_mean.m11 = eps_inv_mean.m22 = 0.0;
+     ASSIGN_ESCALAR(eps_mean.m01, 0,0);
+     ASSIGN_ESCALAR(eps_mean.m02, 0,0);
+     ASSIGN_ESCALAR(eps_mean.m12, 0,0);
+     ASSIGN_ESCALAR(eps_inv_mean.m01, 0,0);
+     ASSIGN_ESCALAR(eps_inv_mean.m02, 0,0);
+     ASSIGN_ESCALAR(eps_inv_mean.m12, 0,0);
+
+     n = 0;
+     for (mi = 0; mi < mesh_size[0]; ++mi)
+	  for (mj = 0; mj < mesh_size[1]; ++mj)
+	       for (mk = 0; mk < mesh_size[2]; ++mk) {
+		    rmesh[3*n] = i1 * s1 + (mi - mesh_center[0]) * m1;
+		    rmesh[3*n+1] = i2 * s2 + (mj - mesh_center[1]) * m2;
+		    rmesh[3*n+2] = i3 * s3 + (mk - mesh_center[2]) * m3;
+		    if (++n == EPS_BATCH) {
+			 add_eps_points(em, n, rmesh,
+					&eps_mean, &eps_inv_mean);
+			 n = 0;
 		    }
+	       }
+     add_eps_points(em, n, rmesh, &eps_mean, &eps_inv_mean);
 
-	  diag_eps_p = DIAG_SYMMETRIC_MATRIX(eps_mean);
-	  if (diag_eps_p) { /* handle the common case of diagonal matrices: */
-	       eps_mean_inv.m00 = mesh_prod / eps_mean.m00;
-	       eps_mean_inv.m11 = mesh_prod / eps_mean.m11;
-	       eps_mean_inv.m22 = mesh_prod / eps_mean.m22;
+     diag_eps_p = DIAG_SYMMETRIC_MATRIX(eps_mean);
+     if (diag_eps_p) { /* handle the common case of diagonal matrices: */
+	  eps_mean_inv.m00 = mesh_prod / eps_mean.m00;
+	  eps_mean_inv.m11 = mesh_prod / eps_mean.m11;
+	  eps_mean_inv.m22 = mesh_prod / eps_mean.m22;
 #ifdef WITH_HERMITIAN_EPSILON
-	       CASSIGN_ZERO(eps_mean_inv.m01);
-	       CASSIGN_ZERO(eps_mean_inv.m02);
-	       CASSIGN_ZERO(eps_mean_inv.m12);
+	  CASSIGN_ZERO(eps_mean_inv.m01);
+	  CASSIGN_ZERO(eps_mean_inv.m02);
+	  CASSIGN_ZERO(eps_mean_inv.m12);
 #else
-	       eps_mean_inv.m01 = eps_mean_inv.m02 = eps_mean_inv.m12 = 0.0;
+	  eps_mean_inv.m01 = eps_mean_inv.m02 = eps_mean_inv.m12 = 0.0;
 #endif
-	       eps_inv_mean.m00 *= mesh_prod_inv;
-	       eps_inv_mean.m11 *= mesh_prod_inv;
-	       eps_inv_mean.m22 *= mesh_prod_inv;
-
-	       means_different_p =
-		    fabs(eps_mean_inv.m00 - eps_inv_mean.m00) > SMALL ||
-		    fabs(eps_mean_inv.m11 - eps_inv_mean.m11) > SMALL ||
-		    fabs(eps_mean_inv.m22 - eps_inv_mean.m22) > SMALL;
-	  }
-	  else {
-	       eps_inv_mean.m00 *= mesh_prod_inv;
-	       eps_inv_mean.m11 *= mesh_prod_inv;
-	       eps_inv_mean.m22 *= mesh_prod_inv;
-	       eps_mean.m00 *= mesh_prod_inv;
-	       eps_mean.m11 *= mesh_prod_inv;
-	       eps_mean.m22 *= mesh_prod_inv;
+	  eps_inv_mean.m00 *= mesh_prod_inv;
+	  eps_inv_mean.m11 *= mesh_prod_inv;
+	  eps_inv_mean.m22 *= mesh_prod_inv;
+
+	  means_different_p =
+	       fabs(eps_mean_inv.m00 - eps_inv_mean.m00) > SMALL ||
+	       fabs(eps_mean_inv.m11 - eps_inv_mean.m11) > SMALL ||
+	       fabs(eps_mean_inv.m22 - eps_inv_mean.m22) > SMALL;
+     }
+     else {
+	  eps_inv_mean.m00 *= mesh_prod_inv;
+	  eps_inv_mean.m11 *= mesh_prod_inv;
+	  eps_inv_mean.m22 *= mesh_prod_inv;
+	  eps_mean.m00 *= mesh_prod_inv;
+	  eps_mean.m11 *= mesh_prod_inv;
+	  eps_mean.m22 *= mesh_prod_inv;
 #ifdef WITH_HERMITIAN_EPSILON
-	       eps_mean.m01.re *= mesh_prod_inv;
-	       eps_mean.m01.im *= mesh_prod_inv;
-	       eps_mean.m02.re *= mesh_prod_inv;
-	       eps_mean.m02.im *= mesh_prod_inv;
-	       eps_mean.m12.re *= mesh_prod_inv;
-	       eps_mean.m12.im *= mesh_prod_inv;
-	       eps_inv_mean.m01.re *= mesh_prod_inv;
-	       eps_inv_mean.m01.im *= mesh_prod_inv;
-	       eps_inv_mean.m02.re *= mesh_prod_inv;
-	       eps_inv_mean.m02.im *= mesh_prod_inv;
-	       eps_inv_mean.m12.re *= mesh_prod_inv;
-	       eps_inv_mean.m12.im *= mesh_prod_inv;
+	  eps_mean.m01.re *= mesh_prod_inv;
+	  eps_mean.m01.im *= mesh_prod_inv;
+	  eps_mean.m02.re *= mesh_prod_inv;
+	  eps_mean.m02.im *= mesh_prod_inv;
+	  eps_mean.m12.re *= mesh_prod_inv;
+	  eps_mean.m12.im *= mesh_prod_inv;
+	  eps_inv_mean.m01.re *= mesh_prod_inv;
+	  eps_inv_mean.m01.im *= mesh_prod_inv;
+	  eps_inv_mean.m02.re *= mesh_prod_inv;
+	  eps_inv_mean.m02.im *= mesh_prod_inv;
+	  eps_inv_mean.m12.re *= mesh_prod_inv;
+	  eps_inv_mean.m12.im *= mesh_prod_inv;
 #else
-	       eps_mean.m01 *= mesh_prod_inv;
-	       eps_mean.m02 *= mesh_prod_inv;
-	       eps_mean.m12 *= mesh_prod_inv;
-	       eps_inv_mean.m01 *= mesh_prod_inv;
-	       eps_inv_mean.m02 *= mesh_prod_inv;
-	       eps_inv_mean.m12 *= mesh_prod_inv;
+	  eps_mean.m01 *= mesh_prod_inv;
+	  eps_mean.m02 *= mesh_prod_inv;
+	  eps_mean.m12 *= mesh_prod_inv;
+	  eps_inv_mean.m01 *= mesh_prod_inv;
+	  eps_inv_mean.m02 *= mesh_prod_inv;
+	  eps_inv_mean.m12 *= mesh_prod_inv;
 #endif
-	       maxwell_sym_matrix_invert(&eps_mean_inv, &eps_mean);
+	  maxwell_sym_matrix_invert(&eps_mean_inv, &eps_mean);
 
-	       means_different_p =
-		    fabs(eps_mean_inv.m00 - eps_inv_mean.m00) > SMALL ||
-		    fabs(eps_mean_inv.m11 - eps_inv_mean.m11) > SMALL ||
-		    fabs(eps_mean_inv.m22 - eps_inv_mean.m22) > SMALL;
+	  means_different_p =
+	       fabs(eps_mean_inv.m00 - eps_inv_mean.m00) > SMALL ||
+	       fabs(eps_mean_inv.m11 - eps_inv_mean.m11) > SMALL ||
+	       fabs(eps_mean_inv.m22 - eps_inv_mean.m22) > SMALL;
 #ifdef WITH_HERMITIAN_EPSILON
-	       means_different_p = means_different_p ||
-		    fabs(eps_mean_inv.m01.re - eps_inv_mean.m01.re) > SMALL ||
-		    fabs(eps_mean_inv.m02.re - eps_inv_mean.m02.re) > SMALL ||
-		    fabs(eps_mean_inv.m12.re - eps_inv_mean.m12.re) > SMALL ||
-		    fabs(eps_mean_inv.m01.im - eps_inv_mean.m01.im) > SMALL ||
-		    fabs(eps_mean_inv.m02.im - eps_inv_mean.m02.im) > SMALL ||
-		    fabs(eps_mean_inv.m12.im - eps_inv_mean.m12.im) > SMALL;
+	  means_different_p = means_different_p ||
+	       fabs(eps_mean_inv.m01.re - eps_inv_mean.m01.re) > SMALL ||
+	       fabs(eps_mean_inv.m02.re - eps_inv_mean.m02.re) > SMALL ||
+	       fabs(eps_mean_inv.m12.re - eps_inv_mean.m12.re) > SMALL ||
+	       fabs(eps_mean_inv.m01.im - eps_inv_mean.m01.im) > SMALL ||
+	       fabs(eps_mean_inv.m02.im - eps_inv_mean.m02.im) > SMALL ||
+	       fabs(eps_mean_inv.m12.im - eps_inv_mean.m12.im) > SMALL;
 #else
-	       means_different_p = means_different_p ||
-		    fabs(eps_mean_inv.m01 - eps_inv_mean.m01) > SMALL ||
-		    fabs(eps_mean_inv.m02 - eps_inv_mean.m02) > SMALL ||
-		    fabs(eps_mean_inv.m12 - eps_inv_mean.m12) > SMALL;
+	  means_different_p = means_different_p ||
+	       fabs(eps_mean_inv.m01 - eps_inv_mean.m01) > SMALL ||
+	       fabs(eps_mean_inv.m02 - eps_inv_mean.m02) > SMALL ||
+	       fabs(eps_mean_inv.m12 - eps_inv_mean.m12) > SMALL;
 #endif
-	  }
-
-	  /* if the two averaging methods yielded different results,
-	     which usually happens if epsilon is not constant, then
-	     we need to find the normal vector to the dielectric interface: */
-	  if (means_different_p) {
-	       real moment0 = 0, moment1 = 0, moment2 = 0;
-
-	       for (mi = 0; mi < size_moment_mesh; ++mi) {
-		    real r[3], eps_trace;
-		    symmetric_matrix eps, eps_inv;
-		    r[0] = i1 * s1 + moment_mesh[mi][0];
-		    r[1] = i2 * s2 + moment_mesh[mi][1];
-		    r[2] = i3 * s3 + moment_mesh[mi][2];
-		    epsilon(&eps, &eps_inv, r, epsilon_data);
-		    eps_trace = eps.m00 + eps.m11 + eps.m22;
-		    eps_trace *= moment_mesh_weights[mi];
-		    moment0 += eps_trace * moment_mesh[mi][0];
-		    moment1 += eps_trace * moment_mesh[mi][1];
-		    moment2 += eps_trace * moment_mesh[mi][2];
-	       }
+     }
 
-	       /* need to convert moment from lattice to cartesian coords: */
-	       norm0 = R[0][0]*moment0 + R[1][0]*moment1 + R[2][0]*moment2;
-	       norm1 = R[0][1]*moment0 + R[1][1]*moment1 + R[2][1]*moment2;
-	       norm2 = R[0][2]*moment0 + R[1][2]*moment1 + R[2][2]*moment2;
+     /* if the two averaging methods yielded different results,
+	which usually happens if epsilon is not constant, then
+	we need to find the normal vector to the dielectric interface: */
+     if (means_different_p) {
+	  real moment0 = 0, moment1 = 0, moment2 = 0;
 
-	  got_mean:
+	  real rm[3*MAX_MOMENT_MESH];
+	  symmetric_matrix eps[MAX_MOMENT_MESH], eps_inv[MAX_MOMENT_MESH];
 
-	       norm_len = sqrt(norm0*norm0 + norm1*norm1 + norm2*norm2);
+	  for (mi = 0; mi < size_moment_mesh; ++mi) {
+	       rm[3*mi] = i1 * s1 + moment_mesh[mi][0];
+	       rm[3*mi+1] = i2 * s2 + moment_mesh[mi][1];
+	       rm[3*mi+2] = i3 * s3 + moment_mesh[mi][2];
+	  }
+	  get_eps_points(em, size_moment_mesh, rm, eps, eps_inv);
+	  for (mi = 0; mi < size_moment_mesh; ++mi) {
+	       real eps_trace;
+	       eps_trace = eps[mi].m00 + eps[mi].m11 + eps[mi].m22;
+	       eps_trace *= moment_mesh_weights[mi];
+	       moment0 += eps_trace * moment_mesh[mi][0];
+	       moment1 += eps_trace * moment_mesh[mi][1];
+	       moment2 += eps_trace * moment_mesh[mi][2];
 	  }
 
-	  if (means_different_p && norm_len > SMALL) {
-	       real x0, x1, x2;
-
-	       norm_len = 1.0/norm_len;
-	       norm0 *= norm_len;
-	       norm1 *= norm_len;
-	       norm2 *= norm_len;
-
-	       /* Compute the effective inverse dielectric tensor.
-		  We define this as:
-                     1/2 ( {eps_inv_mean, P} + {eps_mean_inv, 1-P} )
-	          where P is the projection matrix onto the normal direction
-                  (P = norm ^ norm), and {a,b} is the anti-commutator ab+ba.
-		   = 1/2 {eps_inv_mean - eps_mean_inv, P} + eps_mean_inv
-		   = 1/2 (n_i conj(x_j) + x_i n_j) + (eps_mean_inv)_ij
-		  where n_k is the kth component of the normal vector and
-		     x_i = (eps_inv_mean - eps_mean_inv)_ik n_k
-		  Note the implied summations (Einstein notation).
-
-		  Note that the resulting matrix is symmetric, and we get just
-		  eps_inv_mean if eps_inv_mean == eps_mean_inv, as desired.
-
-	          Note that P is idempotent, so for scalar epsilon this
-	          is just eps_inv_mean * P + eps_mean_inv * (1-P)
-                        = (1/eps_inv_mean * P + eps_mean * (1-P)) ^ (-1),
-	          which corresponds to the expression in the Meade paper. */
-
-	       x0 = (eps_inv_mean.m00 - eps_mean_inv.m00) * norm0;
-	       x1 = (eps_inv_mean.m11 - eps_mean_inv.m11) * norm1;
-	       x2 = (eps_inv_mean.m22 - eps_mean_inv.m22) * norm2;
-	       if (diag_eps_p) {
+	  /* need to convert moment from lattice to cartesian coords: */
+	  norm0 = R[0][0]*moment0 + R[1][0]*moment1 + R[2][0]*moment2;
+	  norm1 = R[0][1]*moment0 + R[1][1]*moment1 + R[2][1]*moment2;
+	  norm2 = R[0][2]*moment0 + R[1][2]*moment1 + R[2][2]*moment2;
+
+     got_mean:
+
+	  norm_len = sqrt(norm0*norm0 + norm1*norm1 + norm2*norm2);
+     }
+
+     if (means_different_p && norm_len > SMALL) {
+	  real x0, x1, x2;
+
+	  norm_len = 1.0/norm_len;
+	  norm0 *= norm_len;
+	  norm1 *= norm_len;
+	  norm2 *= norm_len;
+
+	  /* Compute the effective inverse dielectric tensor.
+	     We define this as:
+		1/2 ( {eps_inv_mean, P} + {eps_mean_inv, 1-P} )
+	     where P is the projection matrix onto the normal direction
+	     (P = norm ^ norm), and {a,b} is the anti-commutator ab+ba.
+	      = 1/2 {eps_inv_mean - eps_mean_inv, P} + eps_mean_inv
+	      = 1/2 (n_i conj(x_j) + x_i n_j) + (eps_mean_inv)_ij
+	     where n_k is the kth component of the normal vector and
+		x_i = (eps_inv_mean - eps_mean_inv)_ik n_k
+	     Note the implied summations (Einstein notation).
+
+	     Note that the resulting matrix is symmetric, and we get just
+	     eps_inv_mean if eps_inv_mean == eps_mean_inv, as desired.
+
+	     Note that P is idempotent, so for scalar epsilon this
+	     is just eps_inv_mean * P + eps_mean_inv * (1-P)
+		   = (1/eps_inv_mean * P + eps_mean * (1-P)) ^ (-1),
+	     which corresponds to the expression in the Meade paper. */
+
+	  x0 = (eps_inv_mean.m00 - eps_mean_inv.m00) * norm0;
+	  x1 = (eps_inv_mean.m11 - eps_mean_inv.m11) * norm1;
+	  x2 = (eps_inv_mean.m22 - eps_mean_inv.m22) * norm2;
+	  if (diag_eps_p) {
 #ifdef WITH_HERMITIAN_EPSILON
-		    md->eps_inv[xyz_index].m01.re = 0.5*(x0*norm1 + x1*norm0);
-		    md->eps_inv[xyz_index].m01.im = 0.0;
-		    md->eps_inv[xyz_index].m02.re = 0.5*(x0*norm2 + x2*norm0);
-		    md->eps_inv[xyz_index].m02.im = 0.0;
-		    md->eps_inv[xyz_index].m12.re = 0.5*(x1*norm2 + x2*norm1);
-		    md->eps_inv[xyz_index].m12.im = 0.0;
+	       md->eps_inv[xyz_index].m01.re = 0.5*(x0*norm1 + x1*norm0);
+	       md->eps_inv[xyz_index].m01.im = 0.0;
+	       md->eps_inv[xyz_index].m02.re = 0.5*(x0*norm2 + x2*norm0);
+	       md->eps_inv[xyz_index].m02.im = 0.0;
+	       md->eps_inv[xyz_index].m12.re = 0.5*(x1*norm2 + x2*norm1);
+	       md->eps_inv[xyz_index].m12.im = 0.0;
 #else
-		    md->eps_inv[xyz_index].m01 = 0.5*(x0*norm1 + x1*norm0);
-		    md->eps_inv[xyz_index].m02 = 0.5*(x0*norm2 + x2*norm0);
-		    md->eps_inv[xyz_index].m12 = 0.5*(x1*norm2 + x2*norm1);
+	       md->eps_inv[xyz_index].m01 = 0.5*(x0*norm1 + x1*norm0);
+	       md->eps_inv[xyz_index].m02 = 0.5*(x0*norm2 + x2*norm0);
+	       md->eps_inv[xyz_index].m12 = 0.5*(x1*norm2 + x2*norm1);
 #endif
-	       }
-	       else {
+	  }
+	  else {
 #ifdef WITH_HERMITIAN_EPSILON
-		    real x0i, x1i, x2i;
-		    x0 += ((eps_inv_mean.m01.re - eps_mean_inv.m01.re)*norm1 +
-			   (eps_inv_mean.m02.re - eps_mean_inv.m02.re)*norm2);
-		    x1 += ((eps_inv_mean.m01.re - eps_mean_inv.m01.re)*norm0 +
-			   (eps_inv_mean.m12.re - eps_mean_inv.m12.re)*norm2);
-		    x2 += ((eps_inv_mean.m02.re - eps_mean_inv.m02.re)*norm0 +
-			   (eps_inv_mean.m12.re - eps_mean_inv.m12.re)*norm1);
-		    x0i = ((eps_inv_mean.m01.im - eps_mean_inv.m01.im)*norm1 +
-			   (eps_inv_mean.m02.im - eps_mean_inv.m02.im)*norm2);
-		    x1i = (-(eps_inv_mean.m01.im - eps_mean_inv.m01.im)*norm0+
-			   (eps_inv_mean.m12.im - eps_mean_inv.m12.im)*norm2);
-		    x2i = -((eps_inv_mean.m02.im - eps_mean_inv.m02.im)*norm0 +
-			    (eps_inv_mean.m12.im - eps_mean_inv.m12.im)*norm1);
-
-		    md->eps_inv[xyz_index].m01.re = (0.5*(x0*norm1 + x1*norm0)
-						     + eps_mean_inv.m01.re);
-		    md->eps_inv[xyz_index].m02.re = (0.5*(x0*norm2 + x2*norm0)
-						     + eps_mean_inv.m02.re);
-		    md->eps_inv[xyz_index].m12.re = (0.5*(x1*norm2 + x2*norm1)
-						     + eps_mean_inv.m12.re);
-		    md->eps_inv[xyz_index].m01.im = (0.5*(x0i*norm1-x1i*norm0)
-						     + eps_mean_inv.m01.im);
-		    md->eps_inv[xyz_index].m02.im = (0.5*(x0i*norm2-x2i*norm0)
-						     + eps_mean_inv.m02.im);
-		    md->eps_inv[xyz_index].m12.im = (0.5*(x1i*norm2-x2i*norm1)
-						     + eps_mean_inv.m12.im);
+	       real x0i, x1i, x2i;
+	       x0 += ((eps_inv_mean.m01.re - eps_mean_inv.m01.re)*norm1 +
+		      (eps_inv_mean.m02.re - eps_mean_inv.m02.re)*norm2);
+	       x1 += ((eps_inv_mean.m01.re - eps_mean_inv.m01.re)*norm0 +
+		      (eps_inv_mean.m12.re - eps_mean_inv.m12.re)*norm2);
+	       x2 += ((eps_inv_mean.m02.re - eps_mean_inv.m02.re)*norm0 +
+		      (eps_inv_mean.m12.re - eps_mean_inv.m12.re)*norm1);
+	       x0i = ((eps_inv_mean.m01.im - eps_mean_inv.m01.im)*norm1 +
+		      (eps_inv_mean.m02.im - eps_mean_inv.m02.im)*norm2);
+	       x1i = (-(eps_inv_mean.m01.im - eps_mean_inv.m01.im)*norm0+
+		      (eps_inv_mean.m12.im - eps_mean_inv.m12.im)*norm2);
+	       x2i = -((eps_inv_mean.m02.im - eps_mean_inv.m02.im)*norm0 +
+		       (eps_inv_mean.m12.im - eps_mean_inv.m12.im)*norm1);
+
+	       md->eps_inv[xyz_index].m01.re = (0.5*(x0*norm1 + x1*norm0)
+						+ eps_mean_inv.m01.re);
+	       md->eps_inv[xyz_index].m02.re = (0.5*(x0*norm2 + x2*norm0)
+						+ eps_mean_inv.m02.re);
+	       md->eps_inv[xyz_index].m12.re = (0.5*(x1*norm2 + x2*norm1)
+						+ eps_mean_inv.m12.re);
+	       md->eps_inv[xyz_index].m01.im = (0.5*(x0i*norm1-x1i*norm0)
+						+ eps_mean_inv.m01.im);
+	       md->eps_inv[xyz_index].m02.im = (0.5*(x0i*norm2-x2i*norm0)
+						+ eps_mean_inv.m02.im);
+	       md->eps_inv[xyz_index].m12.im = (0.5*(x1i*norm2-x2i*norm1)
+						+ eps_mean_inv.m12.im);
 #else
-		    x0 += ((eps_inv_mean.m01 - eps_mean_inv.m01) * norm1 +
-			   (eps_inv_mean.m02 - eps_mean_inv.m02) * norm2);
-		    x1 += ((eps_inv_mean.m01 - eps_mean_inv.m01) * norm0 +
-			   (eps_inv_mean.m12 - eps_mean_inv.m12) * norm2);
-		    x2 += ((eps_inv_mean.m02 - eps_mean_inv.m02) * norm0 +
-			   (eps_inv_mean.m12 - eps_mean_inv.m12) * norm1);
-
-		    md->eps_inv[xyz_index].m01 = (0.5*(x0*norm1 + x1*norm0)
-						  + eps_mean_inv.m01);
-		    md->eps_inv[xyz_index].m02 = (0.5*(x0*norm2 + x2*norm0)
-						  + eps_mean_inv.m02);
-		    md->eps_inv[xyz_index].m12 = (0.5*(x1*norm2 + x2*norm1)
-						  + eps_mean_inv.m12);
+	       x0 += ((eps_inv_mean.m01 - eps_mean_inv.m01) * norm1 +
+		      (eps_inv_mean.m02 - eps_mean_inv.m02) * norm2);
+	       x1 += ((eps_inv_mean.m01 - eps_mean_inv.m01) * norm0 +
+		      (eps_inv_mean.m12 - eps_mean_inv.m12) * norm2);
+	       x2 += ((eps_inv_mean.m02 - eps_mean_inv.m02) * norm0 +
+		      (eps_inv_mean.m12 - eps_mean_inv.m12) * norm1);
+
+	       md->eps_inv[xyz_index].m01 = (0.5*(x0*norm1 + x1*norm0)
+					     + eps_mean_inv.m01);
+	       md->eps_inv[xyz_index].m02 = (0.5*(x0*norm2 + x2*norm0)
+					     + eps_mean_inv.m02);
+	       md->eps_inv[xyz_index].m12 = (0.5*(x1*norm2 + x2*norm1)
+					     + eps_mean_inv.m12);
 #endif
-	       }
-	       md->eps_inv[xyz_index].m00 = x0*norm0 + eps_mean_inv.m00;
-	       md->eps_inv[xyz_index].m11 = x1*norm1 + eps_mean_inv.m11;
-	       md->eps_inv[xyz_index].m22 = x2*norm2 + eps_mean_inv.m22;
 	  }
-	  else { /* undetermined normal vector and/or constant eps */
-	       md->eps_inv[xyz_index] = eps_mean_inv;
+	  md->eps_inv[xyz_index].m00 = x0*norm0 + eps_mean_inv.m00;
+	  md->eps_inv[xyz_index].m11 = x1*norm1 + eps_mean_inv.m11;
+	  md->eps_inv[xyz_index].m22 = x2*norm2 + eps_mean_inv.m22;
+     }
+     else { /* undetermined normal vector and/or constant eps */
+	  md->eps_inv[xyz_index] = eps_mean_inv;
+     }
+}
+
+/* Get the box lo[i] <= (i1,i2,i3)[i] < hi[i] of the grid points that
+   are stored locally, i.e. that are visited by LOOP_XYZ(md) (see
+   xyz_loop.h), along with the index
+       xyz_index = offset + i1*stride[0] + i2*stride[1] + i3*stride[2]
+   of each point in md->eps_inv, as in LOOP_XYZ. */
+static void get_xyz_box(maxwell_data *md, int lo[3], int hi[3],
+			int stride[3], int *offset)
+{
+     int n1 = md->nx, n2 = md->ny, n3 = md->nz;
+
+     lo[0] = lo[1] = lo[2] = 0;
+     hi[0] = n1; hi[1] = n2; hi[2] = n3;
+     *offset = 0;
+#ifdef SCALAR_COMPLEX
+#  ifndef HAVE_MPI
+     stride[0] = n2 * n3; stride[1] = n3; stride[2] = 1;
+#  else /* HAVE_MPI */
+     /* first two dimensions are transposed in MPI output: */
+     lo[1] = md->local_y_start;
+     hi[1] = lo[1] + md->local_ny;
+     stride[0] = n3; stride[1] = n1 * n3; stride[2] = 1;
+     *offset = -lo[1] * stride[1];
+#  endif /* HAVE_MPI */
+#else /* not SCALAR_COMPLEX */
+#  ifndef HAVE_MPI
+     {
+	  int n_last = md->last_dim_size / 2;
+	  int rank = (n3 == 1) ? (n2 == 1 ? 1 : 2) : 3;
+	  switch (rank) {
+	      case 2:
+		   hi[1] = n_last;
+		   stride[0] = n_last; stride[1] = 1; stride[2] = 0;
+		   break;
+	      case 3:
+		   hi[2] = n_last;
+		   stride[0] = n2 * n_last; stride[1] = n_last; stride[2] = 1;
+		   break;
+	      default:
+		   hi[0] = n_last;
+		   stride[0] = 1; stride[1] = stride[2] = 0;
+		   break;
 	  }
-     got_eps_inv:
+     }
+#  else /* HAVE_MPI */
+     {
+	  int local_n3 = n3 > 1 ? md->last_dim_size / 2 : 1;
+	  lo[1] = md->local_y_start;
+	  hi[1] = lo[1] + md->local_ny;
+	  hi[2] = local_n3;
+	  stride[0] = local_n3; stride[1] = n1 * local_n3; stride[2] = 1;
+	  *offset = -lo[1] * stride[1];
+     }
+#  endif /* HAVE_MPI */
+#endif /* not SCALAR_COMPLEX */
+}
+
+#define EPS_TILE 8 /* size of the tiles of grid points, in each dimension */
+#define FEEDBACK_TIME 4.0 /* elapsed time before we print progress feedback */
+
+/* Get the range tlo <= i < thi of the grid points in tile t. */
+static void get_tile(int t, const int lo[3], const int hi[3],
+		     const int ntile[3], int tlo[3], int thi[3])
+{
+     tlo[0] = lo[0] + (t / (ntile[1] * ntile[2])) * EPS_TILE;
+     tlo[1] = lo[1] + ((t / ntile[2]) % ntile[1]) * EPS_TILE;
+     tlo[2] = lo[2] + (t % ntile[2]) * EPS_TILE;
+     thi[0] = MIN2(tlo[0] + EPS_TILE, hi[0]);
+     thi[1] = MIN2(tlo[1] + EPS_TILE, hi[1]);
+     thi[2] = MIN2(tlo[2] + EPS_TILE, hi[2]);
+}
+
+/* Get the box rmin <= r <= rmax sampled by the grid points
+   tlo <= i < thi, including the averaging meshes around them. */
+static void get_tile_region(const eps_mesh_data *em, const real extent[3],
+			    const int tlo[3], const int thi[3],
+			    real rmin[3], real rmax[3])
+{
+     rmin[0] = tlo[0] * em->s1 - extent[0];
+     rmin[1] = tlo[1] * em->s2 - extent[1];
+     rmin[2] = tlo[2] * em->s3 - extent[2];
+     rmax[0] = (thi[0] - 1) * em->s1 + extent[0];
+     rmax[1] = (thi[1] - 1) * em->s2 + extent[1];
+     rmax[2] = (thi[2] - 1) * em->s3 + extent[2];
+}
+
+/* The grid points are computed in EPS_TILE^3 tiles (in 3d), which are
+   distributed among the OpenMP threads if threadsafe is true, that is
+   if the epsilon, mepsilon, and uniform functions may be called
+   concurrently.  If uniform is not NULL, it is first asked whether
+   epsilon is constant over the region sampled by a tile (including
+   the averaging meshes); if so, the whole tile is set to the inverse
+   of that constant, skipping the sub-mesh and the mean function.
+
+   If changed is not NULL, md->eps_inv must hold the result of a
+   previous call for the same grid, and only the tiles whose region may
+   have changed since then are recomputed.  eps_inv_mean is summed
+   afterwards over the whole grid, in a fixed order, so that it is the
+   same (bit for bit) whether or not eps_inv was updated incrementally,
+   and regardless of how the tiles were divided among the threads. */
+static void set_maxwell_eps_inv(maxwell_data *md,
+				const int mesh_size[3],
+				real R[3][3], real G[3][3],
+				maxwell_dielectric_function epsilon,
+				maxwell_dielectric_batch_function epsilon_batch,
+				maxwell_dielectric_mean_function mepsilon,
+				maxwell_dielectric_uniform_function uniform,
+				maxwell_dielectric_changed_function changed,
+				int threadsafe,
+				void *epsilon_data)
+{
+     eps_mesh_data em;
+     real eps_inv_total = 0.0;
+     real extent[3]; /* half-width of region sampled around each point */
+     int lo[3], hi[3], stride[3], offset, ntile[3], ntiles, t, i, j;
+     int *tiles, ntodo = 0;
+     int n1, n2, n3, tiles_done = 0, is_master = mpi_is_master();
+     mpiglue_clock_t prev_feedback_time = MPIGLUE_CLOCK;
+
+     n1 = md->nx; n2 = md->ny; n3 = md->nz;
+
+     em.mesh_size = mesh_size;
+     em.R = R;
+     em.epsilon = epsilon;
+     em.epsilon_batch = epsilon_batch;
+     em.mepsilon = mepsilon;
+     em.epsilon_data = epsilon_data;
+     get_mesh(n1, n2, n3, mesh_size, R, G,
+	      em.mesh_center, &em.mesh_prod,
+	      em.moment_mesh, em.moment_mesh_weights,
+	      &em.size_moment_mesh);
+     em.mesh_prod_inv = 1.0 / em.mesh_prod;
+
+     em.s1 = 1.0 / n1;
+     em.s2 = 1.0 / n2;
+     em.s3 = 1.0 / n3;
+     em.m1 = em.s1 / MAX2(1, mesh_size[0]);
+     em.m2 = em.s2 / MAX2(1, mesh_size[1]);
+     em.m3 = em.s3 / MAX2(1, mesh_size[2]);
+
+     /* the mesh and the mepsilon pixel lie within half a grid step of
+	the point, and the moment mesh within its radius: */
+     extent[0] = 0.5 * em.s1;
+     extent[1] = 0.5 * em.s2;
+     extent[2] = 0.5 * em.s3;
+     for (i = 0; i < em.size_moment_mesh; ++i)
+	  for (j = 0; j < 3; ++j)
+	       extent[j] = MAX2(extent[j], fabs(em.moment_mesh[i][j]));
+
+     get_xyz_box(md, lo, hi, stride, &offset);
+     for (i = 0; i < 3; ++i)
+	  ntile[i] = (hi[i] - lo[i] + EPS_TILE - 1) / EPS_TILE;
+     ntiles = ntile[0] * ntile[1] * ntile[2];
+
+     /* list the tiles to compute (all of them, unless changed): */
+     CHK_MALLOC(tiles, int, MAX2(1, ntiles));
+     for (t = 0; t < ntiles; ++t) {
+	  if (changed) {
+	       int tlo[3], thi[3];
+	       real rmin[3], rmax[3];
+	       get_tile(t, lo, hi, ntile, tlo, thi);
+	       get_tile_region(&em, extent, tlo, thi, rmin, rmax);
+	       if (!changed(rmin, rmax, epsilon_data))
+		    continue;
+	  }
+	  tiles[ntodo++] = t;
+     }
+
+#pragma omp parallel for schedule(dynamic) if (threadsafe)
+     for (j = 0; j < ntodo; ++j) {
+	  int tlo[3], thi[3], i1, i2, i3, uniform_p = 0;
+	  symmetric_matrix eps, eps_inv;
 
-	  eps_inv_total += (md->eps_inv[xyz_index].m00 +
-			    md->eps_inv[xyz_index].m11 +
-			    md->eps_inv[xyz_index].m22);
-     }}}  /* end of loop body */
+	  get_tile(tiles[j], lo, hi, ntile, tlo, thi);
 
+	  if (uniform) {
+	       real rmin[3], rmax[3];
+	       get_tile_region(&em, extent, tlo, thi, rmin, rmax);
+	       if ((uniform_p = uniform(&eps, rmin, rmax, epsilon_data)))
+		    maxwell_sym_matrix_invert(&eps_inv, &eps);
+	  }
+
+	  for (i1 = tlo[0]; i1 < thi[0]; ++i1)
+	       for (i2 = tlo[1]; i2 < thi[1]; ++i2)
+		    for (i3 = tlo[2]; i3 < thi[2]; ++i3) {
+			 int xyz_index = offset + i1 * stride[0]
+			      + i2 * stride[1] + i3 * stride[2];
+			 if (uniform_p)
+			      md->eps_inv[xyz_index] = eps_inv;
+			 else
+			      set_eps_inv_point(md, &em, xyz_index,
+						i1, i2, i3);
+		    }
+
+#pragma omp critical (maxwell_eps_feedback)
+	  {
+	       ++tiles_done;
+	       if (is_master && MPIGLUE_CLOCK_DIFF(MPIGLUE_CLOCK,
+						   prev_feedback_time)
+		   > FEEDBACK_TIME) {
+		    printf("    %d%% of the grid points initialized...\n",
+			   (int) (100.0 * tiles_done / ntodo));
+		    fflush(stdout);
+		    prev_feedback_time = MPIGLUE_CLOCK;
+	       }
+	  }
+     }
+     free(tiles);
+
+     for (i = lo[0]; i < hi[0]; ++i)
+	  for (j = lo[1]; j < hi[1]; ++j) {
+	       int k;
+	       for (k = lo[2]; k < hi[2]; ++k) {
+		    const symmetric_matrix *ei = md->eps_inv + offset
+			 + i * stride[0] + j * stride[1] + k * stride[2];
+		    eps_inv_total += ei->m00 + ei->m11 + ei->m22;
+	       }
+	  }
      mpi_allreduce_1(&eps_inv_total, real, SCALAR_MPI_TYPE,
 		     MPI_SUM, mpb_comm);
      n1 = md->fft_output_size;
@@ -729,20 +976,76 @@ void set_maxwell_dielectric(maxwell_data *md,
      md->eps_inv_mean = eps_inv_total / (3 * n1);
 }
 
+void set_maxwell_dielectric(maxwell_data *md,
+			    const int mesh_size[3],
+			    real R[3][3], real G[3][3],
+			    maxwell_dielectric_function epsilon,
+			    maxwell_dielectric_mean_function mepsilon,
+			    void *epsilon_data)
+{
+     set_maxwell_dielectric2(md, mesh_size, R, G, epsilon, NULL, mepsilon,
+			     NULL, NULL, 0, epsilon_data);
+}
+
+/* As set_maxwell_dielectric, but with an optional batch version of the
+   epsilon function (see maxwell_dielectric_batch_function), which is
+   used instead of epsilon to sample the mesh around each grid point,
+   an optional uniform function
+   (see maxwell_dielectric_uniform_function) to skip the averaging in
+   regions of constant epsilon, an optional changed function (see
+   maxwell_dielectric_changed_function) to recompute only the regions
+   where epsilon has changed since the previous call (which must have
+   been for the same md), and computing eps_inv in parallel
+   (with OpenMP) if threadsafe is true, i.e. if the epsilon,
+   epsilon_batch, mepsilon, and uniform functions may be called
+   concurrently. */
+void set_maxwell_dielectric2(maxwell_data *md,
+			     const int mesh_size[3],
+			     real R[3][3], real G[3][3],
+			     maxwell_dielectric_function epsilon,
+			     maxwell_dielectric_batch_function epsilon_batch,
+			     maxwell_dielectric_mean_function mepsilon,
+			     maxwell_dielectric_uniform_function uniform,
+			     maxwell_dielectric_changed_function changed,
+			     int threadsafe,
+			     void *epsilon_data)
+{
+     set_maxwell_eps_inv(md, mesh_size, R, G, epsilon, epsilon_batch,
+			 mepsilon, uniform, changed, threadsafe, epsilon_data);
+}
+
 void set_maxwell_mu(maxwell_data *md,
                     const int mesh_size[3],
                     real R[3][3], real G[3][3],
                     maxwell_dielectric_function mu,
                     maxwell_dielectric_mean_function mmu,
-                    void *mu_data) {
+                    void *mu_data)
+{
+     set_maxwell_mu2(md, mesh_size, R, G, mu, NULL, mmu, NULL, NULL, 0,
+		     mu_data);
+}
+
+void set_maxwell_mu2(maxwell_data *md,
+		     const int mesh_size[3],
+		     real R[3][3], real G[3][3],
+		     maxwell_dielectric_function mu,
+		     maxwell_dielectric_batch_function mu_batch,
+		     maxwell_dielectric_mean_function mmu,
+		     maxwell_dielectric_uniform_function umu,
+		     maxwell_dielectric_changed_function changed,
+		     int threadsafe,
+		     void *mu_data) {
     symmetric_matrix *eps_inv = md->eps_inv;
     real eps_inv_mean = md->eps_inv_mean;
     if (md->mu_inv == NULL) {
         CHK_MALLOC(md->mu_inv, symmetric_matrix, md->fft_output_size);
+        changed = NULL; /* no previous mu_inv to update */
     }
     /* just re-use code to set epsilon, but initialize mu_inv instead */
     md->eps_inv = md->mu_inv;
-    set_maxwell_dielectric(md, mesh_size, R, G, mu, mmu, mu_data);
+    md->eps_inv_mean = md->mu_inv_mean;
+    set_maxwell_eps_inv(md, mesh_size, R, G, mu, mu_batch, mmu, umu, changed,
+			threadsafe, mu_data);
     md->eps_inv = eps_inv;
     md->mu_inv_mean = md->eps_inv_mean;
     md->eps_inv_mean = eps_inv_mean;
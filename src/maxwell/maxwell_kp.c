@@ -0,0 +1,349 @@
+/* Copyright (C) 1999-2014 Massachusetts Institute of Technology.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+
+#include "config.h"
+#include <check.h>
+#include <mpiglue.h>
+#include <mpi_utils.h>
+#include <blasglue.h>
+#include <eigensolver.h>
+
+#include "maxwell.h"
+
+#define MAX2(a,b) ((a) > (b) ? (a) : (b))
+
+/**************************************************************************/
+
+/* k.p interpolation of the bands between solved k points.
+
+   The Maxwell operator A(k) = curl 1/eps curl is a quadratic function
+   of k, so that for k = k0 + q:
+
+        A(k) = A(k0) + sum_a q_a A1_a + sum_ab q_a q_b A2_ab
+
+   where, with e_a the cartesian unit vectors, A1_a is the sum of
+   maxwell_ucross_op for u = e_a and its adjoint, and A2_ab is
+   maxwell_ucross_vcross_op for u = e_a and v = e_b.  Given the bands
+   H at an anchor point k0, we compute the band-band matrices of these
+   operators once, and the Rayleigh-Ritz problem for the bands at any
+   nearby k, within the span of H, is then a small dense eigenproblem.
+
+   H is transverse to k0+G, not to k+G, so the trial functions are the
+   projections of H onto the transverse fields at k.  This doesn't
+   change H' A(k) H (A(k) is zero for the longitudinal part), but the
+   overlap matrix becomes H'H - sum_ab q_a q_b S2_ab, to second order
+   in q, where S2_ab = sum_G (H_G . e_a)* (H_G . e_b) / |k0+G|^2.  The
+   projected bands are also the interpolated fields that we return.
+
+   The accuracy is limited by the (second-order) coupling to the bands
+   that are not in H, and is thus worst for the highest bands.  We
+   therefore also solve (once, at the anchor point) for a "guard" band,
+   the next band above H, and include it in the interpolation: this
+   improves the highest bands, and the guard band's interpolated
+   frequency gives the gap to the bands that are not included, which
+   we need for the error estimate.  To check the result, we apply the
+   Maxwell operator once to the interpolated bands, which is much
+   cheaper than solving for them. */
+
+/* the cartesian directions of the second-derivative matrices */
+static const int kp_a[6] = { 0, 0, 0, 1, 1, 2 };
+static const int kp_b[6] = { 0, 1, 2, 1, 2, 2 };
+
+/* tolerance for the guard band, which only enters the error estimate */
+#define KP_GUARD_TOLERANCE 1e-4
+
+typedef struct {
+     maxwell_data *d;
+     evectmatrix H;
+     scalar *S, *S2; /* H.p scratch values each */
+} kp_guard_data;
+
+/* Constraint for the guard band: the parity of d, and orthogonality
+   to the bands H below it. */
+static void kp_guard_constraint(evectmatrix X, void *data)
+{
+     kp_guard_data *g = (kp_guard_data *) data;
+
+     maxwell_parity_constraint(X, (void *) g->d);
+
+     /* X = (1 - H Ht) X, calling the BLAS directly since Ht X is not
+	square: */
+     blasglue_gemm('C', 'N', X.p, g->H.p, X.n,
+		   1.0, X.data, X.p, g->H.data, g->H.p, 0.0, g->S2, g->H.p);
+     mpi_allreduce(g->S2, g->S, g->H.p * X.p * SCALAR_NUMVALS,
+		   real, SCALAR_MPI_TYPE, MPI_SUM, mpb_comm);
+     blasglue_gemm('N', 'C', X.n, X.p, g->H.p,
+		   -1.0, g->H.data, g->H.p, g->S, g->H.p, 1.0, X.data, X.p);
+}
+
+/* Set the single column of Y to the band just above the (converged)
+   bands H at the current k point of d. */
+static void kp_guard_band(maxwell_data *d, evectmatrix H, evectmatrix Y)
+{
+     evectmatrix W[3];
+     kp_guard_data g;
+     real eigval;
+     int i, num_iters;
+
+     g.d = d;
+     g.H = H;
+     CHK_MALLOC(g.S, scalar, H.p);
+     CHK_MALLOC(g.S2, scalar, H.p);
+     for (i = 0; i < 3; ++i)
+	  W[i] = create_evectmatrix(Y.N, Y.c, 1, Y.localN, Y.Nstart, Y.allocN);
+
+     for (i = 0; i < Y.n; ++i)
+	  ASSIGN_SCALAR(Y.data[i],
+			rand() * 1.0 / RAND_MAX - 0.5,
+			rand() * 1.0 / RAND_MAX - 0.5);
+     eigensolver(Y, &eigval, maxwell_operator, (void *) d, NULL, NULL,
+		 maxwell_preconditioner2, (void *) d,
+		 kp_guard_constraint, (void *) &g,
+		 W, 3, KP_GUARD_TOLERANCE, &num_iters, EIGS_DEFAULT_FLAGS);
+
+     for (i = 0; i < 3; ++i)
+	  destroy_evectmatrix(W[i]);
+     free(g.S2);
+     free(g.S);
+}
+
+/* Create the k.p data for the (orthonormal) bands H, which must be
+   solutions at the current k point of d.  k = 0 is not supported,
+   since there the constant bands are not in the transverse basis.
+   This also solves for the guard band above H (see above). */
+maxwell_kp_data *create_maxwell_kp_data(maxwell_data *d, evectmatrix Hin)
+{
+     maxwell_kp_data *kp;
+     evectmatrix C[3], H;
+     sqmatrix U;
+     int i, a, ab, b, p = Hin.p + 1;
+
+     CHECK(d, "null maxwell data pointer!");
+     CHECK(Hin.c == 2, "fields don't have 2 components!");
+     CHECK(d->mu_inv == NULL, "k.p interpolation doesn't handle mu");
+     CHECK(!d->zero_k, "k.p interpolation doesn't handle k = 0");
+
+     CHK_MALLOC(kp, maxwell_kp_data, 1);
+     for (a = 0; a < 3; ++a)
+	  kp->k[a] = d->current_k[a];
+     /* kp->H = the bands Hin plus the guard band: */
+     kp->H = H = create_evectmatrix(Hin.N, 2, p, Hin.localN, Hin.Nstart,
+				    Hin.allocN);
+     kp->W = create_evectmatrix(H.N, 2, p, H.localN, H.Nstart, H.allocN);
+     kp->X = create_evectmatrix(H.N, 2, p, H.localN, H.Nstart, H.allocN);
+     evectmatrix_resize(&kp->W, 1, 0);
+     kp_guard_band(d, Hin, kp->W);
+     evectmatrix_copy_slice(H, Hin, 0, 0, p - 1);
+     evectmatrix_copy_slice(H, kp->W, p - 1, 0, 1);
+     evectmatrix_resize(&kp->W, p, 0);
+     kp->M = create_sqmatrix(p);
+     kp->S = create_sqmatrix(p);
+     kp->Sw = create_sqmatrix(p);
+     CHK_MALLOC(kp->diag, real, 3 * p);
+
+     CHK_MALLOC(kp->mn, real, 6 * H.localN);
+     for (i = 0; i < H.localN; ++i) {
+	  kp->mn[6*i+0] = d->k_plus_G[i].mx;
+	  kp->mn[6*i+1] = d->k_plus_G[i].my;
+	  kp->mn[6*i+2] = d->k_plus_G[i].mz;
+	  kp->mn[6*i+3] = d->k_plus_G[i].nx;
+	  kp->mn[6*i+4] = d->k_plus_G[i].ny;
+	  kp->mn[6*i+5] = d->k_plus_G[i].nz;
+     }
+
+     U = kp->M; /* use as scratch */
+
+     kp->S0 = create_sqmatrix(p);
+     evectmatrix_XtX(kp->S0, H, kp->Sw);
+
+     kp->M0 = create_sqmatrix(p);
+     maxwell_operator(H, kp->W, d, 0, kp->W);
+     evectmatrix_XtY(U, H, kp->W, kp->Sw);
+     sqmatrix_symmetrize(kp->M0, U);
+
+     for (a = 0; a < 3; ++a) {
+	  real u[3] = {0,0,0};
+	  u[a] = 1;
+	  kp->M1[a] = create_sqmatrix(p);
+	  maxwell_ucross_op(H, kp->W, d, u);
+	  evectmatrix_XtY(U, H, kp->W, kp->Sw);
+	  sqmatrix_symmetrize(kp->M1[a], U);
+	  sqmatrix_ApaB(kp->M1[a], 1.0, kp->M1[a]);
+     }
+
+     /* for a != b, the ab and ba terms are adjoints of each other,
+	and we combine them: */
+     for (ab = 0; ab < 6; ++ab) {
+	  real u[3] = {0,0,0}, v[3] = {0,0,0};
+	  u[kp_a[ab]] = 1;
+	  v[kp_b[ab]] = 1;
+	  kp->M2[ab] = create_sqmatrix(p);
+	  maxwell_ucross_vcross_op(H, kp->W, d, u, v);
+	  evectmatrix_XtY(U, H, kp->W, kp->Sw);
+	  sqmatrix_symmetrize(kp->M2[ab], U);
+	  if (kp_a[ab] != kp_b[ab])
+	       sqmatrix_ApaB(kp->M2[ab], 1.0, kp->M2[ab]);
+     }
+
+     /* C[a] = cartesian component a of H / |k0+G|: */
+     for (a = 0; a < 3; ++a)
+	  C[a] = create_evectmatrix(H.N, 1, p, H.localN, H.Nstart, H.allocN);
+     for (i = 0; i < H.localN; ++i) {
+	  real kmag = d->k_plus_G[i].kmag;
+	  real s = kmag > 0 ? 1.0 / kmag : 0.0;
+	  for (a = 0; a < 3; ++a) {
+	       real m = kp->mn[6*i+a] * s, n = kp->mn[6*i+3+a] * s;
+	       for (b = 0; b < p; ++b) {
+		    scalar v0 = H.data[(2*i) * p + b];
+		    scalar v1 = H.data[(2*i+1) * p + b];
+		    ASSIGN_SCALAR(C[a].data[i * p + b],
+				  SCALAR_RE(v0) * m + SCALAR_RE(v1) * n,
+				  SCALAR_IM(v0) * m + SCALAR_IM(v1) * n);
+	       }
+	  }
+     }
+     for (ab = 0; ab < 6; ++ab) {
+	  kp->S2[ab] = create_sqmatrix(p);
+	  evectmatrix_XtY(U, C[kp_a[ab]], C[kp_b[ab]], kp->Sw);
+	  sqmatrix_symmetrize(kp->S2[ab], U);
+	  if (kp_a[ab] != kp_b[ab])
+	       sqmatrix_ApaB(kp->S2[ab], 1.0, kp->S2[ab]);
+     }
+     for (a = 0; a < 3; ++a)
+	  destroy_evectmatrix(C[a]);
+
+     return kp;
+}
+
+void destroy_maxwell_kp_data(maxwell_kp_data *kp)
+{
+     if (kp) {
+	  int i;
+	  for (i = 0; i < 6; ++i) {
+	       destroy_sqmatrix(kp->S2[i]);
+	       destroy_sqmatrix(kp->M2[i]);
+	  }
+	  for (i = 0; i < 3; ++i)
+	       destroy_sqmatrix(kp->M1[i]);
+	  destroy_sqmatrix(kp->M0);
+	  destroy_sqmatrix(kp->S0);
+	  free(kp->mn);
+	  free(kp->diag);
+	  destroy_sqmatrix(kp->Sw);
+	  destroy_sqmatrix(kp->S);
+	  destroy_sqmatrix(kp->M);
+	  destroy_evectmatrix(kp->X);
+	  destroy_evectmatrix(kp->W);
+	  destroy_evectmatrix(kp->H);
+	  free(kp);
+     }
+}
+
+/* Set H and eigenvals to the bands at the current k point of d,
+   interpolated from the anchor point of kp.  The eigenvalues are the
+   Rayleigh quotients of the interpolated bands.  Returns an estimate
+   of the largest relative error in the frequencies, from the
+   Kato-Temple bound |r|^2 / gap on the error in an eigenvalue, where
+   r = A H - eigenval H is the residual of the band and gap is the
+   distance to the bands that are not in the interpolation.  The latter
+   start no lower than the guard band's frequency minus the norm of
+   its residual. */
+real maxwell_kp_interpolate(maxwell_kp_data *kp, maxwell_data *d,
+			    evectmatrix H, real *eigenvals)
+{
+     real q[3], err = 0, lnext;
+     evectmatrix X = kp->X;
+     int i, a, ab, b, p = X.p;
+     real *norm2 = kp->diag, *scratch = kp->diag + p, *eigs = kp->diag + 2*p;
+
+     CHECK(d, "null maxwell data pointer!");
+     CHECK(H.p + 1 == p && H.n == X.n, "mismatched k.p bands");
+
+     for (a = 0; a < 3; ++a)
+	  q[a] = d->current_k[a] - kp->k[a];
+
+     /* solve M x = lambda S x, where M = H'A(k)H and S is the overlap
+	of the projected bands, as a polynomial in q: */
+     sqmatrix_copy(kp->M, kp->M0);
+     sqmatrix_copy(kp->S, kp->S0);
+     for (a = 0; a < 3; ++a)
+	  sqmatrix_ApaB(kp->M, q[a], kp->M1[a]);
+     for (ab = 0; ab < 6; ++ab) {
+	  real qq = q[kp_a[ab]] * q[kp_b[ab]];
+	  sqmatrix_ApaB(kp->M, qq, kp->M2[ab]);
+	  sqmatrix_ApaB(kp->S, -qq, kp->S2[ab]);
+     }
+     sqmatrix_gen_eigensolve(kp->M, kp->S, eigs, kp->Sw);
+     evectmatrix_XeYS(X, kp->H, kp->M, 1);
+
+     /* project onto the transverse basis at k: */
+     for (i = 0; i < X.localN; ++i) {
+	  const real *mn0 = kp->mn + 6*i;
+	  real mx = d->k_plus_G[i].mx, my = d->k_plus_G[i].my;
+	  real mz = d->k_plus_G[i].mz, nx = d->k_plus_G[i].nx;
+	  real ny = d->k_plus_G[i].ny, nz = d->k_plus_G[i].nz;
+	  real mm = mx*mn0[0] + my*mn0[1] + mz*mn0[2];
+	  real mn = mx*mn0[3] + my*mn0[4] + mz*mn0[5];
+	  real nm = nx*mn0[0] + ny*mn0[1] + nz*mn0[2];
+	  real nn = nx*mn0[3] + ny*mn0[4] + nz*mn0[5];
+	  for (b = 0; b < p; ++b) {
+	       scalar v0 = X.data[(2*i) * p + b];
+	       scalar v1 = X.data[(2*i+1) * p + b];
+	       ASSIGN_SCALAR(X.data[(2*i) * p + b],
+			     mm * SCALAR_RE(v0) + mn * SCALAR_RE(v1),
+			     mm * SCALAR_IM(v0) + mn * SCALAR_IM(v1));
+	       ASSIGN_SCALAR(X.data[(2*i+1) * p + b],
+			     nm * SCALAR_RE(v0) + nn * SCALAR_RE(v1),
+			     nm * SCALAR_IM(v0) + nn * SCALAR_IM(v1));
+	  }
+     }
+
+     /* normalize (the overlap is only correct to second order): */
+     evectmatrix_XtX_diag_real(X, norm2, scratch);
+     for (b = 0; b < p; ++b)
+	  norm2[b] = 1.0 / sqrt(norm2[b]);
+     for (i = 0; i < X.n; ++i)
+	  for (b = 0; b < p; ++b)
+	       ASSIGN_SCALAR(X.data[i * p + b],
+			     SCALAR_RE(X.data[i * p + b]) * norm2[b],
+			     SCALAR_IM(X.data[i * p + b]) * norm2[b]);
+
+     /* check the result: */
+     maxwell_operator(X, kp->W, d, 1, kp->W);
+     evectmatrix_XtY_diag_real(X, kp->W, eigs, scratch);
+     matrix_XpaY_diag_real(kp->W.data, -1.0, X.data, eigs, X.n, p);
+     evectmatrix_XtX_diag_real(kp->W, norm2, scratch);
+     lnext = eigs[p - 1] - sqrt(norm2[p - 1]);
+     for (b = 0; b < p - 1; ++b) {
+	  real gap = lnext - eigs[b];
+	  if (gap <= 0) /* band crossing: no estimate possible */
+	       err = MAX2(err, 1.0);
+	  else
+	       err = MAX2(err, norm2[b] / (2 * MAX2(eigs[b], 1e-20) * gap));
+     }
+
+     /* return the bands below the guard band: */
+     evectmatrix_copy_slice(H, X, 0, 0, p - 1);
+     for (b = 0; b < p - 1; ++b)
+	  eigenvals[b] = eigs[b];
+
+     return err;
+}
@@ -24,65 +24,86 @@
 
 /**************************************************************************/
 
-/* assign a = v going from transverse to cartesian coordinates.  
-   Here, a = (a[0],a[1],a[2]) is in cartesian coordinates.
-   (v[0],v[vstride]) is in the transverse basis of k.m and k.n. */
+/* The following kernels convert between the transverse (m,n) basis of
+   a k+G planewave and cartesian coordinates for nb bands at once.  The
+   transverse components of band b are (v[b],v[vstride+b]), and the
+   cartesian components are (a[3*b],a[3*b+1],a[3*b+2]).  The k-dependent
+   factors are hoisted out of the band loop, which the compiler can
+   then vectorize. */
+
+/* assign a = v going from transverse to cartesian coordinates. */
 static void assign_t2c(scalar *a, const k_data k,
-		       const scalar *v, int vstride)
+		       const scalar *v, int vstride, int nb)
 {
-     scalar v0 = v[0], v1 = v[vstride];
-
-     ASSIGN_SCALAR(a[0],
-		   SCALAR_RE(v0)*k.mx + SCALAR_RE(v1)*k.nx,
-		   SCALAR_IM(v0)*k.mx + SCALAR_IM(v1)*k.nx);
-     ASSIGN_SCALAR(a[1],
-		   SCALAR_RE(v0)*k.my + SCALAR_RE(v1)*k.ny,
-		   SCALAR_IM(v0)*k.my + SCALAR_IM(v1)*k.ny);
-     ASSIGN_SCALAR(a[2],
-		   SCALAR_RE(v0)*k.mz + SCALAR_RE(v1)*k.nz,
-		   SCALAR_IM(v0)*k.mz + SCALAR_IM(v1)*k.nz);
+     int b;
+
+     for (b = 0; b < nb; ++b) {
+	  scalar v0 = v[b], v1 = v[vstride + b];
+
+	  ASSIGN_SCALAR(a[3*b+0],
+			SCALAR_RE(v0)*k.mx + SCALAR_RE(v1)*k.nx,
+			SCALAR_IM(v0)*k.mx + SCALAR_IM(v1)*k.nx);
+	  ASSIGN_SCALAR(a[3*b+1],
+			SCALAR_RE(v0)*k.my + SCALAR_RE(v1)*k.ny,
+			SCALAR_IM(v0)*k.my + SCALAR_IM(v1)*k.ny);
+	  ASSIGN_SCALAR(a[3*b+2],
+			SCALAR_RE(v0)*k.mz + SCALAR_RE(v1)*k.nz,
+			SCALAR_IM(v0)*k.mz + SCALAR_IM(v1)*k.nz);
+     }
 }
 
 /* project from cartesian to transverse coordinates (inverse of assign_t2c) */
 static void project_c2t(scalar *v, int vstride, const k_data k,
-                        const scalar *a, real scale)
+                        const scalar *a, real scale, int nb)
 {
-    real ax_r=SCALAR_RE(a[0]), ay_r=SCALAR_RE(a[1]), az_r=SCALAR_RE(a[2]);
-    real ax_i=SCALAR_IM(a[0]), ay_i=SCALAR_IM(a[1]), az_i=SCALAR_IM(a[2]);
-    ASSIGN_SCALAR(v[0], (ax_r*k.mx + ay_r*k.my + az_r*k.mz) * scale,
-                  (ax_i*k.mx + ay_i*k.my +az_i*k.mz) * scale);
-    ASSIGN_SCALAR(v[vstride], (ax_r*k.nx + ay_r*k.ny + az_r*k.nz) * scale,
-                  (ax_i*k.nx + ay_i*k.ny +az_i*k.nz) * scale);
+     real mx = k.mx * scale, my = k.my * scale, mz = k.mz * scale;
+     real nx = k.nx * scale, ny = k.ny * scale, nz = k.nz * scale;
+     int b;
+
+     for (b = 0; b < nb; ++b) {
+	  real ax_r=SCALAR_RE(a[3*b]), ay_r=SCALAR_RE(a[3*b+1]);
+	  real az_r=SCALAR_RE(a[3*b+2]);
+	  real ax_i=SCALAR_IM(a[3*b]), ay_i=SCALAR_IM(a[3*b+1]);
+	  real az_i=SCALAR_IM(a[3*b+2]);
+	  ASSIGN_SCALAR(v[b], ax_r*mx + ay_r*my + az_r*mz,
+			ax_i*mx + ay_i*my + az_i*mz);
+	  ASSIGN_SCALAR(v[vstride + b], ax_r*nx + ay_r*ny + az_r*nz,
+			ax_i*nx + ay_i*ny + az_i*nz);
+     }
 }
 
 /* assign a = k x v (cross product), going from transverse to
    cartesian coordinates.
   
-   Here, a = (a[0],a[1],a[2]) and k = (k.kx,k.ky,k.kz) are in
-   cartesian coordinates.  (v[0],v[vstride]) is in the transverse basis of
-   k.m and k.n. */
+   Here, a and k = (k.kx,k.ky,k.kz) are in cartesian coordinates. */
 static void assign_cross_t2c(scalar *a, const k_data k,
-			     const scalar *v, int vstride)
+			     const scalar *v, int vstride, int nb)
 {
-     scalar v0 = v[0], v1 = v[vstride];
-
      /* Note that k x m = |k| n, k x n = - |k| m.  Therefore,
         k x v = k x (v0 m + v1 n) = (v0 n - v1 m) * |k|. */
-
-     ASSIGN_SCALAR(a[0],
-		   (SCALAR_RE(v0)*k.nx - SCALAR_RE(v1)*k.mx) * k.kmag,
-		   (SCALAR_IM(v0)*k.nx - SCALAR_IM(v1)*k.mx) * k.kmag);
-     ASSIGN_SCALAR(a[1],
-		   (SCALAR_RE(v0)*k.ny - SCALAR_RE(v1)*k.my) * k.kmag,
-		   (SCALAR_IM(v0)*k.ny - SCALAR_IM(v1)*k.my) * k.kmag);
-     ASSIGN_SCALAR(a[2],
-		   (SCALAR_RE(v0)*k.nz - SCALAR_RE(v1)*k.mz) * k.kmag,
-		   (SCALAR_IM(v0)*k.nz - SCALAR_IM(v1)*k.mz) * k.kmag);
+     real mx = k.mx * k.kmag, my = k.my * k.kmag, mz = k.mz * k.kmag;
+     real nx = k.nx * k.kmag, ny = k.ny * k.kmag, nz = k.nz * k.kmag;
+     int b;
+
+     for (b = 0; b < nb; ++b) {
+	  scalar v0 = v[b], v1 = v[vstride + b];
+
+	  ASSIGN_SCALAR(a[3*b+0],
+			SCALAR_RE(v0)*nx - SCALAR_RE(v1)*mx,
+			SCALAR_IM(v0)*nx - SCALAR_IM(v1)*mx);
+	  ASSIGN_SCALAR(a[3*b+1],
+			SCALAR_RE(v0)*ny - SCALAR_RE(v1)*my,
+			SCALAR_IM(v0)*ny - SCALAR_IM(v1)*my);
+	  ASSIGN_SCALAR(a[3*b+2],
+			SCALAR_RE(v0)*nz - SCALAR_RE(v1)*mz,
+			SCALAR_IM(v0)*nz - SCALAR_IM(v1)*mz);
+     }
 
 #ifdef DEBUG
-     {
+     for (b = 0; b < nb; ++b) {
 	  real num;
-	  num = SCALAR_NORMSQR(a[0])+SCALAR_NORMSQR(a[1])+SCALAR_NORMSQR(a[2]);
+	  num = SCALAR_NORMSQR(a[3*b]) + SCALAR_NORMSQR(a[3*b+1])
+	       + SCALAR_NORMSQR(a[3*b+2]);
 	  CHECK(!BADNUM(num), "yikes, crazy number!");
      }
 #endif
@@ -91,39 +112,38 @@ static void assign_cross_t2c(scalar *a, const k_data k,
 /* assign v = scale * k x a (cross product), going from cartesian to
    transverse coordinates.
   
-   Here, a = (a[0],a[1],a[2]) and k = (k.kx,k.ky,k.kz) are in
-   cartesian coordinates.  (v[0],v[vstride]) is in the transverse basis of
-   k.m and k.n. */
+   Here, a and k = (k.kx,k.ky,k.kz) are in cartesian coordinates. */
 static void assign_cross_c2t(scalar *v, int vstride,
 			     const k_data k, const scalar *a,
-			     real scale)
+			     real scale, int nb)
 {
-     scalar a0 = a[0], a1 = a[1], a2 = a[2];
-     scalar at0, at1;
-
-     /* First, compute at0 = a*m and at1 = a*n.  (Components of a that
-	are parallel to k are killed anyway by the cross product.) */
-
-     ASSIGN_SCALAR(at0,
-          SCALAR_RE(a0)*k.mx + SCALAR_RE(a1)*k.my + SCALAR_RE(a2)*k.mz,
-	  SCALAR_IM(a0)*k.mx + SCALAR_IM(a1)*k.my + SCALAR_IM(a2)*k.mz);
-     ASSIGN_SCALAR(at1,
-          SCALAR_RE(a0)*k.nx + SCALAR_RE(a1)*k.ny + SCALAR_RE(a2)*k.nz,
-	  SCALAR_IM(a0)*k.nx + SCALAR_IM(a1)*k.ny + SCALAR_IM(a2)*k.nz);
-
-     /* Now, k x a = k x (at0*m + at1*n) = (at0*n - at1*m) * |k|. */
-
-     scale *= k.kmag;  /* combine scale factor and |k|*/
-     ASSIGN_SCALAR(v[0],
-		   - scale * SCALAR_RE(at1),
-		   - scale * SCALAR_IM(at1));
-     ASSIGN_SCALAR(v[vstride],
-		   scale * SCALAR_RE(at0),
-		   scale * SCALAR_IM(at0));
+     /* We compute at0 = a*m and at1 = a*n.  (Components of a that
+	are parallel to k are killed anyway by the cross product.)
+        Then, k x a = k x (at0*m + at1*n) = (at0*n - at1*m) * |k|,
+        and we combine the scale factor and |k| with m and n. */
+     real mx, my, mz, nx, ny, nz;
+     int b;
+
+     scale *= k.kmag;
+     mx = k.mx * scale; my = k.my * scale; mz = k.mz * scale;
+     nx = k.nx * scale; ny = k.ny * scale; nz = k.nz * scale;
+
+     for (b = 0; b < nb; ++b) {
+	  scalar a0 = a[3*b], a1 = a[3*b+1], a2 = a[3*b+2];
+
+	  ASSIGN_SCALAR(v[b],
+			- (SCALAR_RE(a0)*nx + SCALAR_RE(a1)*ny
+			   + SCALAR_RE(a2)*nz),
+			- (SCALAR_IM(a0)*nx + SCALAR_IM(a1)*ny
+			   + SCALAR_IM(a2)*nz));
+	  ASSIGN_SCALAR(v[vstride + b],
+			SCALAR_RE(a0)*mx + SCALAR_RE(a1)*my + SCALAR_RE(a2)*mz,
+			SCALAR_IM(a0)*mx + SCALAR_IM(a1)*my + SCALAR_IM(a2)*mz);
+     }
 
 #ifdef DEBUG
-     {
-	  real dummy = SCALAR_NORMSQR(v[0]) + SCALAR_NORMSQR(v[vstride]);
+     for (b = 0; b < nb; ++b) {
+	  real dummy = SCALAR_NORMSQR(v[b]) + SCALAR_NORMSQR(v[vstride + b]);
 	  CHECK(!BADNUM(dummy), "yikes, crazy number!");
      }
 #endif
@@ -132,35 +152,59 @@ static void assign_cross_c2t(scalar *v, int vstride,
 /* compute a = u x v, where a and u are in cartesian coordinates and
    v is in transverse coordinates. */
 static void assign_ucross_t2c(scalar *a, const real u[3], const k_data k,
-			     const scalar *v, int vstride)
+			     const scalar *v, int vstride, int nb)
 {
-     scalar v0 = v[0], v1 = v[vstride];
-     real vx_r, vy_r, vz_r;
-#ifdef SCALAR_COMPLEX
-     real vx_i, vy_i, vz_i;
-#endif
-
-     /* Note that v = (vx,vy,vz) = (v0 m + v1 n). */
-
-     vx_r = SCALAR_RE(v0)*k.mx + SCALAR_RE(v1)*k.nx;
-     vy_r = SCALAR_RE(v0)*k.my + SCALAR_RE(v1)*k.ny;
-     vz_r = SCALAR_RE(v0)*k.mz + SCALAR_RE(v1)*k.nz;
-
-#ifdef SCALAR_COMPLEX
-     vx_i = SCALAR_IM(v0)*k.mx + SCALAR_IM(v1)*k.nx;
-     vy_i = SCALAR_IM(v0)*k.my + SCALAR_IM(v1)*k.ny;
-     vz_i = SCALAR_IM(v0)*k.mz + SCALAR_IM(v1)*k.nz;
-#endif
+     /* Note that v = (vx,vy,vz) = (v0 m + v1 n), so that u x v
+	= v0 (u x m) + v1 (u x n). */
+     real uxm0 = u[1]*k.mz - u[2]*k.my, uxn0 = u[1]*k.nz - u[2]*k.ny;
+     real uxm1 = u[2]*k.mx - u[0]*k.mz, uxn1 = u[2]*k.nx - u[0]*k.nz;
+     real uxm2 = u[0]*k.my - u[1]*k.mx, uxn2 = u[0]*k.ny - u[1]*k.nx;
+     int b;
+
+     for (b = 0; b < nb; ++b) {
+	  scalar v0 = v[b], v1 = v[vstride + b];
+
+	  ASSIGN_SCALAR(a[3*b+0],
+			SCALAR_RE(v0)*uxm0 + SCALAR_RE(v1)*uxn0,
+			SCALAR_IM(v0)*uxm0 + SCALAR_IM(v1)*uxn0);
+	  ASSIGN_SCALAR(a[3*b+1],
+			SCALAR_RE(v0)*uxm1 + SCALAR_RE(v1)*uxn1,
+			SCALAR_IM(v0)*uxm1 + SCALAR_IM(v1)*uxn1);
+	  ASSIGN_SCALAR(a[3*b+2],
+			SCALAR_RE(v0)*uxm2 + SCALAR_RE(v1)*uxn2,
+			SCALAR_IM(v0)*uxm2 + SCALAR_IM(v1)*uxn2);
+     }
+}
 
-     ASSIGN_SCALAR(a[0],
-		   u[1] * vz_r - u[2] * vy_r,
-		   u[1] * vz_i - u[2] * vy_i);
-     ASSIGN_SCALAR(a[1],
-		   u[2] * vx_r - u[0] * vz_r,
-		   u[2] * vx_i - u[0] * vz_i);
-     ASSIGN_SCALAR(a[2],
-		   u[0] * vy_r - u[1] * vx_r,
-		   u[0] * vy_i - u[1] * vx_i);
+/* compute v = scale * u x a, going from cartesian to transverse
+   coordinates; a and u are in cartesian coordinates. */
+static void assign_ucross_c2t(scalar *v, int vstride, const real u[3],
+			      const k_data k, const scalar *a,
+			      real scale, int nb)
+{
+     /* m . (u x a) = a . (m x u), and similarly for n: */
+     real mxu0 = (k.my*u[2] - k.mz*u[1]) * scale;
+     real mxu1 = (k.mz*u[0] - k.mx*u[2]) * scale;
+     real mxu2 = (k.mx*u[1] - k.my*u[0]) * scale;
+     real nxu0 = (k.ny*u[2] - k.nz*u[1]) * scale;
+     real nxu1 = (k.nz*u[0] - k.nx*u[2]) * scale;
+     real nxu2 = (k.nx*u[1] - k.ny*u[0]) * scale;
+     int b;
+
+     for (b = 0; b < nb; ++b) {
+	  scalar a0 = a[3*b], a1 = a[3*b+1], a2 = a[3*b+2];
+
+	  ASSIGN_SCALAR(v[b],
+			SCALAR_RE(a0)*mxu0 + SCALAR_RE(a1)*mxu1
+			+ SCALAR_RE(a2)*mxu2,
+			SCALAR_IM(a0)*mxu0 + SCALAR_IM(a1)*mxu1
+			+ SCALAR_IM(a2)*mxu2);
+	  ASSIGN_SCALAR(v[vstride + b],
+			SCALAR_RE(a0)*nxu0 + SCALAR_RE(a1)*nxu1
+			+ SCALAR_RE(a2)*nxu2,
+			SCALAR_IM(a0)*nxu0 + SCALAR_IM(a1)*nxu1
+			+ SCALAR_IM(a2)*nxu2);
+     }
 }
 
 /**************************************************************************/
@@ -186,6 +230,32 @@ void maxwell_compute_fft(int dir, maxwell_data *d,
      else { /* create new plans */
 	  ptrdiff_t np[3];
 	  int n[3]; np[0]=n[0]=d->nx; np[1]=n[1]=d->ny; np[2]=n[2]=d->nz;
+	  unsigned flags = FFTW_ESTIMATE;
+	  scalar *scratch_in = 0, *scratch_out = 0;
+
+	  if (d->fft_planner_effort != MAXWELL_FFT_ESTIMATE) {
+	       /* FFTW_MEASURE/PATIENT overwrite the arrays while planning,
+		  so plan on scratch arrays of the same size & alignment
+		  (fine since we use the new-array execute functions below).
+		  If wisdom for this problem was imported, no measuring
+		  is actually done here. */
+	       flags = d->fft_planner_effort == MAXWELL_FFT_PATIENT
+		    ? FFTW_PATIENT : FFTW_MEASURE;
+	       scratch_in = (scalar *) FFTW(malloc)(sizeof(scalar)
+						    * d->fft_data_size);
+	       CHECK(scratch_in, "out of memory!");
+	       if (array_out == array_in)
+		    scratch_out = scratch_in;
+	       else {
+		    scratch_out = (scalar *) FFTW(malloc)(sizeof(scalar)
+							  * d->fft_data_size);
+		    CHECK(scratch_out, "out of memory!");
+	       }
+	       carray_in = (FFTW(complex) *) scratch_in;
+	       rarray_in = (real *) scratch_in;
+	       carray_out = (FFTW(complex) *) scratch_out;
+	       rarray_out = (real *) scratch_out;
+	  }
 #  ifdef SCALAR_COMPLEX
 #    ifdef HAVE_MPI
 	  CHECK(stride==howmany && dist==1, "bug: unsupported stride/dist");
@@ -194,22 +264,22 @@ void maxwell_compute_fft(int dir, maxwell_data *d,
 					 FFTW_MPI_DEFAULT_BLOCK,
 					 carray_in, carray_out,
 					 mpb_comm, FFTW_BACKWARD,
-					 FFTW_ESTIMATE
+					 flags
 					 | FFTW_MPI_TRANSPOSED_IN);
 	  iplan = FFTW(mpi_plan_many_dft)(3, np, howmany, 
 					  FFTW_MPI_DEFAULT_BLOCK,
 					  FFTW_MPI_DEFAULT_BLOCK,
 					  carray_in, carray_out,
 					  mpb_comm, FFTW_FORWARD,
-					  FFTW_ESTIMATE
+					  flags
 					  | FFTW_MPI_TRANSPOSED_OUT);
 #    else /* !HAVE_MPI */
 	  plan = FFTW(plan_many_dft)(3, n, howmany, carray_in, 0, stride, dist,
 				     carray_out, 0, stride, dist,
-				     FFTW_BACKWARD, FFTW_ESTIMATE);
+				     FFTW_BACKWARD, flags);
 	  iplan = FFTW(plan_many_dft)(3, n, howmany, carray_in,0,stride, dist,
 				      carray_out, 0, stride, dist,
-				      FFTW_FORWARD, FFTW_ESTIMATE);
+				      FFTW_FORWARD, flags);
 #    endif /* !HAVE_MPI */
 #  else /* !SCALAR_COMPLEX */
 	  {
@@ -222,27 +292,38 @@ void maxwell_compute_fft(int dir, maxwell_data *d,
 					     FFTW_MPI_DEFAULT_BLOCK,
 					     FFTW_MPI_DEFAULT_BLOCK,
 					     carray_in, rarray_out,
-					     mpb_comm, FFTW_ESTIMATE
+					     mpb_comm, flags
 					     | FFTW_MPI_TRANSPOSED_IN);
 	  iplan = FFTW(mpi_plan_many_dft_r2c)(rnk, np, howmany, 
 					      FFTW_MPI_DEFAULT_BLOCK,
 					      FFTW_MPI_DEFAULT_BLOCK,
 					      rarray_in, carray_out,
-					      mpb_comm, FFTW_ESTIMATE
+					      mpb_comm, flags
 					      | FFTW_MPI_TRANSPOSED_OUT);
 #    else /* !HAVE_MPI */
 	       plan = FFTW(plan_many_dft_c2r)(rnk, n, howmany,
 					      carray_in, 0, stride, dist,
 					      rarray_out, nr, stride, dist,
-					      FFTW_ESTIMATE);
+					      flags);
 	       iplan = FFTW(plan_many_dft_r2c)(rnk, n, howmany,
 					       rarray_in, nr, stride, dist,
 					       carray_out, 0, stride, dist,
-					       FFTW_ESTIMATE);
+					       flags);
 #    endif /* !HAVE_MPI */
 	  }
 #  endif /* !SCALAR_COMPLEX */
 	  CHECK(plan && iplan, "Failure creating FFTW3 plans");
+
+	  if (scratch_in) {
+	       if (scratch_out != scratch_in)
+		    FFTW(free)(scratch_out);
+	       FFTW(free)(scratch_in);
+	       carray_in = (FFTW(complex) *) array_in;
+	       rarray_in = (real *) array_in;
+	       carray_out = (FFTW(complex) *) array_out;
+	       rarray_out = (real *) array_out;
+	       d->fft_wisdom_dirty |= FFT_WISDOM_DIRTY;
+	  }
      }
 
      /* note that the new-array execute functions should be safe
@@ -401,7 +482,7 @@ void maxwell_compute_d_from_H(maxwell_data *d, evectmatrix Hin,
 {
      scalar *fft_data = (scalar *) dfield;
      scalar *fft_data_in = d->fft_data2 == d->fft_data ? fft_data : (fft_data == d->fft_data ? d->fft_data2 : d->fft_data);
-     int i, j, b;
+     int i, j;
 
      CHECK(Hin.c == 2, "fields don't have 2 components!");
      CHECK(d, "null maxwell data pointer!");
@@ -410,19 +491,17 @@ void maxwell_compute_d_from_H(maxwell_data *d, evectmatrix Hin,
 	   "invalid range of bands for computing fields");
 
      /* first, compute fft_data = curl(Hin) (really (k+G) x H) : */
+#pragma omp parallel for private(j)
      for (i = 0; i < d->other_dims; ++i)
 	  for (j = 0; j < d->last_dim; ++j) {
 	       int ij = i * d->last_dim + j;
 	       int ij2 = i * d->last_dim_size + j;
-	       k_data cur_k = d->k_plus_G[ij];
-	       
-	       for (b = 0; b < cur_num_bands; ++b)
-		    assign_cross_t2c(&fft_data_in[3 * (ij2*cur_num_bands 
-						    + b)], 
-				     cur_k, 
-				     &Hin.data[ij * 2 * Hin.p + 
-					      b + cur_band_start],
-				     Hin.p);
+	       k_data cur_k;
+
+	       cur_k = d->k_plus_G[ij];
+	       assign_cross_t2c(&fft_data_in[3 * ij2 * cur_num_bands], cur_k,
+				&Hin.data[ij * 2 * Hin.p + cur_band_start],
+				Hin.p, cur_num_bands);
 	  }
 
      /* now, convert to position space via FFT: */
@@ -444,6 +523,7 @@ void maxwell_compute_e_from_d_(maxwell_data *d,
      CHECK(d, "null maxwell data pointer!");
      CHECK(dfield, "null field input/output data!");
 
+#pragma omp parallel for private(b)
      for (i = 0; i < d->fft_output_size; ++i) {
 	  symmetric_matrix eps_inv = eps_inv_[i];
 	  for (b = 0; b < cur_num_bands; ++b) {
@@ -473,7 +553,7 @@ void maxwell_compute_H_from_e(maxwell_data *d, evectmatrix Hout,
 {
      scalar *fft_data = (scalar *) efield;
      scalar *fft_data_out = d->fft_data2 == d->fft_data ? fft_data : (fft_data == d->fft_data ? d->fft_data2 : d->fft_data);
-     int i, j, b;
+     int i, j;
 
      CHECK(Hout.c == 2, "fields don't have 2 components!");
      CHECK(d, "null maxwell data pointer!");
@@ -487,18 +567,18 @@ void maxwell_compute_H_from_e(maxwell_data *d, evectmatrix Hout,
      
      /* then, compute Hout = curl(fft_data) (* scale factor): */
      
+#pragma omp parallel for private(j)
      for (i = 0; i < d->other_dims; ++i)
 	  for (j = 0; j < d->last_dim; ++j) {
 	       int ij = i * d->last_dim + j;
 	       int ij2 = i * d->last_dim_size + j;
-	       k_data cur_k = d->k_plus_G[ij];
-	       
-	       for (b = 0; b < cur_num_bands; ++b)
-		    assign_cross_c2t(&Hout.data[ij * 2 * Hout.p + 
-					       b + cur_band_start],
-				     Hout.p, cur_k, 
-				     &fft_data_out[3 * (ij2*cur_num_bands+b)],
-				     scale);
+	       k_data cur_k;
+
+	       cur_k = d->k_plus_G[ij];
+	       assign_cross_c2t(&Hout.data[ij * 2 * Hout.p + cur_band_start],
+				Hout.p, cur_k,
+				&fft_data_out[3 * ij2 * cur_num_bands],
+				scale, cur_num_bands);
 	  }
 }
 
@@ -511,7 +591,7 @@ void maxwell_compute_h_from_H(maxwell_data *d, evectmatrix Hin,
 {
      scalar *fft_data = (scalar *) hfield;
      scalar *fft_data_in = d->fft_data2 == d->fft_data ? fft_data : (fft_data == d->fft_data ? d->fft_data2 : d->fft_data);
-     int i, j, b;
+     int i, j;
 
      CHECK(Hin.c == 2, "fields don't have 2 components!");
      CHECK(d, "null maxwell data pointer!");
@@ -521,19 +601,17 @@ void maxwell_compute_h_from_H(maxwell_data *d, evectmatrix Hin,
 
      /* first, compute fft_data = Hin, with the vector field converted 
 	from transverse to cartesian basis: */
+#pragma omp parallel for private(j)
      for (i = 0; i < d->other_dims; ++i)
 	  for (j = 0; j < d->last_dim; ++j) {
 	       int ij = i * d->last_dim + j;
 	       int ij2 = i * d->last_dim_size + j;
-               k_data cur_k = d->k_plus_G[ij];
-	       
-	       for (b = 0; b < cur_num_bands; ++b)
-		    assign_t2c(&fft_data_in[3 * (ij2*cur_num_bands 
-					      + b)], 
-			       cur_k,
-			       &Hin.data[ij * 2 * Hin.p + 
-					b + cur_band_start],
-			       Hin.p);
+	       k_data cur_k;
+
+	       cur_k = d->k_plus_G[ij];
+	       assign_t2c(&fft_data_in[3 * ij2 * cur_num_bands], cur_k,
+			  &Hin.data[ij * 2 * Hin.p + cur_band_start],
+			  Hin.p, cur_num_bands);
 	  }
 
      /* now, convert to position space via FFT: */
@@ -548,7 +626,7 @@ void maxwell_compute_H_from_B(maxwell_data *d, evectmatrix Bin,
 {
      scalar *fft_data = (scalar *) hfield;
      scalar *fft_data_out = d->fft_data2 == d->fft_data ? fft_data : (fft_data == d->fft_data ? d->fft_data2 : d->fft_data);
-     int i, j, b;
+     int i, j;
      real scale = 1.0 / Hout.N; /* scale factor to normalize FFTs */
      
      if (d->mu_inv == NULL) {
@@ -567,17 +645,18 @@ void maxwell_compute_H_from_B(maxwell_data *d, evectmatrix Bin,
                          cur_num_bands*3, cur_num_bands*3, 1);
      
      /* then, compute Hout = (transverse component)(fft_data) * scale factor */
+#pragma omp parallel for private(j)
      for (i = 0; i < d->other_dims; ++i)
          for (j = 0; j < d->last_dim; ++j) {
              int ij = i * d->last_dim + j;
              int ij2 = i * d->last_dim_size + j;
-             k_data cur_k = d->k_plus_G[ij];
-             for (b = 0; b < cur_num_bands; ++b)
-                 project_c2t(&Hout.data[ij * 2 * Hout.p + 
-                                        b + Hout_band_start],
-                             Hout.p, cur_k, 
-                               &fft_data_out[3 * (ij2*cur_num_bands+b)],
-                             scale);
+             k_data cur_k;
+
+             cur_k = d->k_plus_G[ij];
+             project_c2t(&Hout.data[ij * 2 * Hout.p + Hout_band_start],
+                         Hout.p, cur_k,
+                         &fft_data_out[3 * ij2 * cur_num_bands],
+                         scale, cur_num_bands);
          }
 }
 
@@ -708,11 +787,15 @@ void maxwell_vectorfield_otherhalf(maxwell_data *d, scalar_complex *field,
      /* First, swap the order of elements and multiply by exp(ikR)
         phase factors.  We have to be careful here not to double-swap
         any element pair; this is prevented by never swapping with a
-        "conjugated" point that is earlier in the array.  */
+        "conjugated" point that is earlier in the array.  (Since each
+        pair is thus swapped by only one iteration of the outer loop,
+        that loop can be run in parallel; the hole-removal loop that
+        follows cannot, because it moves data backwards in place.) */
 
      if (rank == 3) {
 	  int ix, iy;
-	  for (ix = 0; 2*ix <= nxmax; ++ix) {
+#pragma omp parallel for private(iy,j)
+	  for (ix = 0; ix <= nxmax/2; ++ix) {
 	       int xdiff, ixc;
 #  ifdef HAVE_MPI
 	       if (local_x_start == 0) {
@@ -777,10 +860,11 @@ void maxwell_vectorfield_otherhalf(maxwell_data *d, scalar_complex *field,
 	  if (rank == 1) /* (note that 1d MPI transforms are not allowed) */
 	       nx = 1; /* x dimension is handled by j (last dimension) loop */
 
+#pragma omp parallel for private(j)
 #  ifdef HAVE_MPI
 	  for (i = 0; i < nx; ++i)
 #  else
-	  for (i = 0; 2*i <= nx; ++i)
+	  for (i = 0; i <= nx/2; ++i)
 #  endif
 	  {
 	       int xdiff = i != 0, ic = (nx - i) % nx;
@@ -911,7 +995,8 @@ void maxwell_cscalarfield_otherhalf(maxwell_data *d, scalar_complex *field,
 
      if (rank == 3) {
 	  int ix, iy;
-	  for (ix = 0; 2*ix <= nxmax; ++ix) {
+#pragma omp parallel for private(iy,j)
+	  for (ix = 0; ix <= nxmax/2; ++ix) {
 	       int xdiff, ixc;
 #  ifdef HAVE_MPI
 	       if (local_x_start == 0) {
@@ -976,10 +1061,11 @@ void maxwell_cscalarfield_otherhalf(maxwell_data *d, scalar_complex *field,
 	  if (rank == 1) /* (note that 1d MPI transforms are not allowed) */
 	       nx = 1; /* x dimension is handled by j (last dimension) loop */
 
+#pragma omp parallel for private(j)
 #  ifdef HAVE_MPI
 	  for (i = 0; i < nx; ++i)
 #  else
-	  for (i = 0; 2*i <= nx; ++i)
+	  for (i = 0; i <= nx/2; ++i)
 #  endif
 	  {
 	       int xdiff = i != 0, ic = (nx - i) % nx;
@@ -1084,7 +1170,8 @@ void maxwell_scalarfield_otherhalf(maxwell_data *d, real *field)
 
      if (rank == 3) {
 	  int ix, iy;
-	  for (ix = 0; 2*ix <= nxmax; ++ix) {
+#pragma omp parallel for private(iy,j)
+	  for (ix = 0; ix <= nxmax/2; ++ix) {
 	       int ixc;
 #  ifdef HAVE_MPI
 	       if (local_x_start == 0)
@@ -1127,10 +1214,11 @@ void maxwell_scalarfield_otherhalf(maxwell_data *d, real *field)
 	  if (rank == 1) /* (note that 1d MPI transforms are not allowed) */
 	       nx = 1; /* x dimension is handled by j (last dimension) loop */
 
+#pragma omp parallel for private(j)
 #  ifdef HAVE_MPI
 	  for (i = 0; i < nx; ++i)
 #  else
-	  for (i = 0; 2*i <= nx; ++i)
+	  for (i = 0; i <= nx/2; ++i)
 #  endif
 	  {
 	       int ic = (nx - i) % nx;
@@ -1178,12 +1266,396 @@ void maxwell_scalarfield_otherhalf(maxwell_data *d, real *field)
 
 #define MIN2(a,b) ((a) < (b) ? (a) : (b))
 
+/* In 2d (nz == 1 and k_z == 0) with a definite z parity, the states
+   are purely TE (even: H = Hz m, so D and E lie in the xy plane) or
+   TM (odd: H = Hn n in the plane, so D and E point along z).  Since
+   the m transverse basis vector is along z in this case, we need only
+   Fourier transform the nonzero components of D/E.  Returns the number
+   of nonzero components (2 for TE, 1 for TM), or 0 if the ordinary
+   3-component operator must be used.  (Note that check_maxwell_dielectric
+   requires eps_inv not to couple z to x/y in this case.) */
+int maxwell_2d_parity_components(maxwell_data *d)
+{
+     if (d->nz > 1 || d->current_k[2] != 0.0 || d->mu_inv != NULL)
+	  return 0;
+     if (d->parity & EVEN_Z_PARITY)
+	  return 2;
+     if (d->parity & ODD_Z_PARITY)
+	  return 1;
+     return 0;
+}
+
+/* As maxwell_compute_d_from_H, but computing only the nc = 2 (TE) or
+   nc = 1 (TM) nonzero components of D (x,y or z, respectively).  The
+   output is fft_output_size x cur_num_bands x nc. */
+static void maxwell_compute_d_from_H_2d(maxwell_data *d, evectmatrix Hin,
+					scalar_complex *dfield,
+					int cur_band_start, int cur_num_bands,
+					int nc)
+{
+     scalar *fft_data = (scalar *) dfield;
+     scalar *fft_data_in = d->fft_data2 == d->fft_data ? fft_data : (fft_data == d->fft_data ? d->fft_data2 : d->fft_data);
+     int i, j, b;
+
+#pragma omp parallel for private(j,b)
+     for (i = 0; i < d->other_dims; ++i)
+	  for (j = 0; j < d->last_dim; ++j) {
+	       int ij = i * d->last_dim + j;
+	       int ij2 = i * d->last_dim_size + j;
+	       k_data cur_k;
+	       const scalar *H = &Hin.data[ij * 2 * Hin.p + cur_band_start];
+	       scalar *a = &fft_data_in[nc * ij2 * cur_num_bands];
+
+	       cur_k = d->k_plus_G[ij];
+
+	       if (nc == 2) { /* TE: k x (H0 m) = |k| H0 n */
+		    real nx = cur_k.nx * cur_k.kmag, ny = cur_k.ny * cur_k.kmag;
+		    for (b = 0; b < cur_num_bands; ++b) {
+			 scalar v0 = H[b];
+			 ASSIGN_SCALAR(a[2*b],
+				       SCALAR_RE(v0) * nx, SCALAR_IM(v0) * nx);
+			 ASSIGN_SCALAR(a[2*b+1],
+				       SCALAR_RE(v0) * ny, SCALAR_IM(v0) * ny);
+		    }
+	       }
+	       else { /* TM: k x (H1 n) = -|k| H1 m */
+		    real mz = -cur_k.mz * cur_k.kmag;
+		    for (b = 0; b < cur_num_bands; ++b) {
+			 scalar v1 = H[b + Hin.p];
+			 ASSIGN_SCALAR(a[b],
+				       SCALAR_RE(v1) * mz, SCALAR_IM(v1) * mz);
+		    }
+	       }
+	  }
+
+     maxwell_compute_fft(+1, d, fft_data_in, fft_data,
+			 cur_num_bands*nc, cur_num_bands*nc, 1);
+}
+
+/* As maxwell_compute_e_from_d, for the output of maxwell_compute_d_from_H_2d;
+   only the xy (TE) or zz (TM) block of eps_inv is used. */
+static void maxwell_compute_e_from_d_2d(maxwell_data *d,
+					scalar_complex *dfield,
+					int cur_num_bands, int nc)
+{
+     int i, b;
+
+     if (nc == 2)
+#pragma omp parallel for private(b)
+	  for (i = 0; i < d->fft_output_size; ++i) {
+	       symmetric_matrix eps_inv = d->eps_inv[i];
+	       scalar_complex *f = dfield + 2 * i * cur_num_bands;
+	       for (b = 0; b < cur_num_bands; ++b, f += 2) {
+		    scalar_complex v0 = f[0], v1 = f[1];
+#if defined(WITH_HERMITIAN_EPSILON)
+		    f[0].re = eps_inv.m00 * v0.re;
+		    f[0].im = eps_inv.m00 * v0.im;
+		    CACCUMULATE_SUM_MULT(f[0], eps_inv.m01, v1);
+		    f[1].re = eps_inv.m11 * v1.re;
+		    f[1].im = eps_inv.m11 * v1.im;
+		    CACCUMULATE_SUM_CONJ_MULT(f[1], eps_inv.m01, v0);
+#else
+		    f[0].re = eps_inv.m00 * v0.re + eps_inv.m01 * v1.re;
+		    f[0].im = eps_inv.m00 * v0.im + eps_inv.m01 * v1.im;
+		    f[1].re = eps_inv.m01 * v0.re + eps_inv.m11 * v1.re;
+		    f[1].im = eps_inv.m01 * v0.im + eps_inv.m11 * v1.im;
+#endif
+	       }
+	  }
+     else
+#pragma omp parallel for private(b)
+	  for (i = 0; i < d->fft_output_size; ++i) {
+	       real m22 = d->eps_inv[i].m22;
+	       scalar_complex *f = dfield + i * cur_num_bands;
+	       for (b = 0; b < cur_num_bands; ++b) {
+		    f[b].re *= m22;
+		    f[b].im *= m22;
+	       }
+	  }
+}
+
+/* As maxwell_compute_H_from_e, for the nc-component E field computed
+   by maxwell_compute_e_from_d_2d.  The zero transverse component of
+   Hout (by parity) is set to zero. */
+static void maxwell_compute_H_from_e_2d(maxwell_data *d, evectmatrix Hout,
+					scalar_complex *efield,
+					int cur_band_start, int cur_num_bands,
+					int nc, real scale)
+{
+     scalar *fft_data = (scalar *) efield;
+     scalar *fft_data_out = d->fft_data2 == d->fft_data ? fft_data : (fft_data == d->fft_data ? d->fft_data2 : d->fft_data);
+     int i, j, b;
+
+     maxwell_compute_fft(-1, d, fft_data, fft_data_out,
+			 cur_num_bands*nc, cur_num_bands*nc, 1);
+
+#pragma omp parallel for private(j,b)
+     for (i = 0; i < d->other_dims; ++i)
+	  for (j = 0; j < d->last_dim; ++j) {
+	       int ij = i * d->last_dim + j;
+	       int ij2 = i * d->last_dim_size + j;
+	       k_data cur_k;
+	       scalar *H = &Hout.data[ij * 2 * Hout.p + cur_band_start];
+	       const scalar *a = &fft_data_out[nc * ij2 * cur_num_bands];
+
+	       cur_k = d->k_plus_G[ij];
+
+	       if (nc == 2) { /* TE: H0 = -scale |k| (a . n) */
+		    real nx = -scale * cur_k.kmag * cur_k.nx;
+		    real ny = -scale * cur_k.kmag * cur_k.ny;
+		    for (b = 0; b < cur_num_bands; ++b) {
+			 scalar a0 = a[2*b], a1 = a[2*b+1];
+			 ASSIGN_SCALAR(H[b],
+				       SCALAR_RE(a0) * nx + SCALAR_RE(a1) * ny,
+				       SCALAR_IM(a0) * nx + SCALAR_IM(a1) * ny);
+			 ASSIGN_ZERO(H[b + Hout.p]);
+		    }
+	       }
+	       else { /* TM: H1 = scale |k| (a . m) */
+		    real mz = scale * cur_k.kmag * cur_k.mz;
+		    for (b = 0; b < cur_num_bands; ++b) {
+			 scalar a2 = a[b];
+			 ASSIGN_ZERO(H[b]);
+			 ASSIGN_SCALAR(H[b + Hout.p],
+				       SCALAR_RE(a2) * mz, SCALAR_IM(a2) * mz);
+		    }
+	       }
+	  }
+}
+
+#ifdef MAXWELL_MIXED_PRECISION
+
+/* Single-precision analogue of maxwell_compute_fft, in-place and for
+   stride == howmany and dist == 1 only.  The plans use the same
+   planner effort as the double-precision ones (planning on a scratch
+   array, as there), and the single-precision wisdom is imported and
+   exported along with the double-precision wisdom (see
+   maxwell_import_fft_wisdom). */
+static void maxwell_compute_fft_float(int dir, maxwell_data *d,
+				      float *data, int howmany)
+{
+     fftwf_plan plan, iplan;
+     int ip;
+
+     for (ip = 0; ip < d->nfplans && howmany != d->fplans_howmany[ip]; ++ip);
+     if (ip < d->nfplans) {
+	  plan = (fftwf_plan) d->fplans[ip];
+	  iplan = (fftwf_plan) d->fiplans[ip];
+     }
+     else {
+	  int n[3]; n[0] = d->nx; n[1] = d->ny; n[2] = d->nz;
+	  unsigned flags = FFTW_ESTIMATE;
+	  float *pdata = data;
+
+	  if (d->fft_planner_effort != MAXWELL_FFT_ESTIMATE) {
+	       flags = d->fft_planner_effort == MAXWELL_FFT_PATIENT
+		    ? FFTW_PATIENT : FFTW_MEASURE;
+	       pdata = (float *) fftwf_malloc(sizeof(float) * d->fft_data_size
+					      * SCALAR_NUMVALS);
+	       CHECK(pdata, "out of memory!");
+	  }
+#  ifdef SCALAR_COMPLEX
+	  plan = fftwf_plan_many_dft(3, n, howmany,
+				     (fftwf_complex *) pdata, 0, howmany, 1,
+				     (fftwf_complex *) pdata, 0, howmany, 1,
+				     FFTW_BACKWARD, flags);
+	  iplan = fftwf_plan_many_dft(3, n, howmany,
+				      (fftwf_complex *) pdata, 0, howmany, 1,
+				      (fftwf_complex *) pdata, 0, howmany, 1,
+				      FFTW_FORWARD, flags);
+#  else
+	  {
+	       int rnk = n[2] != 1 ? 3 : (n[1] != 1 ? 2 : 1);
+	       int nr[3]; nr[0] = n[0]; nr[1] = n[1]; nr[2] = n[2];
+	       nr[rnk-1] = 2*(nr[rnk-1]/2 + 1);
+	       plan = fftwf_plan_many_dft_c2r(rnk, n, howmany,
+					      (fftwf_complex *) pdata, 0,
+					      howmany, 1,
+					      pdata, nr, howmany, 1, flags);
+	       iplan = fftwf_plan_many_dft_r2c(rnk, n, howmany,
+					       pdata, nr, howmany, 1,
+					       (fftwf_complex *) pdata, 0,
+					       howmany, 1, flags);
+	  }
+#  endif
+	  CHECK(plan && iplan, "Failure creating single-precision FFTW plans");
+	  if (pdata != data) {
+	       fftwf_free(pdata);
+	       d->fft_wisdom_dirty |= FFT_WISDOM_DIRTY_FLOAT;
+	  }
+     }
+
+#  ifdef SCALAR_COMPLEX
+     fftwf_execute_dft(dir < 0 ? plan : iplan,
+		       (fftwf_complex *) data, (fftwf_complex *) data);
+#  else
+     if (dir > 0)
+	  fftwf_execute_dft_r2c(iplan, data, (fftwf_complex *) data);
+     else
+	  fftwf_execute_dft_c2r(plan, (fftwf_complex *) data, data);
+#  endif
+
+     if (ip == MAX_NPLANS) { /* don't store too many plans */
+	  fftwf_destroy_plan(plan);
+	  fftwf_destroy_plan(iplan);
+     }
+     else if (ip == d->nfplans) { /* save for later re-use */
+	  d->fplans[ip] = plan;
+	  d->fiplans[ip] = iplan;
+	  d->fplans_howmany[ip] = howmany;
+	  d->nfplans++;
+     }
+}
+
+/* As assign_cross_t2c and assign_cross_c2t, but with the cartesian
+   vectors a in single precision, stored with SCALAR_NUMVALS floats
+   per component in the same layout as the scalars of fft_data. */
+
+#ifdef SCALAR_COMPLEX
+#  define ASSIGN_FSCALAR(f, re, im) ((f)[0] = (re), (f)[1] = (im))
+#  define FSCALAR_IM(f) ((f)[1])
+#else
+#  define ASSIGN_FSCALAR(f, re, im) ((f)[0] = (re))
+#  define FSCALAR_IM(f) 0
+#endif
+#define FSCALAR_RE(f) ((f)[0])
+
+static void assign_cross_t2c_float(float *a, const k_data k,
+				   const scalar *v, int vstride, int nb)
+{
+     real mx = k.mx * k.kmag, my = k.my * k.kmag, mz = k.mz * k.kmag;
+     real nx = k.nx * k.kmag, ny = k.ny * k.kmag, nz = k.nz * k.kmag;
+     int b;
+
+     for (b = 0; b < nb; ++b, a += 3 * SCALAR_NUMVALS) {
+	  scalar v0 = v[b], v1 = v[vstride + b];
+
+	  ASSIGN_FSCALAR(a,
+			 SCALAR_RE(v0)*nx - SCALAR_RE(v1)*mx,
+			 SCALAR_IM(v0)*nx - SCALAR_IM(v1)*mx);
+	  ASSIGN_FSCALAR(a + SCALAR_NUMVALS,
+			 SCALAR_RE(v0)*ny - SCALAR_RE(v1)*my,
+			 SCALAR_IM(v0)*ny - SCALAR_IM(v1)*my);
+	  ASSIGN_FSCALAR(a + 2 * SCALAR_NUMVALS,
+			 SCALAR_RE(v0)*nz - SCALAR_RE(v1)*mz,
+			 SCALAR_IM(v0)*nz - SCALAR_IM(v1)*mz);
+     }
+}
+
+static void assign_cross_c2t_float(scalar *v, int vstride,
+				   const k_data k, const float *a,
+				   real scale, int nb)
+{
+     real mx, my, mz, nx, ny, nz;
+     int b;
+
+     scale *= k.kmag;
+     mx = k.mx * scale; my = k.my * scale; mz = k.mz * scale;
+     nx = k.nx * scale; ny = k.ny * scale; nz = k.nz * scale;
+
+     for (b = 0; b < nb; ++b, a += 3 * SCALAR_NUMVALS) {
+	  const float *a0 = a, *a1 = a + SCALAR_NUMVALS;
+	  const float *a2 = a + 2 * SCALAR_NUMVALS;
+
+	  ASSIGN_SCALAR(v[b],
+			- (FSCALAR_RE(a0)*nx + FSCALAR_RE(a1)*ny
+			   + FSCALAR_RE(a2)*nz),
+			- (FSCALAR_IM(a0)*nx + FSCALAR_IM(a1)*ny
+			   + FSCALAR_IM(a2)*nz));
+	  ASSIGN_SCALAR(v[vstride + b],
+			FSCALAR_RE(a0)*mx + FSCALAR_RE(a1)*my
+			+ FSCALAR_RE(a2)*mz,
+			FSCALAR_IM(a0)*mx + FSCALAR_IM(a1)*my
+			+ FSCALAR_IM(a2)*mz);
+     }
+}
+
+/* Compute cur_num_bands columns of Xout = curl(1/epsilon * curl(Xin))
+   as in maxwell_operator, but with the FFTs and the multiplication by
+   eps_inv done in single precision (see maxwell_set_mixed_precision).
+   The curls are computed in full precision, but read from and written
+   to d->fft_data_float directly; d->fft_data is not used. */
+static void maxwell_operator_float(maxwell_data *d,
+				   evectmatrix Xin, evectmatrix Xout,
+				   int cur_band_start, int cur_num_bands,
+				   real scale)
+{
+     float *fdata;
+     int i, j, b;
+
+     if (!d->fft_data_float) {
+	  d->fft_data_float = (float *) fftwf_malloc(sizeof(float)
+						     * d->fft_data_size
+						     * SCALAR_NUMVALS);
+	  CHECK(d->fft_data_float, "out of memory!");
+     }
+     fdata = d->fft_data_float;
+
+     /* fdata = curl(Xin) (really (k+G) x H), as in
+	maxwell_compute_d_from_H: */
+#pragma omp parallel for private(j)
+     for (i = 0; i < d->other_dims; ++i)
+	  for (j = 0; j < d->last_dim; ++j) {
+	       int ij = i * d->last_dim + j;
+	       int ij2 = i * d->last_dim_size + j;
+	       k_data cur_k;
+
+	       cur_k = d->k_plus_G[ij];
+	       assign_cross_t2c_float(fdata + 3 * SCALAR_NUMVALS
+				      * ij2 * cur_num_bands, cur_k,
+				      &Xin.data[ij * 2 * Xin.p
+						+ cur_band_start],
+				      Xin.p, cur_num_bands);
+	  }
+
+     maxwell_compute_fft_float(+1, d, fdata, cur_num_bands * 3);
+
+     /* multiply by eps_inv, as in maxwell_compute_e_from_d_ (with the
+	same complex layout of the data): */
+#pragma omp parallel for private(b)
+     for (i = 0; i < d->fft_output_size; ++i) {
+	  const float *e = d->eps_inv_float + 6 * i;
+	  float *f = fdata + 6 * i * cur_num_bands;
+	  for (b = 0; b < cur_num_bands; ++b, f += 6) {
+	       float v0r = f[0], v0i = f[1], v1r = f[2], v1i = f[3];
+	       float v2r = f[4], v2i = f[5];
+	       f[0] = e[0] * v0r + e[3] * v1r + e[4] * v2r;
+	       f[1] = e[0] * v0i + e[3] * v1i + e[4] * v2i;
+	       f[2] = e[3] * v0r + e[1] * v1r + e[5] * v2r;
+	       f[3] = e[3] * v0i + e[1] * v1i + e[5] * v2i;
+	       f[4] = e[4] * v0r + e[5] * v1r + e[2] * v2r;
+	       f[5] = e[4] * v0i + e[5] * v1i + e[2] * v2i;
+	  }
+     }
+
+     maxwell_compute_fft_float(-1, d, fdata, cur_num_bands * 3);
+
+     /* Xout = curl(fdata) * scale, as in maxwell_compute_H_from_e: */
+#pragma omp parallel for private(j)
+     for (i = 0; i < d->other_dims; ++i)
+	  for (j = 0; j < d->last_dim; ++j) {
+	       int ij = i * d->last_dim + j;
+	       int ij2 = i * d->last_dim_size + j;
+	       k_data cur_k;
+
+	       cur_k = d->k_plus_G[ij];
+	       assign_cross_c2t_float(&Xout.data[ij * 2 * Xout.p
+						 + cur_band_start],
+				      Xout.p, cur_k,
+				      fdata + 3 * SCALAR_NUMVALS
+				      * ij2 * cur_num_bands,
+				      scale, cur_num_bands);
+	  }
+}
+
+#endif /* MAXWELL_MIXED_PRECISION */
+
 /* Compute Xout = 1/mu curl(1/epsilon * curl(Xin)) 1/mu */
 void maxwell_operator(evectmatrix Xin, evectmatrix Xout, void *data,
 		      int is_current_eigenvector, evectmatrix Work)
 {
      maxwell_data *d = (maxwell_data *) data;
-     int cur_band_start;
+     int cur_band_start, nc;
      scalar_complex *cdata;
      real scale;
      
@@ -1197,11 +1669,30 @@ void maxwell_operator(evectmatrix Xin, evectmatrix Xout, void *data,
      scale = -1.0 / Xout.N;  /* scale factor to normalize FFT; 
 				negative sign comes from 2 i's from curls */
 
+     nc = maxwell_2d_parity_components(d);
+
      /* compute the operator, num_fft_bands at a time: */
      for (cur_band_start = 0; cur_band_start < Xin.p; 
 	  cur_band_start += d->num_fft_bands) {
 	  int cur_num_bands = MIN2(d->num_fft_bands, Xin.p - cur_band_start);
 
+	  if (nc) { /* 2d TE/TM: only transform nonzero components */
+	       maxwell_compute_d_from_H_2d(d, Xin, cdata,
+					   cur_band_start, cur_num_bands, nc);
+	       maxwell_compute_e_from_d_2d(d, cdata, cur_num_bands, nc);
+	       maxwell_compute_H_from_e_2d(d, Xout, cdata, cur_band_start,
+					   cur_num_bands, nc, scale);
+	       continue;
+	  }
+
+#ifdef MAXWELL_MIXED_PRECISION
+	  if (d->mixed_precision && d->mu_inv == NULL) {
+	       maxwell_operator_float(d, Xin, Xout,
+				      cur_band_start, cur_num_bands, scale);
+	       continue;
+	  }
+#endif
+
           if (d->mu_inv == NULL)
               maxwell_compute_d_from_H(d, Xin, cdata,
                                        cur_band_start, cur_num_bands);
@@ -1221,6 +1712,119 @@ void maxwell_operator(evectmatrix Xin, evectmatrix Xout, void *data,
      }
 }
 
+/* The following functions are the analogues of the k-space halves of
+   maxwell_compute_d_from_H and maxwell_compute_H_from_e for a batch
+   of k points (see maxwell_set_k_batch): the columns of H consist of
+   d->num_k_batch blocks of H.p / d->num_k_batch columns, where the
+   ik-th block is at the ik-th k point of the batch.  The bands
+   [cur_band_start, cur_band_start + cur_num_bands) may span several
+   k points. */
+
+/* fft_data_in = (k+G) x Hin, as in maxwell_compute_d_from_H. */
+static void maxwell_batch_cross_t2c(maxwell_data *d, evectmatrix Hin,
+				    scalar *fft_data_in,
+				    int cur_band_start, int cur_num_bands)
+{
+     int pk = Hin.p / d->num_k_batch;
+     int cur_band_end = cur_band_start + cur_num_bands;
+     int i, j, b, b2;
+
+#pragma omp parallel for private(j,b,b2)
+     for (i = 0; i < d->other_dims; ++i)
+	  for (j = 0; j < d->last_dim; ++j) {
+	       int ij = i * d->last_dim + j;
+	       int ij2 = i * d->last_dim_size + j;
+	       k_data cur_k;
+
+	       for (b = cur_band_start; b < cur_band_end; b = b2) {
+		    int ik = b / pk;
+		    b2 = MIN2((ik + 1) * pk, cur_band_end);
+		    cur_k = d->k_plus_G_batch[ik * d->local_N + ij];
+		    assign_cross_t2c(&fft_data_in[3 * (ij2 * cur_num_bands
+						       + b - cur_band_start)],
+				     cur_k, &Hin.data[ij * 2 * Hin.p + b],
+				     Hin.p, b2 - b);
+	       }
+	  }
+}
+
+/* Hout = scale * (k+G) x fft_data_out, as in maxwell_compute_H_from_e. */
+static void maxwell_batch_cross_c2t(maxwell_data *d, evectmatrix Hout,
+				    const scalar *fft_data_out,
+				    int cur_band_start, int cur_num_bands,
+				    real scale)
+{
+     int pk = Hout.p / d->num_k_batch;
+     int cur_band_end = cur_band_start + cur_num_bands;
+     int i, j, b, b2;
+
+#pragma omp parallel for private(j,b,b2)
+     for (i = 0; i < d->other_dims; ++i)
+	  for (j = 0; j < d->last_dim; ++j) {
+	       int ij = i * d->last_dim + j;
+	       int ij2 = i * d->last_dim_size + j;
+	       k_data cur_k;
+
+	       for (b = cur_band_start; b < cur_band_end; b = b2) {
+		    int ik = b / pk;
+		    b2 = MIN2((ik + 1) * pk, cur_band_end);
+		    cur_k = d->k_plus_G_batch[ik * d->local_N + ij];
+		    assign_cross_c2t(&Hout.data[ij * 2 * Hout.p + b],
+				     Hout.p, cur_k,
+				     &fft_data_out[3 * (ij2 * cur_num_bands
+							+ b - cur_band_start)],
+				     scale, b2 - b);
+	       }
+	  }
+}
+
+/* Compute Xout = curl(1/epsilon * curl(Xin)) for a batch of k points
+   (see maxwell_set_k_batch), whose columns are the num_k_batch blocks
+   of the fields at each k point.  All of the k points share eps_inv,
+   and their bands are Fourier-transformed together, max_fft_bands
+   at a time, which is more efficient than transforming the few bands
+   of each k point separately when the grid is small.  (The 2d TE/TM
+   special case of maxwell_operator is not used, and mu is not
+   supported.) */
+void maxwell_batch_operator(evectmatrix Xin, evectmatrix Xout, void *data,
+			    int is_current_eigenvector, evectmatrix Work)
+{
+     maxwell_data *d = (maxwell_data *) data;
+     int cur_band_start;
+     scalar *fft_data, *fft_data2;
+     real scale;
+
+     CHECK(d, "null maxwell data pointer!");
+     CHECK(Xin.c == 2, "fields don't have 2 components!");
+     CHECK(d->num_k_batch > 0 && Xin.p % d->num_k_batch == 0,
+	   "fields don't match the k batch");
+     CHECK(d->mu_inv == NULL, "batched operator doesn't handle mu");
+
+     (void) is_current_eigenvector;  /* unused */
+     (void) Work;
+
+     fft_data = d->fft_data;
+     fft_data2 = d->fft_data2;
+     scale = -1.0 / Xout.N;  /* scale factor to normalize FFT; 
+				negative sign comes from 2 i's from curls */
+
+     for (cur_band_start = 0; cur_band_start < Xin.p; 
+	  cur_band_start += d->max_fft_bands) {
+	  int cur_num_bands = MIN2(d->max_fft_bands, Xin.p - cur_band_start);
+
+	  maxwell_batch_cross_t2c(d, Xin, fft_data2,
+				  cur_band_start, cur_num_bands);
+	  maxwell_compute_fft(+1, d, fft_data2, fft_data,
+			      cur_num_bands*3, cur_num_bands*3, 1);
+	  maxwell_compute_e_from_d(d, (scalar_complex *) fft_data,
+				   cur_num_bands);
+	  maxwell_compute_fft(-1, d, fft_data, fft_data2,
+			      cur_num_bands*3, cur_num_bands*3, 1);
+	  maxwell_batch_cross_c2t(d, Xout, fft_data2,
+				  cur_band_start, cur_num_bands, scale);
+     }
+}
+
 void maxwell_muinv_operator(evectmatrix Xin, evectmatrix Xout, void *data,
                             int is_current_eigenvector, evectmatrix Work)
 {
@@ -1291,7 +1895,7 @@ void maxwell_ucross_op(evectmatrix Xin, evectmatrix Xout,
      scalar_complex *cdata;
      real scale;
      int cur_band_start;
-     int i, j, b;
+     int i, j;
 
      CHECK(d, "null maxwell data pointer!");
      CHECK(Xin.c == 2, "fields don't have 2 components!");
@@ -1308,19 +1912,18 @@ void maxwell_ucross_op(evectmatrix Xin, evectmatrix Xout,
           int cur_num_bands = MIN2(d->num_fft_bands, Xin.p - cur_band_start);
 	  
 	  /* first, compute fft_data = u x Xin: */
+#pragma omp parallel for private(j)
 	  for (i = 0; i < d->other_dims; ++i)
 	       for (j = 0; j < d->last_dim; ++j) {
 		    int ij = i * d->last_dim + j;
 		    int ij2 = i * d->last_dim_size + j;
-		    k_data cur_k = d->k_plus_G[ij];
-		    
-		    for (b = 0; b < cur_num_bands; ++b)
-			 assign_ucross_t2c(&fft_data_in[3 * (ij2*cur_num_bands
-							  + b)], 
-					   u, cur_k, 
-					   &Xin.data[ij * 2 * Xin.p + 
-						    b + cur_band_start],
-					   Xin.p);
+		    k_data cur_k;
+
+		    cur_k = d->k_plus_G[ij];
+		    assign_ucross_t2c(&fft_data_in[3 * ij2 * cur_num_bands],
+				      u, cur_k,
+				      &Xin.data[ij * 2 * Xin.p + cur_band_start],
+				      Xin.p, cur_num_bands);
 	       }
 	  
 	  /* now, convert to position space via FFT: */
@@ -1332,3 +1935,75 @@ void maxwell_ucross_op(evectmatrix Xin, evectmatrix Xout,
                                    cur_band_start, cur_num_bands, scale);
      }
 }
+
+/* Compute the operation Xout = - u x 1/epsilon v x Xin (projected onto
+   the transverse basis), which is the second derivative of the
+   maxwell operator with respect to k in the directions u and v (see
+   maxwell_kp.c).  u and v are vectors in cartesian coordinates. */
+void maxwell_ucross_vcross_op(evectmatrix Xin, evectmatrix Xout,
+			      maxwell_data *d, const real u[3],
+			      const real v[3])
+{
+     scalar *fft_data, *fft_data_in;
+     scalar_complex *cdata;
+     real scale;
+     int cur_band_start;
+     int i, j;
+
+     CHECK(d, "null maxwell data pointer!");
+     CHECK(Xin.c == 2, "fields don't have 2 components!");
+
+     cdata = (scalar_complex *) (fft_data = d->fft_data);
+     fft_data_in = d->fft_data2;
+
+     scale = -1.0 / Xout.N;  /* scale factor to normalize FFT */
+
+     /* compute the operator, num_fft_bands at a time: */
+     for (cur_band_start = 0; cur_band_start < Xin.p;
+          cur_band_start += d->num_fft_bands) {
+          int cur_num_bands = MIN2(d->num_fft_bands, Xin.p - cur_band_start);
+	  scalar *fft_data_out;
+
+	  /* first, compute fft_data = v x Xin: */
+#pragma omp parallel for private(j)
+	  for (i = 0; i < d->other_dims; ++i)
+	       for (j = 0; j < d->last_dim; ++j) {
+		    int ij = i * d->last_dim + j;
+		    int ij2 = i * d->last_dim_size + j;
+		    k_data cur_k;
+
+		    cur_k = d->k_plus_G[ij];
+		    assign_ucross_t2c(&fft_data_in[3 * ij2 * cur_num_bands],
+				      v, cur_k,
+				      &Xin.data[ij * 2 * Xin.p + cur_band_start],
+				      Xin.p, cur_num_bands);
+	       }
+
+	  /* now, convert to position space via FFT and multiply
+	     by 1/epsilon: */
+	  maxwell_compute_fft(+1, d, fft_data_in, fft_data,
+			      cur_num_bands*3, cur_num_bands*3, 1);
+          maxwell_compute_e_from_d(d, cdata, cur_num_bands);
+
+	  /* convert back to Fourier space, and compute Xout = u x fft_data
+	     (* scale factor), as in maxwell_compute_H_from_e: */
+	  fft_data_out = d->fft_data2 == d->fft_data ? fft_data
+	       : d->fft_data2;
+	  maxwell_compute_fft(-1, d, fft_data, fft_data_out,
+			      cur_num_bands*3, cur_num_bands*3, 1);
+#pragma omp parallel for private(j)
+	  for (i = 0; i < d->other_dims; ++i)
+	       for (j = 0; j < d->last_dim; ++j) {
+		    int ij = i * d->last_dim + j;
+		    int ij2 = i * d->last_dim_size + j;
+		    k_data cur_k;
+
+		    cur_k = d->k_plus_G[ij];
+		    assign_ucross_c2t(&Xout.data[ij * 2 * Xout.p
+						 + cur_band_start],
+				      Xout.p, u, cur_k,
+				      &fft_data_out[3 * ij2 * cur_num_bands],
+				      scale, cur_num_bands);
+	       }
+     }
+}
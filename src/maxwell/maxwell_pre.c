@@ -45,6 +45,7 @@ void maxwell_simple_precondition(evectmatrix X, void *data, real *eigenvals)
      (void) eigenvals; /* unused */
 #endif
 
+#pragma omp parallel for private(c,b)
      for (i = 0; i < X.localN; ++i) {
 	  for (c = 0; c < X.c; ++c) {
 	       for (b = 0; b < X.p; ++b) {
@@ -80,6 +81,43 @@ void maxwell_preconditioner(evectmatrix Xin, evectmatrix Xout, void *data,
      maxwell_simple_precondition(Xout, data, eigenvals);
 }
 
+/* The analogue of maxwell_preconditioner for maxwell_batch_operator,
+   using the k+G of the k point of each block of columns. */
+void maxwell_batch_preconditioner(evectmatrix Xin, evectmatrix Xout,
+				  void *data,
+				  evectmatrix Y, real *eigenvals,
+				  sqmatrix YtY)
+{
+     maxwell_data *d = (maxwell_data *) data;
+     int i, c, b, pk;
+
+     (void) Y; /* unused */
+     (void) eigenvals; /* unused */
+
+     CHECK(d->num_k_batch > 0 && Xout.p % d->num_k_batch == 0,
+	   "fields don't match the k batch");
+     pk = Xout.p / d->num_k_batch;
+
+     evectmatrix_XeYS(Xout, Xin, YtY, 1);
+
+#pragma omp parallel for private(c,b)
+     for (i = 0; i < Xout.localN; ++i) {
+	  for (c = 0; c < Xout.c; ++c) {
+	       for (b = 0; b < Xout.p; ++b) {
+		    int index = (i * Xout.c + c) * Xout.p + b;
+		    real *kpGn2 = d->k_plus_G_normsqr_batch
+			 + (b / pk) * d->local_N;
+		    real scale = kpGn2[i] * d->eps_inv_mean;
+
+		    scale = 1.0 / FIX_DENOM(scale);
+		    ASSIGN_SCALAR(Xout.data[index],
+				  scale * SCALAR_RE(Xout.data[index]),
+				  scale * SCALAR_IM(Xout.data[index]));
+	       }
+	  }
+     }
+}
+
 void maxwell_target_preconditioner(evectmatrix Xin, evectmatrix Xout, 
 				   void *data,
 				   evectmatrix Y, real *eigenvals,
@@ -100,6 +138,7 @@ void maxwell_target_preconditioner(evectmatrix Xin, evectmatrix Xout,
 
      evectmatrix_XeYS(Xout, Xin, YtY, 1);
 
+#pragma omp parallel for private(c,b)
      for (i = 0; i < Xout.localN; ++i) {
 	  for (c = 0; c < Xout.c; ++c) {
 	       for (b = 0; b < Xout.p; ++b) {
@@ -133,22 +172,60 @@ void maxwell_target_preconditioner(evectmatrix Xin, evectmatrix Xout,
      }
 }
 
+/* Like maxwell_target_preconditioner, but approximates the inverse of
+   |A - target_frequency^2| rather than of (A - target_frequency^2)^2,
+   for eigensolvers that work with the Maxwell operator A itself (e.g.
+   for the correction equation of Jacobi-Davidson).  The denominator
+   is kept away from zero near the target, where the diagonal
+   approximation is meaningless anyway. */
+void maxwell_shifted_preconditioner(evectmatrix Xin, evectmatrix Xout,
+				    void *data,
+				    evectmatrix Y, real *eigenvals,
+				    sqmatrix YtY)
+{
+     maxwell_target_data *td = (maxwell_target_data *) data;
+     maxwell_data *d = td->d;
+     real omega_sqr = td->target_frequency * td->target_frequency;
+     real min_denom = PRECOND_MIN_DENOM * MAX2(omega_sqr, 1.0);
+     int i, c, b;
+     real *kpGn2 = d->k_plus_G_normsqr;
+
+     (void) Y; /* unused */
+     (void) eigenvals; /* unused */
+
+     evectmatrix_XeYS(Xout, Xin, YtY, 1);
+
+#pragma omp parallel for private(c,b)
+     for (i = 0; i < Xout.localN; ++i) {
+	  real scale = fabs(kpGn2[i] * d->eps_inv_mean - omega_sqr);
+	  scale = 1.0 / MAX2(scale, min_denom);
+	  for (c = 0; c < Xout.c; ++c) {
+	       for (b = 0; b < Xout.p; ++b) {
+		    int index = (i * Xout.c + c) * Xout.p + b;
+		    ASSIGN_SCALAR(Xout.data[index],
+				  scale * SCALAR_RE(Xout.data[index]),
+				  scale * SCALAR_IM(Xout.data[index]));
+	       }
+	  }
+     }
+}
+
 /**************************************************************************/
 
 /* Fancy preconditioners */
 
-/* Compute 'a' where v = k x a (cross product).
+/* Compute 'a' where v = k x a (cross product), for nb bands.
 
-   Here, a = (a[0],a[1],a[2]) and k = (k.kx,k.ky,k.kz) are in
-   cartesian coordinates.  (v[0],v[vstride]) is in the transverse basis of
-   k.m and k.n. 
+   Here, a = (a[3*b],a[3*b+1],a[3*b+2]) and k = (k.kx,k.ky,k.kz) are in
+   cartesian coordinates.  (v[b],v[vstride+b]) is in the transverse basis
+   of k.m and k.n. 
 
    We can't compute 'a' exactly, since there is no way to find the
    component of a parallel to k.  So, we only compute the transverse
    component of 'a'--this is the main approximation in our preconditioner.
 */
 static void assign_crossinv_t2c(scalar *a, const k_data k,
-				const scalar *v, int vstride)
+				const scalar *v, int vstride, int nb)
 {
      /* k x v = k x (k x a) = (k*a)k - k^2 a
 	      = -(a_transverse) * k^2
@@ -157,26 +234,32 @@ static void assign_crossinv_t2c(scalar *a, const k_data k,
      /* Thus, we just do the same thing as assign_cross_t2c
 	in maxwell_op.c, except that we divide by -k^2: */
 
-     scalar v0 = v[0], v1 = v[vstride];
      real kmag_inv = -1.0 / FIX_DENOM(k.kmag);
-
-     ASSIGN_SCALAR(a[0],
-                   (SCALAR_RE(v0)*k.nx - SCALAR_RE(v1)*k.mx) * kmag_inv,
-                   (SCALAR_IM(v0)*k.nx - SCALAR_IM(v1)*k.mx) * kmag_inv);
-     ASSIGN_SCALAR(a[1],
-                   (SCALAR_RE(v0)*k.ny - SCALAR_RE(v1)*k.my) * kmag_inv,
-                   (SCALAR_IM(v0)*k.ny - SCALAR_IM(v1)*k.my) * kmag_inv);
-     ASSIGN_SCALAR(a[2],
-                   (SCALAR_RE(v0)*k.nz - SCALAR_RE(v1)*k.mz) * kmag_inv,
-                   (SCALAR_IM(v0)*k.nz - SCALAR_IM(v1)*k.mz) * kmag_inv);
+     real mx = k.mx * kmag_inv, my = k.my * kmag_inv, mz = k.mz * kmag_inv;
+     real nx = k.nx * kmag_inv, ny = k.ny * kmag_inv, nz = k.nz * kmag_inv;
+     int b;
+
+     for (b = 0; b < nb; ++b) {
+	  scalar v0 = v[b], v1 = v[vstride + b];
+
+	  ASSIGN_SCALAR(a[3*b+0],
+			SCALAR_RE(v0)*nx - SCALAR_RE(v1)*mx,
+			SCALAR_IM(v0)*nx - SCALAR_IM(v1)*mx);
+	  ASSIGN_SCALAR(a[3*b+1],
+			SCALAR_RE(v0)*ny - SCALAR_RE(v1)*my,
+			SCALAR_IM(v0)*ny - SCALAR_IM(v1)*my);
+	  ASSIGN_SCALAR(a[3*b+2],
+			SCALAR_RE(v0)*nz - SCALAR_RE(v1)*mz,
+			SCALAR_IM(v0)*nz - SCALAR_IM(v1)*mz);
+     }
 }
 
 /* Compute 'v' * scale, where a = k x v, going from cartesian to transverse
-   coordinates.  Since v is tranvserse to k, we can compute this inverse
-   exactly. */
+   coordinates, for nb bands.  Since v is tranvserse to k, we can compute
+   this inverse exactly. */
 static void assign_crossinv_c2t(scalar *v, int vstride,
 				const k_data k, const scalar *a,
-				real scale)
+				real scale, int nb)
 {
      /* As in assign_crossinv_t2c above, we find:
 
@@ -185,44 +268,42 @@ static void assign_crossinv_c2t(scalar *v, int vstride,
 	So, we do the same thing as in assign_cross_c2t of maxwell_op.c,
 	with the additional -1/k^2 factor. */
 
-     scalar a0 = a[0], a1 = a[1], a2 = a[2];
-     scalar at0, at1;
-
-     ASSIGN_SCALAR(at0,
-          SCALAR_RE(a0)*k.mx + SCALAR_RE(a1)*k.my + SCALAR_RE(a2)*k.mz,
-          SCALAR_IM(a0)*k.mx + SCALAR_IM(a1)*k.my + SCALAR_IM(a2)*k.mz);
-     ASSIGN_SCALAR(at1,
-          SCALAR_RE(a0)*k.nx + SCALAR_RE(a1)*k.ny + SCALAR_RE(a2)*k.nz,
-          SCALAR_IM(a0)*k.nx + SCALAR_IM(a1)*k.ny + SCALAR_IM(a2)*k.nz);
+     real mx, my, mz, nx, ny, nz;
+     int b;
 
      /* combine scale factor and k * (-1/k^2) */
      scale = -scale / FIX_DENOM(k.kmag);
+     mx = k.mx * scale; my = k.my * scale; mz = k.mz * scale;
+     nx = k.nx * scale; ny = k.ny * scale; nz = k.nz * scale;
      
-     ASSIGN_SCALAR(v[0],
-                   - scale * SCALAR_RE(at1),
-                   - scale * SCALAR_IM(at1));
-     ASSIGN_SCALAR(v[vstride],
-                   scale * SCALAR_RE(at0),
-                   scale * SCALAR_IM(at0));
+     for (b = 0; b < nb; ++b) {
+	  scalar a0 = a[3*b], a1 = a[3*b+1], a2 = a[3*b+2];
+
+	  ASSIGN_SCALAR(v[b],
+			- (SCALAR_RE(a0)*nx + SCALAR_RE(a1)*ny
+			   + SCALAR_RE(a2)*nz),
+			- (SCALAR_IM(a0)*nx + SCALAR_IM(a1)*ny
+			   + SCALAR_IM(a2)*nz));
+	  ASSIGN_SCALAR(v[vstride + b],
+			SCALAR_RE(a0)*mx + SCALAR_RE(a1)*my + SCALAR_RE(a2)*mz,
+			SCALAR_IM(a0)*mx + SCALAR_IM(a1)*my + SCALAR_IM(a2)*mz);
+     }
 }
 
 /* Fancy preconditioner.  This is very similar to maxwell_op, except that
-   the steps are (approximately) inverted: */
+   the steps are (approximately) inverted.  If local_tensor is true,
+   we multiply by the full local epsilon tensor (the inverse of eps_inv
+   at each point) rather than by the inverse of its trace: */
 
-void maxwell_preconditioner2(evectmatrix Xin, evectmatrix Xout, void *data,
-			     evectmatrix Y, real *eigenvals,
-			     sqmatrix YtY)
+static void preconditioner2(evectmatrix Xin, evectmatrix Xout,
+			    maxwell_data *d, sqmatrix YtY, int local_tensor)
 {
-     maxwell_data *d = (maxwell_data *) data;
      int cur_band_start;
      scalar *fft_data, *fft_data2;
      scalar_complex *cdata;
      real scale;
      int i, j, b;
 
-     (void) Y; /* unused */
-     (void) eigenvals; /* unused */
-
      CHECK(d, "null maxwell data pointer!");
      CHECK(Xin.c == 2, "fields don't have 2 components!");
 
@@ -243,19 +324,19 @@ void maxwell_preconditioner2(evectmatrix Xin, evectmatrix Xout, void *data,
           /********************************************/
 	  /* Compute approx. inverse of curl (inverse cross product with k): */
 
+#pragma omp parallel for private(j)
 	  for (i = 0; i < d->other_dims; ++i)
 	       for (j = 0; j < d->last_dim; ++j) {
 		    int ij = i * d->last_dim + j;
 		    int ij2 = i * d->last_dim_size + j;
-		    k_data cur_k = d->k_plus_G[ij];
-		    
-		    for (b = 0; b < cur_num_bands; ++b)
-			 assign_crossinv_t2c(&fft_data2[3 * (ij2*cur_num_bands
-							    + b)],
-					     cur_k,
-					     &Xout.data[ij * 2 * Xout.p +
-						      b + cur_band_start],
-					     Xout.p);
+		    k_data cur_k;
+
+		    cur_k = d->k_plus_G[ij];
+		    assign_crossinv_t2c(&fft_data2[3 * ij2 * cur_num_bands],
+					cur_k,
+					&Xout.data[ij * 2 * Xout.p +
+						   cur_band_start],
+					Xout.p, cur_num_bands);
 	       }
 
 	  /********************************************/
@@ -265,22 +346,34 @@ void maxwell_preconditioner2(evectmatrix Xin, evectmatrix Xout, void *data,
 	  maxwell_compute_fft(+1, d, fft_data2, fft_data,
 			      cur_num_bands*3, cur_num_bands*3, 1);
 
-	  /* multiply by epsilon in position space.  Don't bother to
-	     invert the whole epsilon-inverse tensor; just take the
-	     inverse of the average epsilon-inverse (= trace / 3). */
-	  for (i = 0; i < d->fft_output_size; ++i) {
-	       symmetric_matrix eps_inv = d->eps_inv[i];
-	       real eps = 3.0 / (eps_inv.m00 + eps_inv.m11 + eps_inv.m22);
-	       for (b = 0; b < cur_num_bands; ++b) {
-		    int ib = 3 * (i * cur_num_bands + b);
-		    cdata[ib].re *= eps;
-		    cdata[ib].im *= eps;
-		    cdata[ib+1].re *= eps;
-		    cdata[ib+1].im *= eps;
-		    cdata[ib+2].re *= eps;
-		    cdata[ib+2].im *= eps;
+	  /* multiply by epsilon in position space.  Normally, don't
+	     bother to invert the whole epsilon-inverse tensor; just take
+	     the inverse of the average epsilon-inverse (= trace / 3). */
+	  if (local_tensor)
+#pragma omp parallel for private(b)
+	       for (i = 0; i < d->fft_output_size; ++i) {
+		    symmetric_matrix eps;
+		    maxwell_sym_matrix_invert(&eps, d->eps_inv + i);
+		    for (b = 0; b < cur_num_bands; ++b) {
+			 int ib = 3 * (i * cur_num_bands + b);
+			 assign_symmatrix_vector(&cdata[ib], eps, &cdata[ib]);
+		    }
+	       }
+	  else
+#pragma omp parallel for private(b)
+	       for (i = 0; i < d->fft_output_size; ++i) {
+		    symmetric_matrix eps_inv = d->eps_inv[i];
+		    real eps = 3.0 / (eps_inv.m00 + eps_inv.m11 + eps_inv.m22);
+		    for (b = 0; b < cur_num_bands; ++b) {
+			 int ib = 3 * (i * cur_num_bands + b);
+			 cdata[ib].re *= eps;
+			 cdata[ib].im *= eps;
+			 cdata[ib+1].re *= eps;
+			 cdata[ib+1].im *= eps;
+			 cdata[ib+2].re *= eps;
+			 cdata[ib+2].im *= eps;
+		    }
 	       }
-	  }
 
 	  /* convert back to Fourier space */
           maxwell_compute_fft(-1, d, fft_data, fft_data2,
@@ -289,20 +382,19 @@ void maxwell_preconditioner2(evectmatrix Xin, evectmatrix Xout, void *data,
 	  /********************************************/
 	  /* Finally, do second inverse curl (inverse cross product with k): */
 
+#pragma omp parallel for private(j)
           for (i = 0; i < d->other_dims; ++i)
                for (j = 0; j < d->last_dim; ++j) {
                     int ij = i * d->last_dim + j;
                     int ij2 = i * d->last_dim_size + j;
-                    k_data cur_k = d->k_plus_G[ij];
-
-                    for (b = 0; b < cur_num_bands; ++b)
-                         assign_crossinv_c2t(&Xout.data[ij * 2 * Xout.p +
-						       b + cur_band_start],
-					     Xout.p,
-					     cur_k,
-					     &fft_data2[3 * (ij2*cur_num_bands
-							    + b)],
-					     scale);
+                    k_data cur_k;
+
+                    cur_k = d->k_plus_G[ij];
+                    assign_crossinv_c2t(&Xout.data[ij * 2 * Xout.p +
+						   cur_band_start],
+					Xout.p, cur_k,
+					&fft_data2[3 * ij2 * cur_num_bands],
+					scale, cur_num_bands);
                }
 
           /********************************************/
@@ -310,6 +402,24 @@ void maxwell_preconditioner2(evectmatrix Xin, evectmatrix Xout, void *data,
      } /* end of cur_band_start loop */
 }
 
+void maxwell_preconditioner2(evectmatrix Xin, evectmatrix Xout, void *data,
+			     evectmatrix Y, real *eigenvals,
+			     sqmatrix YtY)
+{
+     (void) Y; /* unused */
+     (void) eigenvals; /* unused */
+     preconditioner2(Xin, Xout, (maxwell_data *) data, YtY, 0);
+}
+
+void maxwell_preconditioner3(evectmatrix Xin, evectmatrix Xout, void *data,
+			     evectmatrix Y, real *eigenvals,
+			     sqmatrix YtY)
+{
+     (void) Y; /* unused */
+     (void) eigenvals; /* unused */
+     preconditioner2(Xin, Xout, (maxwell_data *) data, YtY, 1);
+}
+
 void maxwell_target_preconditioner2(evectmatrix Xin, evectmatrix Xout,
 				    void *data,
 				    evectmatrix Y, real *eigenvals,
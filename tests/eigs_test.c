@@ -19,6 +19,7 @@
 #include <stdio.h>
 #include <time.h>
 #include <math.h>
+#include <float.h>
 
 #include "config.h"
 #include <check.h>
@@ -28,17 +29,38 @@
 
 static sqmatrix A, Ainv, B;
 
+/* number of (column) applications of A, for comparing the cost of
+   solvers, and the shift for the targeted solvers: */
+static int num_Aop = 0;
+static real shift = 0.0;
+
 #define MAX(a,b) ((a) > (b) ? (a) : (b))
 #define MIN(a,b) ((a) < (b) ? (a) : (b))
 
+#if defined(SCALAR_SINGLE_PREC)
+#  define REAL_EPSILON FLT_EPSILON
+#elif defined(SCALAR_LONG_DOUBLE_PREC)
+#  define REAL_EPSILON LDBL_EPSILON
+#else
+#  define REAL_EPSILON DBL_EPSILON
+#endif
+
 extern void Aop(evectmatrix Xin, evectmatrix Xout, void *data,
 		int is_current_eigenvector, evectmatrix Work);
+extern void Abatchop(evectmatrix Xin, evectmatrix Xout, void *data,
+		     int is_current_eigenvector, evectmatrix Work);
 extern void Bop(evectmatrix Xin, evectmatrix Xout, void *data,
 		int is_current_eigenvector, evectmatrix Work);
 extern void Ainvop(evectmatrix Xin, evectmatrix Xout, void *data,
 		   evectmatrix Y, real *eigenvals, sqmatrix YtY);
 extern void Cop(evectmatrix Xin, evectmatrix Xout, void *data,
 		evectmatrix Y, real *eigenvals, sqmatrix YtY);
+extern void A2op(evectmatrix Xin, evectmatrix Xout, void *data,
+		 int is_current_eigenvector, evectmatrix Work);
+extern void Cshiftop(evectmatrix Xin, evectmatrix Xout, void *data,
+		     evectmatrix Y, real *eigenvals, sqmatrix YtY);
+extern void C2op(evectmatrix Xin, evectmatrix Xout, void *data,
+		 evectmatrix Y, real *eigenvals, sqmatrix YtY);
 extern void printmat(scalar *A, int m, int n, int ldn);
 extern void printmat_matlab(scalar *A, int m, int n);
 
@@ -59,7 +81,35 @@ real norm_diff(scalar *a, scalar *b, int n)
      return sqrt(diffmag / bmag);
 }
 
+/* Check the p computed eigenvalues against the dense eigenvalues
+   i0..i0+p-1 (of n), to within the error implied by a converged
+   residual, |A y - lambda y|^2 <= tol * lambda^2: an eigenvalue
+   lambda_i is then correct to within tol * lambda_i^2 / gap_i, where
+   gap_i is the distance to the nearest other eigenvalue (plus
+   roundoff). */
+void check_eigvals(const real *eigvals, const real *eigvals_dense,
+                   int i0, int p, int n, real tol)
+{
+     int i, j;
+     for (i = 0; i < p; ++i) {
+          real gap = -1, lam = eigvals_dense[i0 + i];
+          for (j = 0; j < n; ++j)
+               if (j != i0 + i
+                   && (gap < 0 || fabs(eigvals_dense[j] - lam) < gap))
+                    gap = fabs(eigvals_dense[j] - lam);
+          CHECK(fabs(eigvals[i] - lam) <= tol * lam * lam / gap
+                + 1e3 * n * REAL_EPSILON * fabs(lam),
+                "incorrect eigenvalue");
+     }
+}
+
 #define NWORK 4
+#define NWORK_LOBPCG 9
+
+/* Abatchop applies A + b*BATCH_SHIFT to the b-th of BATCH_BLOCKS
+   column blocks, for testing eigensolver_lobpcg_batch: */
+#define BATCH_BLOCKS 2
+#define BATCH_SHIFT 100.0
 
 void rand_posdef(sqmatrix A, sqmatrix X)
 {
@@ -86,8 +136,8 @@ int main(int argc, char **argv)
 {
      int i, j, n = 0, p, trial;
      sqmatrix X, U, YtY, Bcopy;
-     evectmatrix Y, Y2, Ystart, W[NWORK];
-     real *eigvals, *eigvals_dense, sum = 0.0;
+     evectmatrix Y, Y2, Ystart, W[NWORK_LOBPCG];
+     real *eigvals, *eigvals2, *eigvals_dense, sum = 0.0;
      int num_iters, nWork = NWORK;
      evectoperator bop = Bop;
 
@@ -135,7 +185,7 @@ int main(int argc, char **argv)
      Y = create_evectmatrix(n, 1, p, n, 0, n);
      Y2 = create_evectmatrix(n, 1, p, n, 0, n);
      Ystart = create_evectmatrix(n, 1, p, n, 0, n);
-     for (i = 0; i < nWork; ++i)
+     for (i = 0; i < NWORK_LOBPCG; ++i)
          W[i] = create_evectmatrix(n, 1, p, n, 0, n);
      CHK_MALLOC(eigvals, real, p);
          
@@ -226,6 +276,204 @@ int main(int argc, char **argv)
          }
          printf("\nEigenvalue sum = %f\n", sum);
          
+         {
+             int num_Aop_exact;
+
+             printf("\nSolving with exact line minimization...\n");
+             evectmatrix_copy(Y, Ystart);
+             num_Aop = 0;
+             eigensolver(Y, eigvals, Aop,NULL, bop,NULL, Cop,NULL, NULL,NULL,
+                         W, nWork, 1e-10, &num_iters,
+                         EIGS_DEFAULT_FLAGS | EIGS_FORCE_EXACT_LINMIN);
+             num_Aop_exact = num_Aop;
+             printf("Solved for eigenvectors after %d iterations, "
+                    "%d applications of A.\n", num_iters, num_Aop_exact);
+
+             printf("\nSolving with A*Y recurrence...\n");
+             evectmatrix_copy(Y, Ystart);
+             num_Aop = 0;
+             eigensolver(Y, eigvals, Aop,NULL, bop,NULL, Cop,NULL, NULL,NULL,
+                         W, nWork + 1, 1e-10, &num_iters,
+                         EIGS_DEFAULT_FLAGS | EIGS_RECURRENCE_AY
+                         | EIGS_FORCE_EXACT_LINMIN);
+             printf("Solved for eigenvectors after %d iterations, "
+                    "%d applications of A.\n", num_iters, num_Aop);
+             printf("\nEigenvalues = ");
+             for (sum = 0.0, i = 0; i < p; ++i) {
+                 sum += eigvals[i];
+                 printf("  %f", eigvals[i]);
+                 CHECK(fabs(eigvals[i]-eigvals_dense[i])
+                       < 1e-5 * eigvals_dense[i], "incorrect eigenvalue");
+             }
+             printf("\nEigenvalue sum = %f\n", sum);
+
+             /* the recurrence should save most of the A*Y products,
+                which are half of the applications of A: */
+             CHECK(num_Aop < 0.75 * num_Aop_exact,
+                   "A*Y recurrence doesn't save applications of A");
+         }
+         
+         if (!bop) {
+             sqmatrix T = create_sqmatrix(p), S1 = create_sqmatrix(p);
+             sqmatrix S2 = create_sqmatrix(p);
+             for (j = 0; j < 2; ++j) {
+                 printf("\nOrthonormalizing with %s...\n",
+                        j ? "TSQR" : "CholeskyQR2");
+                 evectmatrix_copy(Y, Ystart);
+                 CHECK(eigensolver_orthonormalize(Y, W[0], T, S1, S2,
+                                                  j ? EIGS_TSQR
+                                                  : EIGS_CHOLQR),
+                       "orthonormalization failed");
+                 evectmatrix_XtX(YtY, Y, S1);
+                 for (i = 0; i < p * p; ++i)
+                     ASSIGN_REAL(S1.data[i], i % (p + 1) ? 0.0 : 1.0);
+                 printf("|Yt*Y - 1| = %g, |Ystart*T - Y| / |Y| = ",
+                        norm_diff(YtY.data, S1.data, p * p));
+                 CHECK(norm_diff(YtY.data, S1.data, p * p)
+                       < 100 * p * REAL_EPSILON,
+                       "Y not orthonormal");
+                 evectmatrix_XeYS(Y2, Ystart, T, 0);
+                 printf("%g\n", norm_diff(Y2.data, Y.data, n * p));
+                 CHECK(norm_diff(Y2.data, Y.data, n * p)
+                       < 1e4 * p * REAL_EPSILON,
+                       "incorrect orthonormalization transformation");
+             }
+             destroy_sqmatrix(S2);
+             destroy_sqmatrix(S1);
+             destroy_sqmatrix(T);
+
+             printf("\nSolving with locking of converged bands...\n");
+             evectmatrix_copy(Y, Ystart);
+             eigensolver(Y, eigvals, Aop,NULL, NULL,NULL, Cop,NULL,
+                         NULL,NULL, W, nWork, 1e-10, &num_iters,
+                         EIGS_DEFAULT_FLAGS | EIGS_LOCKING);
+             printf("Solved for eigenvectors after %d iterations.\n",
+                    num_iters);
+             printf("\nEigenvalues = ");
+             for (sum = 0.0, i = 0; i < p; ++i) {
+                 sum += eigvals[i];
+                 printf("  %f", eigvals[i]);
+                 CHECK(fabs(eigvals[i]-eigvals_dense[i])
+                       < 1e-5 * eigvals_dense[i], "incorrect eigenvalue");
+             }
+             printf("\nEigenvalue sum = %f\n", sum);
+         }
+
+         printf("\nSolving with LOBPCG...\n");
+         evectmatrix_copy(Y, Ystart);
+         eigensolver_lobpcg(Y, eigvals, Aop,NULL, bop,NULL, Cop,NULL,
+                            NULL,NULL, W, NWORK_LOBPCG, 1e-10, &num_iters,
+                            EIGS_DEFAULT_FLAGS);
+         printf("Solved for eigenvectors after %d iterations.\n", num_iters);
+         printf("\nEigenvalues = ");
+         for (sum = 0.0, i = 0; i < p; ++i) {
+             sum += eigvals[i];
+             printf("  %f", eigvals[i]);
+             CHECK(fabs(eigvals[i]-eigvals_dense[i]) < 1e-5 * eigvals_dense[i],
+                   "incorrect eigenvalue");
+         }
+         printf("\nEigenvalue sum = %f\n", sum);
+         
+         if (!bop) {
+             evectmatrix Yb, Wb[6];
+             int b;
+
+             printf("\nSolving %d blocks with batched LOBPCG...\n",
+                    BATCH_BLOCKS);
+             Yb = create_evectmatrix(n, 1, BATCH_BLOCKS * p, n, 0, n);
+             for (i = 0; i < 6; ++i)
+                 Wb[i] = create_evectmatrix(n, 1, BATCH_BLOCKS * p, n, 0, n);
+             for (i = 0; i < n; ++i)
+                 for (b = 0; b < BATCH_BLOCKS; ++b)
+                     for (j = 0; j < p; ++j)
+                         Yb.data[i * Yb.p + b * p + j] = Ystart.data[i*p + j];
+             CHK_MALLOC(eigvals2, real, BATCH_BLOCKS * p);
+             eigensolver_lobpcg_batch(Yb, eigvals2, Abatchop,NULL, Cop,NULL,
+                                      NULL,NULL, Wb, 6, 1e-10, &num_iters,
+                                      EIGS_DEFAULT_FLAGS, BATCH_BLOCKS);
+             printf("Solved for eigenvectors after %d iterations.\n",
+                    num_iters);
+             printf("\nEigenvalues = ");
+             for (b = 0; b < BATCH_BLOCKS; ++b)
+                 for (i = 0; i < p; ++i) {
+                     real e = eigvals_dense[i] + b * BATCH_SHIFT;
+                     printf("  %f", eigvals2[b*p + i]);
+                     CHECK(fabs(eigvals2[b*p + i] - e) < 1e-5 * e,
+                           "incorrect eigenvalue");
+                 }
+             printf("\n");
+             free(eigvals2);
+             for (i = 0; i < 6; ++i)
+                 destroy_evectmatrix(Wb[i]);
+             destroy_evectmatrix(Yb);
+
+             printf("\nSolving with Chebyshev filtering...\n");
+             evectmatrix_copy(Y, Ystart);
+             eigensolver_chebyshev(Y, eigvals, Aop,NULL, NULL,NULL,
+                                   W, nWork, 1e-10, &num_iters,
+                                   EIGS_DEFAULT_FLAGS, 8);
+             printf("Solved for eigenvectors after %d iterations.\n",
+                    num_iters);
+             printf("\nEigenvalues = ");
+             for (sum = 0.0, i = 0; i < p; ++i) {
+                 sum += eigvals[i];
+                 printf("  %f", eigvals[i]);
+             }
+             printf("\nEigenvalue sum = %f\n", sum);
+             check_eigvals(eigvals, eigvals_dense, 0, p, n, 1e-10);
+
+             {
+                 /* target the middle of the spectrum, and compare with
+                    the p dense eigenvalues closest to the target,
+                    eigvals_dense[i0..i0+p-1]: */
+                 real target = 0.5 * (eigvals_dense[n/2-1]
+                                      + eigvals_dense[n/2]);
+                 int i0 = 0, num_Aop_jd;
+                 while (i0 + p < n && fabs(eigvals_dense[i0 + p] - target)
+                        < fabs(eigvals_dense[i0] - target))
+                     ++i0;
+                 shift = target;
+
+                 printf("\nSolving with Jacobi-Davidson, target %f...\n",
+                        target);
+                 evectmatrix_copy(Y, Ystart);
+                 num_Aop = 0;
+                 eigensolver_jacobi_davidson(Y, eigvals, Aop,NULL,
+                                             Cshiftop,NULL, NULL,NULL,
+                                             W, NWORK_LOBPCG, 1e-10,
+                                             &num_iters, EIGS_DEFAULT_FLAGS,
+                                             target);
+                 num_Aop_jd = num_Aop;
+                 printf("Solved for eigenvectors after %d iterations, "
+                        "%d applications of A.\n", num_iters, num_Aop_jd);
+                 printf("\nEigenvalues = ");
+                 for (sum = 0.0, i = 0; i < p; ++i) {
+                     sum += eigvals[i];
+                     printf("  %f", eigvals[i]);
+                 }
+                 printf("\nEigenvalue sum = %f\n", sum);
+                 check_eigvals(eigvals, eigvals_dense, i0, p, n, 1e-10);
+
+                 /* the alternative: the lowest eigenvalues of
+                    (A - target)^2, as for maxwell_target_operator */
+                 printf("\nSolving for (A - target)^2...\n");
+                 evectmatrix_copy(Y, Ystart);
+                 num_Aop = 0;
+                 eigensolver(Y, eigvals, A2op,NULL, NULL,NULL, C2op,NULL,
+                             NULL,NULL, W, NWORK, 1e-10,
+                             &num_iters, EIGS_DEFAULT_FLAGS);
+                 printf("Solved for eigenvectors after %d iterations, "
+                        "%d applications of A.\n", num_iters, num_Aop);
+                 eigensolver_get_eigenvals(Y, eigvals, Aop,NULL, W[0],W[1]);
+                 printf("\nEigenvalues = ");
+                 for (i = 0; i < p; ++i)
+                     printf("  %f", eigvals[i]);
+                 printf("\n");
+                 CHECK(num_Aop_jd < num_Aop, "Jacobi-Davidson needs more "
+                       "applications of A than the squared operator");
+             }
+         }
+
          printf("\nSolving without conjugate-gradient...\n");
          evectmatrix_copy(Y, Ystart);
          eigensolver(Y, eigvals, Aop,NULL, bop,NULL, Cop,NULL, NULL,NULL,
@@ -279,7 +527,7 @@ int main(int argc, char **argv)
      destroy_evectmatrix(Y);
      destroy_evectmatrix(Y2);
      destroy_evectmatrix(Ystart);
-     for (i = 0; i < nWork; ++i)
+     for (i = 0; i < NWORK_LOBPCG; ++i)
 	  destroy_evectmatrix(W[i]);
 
      free(eigvals);
@@ -298,6 +546,35 @@ void Aop(evectmatrix Xin, evectmatrix Xout, void *data,
 
      blasglue_gemm('N', 'N', Xout.n, Xout.p, Xin.n,
 		   1.0, A.data, A.p, Xin.data, Xin.p, 0.0, Xout.data, Xout.p);
+     num_Aop += Xin.p;
+}
+
+/* Xout = (A - shift)^2 Xin */
+void A2op(evectmatrix Xin, evectmatrix Xout, void *data,
+	  int is_current_eigenvector, evectmatrix Work)
+{
+     Aop(Xin, Work, data, is_current_eigenvector, Xout);
+     evectmatrix_aXpbY(1.0, Work, -shift, Xin);
+     Aop(Work, Xout, data, is_current_eigenvector, Xout);
+     evectmatrix_aXpbY(1.0, Xout, -shift, Work);
+}
+
+void Abatchop(evectmatrix Xin, evectmatrix Xout, void *data,
+	      int is_current_eigenvector, evectmatrix Work)
+{
+     int i, j, pb = Xin.p / BATCH_BLOCKS;
+
+     Aop(Xin, Xout, data, is_current_eigenvector, Work);
+     for (i = 0; i < Xin.n; ++i)
+	  for (j = pb; j < Xin.p; ++j) {
+	       real shift = (j / pb) * BATCH_SHIFT;
+	       scalar x = Xin.data[i * Xin.p + j];
+	       ASSIGN_SCALAR(Xout.data[i * Xout.p + j],
+			     SCALAR_RE(Xout.data[i * Xout.p + j])
+			     + shift * SCALAR_RE(x),
+			     SCALAR_IM(Xout.data[i * Xout.p + j])
+			     + shift * SCALAR_IM(x));
+	  }
 }
 
 void Bop(evectmatrix Xin, evectmatrix Xout, void *data,
@@ -375,6 +652,40 @@ void Cop(evectmatrix Xin, evectmatrix Xout, void *data,
      }
 }
 
+/* Xout = Xin / |diag(A) - shift|^power, a diagonal preconditioner
+   for |A - shift|^power */
+static void Cshift(evectmatrix Xin, evectmatrix Xout, int power)
+{
+     int in, ip;
+
+     CHECK(A.p == Xin.n && A.p == Xout.n && Xin.p == Xout.p,
+           "matrices not conformant");
+
+     for (in = 0; in < Xout.n; ++in) {
+	  real diag = fabs(SCALAR_RE(A.data[in * A.p + in]) - shift);
+	  diag = diag == 0.0 ? 1.0 : 1.0 / (power == 2 ? diag * diag : diag);
+	  for (ip = 0; ip < Xout.p; ++ip) {
+	       scalar xin = Xin.data[in * Xin.p + ip];
+	       ASSIGN_SCALAR(Xout.data[in * Xout.p + ip],
+			     diag * SCALAR_RE(xin),
+			     diag * SCALAR_IM(xin));
+	  }
+     }
+}
+
+void Cshiftop(evectmatrix Xin, evectmatrix Xout, void *data,
+	      evectmatrix Y, real *eigenvals, sqmatrix YtY)
+{
+     Cshift(Xin, Xout, 1);
+}
+
+void C2op(evectmatrix Xin, evectmatrix Xout, void *data,
+	  evectmatrix Y, real *eigenvals, sqmatrix YtY)
+{
+     evectmatrix_XeYS(Xout, Xin, YtY, 1);
+     Cshift(Xout, Xout, 2);
+}
+
 void printmat(scalar *A, int m, int n, int ldn)
 {
   int i, j;
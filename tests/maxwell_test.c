@@ -59,6 +59,9 @@ int feenableexcept (int EXCEPTS);
 
 #define ERROR_TOL 1e-4
 
+/* offset of the k point that the bands are interpolated to by k.p */
+#define KP_DK 0.02
+
 #ifdef ENABLE_PROF
 #  define PROF_ITERS 10
 #else
@@ -550,7 +553,46 @@ int main(int argc, char **argv)
      /*****************************************/
 
      }
-     
+
+     /*****************************************/
+
+     if (!do_target) {
+	  maxwell_kp_data *kp;
+	  real *kp_eigvals, kp_err;
+
+	  kvector[0] += KP_DK;
+	  printf("\nInterpolating eigenvectors to k = %g by k.p...\n",
+		 kvector[0]);
+	  kp = create_maxwell_kp_data(mdata, H);
+	  update_maxwell_data_k(mdata, kvector, G[0], G[1], G[2]);
+	  CHK_MALLOC(kp_eigvals, real, num_bands);
+	  kp_err = maxwell_kp_interpolate(kp, mdata, H, kp_eigvals);
+	  printf("Estimated k.p error = %e.\n", kp_err);
+
+	  printf("Solving for eigenvectors from the k.p bands...\n");
+	  eigensolver(H, eigvals,
+		      maxwell_operator, (void *) mdata, NULL,NULL,
+		      maxwell_preconditioner2, (void *) mdata,
+		      maxwell_parity_constraint, (void *) mdata,
+		      W, NWORK, error_tol, &num_iters, EIGS_DEFAULT_FLAGS);
+	  printf("Solved for eigenvectors after %d iterations.\n", num_iters);
+	  printf("%15s%15s%15s\n","k.p freq.", "frequency", "error");
+	  for (i = 0; i < num_bands; ++i) {
+	       double err;
+	       real freq = sqrt(eigvals[i]);
+	       real kp_freq = sqrt(kp_eigvals[i]);
+	       printf("%15f%15f%15e\n", kp_freq, freq,
+		      err = fabs(kp_freq - freq) / freq);
+	       /* allow for the error of the direct solution, too */
+	       CHECK(err <= kp_err + sqrt(error_tol),
+		     "k.p error exceeds its estimate");
+	  }
+	  printf("\n");
+
+	  free(kp_eigvals);
+	  destroy_maxwell_kp_data(kp);
+     }
+
      destroy_evectmatrix(H);
      destroy_evectmatrix(Hstart);
      for (i = 0; i < NWORK; ++i)